@@ -0,0 +1,307 @@
+#include "batch.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sim.h"
+#include "json.h"
+#include "jsonscan.h"
+#include "config.h"
+
+/**
+ * @brief Scenario listed in the manifest
+ */
+struct BatchScenario
+{
+    const char *inPath; /**< Input path (JSON commands or input file) */
+    const char *outPath; /**< Output JSON path */
+};
+
+/**
+ * @brief Batch run state shared by the worker threads
+ */
+struct BatchContext
+{
+    const void *image; /**< Junction image each scenario is loaded from */
+    size_t size; /**< Junction image size */
+    struct BatchScenario *scenarios; /**< Scenarios */
+    size_t count; /**< Number of scenarios */
+    atomic_size_t next; /**< Index of the next scenario to take */
+    atomic_size_t failed; /**< Number of failed scenarios */
+};
+
+/**
+ * @brief Read manifest, splitting it into scenarios in place
+ * @param *path Manifest path
+ * @param **text Output manifest text, the scenario paths point into it
+ * @param **scenarios Output scenarios
+ * @param *count Output number of scenarios
+ * @return 0 on success, <0 on failure
+ */
+static int BatchReadManifest(const char *path, char **text, struct BatchScenario **scenarios, size_t *count)
+{
+    *text = NULL;
+    *scenarios = NULL;
+    *count = 0;
+    FILE *f = fopen(path, "rb");
+    if(NULL == f)
+    {
+        printf("Unable to open %s\r\n", path);
+        return -1;
+    }
+    long size = -1;
+    if((0 == fseek(f, 0, SEEK_END)) && ((size = ftell(f)) >= 0) && (0 == fseek(f, 0, SEEK_SET)))
+        *text = malloc(size + 1);
+    if((NULL == *text) || (((size_t)size) != fread(*text, 1, size, f)))
+    {
+        printf("Unable to read %s\r\n", path);
+        fclose(f);
+        free(*text);
+        *text = NULL;
+        return -1;
+    }
+    fclose(f);
+    (*text)[size] = '\0';
+
+    size_t capacity = 0, line = 0;
+    for(char *p = *text; '\0' != *p; )
+    {
+        char *end = p + strcspn(p, "\n");
+        bool last = ('\0' == *end);
+        *end = '\0';
+        ++line;
+        const char *fields[3];
+        size_t numFields = 0;
+        char *save;
+        for(char *field = strtok_r(p, " \t\r", &save); (NULL != field) && (numFields < 3); field = strtok_r(NULL, " \t\r", &save))
+            fields[numFields++] = field;
+        p = last ? end : (end + 1);
+        if((0 == numFields) || ('#' == fields[0][0]))
+            continue;
+        if(2 != numFields)
+        {
+            printf("Line %zu of %s must hold an input and an output path\r\n", line, path);
+            goto failed;
+        }
+        if(*count == capacity)
+        {
+            capacity = (0 != capacity) ? (2 * capacity) : 64;
+            struct BatchScenario *grown = realloc(*scenarios, capacity * sizeof(**scenarios));
+            if(NULL == grown)
+            {
+                printf("Memory allocation failed\r\n");
+                goto failed;
+            }
+            *scenarios = grown;
+        }
+        (*scenarios)[(*count)++] = (struct BatchScenario){.inPath = fields[0], .outPath = fields[1]};
+    }
+    return 0;
+
+failed:
+    free(*text);
+    free(*scenarios);
+    *text = NULL;
+    *scenarios = NULL;
+    return -1;
+}
+
+/**
+ * @brief Check if input file holds JSON commands
+ * @param *path Input path
+ * @return True if the first non-whitespace character is {, false otherwise (input file or no file)
+ */
+static bool BatchIsJson(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if(NULL == f)
+        return false;
+    int c;
+    do
+        c = fgetc(f);
+    while((' ' == c) || ('\t' == c) || ('\r' == c) || ('\n' == c));
+    fclose(f);
+    return '{' == c;
+}
+
+/**
+ * @brief Release vehicles left waiting at the selected instance
+ * @note Vehicles are released directly, the instance must be released afterwards
+ */
+static void BatchReleaseVehicles(void)
+{
+    struct SimConfig *config = SimGetConfig();
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            struct Vehicle *v = config->road[i].lane[k].vehicles;
+            while(NULL != v)
+            {
+                struct Vehicle *next = v->next;
+                free(v);
+                v = next;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Run scenario on a new instance
+ * @param *context Batch context
+ * @param *scenario Scenario
+ * @return 0 on success, <0 on failure
+ */
+static int BatchRunScenario(const struct BatchContext *context, const struct BatchScenario *scenario)
+{
+    const char *inPath = scenario->inPath;
+    char *tmpPath = NULL;
+    int ret = -1;
+    //JSON commands are converted by this thread only, to a file no other scenario uses
+    if(BatchIsJson(inPath))
+    {
+        size_t length = strlen(scenario->outPath);
+        tmpPath = malloc(length + sizeof(".XXXXXX"));
+        if(NULL == tmpPath)
+        {
+            printf("Memory allocation failed\r\n");
+            return -1;
+        }
+        memcpy(tmpPath, scenario->outPath, length);
+        memcpy(tmpPath + length, ".XXXXXX", sizeof(".XXXXXX"));
+        int fd = mkstemp(tmpPath);
+        if(fd < 0)
+        {
+            printf("Unable to create temporary file for %s\r\n", scenario->outPath);
+            free(tmpPath);
+            return -1;
+        }
+        close(fd);
+        struct JsonScanOptions options = {.threads = 1, .chunkSize = 0, .level = JSON_SCAN_AUTO};
+        if(0 != JsonScanConvert(inPath, tmpPath, &options))
+            goto cleanup;
+        inPath = tmpPath;
+    }
+
+    struct SimState *instance = SimLoadJunction(context->image, context->size);
+    if(NULL == instance)
+        goto cleanup;
+    SimSelect(instance);
+    struct JsonRunOptions options = {.checkpointPath = NULL, .checkpointInterval = 0, .resume = false, .tracePath = NULL,
+        .timelinePath = NULL, .profilePath = NULL, .initialized = true, .quiet = true};
+    ret = JsonRunSimFromExternalData(inPath, scenario->outPath, &options);
+    BatchReleaseVehicles();
+    SimRelease(instance);
+
+cleanup:
+    if(NULL != tmpPath)
+    {
+        unlink(tmpPath);
+        free(tmpPath);
+    }
+    if(0 != ret)
+        printf("Scenario %s failed\r\n", scenario->inPath);
+    return ret;
+}
+
+/**
+ * @brief Worker thread: take scenarios until there are none left
+ * @param *arg Batch context
+ * @return NULL
+ */
+static void* BatchWorker(void *arg)
+{
+    struct BatchContext *context = arg;
+    size_t i;
+    while((i = atomic_fetch_add(&context->next, 1)) < context->count)
+    {
+        if(0 != BatchRunScenario(context, &context->scenarios[i]))
+            atomic_fetch_add(&context->failed, 1);
+    }
+    return NULL;
+}
+
+int BatchRun(const char *manifestPath, const struct BatchOptions *options)
+{
+    static const struct BatchOptions defaultOptions = {.threads = 0, .junctionPath = NULL};
+    if(NULL == options)
+        options = &defaultOptions;
+
+    struct BatchContext context = {.image = NULL, .size = 0, .scenarios = NULL, .count = 0};
+    atomic_init(&context.next, 0);
+    atomic_init(&context.failed, 0);
+    char *manifest;
+    if(0 != BatchReadManifest(manifestPath, &manifest, &context.scenarios, &context.count))
+        return -1;
+
+    //the junction is compiled (or mapped) once, each scenario loads its own instance from the image
+    char *compiled = NULL;
+    int ret = -1;
+    if(NULL != options->junctionPath)
+    {
+        if(NULL == (context.image = ConfigMap(options->junctionPath, &context.size)))
+            goto cleanup;
+    }
+    else
+    {
+        FILE *f = open_memstream(&compiled, &context.size);
+        if(NULL == f)
+        {
+            printf("Memory allocation failed\r\n");
+            goto cleanup;
+        }
+        int status = SimCompileJunction(&SimConfig, f);
+        if((0 != fclose(f)) || (0 != status))
+        {
+            printf("Unable to compile junction\r\n");
+            goto cleanup;
+        }
+        context.image = compiled;
+    }
+    //loaded instances inherit the setting of the main instance
+    SimSetEventLogging(false);
+
+    size_t threads = options->threads;
+    if(0 == threads)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (size_t)cpus : 1;
+    }
+    if(threads > context.count)
+        threads = context.count;
+    pthread_t *handles = malloc(threads * sizeof(*handles));
+    size_t started = 0;
+    if(NULL != handles)
+    {
+        for(; started < threads; started++)
+        {
+            if(0 != pthread_create(&handles[started], NULL, BatchWorker, &context))
+                break;
+        }
+    }
+    //with no threads started the scenarios are run by the calling thread
+    if(0 == started)
+        BatchWorker(&context);
+    for(size_t i = 0; i < started; i++)
+        pthread_join(handles[i], NULL);
+    free(handles);
+
+    size_t failed = atomic_load(&context.failed);
+    printf("%zu scenarios done, %zu failed\r\n", context.count, failed);
+    ret = (0 == failed) ? 0 : -1;
+
+cleanup:
+    if(NULL != options->junctionPath)
+    {
+        if(NULL != context.image)
+            ConfigUnmap(context.image, context.size);
+    }
+    else
+        free(compiled);
+    free(context.scenarios);
+    free(manifest);
+    return ret;
+}
@@ -0,0 +1,27 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/**
+ * @brief Batch run options
+ */
+struct BatchOptions
+{
+    unsigned int threads; /**< Number of worker threads, 0 for the number of online CPUs */
+    const char *junctionPath; /**< Junction image path (see config.h), NULL to run the junction configured in SimConfig */
+};
+
+/**
+ * @brief Run scenarios listed in a manifest concurrently
+ *
+ * Each line of the manifest holds an input path and an output JSON path, separated by whitespace. Blank lines
+ * and lines starting with # are skipped. The input is either JSON commands (converted like with JsonScanConvert()
+ * to a temporary file next to the output) or an input file (see command.h). Scenarios are taken by a pool
+ * of threads, each one is simulated by its own instance loaded from the junction image. Only errors are printed.
+ * @param *manifestPath Manifest path
+ * @param *options Options, NULL for defaults
+ * @return 0 if all scenarios succeeded, <0 otherwise
+ * @attention Event logging of the main instance is disabled
+ */
+int BatchRun(const char *manifestPath, const struct BatchOptions *options);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+/*
+Input file format v1 (native byte order, no padding): InCommand structures, each followed by its payload.
+
+Input file format v2:
+* InFileHeader,
+* blocks, each one as a method byte (IN_BLOCK_STORED or IN_BLOCK_LZ), varint decoded size (at most IN_MAX_BLOCK_SIZE),
+  varint stored size and the stored data. Commands never span blocks.
+* commands, each one as a type byte followed by its fields:
+    - vehicle add: start road byte, end road byte, varint name length, name,
+    - step: varint number of steps (at least 1),
+    - vehicle removal: varint name length, name,
+    - lane change: target lane index byte, varint name length, name,
+    - reroute: end road byte, varint name length, name.
+Varints hold 7 bits per byte, least significant group first, the highest bit is set on all bytes but the last.
+
+LZ block data is a sequence of varint literal count, literals, varint match length minus IN_MIN_MATCH and varint
+match distance (1 is the last decoded byte, matches may overlap the bytes they produce). The match is omitted when
+the literals complete the block.
+*/
+
+#define IN_FILE_MAGIC 0x324E4954 /**< "TIN2", can't be confused with a v1 command type */
+#define IN_MAX_BLOCK_SIZE (1 << 20) /**< Maximum decoded size of a v2 block */
+#define IN_MIN_MATCH 4 /**< Minimum LZ match length */
+
+enum
+{
+    IN_BLOCK_STORED = 0, /**< Block data is stored as is */
+    IN_BLOCK_LZ = 1, /**< Block data is LZ-compressed */
+};
+
+/**
+ * @brief Input file header (format v2 only)
+ */
+struct InFileHeader
+{
+    uint32_t magic;
+} __attribute__ ((packed));
+
+/**
+ * @brief Encoded input command, followed by @p length bytes of payload (vehicle name)
+ */
+struct InCommand
+{
+    uint8_t type;
+    uint8_t startRoad;
+    uint8_t endRoad;
+    uint32_t length;
+} __attribute__ ((packed));
+
+enum
+{
+    COMMAND_ADD_VEHICLE = 1,
+    COMMAND_STEP = 2, /**< Input file v2: followed by the number of steps */
+    COMMAND_REMOVE_VEHICLE = 3,
+    COMMAND_CHANGE_LANE = 4, /**< endRoad holds the target lane index on the vehicle road */
+    COMMAND_REROUTE_VEHICLE = 5,
+    COMMAND_QUERY_LIGHTS = 6, /**< Server only: get light state of all lanes */
+    COMMAND_RESET = 7, /**< Server only: restart the simulation from the initial state */
+    COMMAND_ANNOUNCE_VEHICLE = 8, /**< Trace only: arrival known in advance, the payload is the 32-bit arrival step */
+};
+
+#endif
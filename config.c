@@ -0,0 +1,557 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CONFIG_MAX_NAME 32 /**< Maximum length of keys and names, including the terminating null character */
+
+/**
+ * @brief JSON parser state
+ */
+struct ConfigParser
+{
+    const char *start; /**< JSON text */
+    const char *p; /**< Current position */
+};
+
+static const char *ConfigSelectionPolicyNames[] = {
+    [SIM_RIGHT_HAND_RULE] = "rightHandRule",
+    [SIM_FCFS] = "fcfs",
+    [SIM_HLFS] = "hlfs",
+    [SIM_DYNAMIC] = "dynamic",
+    [SIM_LOOKAHEAD] = "lookahead",
+    [SIM_MAX_PRESSURE] = "maxPressure",
+};
+
+static const char *ConfigTimePolicyNames[] = {
+    [SIM_TIME_FIXED] = "fixed",
+    [SIM_TIME_PROPORTIONAL] = "proportional",
+    [SIM_TIME_PRIORITIZED] = "prioritized",
+};
+
+static const char *ConfigDirectionNames[] = {
+    [NORTH] = "north",
+    [SOUTH] = "south",
+    [WEST] = "west",
+    [EAST] = "east",
+};
+
+/**
+ * @brief Print parse error with the current offset
+ * @param *parser Parser
+ * @param *format Message format
+ * @return Always -1
+ */
+static int ConfigError(const struct ConfigParser *parser, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("Junction configuration error at offset %zu: ", (size_t)(parser->p - parser->start));
+    vprintf(format, args);
+    printf("\r\n");
+    va_end(args);
+    return -1;
+}
+
+/**
+ * @brief Skip whitespace
+ * @param *parser Parser
+ */
+static void ConfigSkipSpace(struct ConfigParser *parser)
+{
+    while((' ' == *parser->p) || ('\t' == *parser->p) || ('\r' == *parser->p) || ('\n' == *parser->p))
+        ++parser->p;
+}
+
+/**
+ * @brief Skip whitespace and consume given character if it comes next
+ * @param *parser Parser
+ * @param c Character
+ * @return True if consumed, false otherwise
+ */
+static bool ConfigAccept(struct ConfigParser *parser, char c)
+{
+    ConfigSkipSpace(parser);
+    if(('\0' == c) || (c != *parser->p))
+        return false;
+    ++parser->p;
+    return true;
+}
+
+/**
+ * @brief Parse string with no escape sequences
+ * @param *parser Parser
+ * @param *out Output buffer
+ * @param size Output buffer size
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseString(struct ConfigParser *parser, char *out, size_t size)
+{
+    if(!ConfigAccept(parser, '"'))
+        return ConfigError(parser, "string expected");
+    size_t length = 0;
+    while('"' != *parser->p)
+    {
+        if(('\\' == *parser->p) || ((unsigned char)*parser->p < 0x20))
+            return ConfigError(parser, "unsupported character in string");
+        if((length + 1) == size)
+            return ConfigError(parser, "string too long");
+        out[length++] = *parser->p++;
+    }
+    ++parser->p;
+    out[length] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Parse string and find it among names
+ * @param *parser Parser
+ * @param *names Names, indexed by value
+ * @param count Number of names
+ * @param *value Output value
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseName(struct ConfigParser *parser, const char **names, size_t count, unsigned int *value)
+{
+    char name[CONFIG_MAX_NAME];
+    if(0 != ConfigParseString(parser, name, sizeof(name)))
+        return -1;
+    for(size_t i = 0; i < count; i++)
+    {
+        if(!strcmp(names[i], name))
+        {
+            *value = i;
+            return 0;
+        }
+    }
+    return ConfigError(parser, "unknown value \"%s\"", name);
+}
+
+/**
+ * @brief Parse number
+ * @param *parser Parser
+ * @param *value Output value
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseNumber(struct ConfigParser *parser, double *value)
+{
+    ConfigSkipSpace(parser);
+    if(('-' != *parser->p) && ((*parser->p < '0') || (*parser->p > '9')))
+        return ConfigError(parser, "number expected");
+    char *end;
+    *value = strtod(parser->p, &end);
+    if(end == parser->p)
+        return ConfigError(parser, "number expected");
+    parser->p = end;
+    return 0;
+}
+
+/**
+ * @brief Parse non-negative integer
+ * @param *parser Parser
+ * @param max Maximum value
+ * @param *value Output value
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseUnsigned(struct ConfigParser *parser, uint32_t max, uint32_t *value)
+{
+    double number;
+    if(0 != ConfigParseNumber(parser, &number))
+        return -1;
+    if((number < 0) || (number > max) || (number != (uint32_t)number))
+        return ConfigError(parser, "integer from 0 to %lu expected", (unsigned long)max);
+    *value = number;
+    return 0;
+}
+
+/**
+ * @brief Parse boolean
+ * @param *parser Parser
+ * @param *value Output value
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseBool(struct ConfigParser *parser, bool *value)
+{
+    ConfigSkipSpace(parser);
+    if(!strncmp(parser->p, "true", 4))
+        *value = true;
+    else if(!strncmp(parser->p, "false", 5))
+        *value = false;
+    else
+        return ConfigError(parser, "boolean expected");
+    parser->p += *value ? 4 : 5;
+    return 0;
+}
+
+/**
+ * @brief Go to the next member of an object
+ * @param *parser Parser
+ * @param *first True before the first member (the object is opened), cleared by this function
+ * @param *key Output key buffer, CONFIG_MAX_NAME characters
+ * @return 1 if there is a member (its value follows), 0 at the end of the object, <0 on failure
+ */
+static int ConfigNextMember(struct ConfigParser *parser, bool *first, char *key)
+{
+    if(*first)
+    {
+        if(!ConfigAccept(parser, '{'))
+            return ConfigError(parser, "object expected");
+        *first = false;
+        if(ConfigAccept(parser, '}'))
+            return 0;
+    }
+    else if(ConfigAccept(parser, '}'))
+        return 0;
+    else if(!ConfigAccept(parser, ','))
+        return ConfigError(parser, "',' or '}' expected");
+    if(0 != ConfigParseString(parser, key, CONFIG_MAX_NAME))
+        return -1;
+    if(!ConfigAccept(parser, ':'))
+        return ConfigError(parser, "':' expected");
+    return 1;
+}
+
+/**
+ * @brief Go to the next element of an array
+ * @param *parser Parser
+ * @param *first True before the first element (the array is opened), cleared by this function
+ * @return 1 if there is an element, 0 at the end of the array, <0 on failure
+ */
+static int ConfigNextElement(struct ConfigParser *parser, bool *first)
+{
+    if(*first)
+    {
+        if(!ConfigAccept(parser, '['))
+            return ConfigError(parser, "array expected");
+        *first = false;
+        return ConfigAccept(parser, ']') ? 0 : 1;
+    }
+    if(ConfigAccept(parser, ']'))
+        return 0;
+    if(!ConfigAccept(parser, ','))
+        return ConfigError(parser, "',' or ']' expected");
+    return 1;
+}
+
+/**
+ * @brief Parse lane
+ * @param *parser Parser
+ * @param *lane Output lane
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseLane(struct ConfigParser *parser, struct Lane *lane)
+{
+    //defaults are the same as in the Python module
+    memset(lane, 0, sizeof(*lane));
+    lane->minGreenTime = 1;
+    lane->maxGreenTime = 10;
+    lane->minRedTime = 1;
+    lane->saturationFlow = 1;
+    lane->priority = 1.f;
+
+    struct
+    {
+        const char *key;
+        uint32_t *value;
+    } const times[] = {
+        {"minGreenTime", &lane->minGreenTime},
+        {"maxGreenTime", &lane->maxGreenTime},
+        {"minRedTime", &lane->minRedTime},
+        {"stepsPerVehicle", &lane->stepsPerVehicle},
+        {"saturationFlow", &lane->saturationFlow},
+        {"startupLostTime", &lane->startupLostTime},
+    };
+
+    bool first = true, directions = false;
+    char key[CONFIG_MAX_NAME];
+    int status;
+    while(0 < (status = ConfigNextMember(parser, &first, key)))
+    {
+        size_t i = 0;
+        while((i < (sizeof(times) / sizeof(*times))) && strcmp(times[i].key, key))
+            ++i;
+        if(i < (sizeof(times) / sizeof(*times)))
+            status = ConfigParseUnsigned(parser, UINT32_MAX, times[i].value);
+        else if(!strcmp(key, "permissive"))
+            status = ConfigParseBool(parser, &lane->permissive);
+        else if(!strcmp(key, "priority"))
+        {
+            double priority;
+            status = ConfigParseNumber(parser, &priority);
+            lane->priority = priority;
+        }
+        else if(!strcmp(key, "directions"))
+        {
+            bool firstDirection = true;
+            directions = true;
+            while(0 < (status = ConfigNextElement(parser, &firstDirection)))
+            {
+                unsigned int direction;
+                uint32_t index;
+                ConfigSkipSpace(parser);
+                if('"' == *parser->p)
+                    status = ConfigParseName(parser, ConfigDirectionNames,
+                        sizeof(ConfigDirectionNames) / sizeof(*ConfigDirectionNames), &direction);
+                else
+                {
+                    status = ConfigParseUnsigned(parser, MAX_ROADS - 1, &index);
+                    direction = index;
+                }
+                if(0 != status)
+                    break;
+                lane->direction.mask |= 1u << direction;
+            }
+        }
+        else
+            status = ConfigError(parser, "unknown lane key \"%s\"", key);
+        if(0 != status)
+            return -1;
+    }
+    if(0 != status)
+        return -1;
+    if(!directions)
+        return ConfigError(parser, "lane has no directions");
+    return 0;
+}
+
+/**
+ * @brief Parse road
+ * @param *parser Parser
+ * @param *road Output road, lanes are allocated
+ * @return 0 on success, <0 on failure
+ */
+static int ConfigParseRoad(struct ConfigParser *parser, struct Road *road)
+{
+    bool first = true, bearing = false;
+    char key[CONFIG_MAX_NAME];
+    int status;
+    while(0 < (status = ConfigNextMember(parser, &first, key)))
+    {
+        if(!strcmp(key, "bearing"))
+        {
+            uint32_t value;
+            status = ConfigParseUnsigned(parser, 359, &value);
+            road->bearing = value;
+            bearing = true;
+        }
+        else if(!strcmp(key, "lanes"))
+        {
+            bool firstLane = true;
+            size_t capacity = 0;
+            while(0 < (status = ConfigNextElement(parser, &firstLane)))
+            {
+                //lanes are aligned to cache lines
+                if(road->laneCount == capacity)
+                {
+                    capacity = (0 != capacity) ? (2 * capacity) : 4;
+                    struct Lane *lanes = aligned_alloc(SIM_CACHE_LINE, capacity * sizeof(*lanes));
+                    if(NULL == lanes)
+                    {
+                        printf("Memory allocation failed\r\n");
+                        return -1;
+                    }
+                    if(0 != road->laneCount)
+                        memcpy(lanes, road->lane, road->laneCount * sizeof(*lanes));
+                    free(road->lane);
+                    road->lane = lanes;
+                }
+                if(0 != (status = ConfigParseLane(parser, &road->lane[road->laneCount])))
+                    break;
+                ++road->laneCount;
+            }
+        }
+        else
+            status = ConfigError(parser, "unknown road key \"%s\"", key);
+        if(0 != status)
+            return -1;
+    }
+    if(0 != status)
+        return -1;
+    if(!bearing)
+        return ConfigError(parser, "road has no bearing");
+    return 0;
+}
+
+int ConfigParse(const char *json, struct SimConfig *config)
+{
+    *config = (struct SimConfig){.road = calloc(MAX_ROADS, sizeof(struct Road)), .roadCount = 0,
+        .selectionPolicy = SIM_DYNAMIC, .timePolicy = SIM_TIME_PRIORITIZED, .phaseScheduling = false, .fixedPoint = false};
+    if(NULL == config->road)
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+
+    struct ConfigParser parser = {.start = json, .p = json};
+    bool first = true, roads = false;
+    char key[CONFIG_MAX_NAME];
+    int status;
+    while(0 < (status = ConfigNextMember(&parser, &first, key)))
+    {
+        unsigned int value;
+        if(!strcmp(key, "selectionPolicy"))
+        {
+            status = ConfigParseName(&parser, ConfigSelectionPolicyNames,
+                sizeof(ConfigSelectionPolicyNames) / sizeof(*ConfigSelectionPolicyNames), &value);
+            config->selectionPolicy = value;
+        }
+        else if(!strcmp(key, "timePolicy"))
+        {
+            status = ConfigParseName(&parser, ConfigTimePolicyNames,
+                sizeof(ConfigTimePolicyNames) / sizeof(*ConfigTimePolicyNames), &value);
+            config->timePolicy = value;
+        }
+        else if(!strcmp(key, "phaseScheduling"))
+            status = ConfigParseBool(&parser, &config->phaseScheduling);
+        else if(!strcmp(key, "fixedPoint"))
+            status = ConfigParseBool(&parser, &config->fixedPoint);
+        else if(!strcmp(key, "roads") && !roads)
+        {
+            bool firstRoad = true;
+            roads = true;
+            while(0 < (status = ConfigNextElement(&parser, &firstRoad)))
+            {
+                if(MAX_ROADS == config->roadCount)
+                {
+                    status = ConfigError(&parser, "more than %u roads", (unsigned int)MAX_ROADS);
+                    break;
+                }
+                //the road is counted first, so that its lanes are released on failure
+                if(0 != (status = ConfigParseRoad(&parser, &config->road[config->roadCount++])))
+                    break;
+            }
+        }
+        else
+            status = ConfigError(&parser, "unknown or repeated key \"%s\"", key);
+        if(0 != status)
+            goto failed;
+    }
+    if(0 != status)
+        goto failed;
+    if(!roads)
+    {
+        ConfigError(&parser, "no roads");
+        goto failed;
+    }
+    ConfigSkipSpace(&parser);
+    if('\0' != *parser.p)
+    {
+        ConfigError(&parser, "unexpected data after the configuration");
+        goto failed;
+    }
+
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        config->road[i].position = i;
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+            config->road[i].lane[k].road = &config->road[i];
+    }
+    return 0;
+
+failed:
+    ConfigRelease(config);
+    return -1;
+}
+
+void ConfigRelease(struct SimConfig *config)
+{
+    if(NULL != config->road)
+    {
+        for(size_t i = 0; i < config->roadCount; i++)
+            free(config->road[i].lane);
+    }
+    free(config->road);
+    config->road = NULL;
+    config->roadCount = 0;
+}
+
+int ConfigCompile(const char *inPath, const char *outPath)
+{
+    FILE *in = fopen(inPath, "rb");
+    if(NULL == in)
+    {
+        printf("Unable to open %s\r\n", inPath);
+        return -1;
+    }
+    char *json = NULL;
+    long size = -1;
+    if((0 == fseek(in, 0, SEEK_END)) && ((size = ftell(in)) >= 0) && (0 == fseek(in, 0, SEEK_SET)))
+        json = malloc(size + 1);
+    if((NULL == json) || (((size_t)size) != fread(json, 1, size, in)))
+    {
+        printf("Unable to read %s\r\n", inPath);
+        fclose(in);
+        free(json);
+        return -1;
+    }
+    fclose(in);
+    json[size] = '\0';
+
+    struct SimConfig config;
+    int ret = ConfigParse(json, &config);
+    free(json);
+    if(0 != ret)
+        return -1;
+
+    ret = -1;
+    FILE *out = fopen(outPath, "wb");
+    if(NULL == out)
+        printf("Unable to open %s\r\n", outPath);
+    else
+    {
+        if(0 == SimCompileJunction(&config, out))
+            ret = 0;
+        if(0 != fclose(out))
+            ret = -1;
+        if(0 != ret)
+            printf("Unable to compile junction to %s\r\n", outPath);
+    }
+    ConfigRelease(&config);
+    return ret;
+}
+
+const void* ConfigMap(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        printf("Unable to open %s\r\n", path);
+        return NULL;
+    }
+    struct stat st;
+    void *image = MAP_FAILED;
+    if((0 == fstat(fd, &st)) && (st.st_size > 0))
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == image)
+    {
+        printf("Unable to map %s\r\n", path);
+        return NULL;
+    }
+    *size = st.st_size;
+    return image;
+}
+
+void ConfigUnmap(const void *image, size_t size)
+{
+    munmap((void*)image, size);
+}
+
+struct SimState* ConfigLoad(const char *path)
+{
+    size_t size;
+    const void *image = ConfigMap(path, &size);
+    if(NULL == image)
+        return NULL;
+    struct SimState *instance = SimLoadJunction(image, size);
+    ConfigUnmap(image, size);
+    if(NULL == instance)
+        printf("Unable to load junction from %s\r\n", path);
+    return instance;
+}
@@ -0,0 +1,77 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "sim.h"
+
+/*
+Junction configuration (JSON):
+{
+    "selectionPolicy": "rightHandRule" | "fcfs" | "hlfs" | "dynamic" | "lookahead" | "maxPressure", (default: "dynamic")
+    "timePolicy": "fixed" | "proportional" | "prioritized", (default: "prioritized")
+    "phaseScheduling": bool, (default: false)
+    "fixedPoint": bool, (default: false)
+    "roads": [
+        {
+            "bearing": degrees,
+            "lanes": [
+                {
+                    "directions": [target road index or "north" | "south" | "west" | "east", ...],
+                    "permissive": bool, (default: false)
+                    "priority": number, (default: 1)
+                    "minGreenTime", "maxGreenTime", "minRedTime", "stepsPerVehicle", "saturationFlow",
+                    "startupLostTime": steps (default: 1, 10, 1, 0, 1, 0)
+                }, ...
+            ]
+        }, ...
+    ]
+}
+Roads are indexed in the order they are listed. Unknown keys are rejected.
+*/
+
+/**
+ * @brief Parse junction configuration
+ * @param *json Null-terminated JSON text
+ * @param *config Output configuration, roads and lanes are allocated and must be released with ConfigRelease()
+ * @return 0 on success, <0 on failure
+ */
+int ConfigParse(const char *json, struct SimConfig *config);
+
+/**
+ * @brief Release roads and lanes of a configuration filled by ConfigParse()
+ * @param *config Configuration
+ */
+void ConfigRelease(struct SimConfig *config);
+
+/**
+ * @brief Compile junction configuration to a junction image (see SimCompileJunction())
+ * @param *inPath Junction configuration (JSON) path
+ * @param *outPath Output junction image path
+ * @return 0 on success, <0 on failure
+ */
+int ConfigCompile(const char *inPath, const char *outPath);
+
+/**
+ * @brief Map junction image file into memory (read-only)
+ * @param *path Junction image path
+ * @param *size Output image size
+ * @return Image, NULL on failure
+ */
+const void* ConfigMap(const char *path, size_t *size);
+
+/**
+ * @brief Unmap junction image mapped by ConfigMap()
+ * @param *image Image
+ * @param size Image size
+ */
+void ConfigUnmap(const void *image, size_t size);
+
+/**
+ * @brief Create simulation instance from a junction image file
+ *
+ * The file is mapped into memory and loaded with SimLoadJunction(), nothing is derived from the configuration.
+ * @param *path Junction image path
+ * @return New instance, released with SimRelease(), NULL on failure
+ */
+struct SimState* ConfigLoad(const char *path);
+
+#endif
@@ -0,0 +1,386 @@
+#include "controller.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "command.h"
+
+#define CONTROLLER_READ_SIZE 65536 /**< Detector event buffer size */
+
+static volatile sig_atomic_t ControllerStop = 0;
+
+static void ControllerSignalHandler(int signum)
+{
+    (void)signum;
+    ControllerStop = 1;
+}
+
+/**
+ * @brief Get time
+ * @param clock Clock
+ * @return Time in ns
+ */
+static uint64_t ControllerGetTime(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void ControllerVehicleExitedCallback(struct Vehicle *vehicle, void *context)
+{
+    struct Controller *controller = context;
+    vehicle->next = controller->freeVehicles;
+    controller->freeVehicles = vehicle;
+}
+
+int ControllerInit(struct Controller *controller, size_t maxVehicles, uint64_t budget)
+{
+    *controller = (struct Controller){.budget = budget, .clock = CLOCK_MONOTONIC};
+    controller->pool = malloc(maxVehicles * sizeof(*controller->pool));
+    if((NULL == controller->pool) || (0 != SimReserveVehicles(maxVehicles)))
+    {
+        fprintf(stderr, "Memory allocation failed\r\n");
+        free(controller->pool);
+        return -1;
+    }
+    controller->poolSize = maxVehicles;
+    for(size_t i = maxVehicles; i > 0; i--)
+    {
+        controller->pool[i - 1].next = controller->freeVehicles;
+        controller->freeVehicles = &controller->pool[i - 1];
+    }
+    SimSetEventLogging(false);
+    SimRegisterVehicleExitedCallback(ControllerVehicleExitedCallback, controller);
+    return 0;
+}
+
+void ControllerDeinit(struct Controller *controller)
+{
+    struct SimConfig *config = SimGetConfig();
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            struct Lane *lane = &config->road[i].lane[k];
+            while(0 != lane->vehicleCount)
+                SimRemoveVehicle(lane->vehicles);
+        }
+    }
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+    free(controller->pool);
+    controller->pool = NULL;
+    controller->freeVehicles = NULL;
+    controller->poolSize = 0;
+}
+
+int ControllerDetect(struct Controller *controller, const char *name, size_t length, enum Direction start, enum Direction end)
+{
+    struct Vehicle *v = controller->freeVehicles;
+    struct SimConfig *config = SimGetConfig();
+    //events of unknown roads or without a lane are dropped here, the simulation would report them on the binary output
+    struct Lane *lane = ((start < config->roadCount) && (end < config->roadCount)) ? SimSelectLane(start, end) : NULL;
+    if((NULL == v) || (NULL == lane))
+    {
+        ++controller->dropped;
+        return -1;
+    }
+    if(length >= sizeof(v->name))
+        length = sizeof(v->name) - 1;
+    memcpy(v->name, name, length);
+    v->name[length] = '\0';
+    v->direction = end;
+    struct Vehicle *next = v->next;
+    if(0 != SimPlaceVehicle(v, lane))
+    {
+        ++controller->dropped;
+        return -1;
+    }
+    controller->freeVehicles = next;
+    if(NULL != controller->trace)
+        SimTraceRecordCommand(controller->trace, COMMAND_ADD_VEHICLE, start, end, v->name, length);
+    return 0;
+}
+
+int ControllerRemove(struct Controller *controller, const char *name)
+{
+    struct Vehicle *v = SimFindVehicle(name);
+    if((NULL == v) || (0 != SimRemoveVehicle(v)))
+    {
+        ++controller->dropped;
+        return -1;
+    }
+    if(NULL != controller->trace)
+        SimTraceRecordCommand(controller->trace, COMMAND_REMOVE_VEHICLE, 0, 0, name, strlen(name));
+    v->next = controller->freeVehicles;
+    controller->freeVehicles = v;
+    return 0;
+}
+
+uint64_t ControllerStep(struct Controller *controller)
+{
+    if(NULL != controller->trace)
+        SimTraceRecordCommand(controller->trace, COMMAND_STEP, 0, 0, NULL, 0);
+    uint64_t start = ControllerGetTime(controller->clock);
+    SimDoStep();
+    uint64_t latency = ControllerGetTime(controller->clock) - start;
+
+    struct ControllerHistogram *histogram = &controller->histogram;
+    unsigned int bucket = 63 - __builtin_clzll(latency | 1);
+    if(bucket >= CONTROLLER_HISTOGRAM_BUCKETS)
+        bucket = CONTROLLER_HISTOGRAM_BUCKETS - 1;
+    ++histogram->bucket[bucket];
+    ++histogram->count;
+    histogram->total += latency;
+    if(latency > histogram->max)
+        histogram->max = latency;
+    if((0 != controller->budget) && (latency > controller->budget))
+        ++controller->overruns;
+    return latency;
+}
+
+uint64_t ControllerGetPercentile(const struct ControllerHistogram *histogram, double percentile)
+{
+    if(0 == histogram->count)
+        return 0;
+    uint64_t target = (uint64_t)((percentile / 100.) * (double)histogram->count + 0.5);
+    if(0 == target)
+        target = 1;
+    uint64_t count = 0;
+    for(unsigned int i = 0; i < CONTROLLER_HISTOGRAM_BUCKETS; i++)
+    {
+        count += histogram->bucket[i];
+        if(count >= target)
+        {
+            uint64_t bound = (2ULL << i) - 1;
+            return (bound < histogram->max) ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void ControllerPrintReport(const struct Controller *controller, FILE *f)
+{
+    const struct ControllerHistogram *histogram = &controller->histogram;
+    fprintf(f, "Steps: %llu, dropped events: %llu\r\n", (unsigned long long)histogram->count,
+        (unsigned long long)controller->dropped);
+    if(0 == histogram->count)
+        return;
+    fprintf(f, "Step latency: mean %llu ns, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\r\n",
+        (unsigned long long)(histogram->total / histogram->count),
+        (unsigned long long)ControllerGetPercentile(histogram, 50.),
+        (unsigned long long)ControllerGetPercentile(histogram, 99.),
+        (unsigned long long)ControllerGetPercentile(histogram, 99.9),
+        (unsigned long long)histogram->max);
+    if(0 != controller->budget)
+        fprintf(f, "Budget: %llu ns, exceeded %llu times\r\n", (unsigned long long)controller->budget,
+            (unsigned long long)controller->overruns);
+    for(unsigned int i = 0; i < CONTROLLER_HISTOGRAM_BUCKETS; i++)
+    {
+        if(0 != histogram->bucket[i])
+            fprintf(f, "  < %12llu ns: %llu\r\n", (unsigned long long)(2ULL << i), (unsigned long long)histogram->bucket[i]);
+    }
+}
+
+/**
+ * @brief Handle all complete detector events in the buffer
+ * @param *controller Controller
+ * @param *in Event buffer
+ * @param *inSize Number of bytes in the buffer, updated with the number of bytes left
+ * @return 0 on success, <0 if the input is malformed
+ */
+static int ControllerHandleEvents(struct Controller *controller, uint8_t *in, size_t *inSize)
+{
+    size_t position = 0;
+    while((*inSize - position) >= sizeof(struct InCommand))
+    {
+        struct InCommand cmd;
+        memcpy(&cmd, in + position, sizeof(cmd));
+        if(cmd.length > (CONTROLLER_READ_SIZE - sizeof(cmd)))
+        {
+            fprintf(stderr, "Malformed detector event\r\n");
+            return -1;
+        }
+        if((*inSize - position) < (sizeof(cmd) + cmd.length))
+            break; //wait for the rest of the event
+
+        const char *name = (const char*)(in + position + sizeof(cmd));
+        if(COMMAND_ADD_VEHICLE == cmd.type)
+            ControllerDetect(controller, name, cmd.length, cmd.startRoad, cmd.endRoad);
+        else if(COMMAND_REMOVE_VEHICLE == cmd.type)
+        {
+            //names are stored truncated
+            char buffer[MAX_VEHICLE_NAME_LENGTH];
+            size_t length = (cmd.length < sizeof(buffer)) ? cmd.length : (sizeof(buffer) - 1);
+            memcpy(buffer, name, length);
+            buffer[length] = '\0';
+            ControllerRemove(controller, buffer);
+        }
+        position += sizeof(cmd) + cmd.length;
+    }
+    *inSize -= position;
+    memmove(in, in + position, *inSize);
+    return 0;
+}
+
+int ControllerRun(int inFd, int outFd, uint32_t period, size_t maxVehicles, uint64_t budget, const char *tracePath)
+{
+    //the output is binary, so nothing else is printed to it
+    SimSetEventLogging(false);
+    if(0 != SimInit())
+        return -1;
+
+    struct SimConfig *config = SimGetConfig();
+    size_t laneCount = 0;
+    for(size_t i = 0; i < config->roadCount; i++)
+        laneCount += config->road[i].laneCount;
+
+    //buffers are allocated up front, so that the control loop does not allocate memory
+    struct Controller controller;
+    uint8_t *in = malloc(CONTROLLER_READ_SIZE);
+    uint8_t *out = calloc(1, sizeof(struct ControllerOutput) + laneCount);
+    if((NULL == in) || (NULL == out))
+        fprintf(stderr, "Memory allocation failed\r\n");
+    if((NULL == in) || (NULL == out) || (0 != ControllerInit(&controller, maxVehicles, budget)))
+    {
+        free(in);
+        free(out);
+        return -1;
+    }
+    uint8_t *lights = out + sizeof(struct ControllerOutput);
+
+    //the trace is buffered, so recording does not slow down the control loop
+    FILE *traceFile = NULL;
+    if(NULL != tracePath)
+    {
+        traceFile = fopen(tracePath, "wb");
+        if((NULL == traceFile) || (NULL == (controller.trace = SimTraceStartRecording(traceFile))))
+        {
+            fprintf(stderr, "Unable to record trace to %s\r\n", tracePath);
+            if(NULL != traceFile)
+                fclose(traceFile);
+            ControllerDeinit(&controller);
+            free(in);
+            free(out);
+            return -1;
+        }
+    }
+
+    //avoid page faults in the control loop
+    if(0 != mlockall(MCL_CURRENT | MCL_FUTURE))
+        fprintf(stderr, "Unable to lock memory, page faults may delay steps\r\n");
+
+    int flags = fcntl(inFd, F_GETFL);
+    if((flags < 0) || (0 != fcntl(inFd, F_SETFL, flags | O_NONBLOCK)))
+        fprintf(stderr, "Unable to switch detector input to non-blocking mode\r\n");
+
+    struct sigaction action = {.sa_handler = ControllerSignalHandler};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int ret = 0;
+    size_t inSize = 0;
+    bool inputOpen = true;
+    uint64_t missed = 0;
+    uint64_t next = ControllerGetTime(CLOCK_MONOTONIC);
+    while(!ControllerStop && inputOpen)
+    {
+        //drain all available detector events
+        while(inSize < CONTROLLER_READ_SIZE)
+        {
+            ssize_t size = read(inFd, in + inSize, CONTROLLER_READ_SIZE - inSize);
+            if(size > 0)
+                inSize += size;
+            else
+            {
+                if(0 == size)
+                    inputOpen = false;
+                else if((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+                {
+                    fprintf(stderr, "Unable to read detector events\r\n");
+                    inputOpen = false;
+                    ret = -1;
+                }
+                break;
+            }
+        }
+        if(0 != ControllerHandleEvents(&controller, in, &inSize))
+        {
+            ret = -1;
+            break;
+        }
+
+        ControllerStep(&controller);
+
+        bool changed = false;
+        size_t n = 0;
+        for(size_t i = 0; i < config->roadCount; i++)
+        {
+            for(size_t k = 0; k < config->road[i].laneCount; k++, n++)
+            {
+                if(lights[n] != config->road[i].lane[k].light)
+                {
+                    lights[n] = config->road[i].lane[k].light;
+                    changed = true;
+                }
+            }
+        }
+        if(changed)
+        {
+            struct SimStats stats;
+            SimGetStats(&stats);
+            struct ControllerOutput header = {.step = stats.step, .count = laneCount};
+            memcpy(out, &header, sizeof(header));
+            size_t sent = 0, length = sizeof(header) + laneCount;
+            while(sent < length)
+            {
+                ssize_t size = write(outFd, out + sent, length - sent);
+                if(size < 0)
+                {
+                    if(EINTR == errno)
+                        continue;
+                    fprintf(stderr, "Unable to write lights\r\n");
+                    ret = -1;
+                    ControllerStop = 1;
+                    break;
+                }
+                sent += size;
+            }
+        }
+
+        //wait for the next period, skip the missed ones
+        next += (uint64_t)period * 1000ULL;
+        uint64_t now = ControllerGetTime(CLOCK_MONOTONIC);
+        if(now >= next)
+        {
+            ++missed;
+            next = now;
+            continue;
+        }
+        struct timespec deadline = {.tv_sec = next / 1000000000ULL, .tv_nsec = next % 1000000000ULL};
+        while((EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) && !ControllerStop)
+            ;
+    }
+
+    ControllerPrintReport(&controller, stderr);
+    fprintf(stderr, "Missed periods: %llu\r\n", (unsigned long long)missed);
+    if(NULL != controller.trace)
+    {
+        //the vehicles left waiting are not traced
+        if(0 != SimTraceStop(controller.trace))
+            fprintf(stderr, "Unable to write trace\r\n");
+        controller.trace = NULL;
+        fclose(traceFile);
+    }
+    ControllerDeinit(&controller);
+    free(in);
+    free(out);
+    return ret;
+}
@@ -0,0 +1,136 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include "sim.h"
+#include "trace.h"
+
+/*
+Real-time controller protocol (native byte order, no padding):
+* detector events are InCommand structures (see command.h) followed by the vehicle name:
+    - vehicle add: a vehicle arrived at the stop line,
+    - vehicle removal: a vehicle left the junction without passing the stop line,
+    - other commands are ignored, the steps are paced by the clock,
+* after each step that changed any light, a ControllerOutput header is written, followed by one byte (enum Light)
+  per lane, in road-major order.
+*/
+
+#define CONTROLLER_HISTOGRAM_BUCKETS 32 /**< Number of latency histogram buckets */
+
+/**
+ * @brief Step latency histogram, bucket i counts latencies from 2^i to 2^(i+1)-1 ns (bucket 0 also counts 0 ns)
+ */
+struct ControllerHistogram
+{
+    uint64_t bucket[CONTROLLER_HISTOGRAM_BUCKETS]; /**< Number of steps in each bucket */
+    uint64_t count; /**< Number of steps */
+    uint64_t total; /**< Sum of all latencies in ns */
+    uint64_t max; /**< Worst-case latency in ns */
+};
+
+/**
+ * @brief Controller, driving the selected simulation instance
+ */
+struct Controller
+{
+    struct Vehicle *pool; /**< Preallocated vehicles */
+    struct Vehicle *freeVehicles; /**< Unused vehicles, linked through their next pointers */
+    size_t poolSize; /**< Number of preallocated vehicles */
+    uint64_t dropped; /**< Number of detector events that could not be handled */
+    uint64_t budget; /**< Step latency budget in ns, 0 if not checked */
+    uint64_t overruns; /**< Number of steps exceeding the budget */
+    clockid_t clock; /**< Clock used to measure step latency, CLOCK_MONOTONIC by default */
+    struct ControllerHistogram histogram; /**< Step latency histogram */
+    struct SimTrace *trace; /**< Trace the handled detector events and steps are recorded to, NULL if not traced */
+};
+
+/**
+ * @brief Light change record header, followed by @p count lights
+ */
+struct ControllerOutput
+{
+    uint32_t step; /**< Step after which the lights are valid */
+    uint16_t count; /**< Number of lanes */
+} __attribute__ ((packed));
+
+/**
+ * @brief Prepare selected simulation instance for real-time control
+ *
+ * All memory is allocated here: vehicles come from a pool and the vehicle index is reserved for the whole pool,
+ * so that detector events and steps never allocate memory. Simulation events are no longer printed.
+ * @param *controller Controller
+ * @param maxVehicles Maximum number of waiting vehicles
+ * @param budget Step latency budget in ns, 0 if not checked
+ * @return 0 on success, <0 on failure
+ * @attention The simulation must be initialized before calling this function
+ */
+int ControllerInit(struct Controller *controller, size_t maxVehicles, uint64_t budget);
+
+/**
+ * @brief Remove all vehicles from the simulation and release controller resources
+ * @param *controller Controller
+ */
+void ControllerDeinit(struct Controller *controller);
+
+/**
+ * @brief Handle vehicle detection
+ * @param *controller Controller
+ * @param *name Vehicle name
+ * @param length Vehicle name length, longer names are truncated
+ * @param start Starting road
+ * @param end Target road
+ * @return 0 on success, <0 on failure (no free vehicle, unknown road or no lane)
+ */
+int ControllerDetect(struct Controller *controller, const char *name, size_t length, enum Direction start, enum Direction end);
+
+/**
+ * @brief Handle vehicle leaving the junction without passing the stop line
+ * @param *controller Controller
+ * @param *name Vehicle name
+ * @return 0 on success, <0 on failure (no such vehicle)
+ */
+int ControllerRemove(struct Controller *controller, const char *name);
+
+/**
+ * @brief Perform one simulation step and record its latency
+ * @param *controller Controller
+ * @return Step latency in ns
+ */
+uint64_t ControllerStep(struct Controller *controller);
+
+/**
+ * @brief Get latency percentile from histogram
+ * @param *histogram Histogram
+ * @param percentile Percentile (0-100)
+ * @return Upper bound of the bucket containing the percentile in ns, 0 if the histogram is empty
+ */
+uint64_t ControllerGetPercentile(const struct ControllerHistogram *histogram, double percentile);
+
+/**
+ * @brief Print latency report
+ * @param *controller Controller
+ * @param *f Output file
+ */
+void ControllerPrintReport(const struct Controller *controller, FILE *f);
+
+/**
+ * @brief Run real-time controller paced by the monotonic clock
+ *
+ * Each period, all detector events available on the input are handled, one step is performed and the lights
+ * are written to the output if they changed. The controller runs until the input is closed or SIGINT or SIGTERM
+ * is received, then the latency report is printed to the standard error.
+ * @param inFd Detector event input, switched to non-blocking mode
+ * @param outFd Light change output
+ * @param period Step period in us
+ * @param maxVehicles Maximum number of waiting vehicles
+ * @param budget Step latency budget in ns, 0 if not checked
+ * @param *tracePath Trace file path, NULL to disable tracing
+ * @return 0 on success, <0 on failure
+ * @attention The junction must be configured before calling this function
+ */
+int ControllerRun(int inFd, int outFd, uint32_t period, size_t maxVehicles, uint64_t budget, const char *tracePath);
+
+#endif
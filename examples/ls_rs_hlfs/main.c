@@ -46,7 +46,15 @@ int main(int argc, char **argv)
     SimConfig.selectionPolicy = SIM_HLFS;
     SimConfig.timePolicy = SIM_TIME_PROPORTIONAL;
 
+    static struct Road roads[4];
+    static struct Lane lanes[4][2];
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    for(size_t i = 0; i < SimConfig.roadCount; i++)
+        roads[i].lane = lanes[i];
+
     SimConfig.road[0].position = NORTH;
+    SimConfig.road[0].bearing = 0;
     SimConfig.road[0].laneCount = 2;
     //from north to west and south (straight and right)
     SimConfig.road[0].lane[0].road = &SimConfig.road[0];
@@ -72,6 +80,7 @@ int main(int argc, char **argv)
     SimConfig.road[0].lane[1].priority = 1.f;
 
     SimConfig.road[1].position = SOUTH;
+    SimConfig.road[1].bearing = 180;
     SimConfig.road[1].laneCount = 2;
     //from south to north and east (straight and right)
     SimConfig.road[1].lane[0].road = &SimConfig.road[1];
@@ -97,6 +106,7 @@ int main(int argc, char **argv)
     SimConfig.road[1].lane[1].priority = 1.f;
 
     SimConfig.road[2].position = WEST;
+    SimConfig.road[2].bearing = 270;
     SimConfig.road[2].laneCount = 2;
     //from west to east and south (straight and right)
     SimConfig.road[2].lane[0].road = &SimConfig.road[2];
@@ -122,6 +132,7 @@ int main(int argc, char **argv)
     SimConfig.road[2].lane[1].priority = 1.f;
 
     SimConfig.road[3].position = EAST;
+    SimConfig.road[3].bearing = 90;
     SimConfig.road[3].laneCount = 2;
     //from east to west and north (straight and left)
     SimConfig.road[3].lane[0].road = &SimConfig.road[3];
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include "sim.h"
+
+/*
+This example demonstrates what-if branching of a running simulation.
+
+The junction has one lane on each road, with dynamic lane selection and prioritized light timing.
+There is a heavy flow from north to south and a light flow from the other roads.
+
+After the first 6 steps the simulation is forked into three branches:
+* A - nothing is changed, the simulation just continues,
+* B - the current north green light is extended by 5 steps,
+* C - the north lane priority is doubled.
+Vehicles waiting at the junction are shared by all branches and not copied.
+Each branch is then advanced until all vehicles exit and the outcomes are compared.
+*/
+
+#define VEHICLE_COUNT 24
+
+static void SetupLane(struct Road *road, enum Direction position, uint16_t bearing)
+{
+    static struct Lane lanes[4][1];
+    road->position = position;
+    road->bearing = bearing;
+    road->lane = lanes[position];
+    road->laneCount = 1;
+    road->lane[0].road = road;
+    road->lane[0].direction.north = (NORTH != position);
+    road->lane[0].direction.south = (SOUTH != position);
+    road->lane[0].direction.west = (WEST != position);
+    road->lane[0].direction.east = (EAST != position);
+    road->lane[0].minGreenTime = 2;
+    road->lane[0].maxGreenTime = 6;
+    road->lane[0].minRedTime = 1;
+    road->lane[0].stepsPerVehicle = 1;
+    road->lane[0].priority = 1.f;
+    road->lane[0].permissive = false;
+}
+
+int main(void)
+{
+    SimConfig.selectionPolicy = SIM_DYNAMIC;
+    SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
+    static struct Road roads[4];
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    SetupLane(&SimConfig.road[NORTH], NORTH, 0);
+    SetupLane(&SimConfig.road[SOUTH], SOUTH, 180);
+    SetupLane(&SimConfig.road[WEST], WEST, 270);
+    SetupLane(&SimConfig.road[EAST], EAST, 90);
+
+    printf("What-if branching example\r\n");
+
+    SimInit();
+
+    static struct Vehicle v[VEHICLE_COUNT];
+    for(size_t i = 0; i < VEHICLE_COUNT; i++)
+    {
+        snprintf(v[i].name, sizeof(v[i].name), "v%zu", i);
+        enum Direction start = (i % 3) ? NORTH : (enum Direction)(1 + (i / 3) % 3);
+        v[i].direction = (NORTH == start) ? SOUTH : NORTH;
+        SimPlaceVehicle(&v[i], SimSelectLane(start, v[i].direction));
+        if(i < 6)
+            SimDoStep();
+    }
+
+    //fork the warm simulation into branches, the main instance stays untouched
+    struct SimState *branch[3];
+    for(size_t i = 0; i < 3; i++)
+    {
+        branch[i] = SimFork();
+        if(NULL == branch[i])
+            return 1;
+    }
+
+    SimSelect(branch[1]);
+    struct Lane *north = &SimGetConfig()->road[NORTH].lane[0];
+    if(LIGHT_GREEN == north->light)
+        north->stepsBeforeChange += 5;
+    else
+        north->minGreenTime += 5;
+
+    SimSelect(branch[2]);
+    SimGetConfig()->road[NORTH].lane[0].priority *= 2.f;
+
+    struct SimStats stats[3];
+    for(size_t i = 0; i < 3; i++)
+    {
+        SimSelect(branch[i]);
+        while(SimDoStep())
+            ;
+        SimGetStats(&stats[i]);
+    }
+    SimSelect(NULL);
+
+    printf("\r\nBranch | steps | exited | total delay\r\n");
+    for(size_t i = 0; i < 3; i++)
+    {
+        printf("%c      | %5lu | %6lu | %11llu\r\n", (char)('A' + i), (unsigned long)stats[i].step,
+            (unsigned long)stats[i].exitedVehicles, (unsigned long long)stats[i].totalDelay);
+        SimRelease(branch[i]);
+    }
+}
@@ -2,67 +2,635 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "sim.h"
+#include "trace.h"
+#include "timeline.h"
+#include "profile.h"
+#include "command.h"
+#include "output.h"
 
-struct InCommand
+/**
+ * @brief Checkpoint header, followed by the simulation snapshot
+ */
+struct JsonCheckpoint
 {
-    uint8_t type;
-    uint8_t startRoad;
-    uint8_t endRoad;
-    uint32_t length;
+    uint64_t inOffset; /**< Input file offset of the next command (v1) or of the block containing it (v2) */
+    uint64_t outOffset; /**< Output file offset after the last step */
+    uint32_t step; /**< Number of steps done */
+    uint32_t inPosition; /**< Position of the next command in the decoded block (v2) */
+    uint32_t pendingSteps; /**< Steps of the last step command not done yet */
 } __attribute__ ((packed));
 
-enum
+/**
+ * @brief Input command reader, decoding both input file formats (see command.h)
+ */
+struct JsonInput
 {
-    COMMAND_ADD_VEHICLE = 1,
-    COMMAND_STEP = 2,
+    FILE *f; /**< Input file */
+    bool v2; /**< Format v2 (blocks of varint-encoded commands) */
+    bool failed; /**< Input is broken, no more commands are read */
+    uint8_t *block; /**< Decoded block (v2) */
+    uint8_t *stored; /**< Compressed block data (v2) */
+    size_t size; /**< Decoded block size */
+    size_t position; /**< Read position in the decoded block */
+    uint64_t blockOffset; /**< File offset of the decoded block */
+    char *name; /**< Name of the last command read */
+    size_t nameCapacity; /**< Name buffer capacity */
 };
 
+/**
+ * @brief Decoded input command
+ */
+struct JsonCommand
+{
+    uint8_t type; /**< Command type */
+    uint8_t startRoad; /**< Start road */
+    uint8_t endRoad; /**< End road, or target lane index of a lane change */
+    uint32_t count; /**< Number of steps of a step command */
+    uint32_t length; /**< Vehicle name length */
+    const char *name; /**< Null-terminated vehicle name, valid until the next command is read */
+};
+
+static struct Vehicle* JsonVehicleAllocator(size_t nameLength, void *context)
+{
+    (void)context;
+    return malloc(sizeof(struct Vehicle) + nameLength + 1);
+}
+
+/**
+ * @brief Write checkpoint atomically (to a temporary file, which then replaces the old checkpoint)
+ * @param *path Checkpoint path
+ * @param *checkpoint Checkpoint header
+ * @return 0 on success, <0 on failure
+ */
+static int JsonWriteCheckpoint(const char *path, const struct JsonCheckpoint *checkpoint)
+{
+    size_t length = strlen(path);
+    char *tmpPath = malloc(length + sizeof(".tmp"));
+    if(NULL == tmpPath)
+        return -1;
+    memcpy(tmpPath, path, length);
+    memcpy(tmpPath + length, ".tmp", sizeof(".tmp"));
+
+    int ret = -1;
+    FILE *f = fopen(tmpPath, "wb");
+    if(NULL != f)
+    {
+        if((1 == fwrite(checkpoint, sizeof(*checkpoint), 1, f)) && (0 == SimSaveSnapshot(f)))
+            ret = 0;
+        if(0 != fclose(f))
+            ret = -1;
+        if((0 == ret) && (0 != rename(tmpPath, path)))
+            ret = -1;
+    }
+    if(0 != ret)
+        printf("Unable to write checkpoint %s\r\n", path);
+    free(tmpPath);
+    return ret;
+}
+
+/**
+ * @brief Restore simulation from checkpoint
+ * @param *path Checkpoint path
+ * @param *checkpoint Output checkpoint header
+ * @return 0 on success, <0 on failure
+ */
+static int JsonReadCheckpoint(const char *path, struct JsonCheckpoint *checkpoint)
+{
+    FILE *f = fopen(path, "rb");
+    if(NULL == f)
+    {
+        printf("Unable to open %s\r\n", path);
+        return -1;
+    }
+    int ret = -1;
+    if((1 == fread(checkpoint, sizeof(*checkpoint), 1, f)) && (0 == SimLoadSnapshot(f, JsonVehicleAllocator, NULL)))
+        ret = 0;
+    else
+        printf("Checkpoint %s is broken\r\n", path);
+    fclose(f);
+    return ret;
+}
+
+/**
+ * @brief Open input file and detect its format
+ * @param *input Output reader
+ * @param *path Input file path
+ * @return 0 on success, <0 on failure
+ */
+static int JsonOpenInput(struct JsonInput *input, const char *path)
+{
+    *input = (struct JsonInput){.f = fopen(path, "rb")};
+    if(NULL == input->f)
+        return -1;
+    struct InFileHeader header;
+    if((1 == fread(&header, sizeof(header), 1, input->f)) && (IN_FILE_MAGIC == header.magic))
+    {
+        input->v2 = true;
+        input->blockOffset = sizeof(header);
+    }
+    else
+        rewind(input->f);
+    return 0;
+}
+
+/**
+ * @brief Close input file and release reader buffers
+ * @param *input Reader
+ */
+static void JsonCloseInput(struct JsonInput *input)
+{
+    if(NULL != input->f)
+        fclose(input->f);
+    free(input->block);
+    free(input->stored);
+    free(input->name);
+    *input = (struct JsonInput){.f = NULL};
+}
+
+/**
+ * @brief Read varint from the input file
+ * @param *f Input file
+ * @param *value Output value
+ * @return 0 on success, <0 on failure
+ */
+static int JsonReadFileVarint(FILE *f, uint64_t *value)
+{
+    *value = 0;
+    for(unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(f);
+        if(EOF == byte)
+            return -1;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if(0 == (byte & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Get varint from a buffer
+ * @param *data Buffer
+ * @param size Buffer size
+ * @param *position Read position, updated
+ * @param *value Output value
+ * @return 0 on success, <0 if the varint is incomplete
+ */
+static int JsonGetVarint(const uint8_t *data, size_t size, size_t *position, uint64_t *value)
+{
+    *value = 0;
+    for(unsigned int shift = 0; (shift < 64) && (*position < size); shift += 7)
+    {
+        uint8_t byte = data[(*position)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if(0 == (byte & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Decompress LZ block
+ * @param *src Compressed data
+ * @param srcSize Compressed data size
+ * @param *dst Output buffer
+ * @param dstSize Decoded block size
+ * @return 0 on success, <0 if the data is broken
+ */
+static int JsonDecodeLz(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstSize)
+{
+    size_t in = 0, out = 0;
+    while(out < dstSize)
+    {
+        uint64_t literals, length, distance;
+        if((0 != JsonGetVarint(src, srcSize, &in, &literals)) || (literals > (dstSize - out))
+            || (literals > (srcSize - in)))
+            return -1;
+        memcpy(dst + out, src + in, literals);
+        in += literals;
+        out += literals;
+        if(out == dstSize)
+            break;
+
+        if((0 != JsonGetVarint(src, srcSize, &in, &length)) || (0 != JsonGetVarint(src, srcSize, &in, &distance))
+            || (length > (dstSize - out - IN_MIN_MATCH)) || (0 == distance) || (distance > out))
+            return -1;
+        //byte by byte, the match may overlap the bytes it produces
+        const uint8_t *match = dst + out - distance;
+        for(size_t i = 0; i < (length + IN_MIN_MATCH); i++)
+            dst[out++] = match[i];
+    }
+    return (in == srcSize) ? 0 : -1;
+}
+
+/**
+ * @brief Read and decode next input block (v2)
+ * @param *input Reader
+ * @return 1 if a block was read, 0 at the end of the file, <0 on failure
+ */
+static int JsonReadBlock(struct JsonInput *input)
+{
+    long offset = ftell(input->f);
+    int method = fgetc(input->f);
+    if(EOF == method)
+        return 0;
+    uint64_t size, storedSize;
+    if((0 != JsonReadFileVarint(input->f, &size)) || (0 != JsonReadFileVarint(input->f, &storedSize))
+        || (size > IN_MAX_BLOCK_SIZE) || ((IN_BLOCK_STORED == method) && (storedSize != size))
+        || ((IN_BLOCK_LZ == method) && (storedSize > (2 * IN_MAX_BLOCK_SIZE)))
+        || ((IN_BLOCK_STORED != method) && (IN_BLOCK_LZ != method)))
+        return -1;
+
+    if((NULL == input->block) && (NULL == (input->block = malloc(IN_MAX_BLOCK_SIZE))))
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+    if(IN_BLOCK_STORED == method)
+    {
+        if(size != fread(input->block, 1, size, input->f))
+            return -1;
+    }
+    else
+    {
+        if((NULL == input->stored) && (NULL == (input->stored = malloc(2 * IN_MAX_BLOCK_SIZE))))
+        {
+            printf("Memory allocation failed\r\n");
+            return -1;
+        }
+        if((storedSize != fread(input->stored, 1, storedSize, input->f))
+            || (0 != JsonDecodeLz(input->stored, storedSize, input->block, size)))
+            return -1;
+    }
+    input->blockOffset = offset;
+    input->size = size;
+    input->position = 0;
+    return 1;
+}
+
+/**
+ * @brief Make room for the name of the command read, including the terminating null character
+ * @param *input Reader
+ * @param length Name length
+ * @return 0 on success, <0 on failure
+ */
+static int JsonReserveName(struct JsonInput *input, size_t length)
+{
+    if(length >= input->nameCapacity)
+    {
+        char *buffer = realloc(input->name, length + 1);
+        if(NULL == buffer)
+        {
+            printf("Memory allocation failed\r\n");
+            return -1;
+        }
+        input->name = buffer;
+        input->nameCapacity = length + 1;
+    }
+    input->name[length] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Read next v1 command
+ * @param *input Reader
+ * @param *cmd Output command
+ * @return 1 if a command was read, 0 at the end of the file, <0 if the input is broken
+ */
+static int JsonReadCommandV1(struct JsonInput *input, struct JsonCommand *cmd)
+{
+    struct InCommand raw;
+    size_t size = fread(&raw, 1, sizeof(raw), input->f);
+    if(0 == size)
+        return 0;
+    if((sizeof(raw) != size) || (0 != JsonReserveName(input, raw.length)))
+        return -1;
+    if(raw.length != fread(input->name, 1, raw.length, input->f))
+        return -1;
+    *cmd = (struct JsonCommand){.type = raw.type, .startRoad = raw.startRoad, .endRoad = raw.endRoad, .count = 1,
+        .length = raw.length, .name = input->name};
+    return 1;
+}
+
+/**
+ * @brief Read next v2 command
+ * @param *input Reader
+ * @param *cmd Output command
+ * @return 1 if a command was read, 0 at the end of the file, <0 if the input is broken
+ */
+static int JsonReadCommandV2(struct JsonInput *input, struct JsonCommand *cmd)
+{
+    while(input->position == input->size)
+    {
+        int ret = JsonReadBlock(input);
+        if(ret <= 0)
+            return ret;
+    }
+
+    const uint8_t *data = input->block;
+    size_t size = input->size, position = input->position;
+    *cmd = (struct JsonCommand){.type = data[position++], .count = 1};
+    uint64_t value;
+    switch(cmd->type)
+    {
+        case COMMAND_STEP:
+            if((0 != JsonGetVarint(data, size, &position, &value)) || (0 == value) || (value > UINT32_MAX))
+                return -1;
+            cmd->count = value;
+            break;
+        case COMMAND_ADD_VEHICLE:
+            if(position == size)
+                return -1;
+            cmd->startRoad = data[position++];
+            //fall through
+        case COMMAND_CHANGE_LANE:
+        case COMMAND_REROUTE_VEHICLE:
+            if(position == size)
+                return -1;
+            cmd->endRoad = data[position++];
+            //fall through
+        case COMMAND_REMOVE_VEHICLE:
+            if((0 != JsonGetVarint(data, size, &position, &value)) || (value > (size - position)))
+                return -1;
+            cmd->length = value;
+            break;
+        default:
+            //unknown commands are reported by the caller
+            break;
+    }
+    if(0 != JsonReserveName(input, cmd->length))
+        return -1;
+    memcpy(input->name, data + position, cmd->length);
+    cmd->name = input->name;
+    input->position = position + cmd->length;
+    return 1;
+}
+
+/**
+ * @brief Read next input command
+ * @param *input Reader
+ * @param *cmd Output command
+ * @return 1 if a command was read, 0 at the end of the file, <0 if the input is broken
+ */
+static int JsonReadCommand(struct JsonInput *input, struct JsonCommand *cmd)
+{
+    if(input->failed)
+        return -1;
+    int ret = input->v2 ? JsonReadCommandV2(input, cmd) : JsonReadCommandV1(input, cmd);
+    if(ret < 0)
+        input->failed = true;
+    return ret;
+}
+
+/**
+ * @brief Get position of the next command
+ * @param *input Reader
+ * @param *offset Output file offset (v1) or block file offset (v2)
+ * @param *position Output position in the decoded block (v2)
+ */
+static void JsonTellInput(const struct JsonInput *input, uint64_t *offset, uint32_t *position)
+{
+    if(input->v2)
+    {
+        *offset = input->blockOffset;
+        *position = input->position;
+    }
+    else
+    {
+        *offset = ftell(input->f);
+        *position = 0;
+    }
+}
+
+/**
+ * @brief Continue reading from a position returned by JsonTellInput()
+ * @param *input Reader
+ * @param offset File offset (v1) or block file offset (v2)
+ * @param position Position in the decoded block (v2)
+ * @return 0 on success, <0 on failure
+ */
+static int JsonSeekInput(struct JsonInput *input, uint64_t offset, uint32_t position)
+{
+    if(0 != fseek(input->f, offset, SEEK_SET))
+        return -1;
+    if(!input->v2)
+        return 0;
+    input->size = 0;
+    input->position = 0;
+    int ret = JsonReadBlock(input);
+    if((ret < 0) || (position > input->size))
+        return -1;
+    input->position = position;
+    return 0;
+}
+
+/**
+ * @brief Handle command referring to a waiting vehicle by its name
+ * @param *cmd Command
+ * @param *trace Trace, can be NULL
+ * @param quiet Do not print notes on ignored commands
+ * @note Commands referring to vehicles that are not waiting (e.g. already exited) are ignored
+ */
+static void JsonHandleVehicleCommand(const struct JsonCommand *cmd, struct SimTrace *trace, bool quiet)
+{
+    if(NULL != trace)
+        SimTraceRecordCommand(trace, cmd->type, cmd->startRoad, cmd->endRoad, cmd->name, cmd->length);
+
+    struct Vehicle *v = SimFindVehicle(cmd->name);
+    if(NULL == v)
+    {
+        if(!quiet)
+            printf("Vehicle %s is not waiting, command ignored\r\n", cmd->name);
+    }
+    else if(COMMAND_REMOVE_VEHICLE == cmd->type)
+    {
+        if(0 == SimRemoveVehicle(v))
+            free(v);
+    }
+    else if(COMMAND_CHANGE_LANE == cmd->type)
+    {
+        struct Road *road = v->lane->road;
+        if(cmd->endRoad < road->laneCount)
+            SimChangeLane(v, &road->lane[cmd->endRoad]);
+        else if(!quiet)
+            printf("Invalid lane %u for vehicle %s\r\n", (unsigned int)cmd->endRoad, cmd->name);
+    }
+    else
+        SimRerouteVehicle(v, cmd->endRoad);
+}
+
+/**
+ * @brief Stop trace recording (if any) and close the trace file
+ * @param *trace Trace, can be NULL
+ * @param *f Trace file
+ */
+static void JsonStopTrace(struct SimTrace *trace, FILE *f)
+{
+    if(NULL == trace)
+        return;
+    if(0 != SimTraceStop(trace))
+        printf("Unable to write trace\r\n");
+    fclose(f);
+}
+
+/**
+ * @brief Announce vehicles placed by the input commands of the upcoming steps (look-ahead policy)
+ * @param *ahead Input read ahead of the simulation
+ * @param *aheadStep Step of the next command in @p ahead, updated
+ * @param *trace Trace, can be NULL
+ * @note The input is read until the end of the look-ahead horizon, so each command is read ahead only once.
+ * Broken commands are reported when the simulation reaches them.
+ */
+static void JsonAnnounceArrivals(struct JsonInput *ahead, uint32_t *aheadStep, struct SimTrace *trace)
+{
+    struct SimStats stats;
+    SimGetStats(&stats);
+    while(*aheadStep < (stats.step + SIM_LOOKAHEAD_HORIZON))
+    {
+        struct JsonCommand cmd;
+        if(1 != JsonReadCommand(ahead, &cmd))
+            return;
+        if(COMMAND_STEP == cmd.type)
+            *aheadStep += cmd.count;
+        else if((COMMAND_ADD_VEHICLE == cmd.type) && (*aheadStep > stats.step)
+            && (0 == SimAnnounceVehicle(cmd.startRoad, cmd.endRoad, *aheadStep)) && (NULL != trace))
+            SimTraceRecordCommand(trace, COMMAND_ANNOUNCE_VEHICLE, cmd.startRoad, cmd.endRoad,
+                (const char*)aheadStep, sizeof(*aheadStep));
+    }
+}
+
 static void JsonVehicleExitedCallback(struct Vehicle *vehicle, void *context)
 {
-    FILE *f = context;
-    fprintf(f, "\r\n\"%s\",", vehicle->name);
+    struct Output *out = context;
+    OutputWrite(out, "\r\n\"", 3);
+    OutputWriteString(out, vehicle->name);
+    OutputWrite(out, "\",", 2);
     free(vehicle);
 }
 
-int JsonRunSimFromExternalData(const char *inPath, const char *outPath)
+int JsonRunSimFromExternalData(const char *inPath, const char *outPath, const struct JsonRunOptions *options)
 {
-    FILE *in = fopen(inPath, "rb");
-    if(NULL == in)
+    static const struct JsonRunOptions defaultOptions = {.checkpointPath = NULL, .checkpointInterval = 0, .resume = false,
+        .tracePath = NULL, .timelinePath = NULL, .profilePath = NULL, .initialized = false, .quiet = false};
+    if(NULL == options)
+        options = &defaultOptions;
+
+    struct JsonCheckpoint checkpoint = {.inOffset = 0, .outOffset = 0, .step = 0, .inPosition = 0, .pendingSteps = 0};
+    if(options->resume && (0 != JsonReadCheckpoint(options->checkpointPath, &checkpoint)))
+        return -1;
+
+    struct JsonInput in, ahead = {.f = NULL};
+    if(0 != JsonOpenInput(&in, inPath))
     {
         printf("Unable to open %s\r\n", inPath);
         return -1;
     }
 
-    FILE *out = fopen(outPath, "w+");
-    if(NULL == in)
+    //the output is written in the background, the simulation only waits for it at checkpoints and at the end
+    int outFd = open(outPath, options->resume ? O_RDWR : (O_RDWR | O_CREAT | O_TRUNC), 0666);
+    struct Output *out = (outFd >= 0) ? OutputOpen(outFd, options->resume ? checkpoint.outOffset : 0, NULL) : NULL;
+    if(NULL == out)
     {
+        if(outFd >= 0)
+            close(outFd);
+        JsonCloseInput(&in);
         printf("Unable to open %s\r\n", outPath);
         return -1;
     }
 
-    fprintf(out, "{\r\n\"stepStatuses\": [ ");
-
-    SimInit();
+    FILE *traceFile = NULL, *timelineFile = NULL, *profileFile = NULL;
+    struct SimTrace *trace = NULL;
+    struct SimTimeline *timeline = NULL;
+    struct SimProfile *profile = NULL;
+    int ret = -1;
+    if(options->resume)
+    {
+        //continue right after the last checkpointed step, any output produced later is overwritten
+        if(0 != JsonSeekInput(&in, checkpoint.inOffset, checkpoint.inPosition))
+        {
+            printf("Checkpoint %s does not match %s\r\n", options->checkpointPath, inPath);
+            goto cleanup;
+        }
+        printf("Resuming from step %lu\r\n", (unsigned long)checkpoint.step);
+    }
+    else
+    {
+        if(!options->initialized && (0 != SimInit()))
+            goto cleanup;
+        if(in.v2)
+            checkpoint.inOffset = sizeof(struct InFileHeader);
+        OutputWriteString(out, "{\r\n\"stepStatuses\": [ ");
+    }
 
     SimRegisterVehicleExitedCallback(JsonVehicleExitedCallback, out);
 
-    printf("Using %s as input and %s as output\r\n", inPath, outPath);
-    
-    struct InCommand cmd;
-    size_t size = 0;
+    //the trace starts from the current state, so it can also be recorded after resuming
+    if(NULL != options->tracePath)
+    {
+        traceFile = fopen(options->tracePath, "wb");
+        if((NULL == traceFile) || (NULL == (trace = SimTraceStartRecording(traceFile))))
+        {
+            printf("Unable to record trace to %s\r\n", options->tracePath);
+            goto cleanup;
+        }
+    }
+    if(NULL != options->timelinePath)
+    {
+        timelineFile = fopen(options->timelinePath, "wb");
+        if((NULL == timelineFile) || (NULL == (timeline = SimTimelineStart(timelineFile))))
+        {
+            printf("Unable to record timeline to %s\r\n", options->timelinePath);
+            goto cleanup;
+        }
+    }
+    if(NULL != options->profilePath)
+    {
+        profileFile = fopen(options->profilePath, "wb");
+        if((NULL == profileFile) || (NULL == (profile = SimProfileStart(profileFile))))
+        {
+            printf("Unable to record profile to %s\r\n", options->profilePath);
+            goto cleanup;
+        }
+    }
 
+    //the look-ahead policy gets the arrivals from the commands ahead of the simulation
+    uint32_t aheadStep = checkpoint.step + checkpoint.pendingSteps;
+    if(SIM_LOOKAHEAD == SimGetConfig()->selectionPolicy)
+    {
+        if((0 != JsonOpenInput(&ahead, inPath)) || (0 != JsonSeekInput(&ahead, checkpoint.inOffset, checkpoint.inPosition)))
+        {
+            printf("Unable to read ahead %s\r\n", inPath);
+            goto cleanup;
+        }
+    }
+
+    if(!options->quiet)
+        printf("Using %s as input and %s as output\r\n", inPath, outPath);
+
+    //steps of the last step command not done yet
+    uint32_t steps = checkpoint.pendingSteps;
     while(1)
     {
-        size = fread(&cmd, 1, sizeof(cmd), in);
-        if(0 == size)
-            break;
-        if(sizeof(cmd) != size)
+        struct JsonCommand cmd = {.type = COMMAND_STEP};
+        if(0 == steps)
         {
-            fclose(in);
-            fclose(out);
-            printf("Input file is broken (incomplete command structure)\r\n");
-            return -1;
+            int status = JsonReadCommand(&in, &cmd);
+            if(0 == status)
+                break;
+            if(status < 0)
+            {
+                printf("Input file is broken (incomplete command structure)\r\n");
+                goto cleanup;
+            }
+            if(COMMAND_STEP == cmd.type)
+            {
+                steps = cmd.count;
+                continue;
+            }
         }
 
         switch(cmd.type)
@@ -71,44 +639,100 @@ int JsonRunSimFromExternalData(const char *inPath, const char *outPath)
                 struct Vehicle *v = malloc(sizeof(*v) + cmd.length + 1);
                 if(NULL == v)
                 {
-                    fclose(in);
-                    fclose(out);
                     printf("Memory allocation failed\r\n");
-                    return -1;
+                    goto cleanup;
                 }
 
                 v->direction = cmd.endRoad;
-
-                if(cmd.length != fread(v->name, 1, cmd.length, in))
-                {
-                    fclose(in);
-                    fclose(out);
-                    printf("Input file is broken (incomplete command structure)\r\n");
-                    return -1;
-                }
-                v->name[cmd.length] = '\0';
+                memcpy(v->name, cmd.name, cmd.length + 1);
+                if(NULL != trace)
+                    SimTraceRecordCommand(trace, cmd.type, cmd.startRoad, cmd.endRoad, v->name, cmd.length);
 
                 SimPlaceVehicle(v, SimSelectLane(cmd.startRoad, cmd.endRoad));
                 break;
             case COMMAND_STEP:
-                fprintf(out, "\r\n{\r\n\"leftVehicles\": [ ");
+                if(NULL != ahead.f)
+                    JsonAnnounceArrivals(&ahead, &aheadStep, trace);
+                OutputWriteString(out, "\r\n{\r\n\"leftVehicles\": [ ");
+                if(NULL != trace)
+                    SimTraceRecordCommand(trace, COMMAND_STEP, 0, 0, NULL, 0);
+                //the commands preceding the step are handled since the end of the previous step (and its output)
+                if(NULL != profile)
+                    SimProfileSpan(profile, SIM_PROFILE_COMMANDS);
                 SimDoStep();
-                fseek(out, ftell(out) - 1, SEEK_SET); //remove comma after the last element
-                fprintf(out, "]\r\n},");
+                OutputRewind(out, 1); //remove comma after the last element
+                if(0 != OutputWriteString(out, "]\r\n},"))
+                {
+                    printf("Unable to write %s\r\n", outPath);
+                    goto cleanup;
+                }
+                if(NULL != profile)
+                    SimProfileSpan(profile, SIM_PROFILE_OUTPUT);
+                ++checkpoint.step;
+                --steps;
+                if((NULL != options->checkpointPath) && (0 != options->checkpointInterval)
+                    && (0 == (checkpoint.step % options->checkpointInterval)))
+                {
+                    uint64_t inOffset;
+                    uint32_t inPosition;
+                    JsonTellInput(&in, &inOffset, &inPosition);
+                    checkpoint.inOffset = inOffset;
+                    checkpoint.inPosition = inPosition;
+                    checkpoint.pendingSteps = steps;
+                    checkpoint.outOffset = OutputTell(out);
+                    if(0 != OutputFlush(out))
+                    {
+                        printf("Unable to write %s\r\n", outPath);
+                        goto cleanup;
+                    }
+                    JsonWriteCheckpoint(options->checkpointPath, &checkpoint);
+                    if(NULL != profile)
+                        SimProfileSpan(profile, SIM_PROFILE_CHECKPOINT);
+                }
+                break;
+            case COMMAND_REMOVE_VEHICLE:
+            case COMMAND_CHANGE_LANE:
+            case COMMAND_REROUTE_VEHICLE:
+                JsonHandleVehicleCommand(&cmd, trace, options->quiet);
                 break;
             default:
-                fclose(in);
-                fclose(out);
                 printf("Unknown encoded command: %u\r\n", (unsigned int)cmd.type);
-                return -1;
+                goto cleanup;
         }
+    }
 
-    } 
+    OutputRewind(out, 1); //remove comma after the last element
+    OutputWriteString(out, "]\r\n}\r\n");
+    if(0 != OutputFlush(out))
+    {
+        printf("Unable to write %s\r\n", outPath);
+        goto cleanup;
+    }
+    //drop any output left by the run the checkpoint was taken from
+    if(0 != ftruncate(outFd, OutputTell(out)))
+        printf("Unable to truncate %s\r\n", outPath);
+    if(NULL != profile)
+        SimProfileSpan(profile, SIM_PROFILE_FINISH);
+    if(!options->quiet)
+        printf("Simulation finished\r\n");
+    ret = 0;
 
-    fseek(out, ftell(out) - 1, SEEK_SET); //remove comma after the last element
-    fprintf(out, "]\r\n}\r\n");
-    printf("Simulation finished\r\n");
-    fclose(out);
-    fclose(in);
-    return 0;
+cleanup:
+    if(NULL != trace)
+        JsonStopTrace(trace, traceFile);
+    else if(NULL != traceFile)
+        fclose(traceFile);
+    if((NULL != timeline) && (0 != SimTimelineStop(timeline)))
+        printf("Unable to write timeline\r\n");
+    if(NULL != timelineFile)
+        fclose(timelineFile);
+    if((NULL != profile) && (0 != SimProfileStop(profile)))
+        printf("Unable to write profile\r\n");
+    if(NULL != profileFile)
+        fclose(profileFile);
+    JsonCloseInput(&ahead);
+    JsonCloseInput(&in);
+    OutputClose(out);
+    close(outFd);
+    return ret;
 }
@@ -1,12 +1,31 @@
 #ifndef JSON_H
 #define JSON_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Simulation run options
+ */
+struct JsonRunOptions
+{
+    const char *checkpointPath; /**< Checkpoint file path, NULL to disable checkpoints */
+    uint32_t checkpointInterval; /**< Steps between consecutive checkpoints, 0 to disable periodic checkpoints */
+    bool resume; /**< Restart from the checkpoint instead of step 0 */
+    const char *tracePath; /**< Trace file path (see trace.h), NULL to disable tracing */
+    const char *timelinePath; /**< Timeline file path (see timeline.h), NULL to disable the timeline */
+    const char *profilePath; /**< Profile file path (trace-event JSON, see profile.h), NULL to disable profiling */
+    bool initialized; /**< The selected instance is initialized already (e.g. loaded with SimLoadJunction()), SimInit() is not called */
+    bool quiet; /**< Print errors only, no progress and no notes on ignored commands */
+};
+
 /**
  * @brief Run simulation using external commands and print output to JSON
  * @param *inPath Input data file (binary) path
  * @param *outPath Output JSON file
+ * @param *options Run options, NULL for defaults
  * @return 0 on success, <0 on failure
  */
-int JsonRunSimFromExternalData(const char *inPath, const char *outPath);
+int JsonRunSimFromExternalData(const char *inPath, const char *outPath, const struct JsonRunOptions *options);
 
-#endif
\ No newline at end of file
+#endif
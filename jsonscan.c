@@ -0,0 +1,1282 @@
+#include "jsonscan.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "command.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_SCAN_X86
+#endif
+
+#define JSON_SCAN_DEFAULT_CHUNK (8 << 20) /**< Default chunk size */
+#define JSON_SCAN_BLOCK_TARGET 65536 /**< Decoded size of the written blocks, unless a single command is longer */
+#define JSON_SCAN_MAX_NAME (IN_MAX_BLOCK_SIZE - 16) /**< Maximum vehicle name length, so that any command fits a block */
+#define JSON_SCAN_MAX_VARINT 10 /**< Maximum length of an encoded 64-bit varint */
+#define JSON_SCAN_HASH_BITS 14 /**< Size of the LZ match table */
+#define JSON_SCAN_COMMANDS_DEPTH 2 /**< Nesting depth of the commands array elements */
+
+/**
+ * @brief Positions of the interesting characters in a 64-byte block, one bit per byte
+ */
+struct JsonScanMasks
+{
+    uint64_t quote; /**< Quotation marks */
+    uint64_t backslash; /**< Backslashes */
+    uint64_t open; /**< Opening braces and brackets */
+    uint64_t close; /**< Closing braces and brackets */
+    uint64_t colon; /**< Colons */
+    uint64_t comma; /**< Commas */
+};
+
+typedef void (*JsonScanKernel)(const uint8_t *data, struct JsonScanMasks *masks);
+
+/**
+ * @brief String state carried from one block to the next
+ */
+struct JsonScanCarry
+{
+    bool escaped; /**< First byte of the next block is escaped */
+    bool inString; /**< Next block starts inside a string */
+};
+
+/**
+ * @brief Parser state
+ */
+enum JsonScanState
+{
+    JSON_SCAN_OUTSIDE = 0, /**< Not in a command object */
+    JSON_SCAN_KEY, /**< Expecting a key or the end of the object */
+    JSON_SCAN_KEY_END, /**< In a key */
+    JSON_SCAN_COLON, /**< Expecting a colon */
+    JSON_SCAN_VALUE, /**< Expecting a value */
+    JSON_SCAN_STRING_END, /**< In a string value */
+    JSON_SCAN_NEXT, /**< Expecting a comma or the end of the object */
+};
+
+/**
+ * @brief Command object fields, referring to the input
+ */
+struct JsonScanObject
+{
+    size_t start; /**< Offset of the opening brace */
+    unsigned int fields; /**< Number of fields */
+    int type; /**< Command type, 0 if missing */
+    int startRoad; /**< Start road, <0 if missing */
+    int endRoad; /**< End road, <0 if missing */
+    int lane; /**< Lane index, <0 if missing */
+    const uint8_t *name; /**< Raw vehicle name (with escape sequences), NULL if missing */
+    size_t nameLength; /**< Raw vehicle name length */
+};
+
+struct JsonScanContext;
+
+/**
+ * @brief Chunk of the input parsed by one thread
+ */
+struct JsonScanChunk
+{
+    const struct JsonScanContext *context; /**< Conversion context */
+    size_t index; /**< Chunk index in the window */
+    size_t start; /**< Offset of the first byte */
+    size_t end; /**< Offset after the last byte */
+
+    bool flipsString; /**< Chunk contains an odd number of unescaped quotes */
+    int64_t depthOutside; /**< Nesting depth change if the chunk starts outside a string */
+    int64_t depthInside; /**< Nesting depth change if the chunk starts inside a string */
+
+    bool inString; /**< Chunk starts inside a string */
+    int64_t depth; /**< Nesting depth at the chunk start */
+
+    uint8_t *output; /**< Encoded commands (format v2) */
+    size_t outputSize; /**< Number of bytes in the output */
+    size_t outputCapacity; /**< Output capacity */
+    uint8_t *name; /**< Decoded vehicle name */
+    size_t nameCapacity; /**< Name buffer capacity */
+    uint32_t *table; /**< LZ match table, used by the thread when compressing blocks */
+    bool hasCommands; /**< At least one command other than step was encoded */
+    uint64_t leadingSteps; /**< Steps before the first encoded command */
+    uint64_t trailingSteps; /**< Steps after the last encoded command */
+
+    const char *error; /**< Error description, NULL if none */
+    size_t errorOffset; /**< Input offset of the error */
+};
+
+/**
+ * @brief Conversion context
+ */
+struct JsonScanContext
+{
+    const uint8_t *data; /**< Input */
+    size_t size; /**< Input size */
+    size_t root; /**< Offset of the root object */
+    JsonScanKernel classify; /**< Classification kernel */
+    struct JsonScanWriter *writer; /**< Output writer */
+};
+
+/**
+ * @brief Output block
+ */
+struct JsonScanBlock
+{
+    uint8_t *data; /**< Decoded block */
+    size_t size; /**< Decoded size */
+    size_t capacity; /**< Capacity of both buffers */
+    uint8_t *compressed; /**< Compressed block */
+    size_t stored; /**< Compressed size, at least the decoded size if compression does not help */
+};
+
+/**
+ * @brief Output writer, building the blocks of the input file
+ */
+struct JsonScanWriter
+{
+    FILE *f; /**< Output file */
+    struct JsonScanBlock *blocks; /**< Blocks of the current window, the last one is being built */
+    size_t count; /**< Number of blocks */
+    size_t capacity; /**< Block capacity */
+    size_t stride; /**< Number of threads compressing the blocks */
+    uint64_t pendingSteps; /**< Steps not written yet */
+};
+
+static void JsonScanClassifyScalar(const uint8_t *data, struct JsonScanMasks *masks)
+{
+    *masks = (struct JsonScanMasks){0};
+    for(unsigned int i = 0; i < 64; i++)
+    {
+        uint64_t bit = 1ULL << i;
+        switch(data[i])
+        {
+            case '"':
+                masks->quote |= bit;
+                break;
+            case '\\':
+                masks->backslash |= bit;
+                break;
+            case '{':
+            case '[':
+                masks->open |= bit;
+                break;
+            case '}':
+            case ']':
+                masks->close |= bit;
+                break;
+            case ':':
+                masks->colon |= bit;
+                break;
+            case ',':
+                masks->comma |= bit;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+#ifdef JSON_SCAN_X86
+__attribute__((target("sse2")))
+static void JsonScanClassifySse2(const uint8_t *data, struct JsonScanMasks *masks)
+{
+    //'[' and ']' differ from '{' and '}' only by the 0x20 bit
+    const __m128i fold = _mm_set1_epi8(0x20), quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'),
+        open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}'), colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+    *masks = (struct JsonScanMasks){0};
+    for(unsigned int i = 0; i < 64; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i folded = _mm_or_si128(v, fold);
+        masks->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i;
+        masks->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << i;
+        masks->open |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, open)) << i;
+        masks->close |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(folded, close)) << i;
+        masks->colon |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, colon)) << i;
+        masks->comma |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void JsonScanClassifyAvx2(const uint8_t *data, struct JsonScanMasks *masks)
+{
+    const __m256i fold = _mm256_set1_epi8(0x20), quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\'),
+        open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}'), colon = _mm256_set1_epi8(':'),
+        comma = _mm256_set1_epi8(',');
+    *masks = (struct JsonScanMasks){0};
+    for(unsigned int i = 0; i < 64; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i folded = _mm256_or_si256(v, fold);
+        masks->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << i;
+        masks->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << i;
+        masks->open |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(folded, open)) << i;
+        masks->close |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(folded, close)) << i;
+        masks->colon |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colon)) << i;
+        masks->comma |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma)) << i;
+    }
+}
+#endif
+
+int JsonScanIsSupported(enum JsonScanLevel level)
+{
+    switch(level)
+    {
+        case JSON_SCAN_AUTO:
+        case JSON_SCAN_SCALAR:
+            return 1;
+#ifdef JSON_SCAN_X86
+        case JSON_SCAN_SSE2:
+            return __builtin_cpu_supports("sse2") ? 1 : 0;
+        case JSON_SCAN_AVX2:
+            return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Get classification kernel
+ * @param level Kernel, JSON_SCAN_AUTO for the best one supported
+ * @return Kernel, NULL if not supported
+ */
+static JsonScanKernel JsonScanGetKernel(enum JsonScanLevel level)
+{
+    if(!JsonScanIsSupported(level))
+        return NULL;
+#ifdef JSON_SCAN_X86
+    if((JSON_SCAN_AVX2 == level) || ((JSON_SCAN_AUTO == level) && JsonScanIsSupported(JSON_SCAN_AVX2)))
+        return JsonScanClassifyAvx2;
+    if((JSON_SCAN_SSE2 == level) || ((JSON_SCAN_AUTO == level) && JsonScanIsSupported(JSON_SCAN_SSE2)))
+        return JsonScanClassifySse2;
+#endif
+    return JsonScanClassifyScalar;
+}
+
+/**
+ * @brief Get 64-byte block of the input
+ * @param *context Conversion context
+ * @param offset Block offset
+ * @param *pad Buffer for the last block, which is padded with spaces
+ * @return Block data
+ */
+static const uint8_t* JsonScanGetBlock(const struct JsonScanContext *context, size_t offset, uint8_t *pad)
+{
+    if((offset + 64) <= context->size)
+        return context->data + offset;
+    memset(pad, ' ', 64);
+    memcpy(pad, context->data + offset, context->size - offset);
+    return pad;
+}
+
+/**
+ * @brief Find string bounds in a block
+ * @param *masks Block masks
+ * @param *carry String state, updated
+ * @param *quotes Output unescaped quotes
+ * @return Bytes inside strings, including the opening quotes and excluding the closing quotes
+ */
+static uint64_t JsonScanFindStrings(const struct JsonScanMasks *masks, struct JsonScanCarry *carry, uint64_t *quotes)
+{
+    uint64_t escaped = 0;
+    if((0 != masks->backslash) || carry->escaped)
+    {
+        //rare, so the backslash runs are resolved bit by bit
+        bool escape = carry->escaped;
+        for(unsigned int i = 0; i < 64; i++)
+        {
+            if(escape)
+            {
+                escaped |= 1ULL << i;
+                escape = false;
+            }
+            else if(masks->backslash & (1ULL << i))
+                escape = true;
+        }
+        carry->escaped = escape;
+    }
+    *quotes = masks->quote & ~escaped;
+
+    //prefix XOR: each quote toggles the string state of all following bytes
+    uint64_t inside = *quotes;
+    for(unsigned int shift = 1; shift < 64; shift <<= 1)
+        inside ^= inside << shift;
+    if(carry->inString)
+        inside = ~inside;
+    carry->inString = 0 != (inside >> 63);
+    return inside;
+}
+
+/**
+ * @brief Get escape state at the start of a chunk
+ * @param *context Conversion context
+ * @param offset Chunk offset
+ * @return True if the first byte is escaped
+ */
+static bool JsonScanIsEscaped(const struct JsonScanContext *context, size_t offset)
+{
+    size_t count = 0;
+    while((count < offset) && ('\\' == context->data[offset - 1 - count]))
+        ++count;
+    return 0 != (count & 1);
+}
+
+/**
+ * @brief First pass: get string state and nesting depth change of a chunk, for both possible starting states
+ * @param *arg Chunk
+ * @return NULL
+ */
+static void* JsonScanMeasureChunk(void *arg)
+{
+    struct JsonScanChunk *chunk = arg;
+    const struct JsonScanContext *context = chunk->context;
+    struct JsonScanCarry carry = {.escaped = JsonScanIsEscaped(context, chunk->start), .inString = false};
+    uint8_t pad[64];
+    chunk->depthOutside = 0;
+    chunk->depthInside = 0;
+    for(size_t offset = chunk->start; offset < chunk->end; offset += 64)
+    {
+        struct JsonScanMasks masks;
+        uint64_t quotes;
+        context->classify(JsonScanGetBlock(context, offset, pad), &masks);
+        uint64_t inside = JsonScanFindStrings(&masks, &carry, &quotes);
+        //starting inside a string inverts the string state of every byte
+        chunk->depthOutside += __builtin_popcountll(masks.open & ~inside) - __builtin_popcountll(masks.close & ~inside);
+        chunk->depthInside += __builtin_popcountll(masks.open & inside) - __builtin_popcountll(masks.close & inside);
+    }
+    chunk->flipsString = carry.inString;
+    return NULL;
+}
+
+/**
+ * @brief Append data to the chunk output
+ * @param *chunk Chunk
+ * @param *data Data
+ * @param size Number of bytes
+ * @return 0 on success, <0 on failure
+ */
+static int JsonScanAppend(struct JsonScanChunk *chunk, const void *data, size_t size)
+{
+    if((chunk->outputSize + size) > chunk->outputCapacity)
+    {
+        size_t capacity = (0 == chunk->outputCapacity) ? 65536 : chunk->outputCapacity;
+        while(capacity < (chunk->outputSize + size))
+            capacity *= 2;
+        uint8_t *output = realloc(chunk->output, capacity);
+        if(NULL == output)
+            return -1;
+        chunk->output = output;
+        chunk->outputCapacity = capacity;
+    }
+    memcpy(chunk->output + chunk->outputSize, data, size);
+    chunk->outputSize += size;
+    return 0;
+}
+
+/**
+ * @brief Encode varint (7 bits per byte, least significant group first)
+ * @param *out Output buffer, at least JSON_SCAN_MAX_VARINT bytes
+ * @param value Value
+ * @return Number of bytes
+ */
+static size_t JsonScanEncodeVarint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while(value >= 0x80)
+    {
+        out[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/**
+ * @brief Get hexadecimal digit value
+ * @param c Character
+ * @return Value, <0 if not a hexadecimal digit
+ */
+static int JsonScanHexValue(uint8_t c)
+{
+    if((c >= '0') && (c <= '9'))
+        return c - '0';
+    if((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Decode \\uXXXX escape sequence
+ * @param *s Hexadecimal digits
+ * @return Code unit, <0 if invalid
+ */
+static int32_t JsonScanDecodeHex4(const uint8_t *s)
+{
+    int32_t value = 0;
+    for(unsigned int i = 0; i < 4; i++)
+    {
+        int digit = JsonScanHexValue(s[i]);
+        if(digit < 0)
+            return -1;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+/**
+ * @brief Append code point to a string in UTF-8
+ * @param *out Output string
+ * @param code Code point
+ * @return Number of bytes
+ */
+static size_t JsonScanPutUtf8(uint8_t *out, uint32_t code)
+{
+    if(code < 0x80)
+    {
+        out[0] = code;
+        return 1;
+    }
+    if(code < 0x800)
+    {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        return 2;
+    }
+    if(code < 0x10000)
+    {
+        out[0] = 0xE0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3F);
+    out[2] = 0x80 | ((code >> 6) & 0x3F);
+    out[3] = 0x80 | (code & 0x3F);
+    return 4;
+}
+
+/**
+ * @brief Decode string escape sequences to the chunk name buffer
+ * @param *chunk Chunk
+ * @param *s Raw string
+ * @param length Raw string length
+ * @param *decoded Output decoded length
+ * @return 0 on success, <0 on failure (chunk error is set)
+ */
+static int JsonScanDecodeString(struct JsonScanChunk *chunk, const uint8_t *s, size_t length, size_t *decoded)
+{
+    static const char simple[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+    //the decoded string is never longer than the raw one
+    if(length > chunk->nameCapacity)
+    {
+        uint8_t *name = realloc(chunk->name, length);
+        if(NULL == name)
+        {
+            chunk->error = "memory allocation failed";
+            return -1;
+        }
+        chunk->name = name;
+        chunk->nameCapacity = length;
+    }
+    size_t n = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        if('\\' != s[i])
+        {
+            chunk->name[n++] = s[i];
+            continue;
+        }
+        //the closing quote is never escaped, so the sequence has at least one more character
+        const char *e = simple;
+        ++i;
+        while(('\0' != *e) && ((uint8_t)*e != s[i]))
+            e += 2;
+        if('\0' != *e)
+        {
+            chunk->name[n++] = e[1];
+            continue;
+        }
+        int32_t code = (('u' == s[i]) && ((length - i) >= 5)) ? JsonScanDecodeHex4(s + i + 1) : -1;
+        i += 4;
+        if((code >= 0xD800) && (code < 0xDC00))
+        {
+            //surrogate pair
+            int32_t low = (((length - i) >= 7) && ('\\' == s[i + 1]) && ('u' == s[i + 2])) ? JsonScanDecodeHex4(s + i + 3) : -1;
+            code = ((low >= 0xDC00) && (low < 0xE000)) ? (0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00)) : -1;
+            i += 6;
+        }
+        if((code < 0) || ((code >= 0xDC00) && (code < 0xE000)))
+        {
+            chunk->error = "invalid escape sequence";
+            return -1;
+        }
+        n += JsonScanPutUtf8(chunk->name + n, code);
+    }
+    *decoded = n;
+    return 0;
+}
+
+/**
+ * @brief Command object parser
+ */
+struct JsonScanParser
+{
+    enum JsonScanState state; /**< Parser state */
+    int64_t depth; /**< Nesting depth */
+    struct JsonScanObject object; /**< Current command object */
+    size_t keyStart; /**< Offset of the current key */
+    size_t keyEnd; /**< Offset after the current key */
+    size_t valueStart; /**< Offset of the current value */
+};
+
+/**
+ * @brief Report chunk error
+ * @param *chunk Chunk
+ * @param offset Input offset
+ * @param *error Error description
+ * @return Always -1
+ */
+static int JsonScanFail(struct JsonScanChunk *chunk, size_t offset, const char *error)
+{
+    chunk->error = error;
+    chunk->errorOffset = offset;
+    return -1;
+}
+
+/**
+ * @brief Compare string with a literal
+ * @param *s String
+ * @param length String length
+ * @param *literal Null-terminated literal
+ * @return True if equal
+ */
+static bool JsonScanEquals(const uint8_t *s, size_t length, const char *literal)
+{
+    return (strlen(literal) == length) && (0 == memcmp(s, literal, length));
+}
+
+/**
+ * @brief Decode direction
+ * @param *s Direction name
+ * @param length Name length
+ * @return Direction, <0 if unknown
+ */
+static int JsonScanParseDirection(const uint8_t *s, size_t length)
+{
+    static const char *const names[] = {[NORTH] = "north", [SOUTH] = "south", [WEST] = "west", [EAST] = "east"};
+    for(int i = 0; i <= DIRECTION_LIMIT; i++)
+    {
+        if(JsonScanEquals(s, length, names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Decode command type
+ * @param *s Command type name
+ * @param length Name length
+ * @return Command type, 0 if unknown
+ */
+static int JsonScanParseType(const uint8_t *s, size_t length)
+{
+    static const char *const names[] = {[COMMAND_ADD_VEHICLE] = "addVehicle", [COMMAND_STEP] = "step",
+        [COMMAND_REMOVE_VEHICLE] = "removeVehicle", [COMMAND_CHANGE_LANE] = "changeLane",
+        [COMMAND_REROUTE_VEHICLE] = "rerouteVehicle"};
+    for(int i = COMMAND_ADD_VEHICLE; i <= COMMAND_REROUTE_VEHICLE; i++)
+    {
+        if(JsonScanEquals(s, length, names[i]))
+            return i;
+    }
+    return 0;
+}
+
+/**
+ * @brief Store value of the current field
+ * @param *chunk Chunk
+ * @param *parser Parser
+ * @param valueEnd Offset after the value
+ * @param string Value is a string
+ * @return 0 on success, <0 on failure
+ * @note Unknown fields are ignored
+ */
+static int JsonScanSetField(struct JsonScanChunk *chunk, struct JsonScanParser *parser, size_t valueEnd, bool string)
+{
+    const uint8_t *data = chunk->context->data;
+    const uint8_t *key = data + parser->keyStart, *value = data + parser->valueStart;
+    size_t keyLength = parser->keyEnd - parser->keyStart, length = valueEnd - parser->valueStart;
+    struct JsonScanObject *object = &parser->object;
+    ++object->fields;
+    if(JsonScanEquals(key, keyLength, "type"))
+    {
+        if(!string || (0 == (object->type = JsonScanParseType(value, length))))
+            return JsonScanFail(chunk, parser->valueStart, "unknown command type");
+    }
+    else if(JsonScanEquals(key, keyLength, "vehicleId"))
+    {
+        if(!string)
+            return JsonScanFail(chunk, parser->valueStart, "vehicle name is not a string");
+        object->name = value;
+        object->nameLength = length;
+    }
+    else if(JsonScanEquals(key, keyLength, "startRoad") || JsonScanEquals(key, keyLength, "endRoad"))
+    {
+        int direction = string ? JsonScanParseDirection(value, length) : -1;
+        if(direction < 0)
+            return JsonScanFail(chunk, parser->valueStart, "unknown direction");
+        if('s' == key[0])
+            object->startRoad = direction;
+        else
+            object->endRoad = direction;
+    }
+    else if(JsonScanEquals(key, keyLength, "lane"))
+    {
+        //number, possibly surrounded by whitespace
+        while((0 != length) && (NULL != memchr(" \t\r\n", value[0], 4)))
+        {
+            ++value;
+            --length;
+        }
+        while((0 != length) && (NULL != memchr(" \t\r\n", value[length - 1], 4)))
+            --length;
+        int lane = (!string && (0 != length)) ? 0 : -1;
+        for(size_t i = 0; (i < length) && (lane >= 0); i++)
+            lane = ((value[i] >= '0') && (value[i] <= '9') && (lane <= UINT8_MAX)) ? (10 * lane + value[i] - '0') : -1;
+        if((lane < 0) || (lane > UINT8_MAX))
+            return JsonScanFail(chunk, parser->valueStart, "invalid lane index");
+        object->lane = lane;
+    }
+    return 0;
+}
+
+/**
+ * @brief Encode step command
+ * @param *out Output buffer, at least 1 + JSON_SCAN_MAX_VARINT bytes
+ * @param *steps Number of steps, decreased by the number of encoded steps
+ * @return Number of bytes
+ */
+static size_t JsonScanEncodeSteps(uint8_t *out, uint64_t *steps)
+{
+    uint64_t count = (*steps > UINT32_MAX) ? UINT32_MAX : *steps;
+    *steps -= count;
+    out[0] = COMMAND_STEP;
+    return 1 + JsonScanEncodeVarint(out + 1, count);
+}
+
+/**
+ * @brief Encode completed command object to the chunk output
+ * @param *chunk Chunk
+ * @param *object Command object
+ * @return 0 on success, <0 on failure
+ */
+static int JsonScanEmit(struct JsonScanChunk *chunk, const struct JsonScanObject *object)
+{
+    if(COMMAND_STEP == object->type)
+    {
+        //consecutive steps are merged, runs at the chunk ends are merged with the neighbouring chunks
+        if(chunk->hasCommands)
+            ++chunk->trailingSteps;
+        else
+            ++chunk->leadingSteps;
+        return 0;
+    }
+
+    bool valid = (0 != object->type) && (NULL != object->name);
+    if(COMMAND_ADD_VEHICLE == object->type)
+        valid = valid && (object->startRoad >= 0) && (object->endRoad >= 0);
+    else if(COMMAND_CHANGE_LANE == object->type)
+        valid = valid && (object->lane >= 0);
+    else if(COMMAND_REROUTE_VEHICLE == object->type)
+        valid = valid && (object->endRoad >= 0);
+    if(!valid)
+        return JsonScanFail(chunk, object->start, "command field missing");
+
+    const uint8_t *name = object->name;
+    size_t length = object->nameLength;
+    if(NULL != memchr(name, '\\', length))
+    {
+        if(0 != JsonScanDecodeString(chunk, name, length, &length))
+            return JsonScanFail(chunk, object->start, chunk->error);
+        name = chunk->name;
+    }
+    if(length > JSON_SCAN_MAX_NAME)
+        return JsonScanFail(chunk, object->start, "vehicle name too long");
+
+    uint8_t header[3 + JSON_SCAN_MAX_VARINT];
+    size_t n = 0;
+    while(chunk->hasCommands && (0 != chunk->trailingSteps))
+    {
+        n = JsonScanEncodeSteps(header, &chunk->trailingSteps);
+        if(0 != JsonScanAppend(chunk, header, n))
+            return JsonScanFail(chunk, object->start, "memory allocation failed");
+    }
+    n = 0;
+    header[n++] = object->type;
+    if(COMMAND_ADD_VEHICLE == object->type)
+    {
+        header[n++] = object->startRoad;
+        header[n++] = object->endRoad;
+    }
+    else if(COMMAND_CHANGE_LANE == object->type)
+        header[n++] = object->lane;
+    else if(COMMAND_REROUTE_VEHICLE == object->type)
+        header[n++] = object->endRoad;
+    n += JsonScanEncodeVarint(header + n, length);
+    if((0 != JsonScanAppend(chunk, header, n)) || (0 != JsonScanAppend(chunk, name, length)))
+        return JsonScanFail(chunk, object->start, "memory allocation failed");
+    chunk->hasCommands = true;
+    return 0;
+}
+
+/**
+ * @brief Handle structural character or quote
+ * @param *chunk Chunk
+ * @param *parser Parser
+ * @param position Character offset
+ * @return 0 on success, <0 on failure
+ */
+static int JsonScanHandle(struct JsonScanChunk *chunk, struct JsonScanParser *parser, size_t position)
+{
+    uint8_t c = chunk->context->data[position];
+    switch(parser->state)
+    {
+        case JSON_SCAN_OUTSIDE:
+            if(('{' == c) || ('[' == c))
+            {
+                if((0 == parser->depth) && (position != chunk->context->root))
+                    return JsonScanFail(chunk, position, "data after the root object");
+                if(JSON_SCAN_COMMANDS_DEPTH == parser->depth)
+                {
+                    if('[' == c)
+                        return JsonScanFail(chunk, position, "command is not an object");
+                    parser->object = (struct JsonScanObject){.start = position, .startRoad = -1, .endRoad = -1,
+                        .lane = -1};
+                    parser->state = JSON_SCAN_KEY;
+                }
+                ++parser->depth;
+            }
+            else if(('}' == c) || (']' == c))
+            {
+                if(0 == parser->depth--)
+                    return JsonScanFail(chunk, position, "unbalanced brackets");
+            }
+            else if(('"' == c) && (JSON_SCAN_COMMANDS_DEPTH == parser->depth))
+                return JsonScanFail(chunk, position, "command is not an object");
+            return 0;
+        case JSON_SCAN_KEY:
+            if('"' == c)
+            {
+                parser->keyStart = position + 1;
+                parser->state = JSON_SCAN_KEY_END;
+                return 0;
+            }
+            if(('}' != c) || (0 != parser->object.fields))
+                return JsonScanFail(chunk, position, "expected a key");
+            break;
+        case JSON_SCAN_KEY_END:
+            parser->keyEnd = position;
+            parser->state = JSON_SCAN_COLON;
+            return 0;
+        case JSON_SCAN_COLON:
+            if(':' != c)
+                return JsonScanFail(chunk, position, "expected a colon");
+            parser->valueStart = position + 1;
+            parser->state = JSON_SCAN_VALUE;
+            return 0;
+        case JSON_SCAN_VALUE:
+            if('"' == c)
+            {
+                parser->valueStart = position + 1;
+                parser->state = JSON_SCAN_STRING_END;
+                return 0;
+            }
+            if((',' != c) && ('}' != c))
+                return JsonScanFail(chunk, position, "unsupported value");
+            if(0 != JsonScanSetField(chunk, parser, position, false))
+                return -1;
+            parser->state = JSON_SCAN_NEXT;
+            return JsonScanHandle(chunk, parser, position);
+        case JSON_SCAN_STRING_END:
+            parser->state = JSON_SCAN_NEXT;
+            return JsonScanSetField(chunk, parser, position, true);
+        case JSON_SCAN_NEXT:
+            if(',' == c)
+            {
+                parser->state = JSON_SCAN_KEY;
+                return 0;
+            }
+            if('}' != c)
+                return JsonScanFail(chunk, position, "expected a comma");
+            break;
+    }
+
+    //end of the command object
+    --parser->depth;
+    parser->state = JSON_SCAN_OUTSIDE;
+    return JsonScanEmit(chunk, &parser->object);
+}
+
+/**
+ * @brief Second pass: encode the command objects starting in a chunk
+ * @param *arg Chunk, with the starting state set
+ * @return NULL
+ * @note The last object is parsed until its end, even if it continues in the following chunks
+ */
+static void* JsonScanParseChunk(void *arg)
+{
+    struct JsonScanChunk *chunk = arg;
+    const struct JsonScanContext *context = chunk->context;
+    struct JsonScanCarry carry = {.escaped = JsonScanIsEscaped(context, chunk->start), .inString = chunk->inString};
+    struct JsonScanParser parser = {.state = JSON_SCAN_OUTSIDE, .depth = chunk->depth};
+    uint8_t pad[64];
+    chunk->outputSize = 0;
+    chunk->hasCommands = false;
+    chunk->leadingSteps = 0;
+    chunk->trailingSteps = 0;
+    chunk->error = NULL;
+    for(size_t offset = chunk->start; offset < context->size; offset += 64)
+    {
+        struct JsonScanMasks masks;
+        uint64_t quotes;
+        context->classify(JsonScanGetBlock(context, offset, pad), &masks);
+        uint64_t inside = JsonScanFindStrings(&masks, &carry, &quotes);
+        uint64_t events = quotes | ((masks.open | masks.close | masks.colon | masks.comma) & ~inside);
+        while(0 != events)
+        {
+            size_t position = offset + __builtin_ctzll(events);
+            events &= events - 1;
+            //objects starting after the chunk belong to the next chunk
+            if((position >= chunk->end) && (JSON_SCAN_OUTSIDE == parser.state))
+                return NULL;
+            if(0 != JsonScanHandle(chunk, &parser, position))
+                return NULL;
+        }
+    }
+    if(JSON_SCAN_OUTSIDE != parser.state)
+        JsonScanFail(chunk, parser.object.start, "incomplete command");
+    return NULL;
+}
+
+/**
+ * @brief Run chunk pass in parallel
+ * @param *chunks Chunks
+ * @param count Number of chunks
+ * @param *threads Thread handles, one per chunk
+ * @param routine Pass
+ */
+static void JsonScanRunPass(struct JsonScanChunk *chunks, size_t count, pthread_t *threads, void* (*routine)(void*))
+{
+    size_t started = 1;
+    for(; started < count; started++)
+    {
+        if(0 != pthread_create(&threads[started], NULL, routine, &chunks[started]))
+            break;
+    }
+    //the first chunk and any chunks without a thread are handled by the calling thread
+    routine(&chunks[0]);
+    for(size_t i = started; i < count; i++)
+        routine(&chunks[i]);
+    for(size_t i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/**
+ * @brief Compress block (greedy LZ, see command.h)
+ * @param *block Block, compressed size is set
+ * @param *table Match table
+ */
+static void JsonScanCompress(struct JsonScanBlock *block, uint32_t *table)
+{
+    const uint8_t *src = block->data;
+    uint8_t *dst = block->compressed;
+    size_t size = block->size, out = 0, literals = 0, i = 0;
+    block->stored = size;
+    //table entries are positions plus one, 0 for none
+    memset(table, 0, sizeof(*table) << JSON_SCAN_HASH_BITS);
+    while((i + IN_MIN_MATCH) <= size)
+    {
+        uint32_t word;
+        memcpy(&word, src + i, sizeof(word));
+        uint32_t hash = (word * 2654435761u) >> (32 - JSON_SCAN_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = i + 1;
+        if((0 == candidate--) || (0 != memcmp(src + candidate, src + i, IN_MIN_MATCH)))
+        {
+            ++i;
+            continue;
+        }
+        size_t length = IN_MIN_MATCH;
+        while(((i + length) < size) && (src[candidate + length] == src[i + length]))
+            ++length;
+        //the compressed block must stay smaller than the decoded one
+        if((out + (i - literals) + 3 * JSON_SCAN_MAX_VARINT) >= size)
+            return;
+        out += JsonScanEncodeVarint(dst + out, i - literals);
+        memcpy(dst + out, src + literals, i - literals);
+        out += i - literals;
+        out += JsonScanEncodeVarint(dst + out, length - IN_MIN_MATCH);
+        out += JsonScanEncodeVarint(dst + out, i - candidate);
+        i += length;
+        literals = i;
+    }
+    if(literals < size)
+    {
+        if((out + (size - literals) + JSON_SCAN_MAX_VARINT) >= size)
+            return;
+        out += JsonScanEncodeVarint(dst + out, size - literals);
+        memcpy(dst + out, src + literals, size - literals);
+        out += size - literals;
+    }
+    block->stored = out;
+}
+
+/**
+ * @brief Compress every n-th complete block of the window (n = number of compressing threads)
+ * @param *arg Chunk of the thread
+ * @return NULL
+ */
+static void* JsonScanCompressBlocks(void *arg)
+{
+    struct JsonScanChunk *chunk = arg;
+    struct JsonScanWriter *writer = chunk->context->writer;
+    for(size_t i = chunk->index; (i + 1) < writer->count; i += writer->stride)
+        JsonScanCompress(&writer->blocks[i], chunk->table);
+    return NULL;
+}
+
+/**
+ * @brief Write compressed blocks
+ * @param *writer Writer
+ * @param count Number of blocks
+ * @return 0 on success, <0 on failure
+ * @note The remaining blocks are moved to the start
+ */
+static int JsonScanWriteBlocks(struct JsonScanWriter *writer, size_t count)
+{
+    int ret = 0;
+    for(size_t i = 0; (i < count) && (0 == ret); i++)
+    {
+        const struct JsonScanBlock *block = &writer->blocks[i];
+        const uint8_t *data = block->compressed;
+        size_t stored = block->stored;
+        uint8_t header[1 + 2 * JSON_SCAN_MAX_VARINT] = {IN_BLOCK_LZ};
+        if(stored >= block->size)
+        {
+            header[0] = IN_BLOCK_STORED;
+            stored = block->size;
+            data = block->data;
+        }
+        size_t n = 1 + JsonScanEncodeVarint(header + 1, block->size);
+        n += JsonScanEncodeVarint(header + n, stored);
+        if((n != fwrite(header, 1, n, writer->f)) || (stored != fwrite(data, 1, stored, writer->f)))
+            ret = -1;
+    }
+    //buffers of the written blocks are kept for reuse
+    for(size_t i = count; i < writer->count; i++)
+    {
+        struct JsonScanBlock block = writer->blocks[i - count];
+        writer->blocks[i - count] = writer->blocks[i];
+        writer->blocks[i] = block;
+    }
+    writer->count -= count;
+    return ret;
+}
+
+/**
+ * @brief Append command to the block being built
+ * @param *writer Writer
+ * @param *data Encoded command
+ * @param size Command size, at most IN_MAX_BLOCK_SIZE
+ * @return 0 on success, <0 on failure
+ */
+static int JsonScanWrite(struct JsonScanWriter *writer, const uint8_t *data, size_t size)
+{
+    struct JsonScanBlock *block = (0 == writer->count) ? NULL : &writer->blocks[writer->count - 1];
+    if((NULL == block) || ((0 != block->size) && ((block->size + size) > JSON_SCAN_BLOCK_TARGET)))
+    {
+        if(writer->count == writer->capacity)
+        {
+            size_t capacity = (0 == writer->capacity) ? 64 : (2 * writer->capacity);
+            struct JsonScanBlock *blocks = realloc(writer->blocks, capacity * sizeof(*blocks));
+            if(NULL == blocks)
+                return -1;
+            memset(blocks + writer->capacity, 0, (capacity - writer->capacity) * sizeof(*blocks));
+            writer->blocks = blocks;
+            writer->capacity = capacity;
+        }
+        block = &writer->blocks[writer->count++];
+        block->size = 0;
+    }
+    if((block->size + size) > block->capacity)
+    {
+        //only a single long command makes a block exceed the target size
+        size_t capacity = (size > JSON_SCAN_BLOCK_TARGET) ? size : JSON_SCAN_BLOCK_TARGET;
+        free(block->data);
+        free(block->compressed);
+        block->data = malloc(capacity);
+        block->compressed = malloc(capacity);
+        block->capacity = ((NULL == block->data) || (NULL == block->compressed)) ? 0 : capacity;
+        if(0 == block->capacity)
+            return -1;
+    }
+    memcpy(block->data + block->size, data, size);
+    block->size += size;
+    return 0;
+}
+
+/**
+ * @brief Write pending steps
+ * @param *writer Writer
+ * @return 0 on success, <0 on failure
+ */
+static int JsonScanWriteSteps(struct JsonScanWriter *writer)
+{
+    while(0 != writer->pendingSteps)
+    {
+        uint8_t command[1 + JSON_SCAN_MAX_VARINT];
+        if(0 != JsonScanWrite(writer, command, JsonScanEncodeSteps(command, &writer->pendingSteps)))
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Get size of an encoded command
+ * @param *data Command encoded by JsonScanEmit()
+ * @return Number of bytes
+ */
+static size_t JsonScanGetCommandSize(const uint8_t *data)
+{
+    static const uint8_t fields[] = {[COMMAND_ADD_VEHICLE] = 2, [COMMAND_STEP] = 0, [COMMAND_REMOVE_VEHICLE] = 0,
+        [COMMAND_CHANGE_LANE] = 1, [COMMAND_REROUTE_VEHICLE] = 1};
+    size_t n = 1 + fields[data[0]];
+    uint64_t value = 0;
+    for(unsigned int shift = 0; ; shift += 7)
+    {
+        value |= (uint64_t)(data[n] & 0x7F) << shift;
+        if(0 == (data[n++] & 0x80))
+            break;
+    }
+    //the step count is not followed by a name
+    return (COMMAND_STEP == data[0]) ? n : (n + value);
+}
+
+/**
+ * @brief Append chunk output, merging the step runs at the chunk ends
+ * @param *writer Writer
+ * @param *chunk Parsed chunk
+ * @return 0 on success, <0 on failure
+ * @note Blocks are filled command by command, so the output does not depend on the chunk size
+ */
+static int JsonScanMerge(struct JsonScanWriter *writer, const struct JsonScanChunk *chunk)
+{
+    writer->pendingSteps += chunk->leadingSteps;
+    if(!chunk->hasCommands)
+        return 0;
+    if(0 != JsonScanWriteSteps(writer))
+        return -1;
+    for(size_t offset = 0; offset < chunk->outputSize;)
+    {
+        size_t size = JsonScanGetCommandSize(chunk->output + offset);
+        if(0 != JsonScanWrite(writer, chunk->output + offset, size))
+            return -1;
+        offset += size;
+    }
+    writer->pendingSteps = chunk->trailingSteps;
+    return 0;
+}
+
+/**
+ * @brief Compress blocks in parallel and write them
+ * @param *writer Writer
+ * @param *chunks Chunks, one per thread
+ * @param threads Number of threads
+ * @param *handles Thread handles
+ * @param all Write also the block being built
+ * @return 0 on success, <0 on failure
+ */
+static int JsonScanFlush(struct JsonScanWriter *writer, struct JsonScanChunk *chunks, size_t threads, pthread_t *handles,
+    bool all)
+{
+    if(0 == writer->count)
+        return 0;
+    size_t complete = writer->count - 1;
+    writer->stride = (complete < threads) ? complete : threads;
+    if(0 != complete)
+        JsonScanRunPass(chunks, writer->stride, handles, JsonScanCompressBlocks);
+    if(all)
+        JsonScanCompress(&writer->blocks[complete++], chunks[0].table);
+    return JsonScanWriteBlocks(writer, complete);
+}
+
+/**
+ * @brief Find the commands array of the root object
+ * @param *context Conversion context, root offset is set
+ * @return 0 on success, <0 if the input does not start with {"commands": [
+ */
+static int JsonScanFindCommands(struct JsonScanContext *context)
+{
+    static const char *const tokens[] = {"{", "\"commands\"", ":", "["};
+    size_t position = 0;
+    for(size_t i = 0; i < (sizeof(tokens) / sizeof(*tokens)); i++)
+    {
+        while((position < context->size) && (NULL != memchr(" \t\r\n", context->data[position], 4)))
+            ++position;
+        size_t length = strlen(tokens[i]);
+        if(((context->size - position) < length) || (0 != memcmp(context->data + position, tokens[i], length)))
+            return -1;
+        if(0 == i)
+            context->root = position;
+        position += length;
+    }
+    return 0;
+}
+
+int JsonScanConvert(const char *inPath, const char *outPath, const struct JsonScanOptions *options)
+{
+    static const struct JsonScanOptions defaultOptions = {.threads = 0, .chunkSize = 0, .level = JSON_SCAN_AUTO};
+    if(NULL == options)
+        options = &defaultOptions;
+
+    struct JsonScanContext context = {.classify = JsonScanGetKernel(options->level)};
+    if(NULL == context.classify)
+    {
+        printf("Character classification level %u is not supported by this CPU\r\n", (unsigned int)options->level);
+        return -1;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = (0 != options->threads) ? options->threads : ((online > 0) ? online : 1);
+    size_t chunkSize = (0 != options->chunkSize) ? ((options->chunkSize + 63) & ~(size_t)63) : JSON_SCAN_DEFAULT_CHUNK;
+
+    int fd = open(inPath, O_RDONLY);
+    struct stat st;
+    if((fd < 0) || (0 != fstat(fd, &st)))
+    {
+        if(fd >= 0)
+            close(fd);
+        printf("Unable to open %s\r\n", inPath);
+        return -1;
+    }
+    context.size = st.st_size;
+    void *map = (0 == context.size) ? MAP_FAILED : mmap(NULL, context.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == map)
+    {
+        printf("Unable to map %s\r\n", inPath);
+        return -1;
+    }
+    madvise(map, context.size, MADV_SEQUENTIAL);
+    context.data = map;
+    if(0 != JsonScanFindCommands(&context))
+    {
+        munmap(map, context.size);
+        printf("%s does not start with {\"commands\": [\r\n", inPath);
+        return -1;
+    }
+
+    int ret = -1;
+    struct JsonScanWriter writer = {.f = fopen(outPath, "wb")};
+    context.writer = &writer;
+    struct JsonScanChunk *chunks = calloc(threads, sizeof(*chunks));
+    pthread_t *handles = malloc(threads * sizeof(*handles));
+    bool allocated = (NULL != chunks) && (NULL != handles);
+    for(size_t i = 0; allocated && (i < threads); i++)
+    {
+        chunks[i].context = &context;
+        chunks[i].index = i;
+        allocated = NULL != (chunks[i].table = malloc(sizeof(*chunks[i].table) << JSON_SCAN_HASH_BITS));
+    }
+    struct InFileHeader header = {.magic = IN_FILE_MAGIC};
+    if(NULL == writer.f)
+        printf("Unable to open %s\r\n", outPath);
+    else if(!allocated)
+        printf("Memory allocation failed\r\n");
+    else if(1 != fwrite(&header, sizeof(header), 1, writer.f))
+        printf("Unable to write %s\r\n", outPath);
+    else
+        ret = 0;
+
+    //the windows of one chunk per thread are parsed one after another, the state is carried between them
+    bool inString = false;
+    int64_t depth = 0;
+    for(size_t window = 0; (0 == ret) && (window < context.size); window += threads * chunkSize)
+    {
+        size_t count = 0;
+        for(; (count < threads) && ((window + count * chunkSize) < context.size); count++)
+        {
+            chunks[count].start = window + count * chunkSize;
+            chunks[count].end = chunks[count].start + chunkSize;
+            if(chunks[count].end > context.size)
+                chunks[count].end = context.size;
+        }
+        JsonScanRunPass(chunks, count, handles, JsonScanMeasureChunk);
+        for(size_t i = 0; i < count; i++)
+        {
+            chunks[i].inString = inString;
+            chunks[i].depth = depth;
+            depth += inString ? chunks[i].depthInside : chunks[i].depthOutside;
+            inString ^= chunks[i].flipsString;
+        }
+        JsonScanRunPass(chunks, count, handles, JsonScanParseChunk);
+        for(size_t i = 0; (i < count) && (0 == ret); i++)
+        {
+            if(NULL != chunks[i].error)
+            {
+                printf("Input JSON is broken at offset %llu: %s\r\n", (unsigned long long)chunks[i].errorOffset,
+                    chunks[i].error);
+                ret = -1;
+            }
+            else if(0 != JsonScanMerge(&writer, &chunks[i]))
+            {
+                printf("Unable to write %s\r\n", outPath);
+                ret = -1;
+            }
+        }
+        if((0 == ret) && (0 != JsonScanFlush(&writer, chunks, threads, handles, false)))
+        {
+            printf("Unable to write %s\r\n", outPath);
+            ret = -1;
+        }
+    }
+
+    if((0 == ret) && (inString || (0 != depth)))
+    {
+        printf("Input JSON is incomplete\r\n");
+        ret = -1;
+    }
+    if((0 == ret) && ((0 != JsonScanWriteSteps(&writer)) || (0 != JsonScanFlush(&writer, chunks, threads, handles, true))))
+    {
+        printf("Unable to write %s\r\n", outPath);
+        ret = -1;
+    }
+    if((NULL != writer.f) && (0 != fclose(writer.f)) && (0 == ret))
+    {
+        printf("Unable to write %s\r\n", outPath);
+        ret = -1;
+    }
+    for(size_t i = 0; (NULL != chunks) && (i < threads); i++)
+    {
+        free(chunks[i].output);
+        free(chunks[i].name);
+        free(chunks[i].table);
+    }
+    for(size_t i = 0; i < writer.capacity; i++)
+    {
+        free(writer.blocks[i].data);
+        free(writer.blocks[i].compressed);
+    }
+    free(chunks);
+    free(handles);
+    free(writer.blocks);
+    munmap(map, context.size);
+    return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef JSONSCAN_H
+#define JSONSCAN_H
+
+#include <stddef.h>
+
+/**
+ * @brief Character classification kernel
+ */
+enum JsonScanLevel
+{
+    JSON_SCAN_AUTO = 0, /**< Best kernel supported by the CPU */
+    JSON_SCAN_SCALAR = 1, /**< Portable byte by byte classification */
+    JSON_SCAN_SSE2 = 2, /**< 16 bytes at once (x86 only) */
+    JSON_SCAN_AVX2 = 3, /**< 32 bytes at once (x86 only) */
+};
+
+/**
+ * @brief JSON conversion options
+ */
+struct JsonScanOptions
+{
+    unsigned int threads; /**< Number of parser threads, 0 for the number of online CPUs */
+    size_t chunkSize; /**< Bytes of input parsed by one thread at once (rounded up to 64), 0 for the default */
+    enum JsonScanLevel level; /**< Character classification kernel */
+};
+
+/**
+ * @brief Check if given classification kernel can be used on this CPU
+ * @param level Kernel
+ * @return 1 if supported, 0 otherwise
+ */
+int JsonScanIsSupported(enum JsonScanLevel level);
+
+/**
+ * @brief Convert JSON commands to an input file (format v2, see command.h)
+ *
+ * The input must follow the fixed schema `{"commands": [{"type": ..., "vehicleId": ..., ...}, ...]}`.
+ * Structural characters and string bounds are found 64 bytes at once using vector instructions.
+ * The input is split into chunks, which are parsed in parallel and merged in order.
+ * @param *inPath Input JSON file path
+ * @param *outPath Output input file path
+ * @param *options Options, NULL for defaults
+ * @return 0 on success, <0 on failure
+ */
+int JsonScanConvert(const char *inPath, const char *outPath, const struct JsonScanOptions *options);
+
+#endif
@@ -1,16 +1,33 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "json.h"
+#include "jsonscan.h"
+#include "config.h"
+#include "batch.h"
+#include "server.h"
+#include "controller.h"
+#include "replay.h"
 #include "sim.h"
 
-int main(int argc, char **argv)
+/**
+ * @brief Configure the junction: one non-permissive lane per road
+ */
+static void SetupJunction(void)
 {
-    if(argc < 3)
-        printf("Usage: %s <in-file.dat> <out-file.json>\r\n", argv[0]);
-    
     SimConfig.selectionPolicy = SIM_DYNAMIC;
     SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
 
+    static struct Road roads[4];
+    static struct Lane lanes[4][1];
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    for(size_t i = 0; i < SimConfig.roadCount; i++)
+        roads[i].lane = lanes[i];
+
     SimConfig.road[0].position = NORTH;
+    SimConfig.road[0].bearing = 0;
     SimConfig.road[0].laneCount = 1;
     SimConfig.road[0].lane[0].road = &SimConfig.road[0];
     SimConfig.road[0].lane[0].direction.south = 1;
@@ -23,6 +40,7 @@ int main(int argc, char **argv)
     SimConfig.road[0].lane[0].permissive = false;
 
     SimConfig.road[1].position = SOUTH;
+    SimConfig.road[1].bearing = 180;
     SimConfig.road[1].laneCount = 1;
     SimConfig.road[1].lane[0].road = &SimConfig.road[1];
     SimConfig.road[1].lane[0].direction.north = 1;
@@ -35,6 +53,7 @@ int main(int argc, char **argv)
     SimConfig.road[1].lane[0].permissive = false;
 
     SimConfig.road[2].position = WEST;
+    SimConfig.road[2].bearing = 270;
     SimConfig.road[2].laneCount = 1;
     SimConfig.road[2].lane[0].road = &SimConfig.road[2];
     SimConfig.road[2].lane[0].direction.south = 1;
@@ -47,6 +66,7 @@ int main(int argc, char **argv)
     SimConfig.road[2].lane[0].permissive = false;
 
     SimConfig.road[3].position = EAST;
+    SimConfig.road[3].bearing = 90;
     SimConfig.road[3].laneCount = 1;
     SimConfig.road[3].lane[0].road = &SimConfig.road[3];
     SimConfig.road[3].lane[0].direction.south = 1;
@@ -57,6 +77,181 @@ int main(int argc, char **argv)
     SimConfig.road[3].lane[0].minRedTime = 1;
     SimConfig.road[3].lane[0].priority = 1.f;
     SimConfig.road[3].lane[0].permissive = false;
+}
+
+int main(int argc, char **argv)
+{
+    if((3 == argc) && !strcmp(argv[1], "-s"))
+    {
+        SetupJunction();
+        return (0 == ServerRun(argv[2])) ? 0 : 1;
+    }
+
+    if((3 == argc) && !strcmp(argv[1], "-p"))
+    {
+        SetupJunction();
+        return (0 == ReplayRun(argv[2])) ? 0 : 1;
+    }
+
+    if((argc >= 3) && !strcmp(argv[1], "-t"))
+    {
+        size_t maxVehicles = 4096;
+        uint64_t budget = 0;
+        const char *tracePath = NULL;
+        for(int i = 3; i < argc; i++)
+        {
+            if(!strcmp(argv[i], "-m") && ((i + 1) < argc))
+                maxVehicles = strtoul(argv[++i], NULL, 0);
+            else if(!strcmp(argv[i], "-b") && ((i + 1) < argc))
+                budget = strtoull(argv[++i], NULL, 0) * 1000ULL;
+            else if(!strcmp(argv[i], "-T") && ((i + 1) < argc))
+                tracePath = argv[++i];
+            else
+            {
+                fprintf(stderr, "Unknown option %s\r\n", argv[i]);
+                return 1;
+            }
+        }
+        SetupJunction();
+        return (0 == ControllerRun(STDIN_FILENO, STDOUT_FILENO, strtoul(argv[2], NULL, 0), maxVehicles, budget, tracePath)) ? 0 : 1;
+    }
+
+    if((argc >= 4) && !strcmp(argv[1], "-j"))
+    {
+        struct JsonScanOptions options = {.threads = 0, .chunkSize = 0, .level = JSON_SCAN_AUTO};
+        for(int i = 4; i < argc; i++)
+        {
+            if(!strcmp(argv[i], "-w") && ((i + 1) < argc))
+                options.threads = strtoul(argv[++i], NULL, 0);
+            else if(!strcmp(argv[i], "-k") && ((i + 1) < argc))
+                options.chunkSize = strtoull(argv[++i], NULL, 0) << 10;
+            else if(!strcmp(argv[i], "-S"))
+                options.level = JSON_SCAN_SCALAR;
+            else
+            {
+                printf("Unknown option %s\r\n", argv[i]);
+                return 1;
+            }
+        }
+        return (0 == JsonScanConvert(argv[2], argv[3], &options)) ? 0 : 1;
+    }
+
+    if((argc >= 3) && !strcmp(argv[1], "-B"))
+    {
+        struct BatchOptions options = {.threads = 0, .junctionPath = NULL};
+        for(int i = 3; i < argc; i++)
+        {
+            if(!strcmp(argv[i], "-w") && ((i + 1) < argc))
+                options.threads = strtoul(argv[++i], NULL, 0);
+            else if(!strcmp(argv[i], "-x") && ((i + 1) < argc))
+                options.junctionPath = argv[++i];
+            else
+            {
+                printf("Unknown option %s\r\n", argv[i]);
+                return 1;
+            }
+        }
+        if(NULL == options.junctionPath)
+            SetupJunction();
+        return (0 == BatchRun(argv[2], &options)) ? 0 : 1;
+    }
+
+    if((4 == argc) && !strcmp(argv[1], "-J"))
+        return (0 == ConfigCompile(argv[2], argv[3])) ? 0 : 1;
+
+    if(argc < 3)
+    {
+        printf("Usage: %s <in-file.dat> <out-file.json> [-c <checkpoint-file> [-n <interval>] [-r]] [-T <trace-file>] [-e <timeline-file>] [-P <profile-file>] [-x <junction.bin>] [-l] [-g] [-f]\r\n", argv[0]);
+        printf("       %s -s <socket-path>\r\n", argv[0]);
+        printf("       %s -t <period-us> [-m <max-vehicles>] [-b <budget-us>] [-T <trace-file>]\r\n", argv[0]);
+        printf("       %s -p <trace-file>\r\n", argv[0]);
+        printf("       %s -j <in-file.json> <out-file.dat> [-w <threads>] [-k <chunk-KiB>] [-S]\r\n", argv[0]);
+        printf("       %s -J <junction.json> <junction.bin>\r\n", argv[0]);
+        printf("       %s -B <manifest> [-w <threads>] [-x <junction.bin>]\r\n", argv[0]);
+        printf("  -c  write checkpoints to <checkpoint-file>\r\n");
+        printf("  -n  write a checkpoint every <interval> steps\r\n");
+        printf("  -r  resume from <checkpoint-file> instead of starting from step 0\r\n");
+        printf("  -s  run as a server listening on a Unix domain socket\r\n");
+        printf("  -t  run as a real-time controller: detector events from stdin, light changes to stdout\r\n");
+        printf("  -m  maximum number of waiting vehicles (controller)\r\n");
+        printf("  -b  step latency budget (controller)\r\n");
+        printf("  -T  record input commands, light changes and vehicle exits to <trace-file>\r\n");
+        printf("  -e  record light changes and queue lengths to <timeline-file>\r\n");
+        printf("  -P  record step phases, input/output work and queue lengths to <profile-file> (trace-event JSON)\r\n");
+        printf("  -x  simulate the junction compiled to <junction.bin> instead of the built-in one\r\n");
+        printf("  -l  use the look-ahead policy, taking the arrivals of the upcoming steps from the input\r\n");
+        printf("  -g  schedule phases (maximal sets of compatible lanes) instead of single lanes\r\n");
+        printf("  -f  use exact fixed-point lane scoring instead of float\r\n");
+        printf("  -p  replay <trace-file> and report the first divergence\r\n");
+        printf("  -j  convert JSON commands to an input file\r\n");
+        printf("  -w  number of parser threads (conversion) or scenario threads (batch), default: number of CPUs\r\n");
+        printf("  -k  input parsed by one thread at once (conversion)\r\n");
+        printf("  -S  use scalar character classification instead of SSE2/AVX2 (conversion)\r\n");
+        printf("  -J  compile junction configuration (JSON) to a junction image\r\n");
+        printf("  -B  run the scenarios listed in <manifest> (lines of <input> <output.json>) concurrently\r\n");
+        return 1;
+    }
+
+    struct JsonRunOptions options = {.checkpointPath = NULL, .checkpointInterval = 0, .resume = false, .tracePath = NULL,
+        .timelinePath = NULL, .profilePath = NULL, .initialized = false, .quiet = false};
+    const char *junctionPath = NULL;
+    bool lookahead = false, phases = false, fixedPoint = false;
+    for(int i = 3; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-c") && ((i + 1) < argc))
+            options.checkpointPath = argv[++i];
+        else if(!strcmp(argv[i], "-n") && ((i + 1) < argc))
+            options.checkpointInterval = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "-r"))
+            options.resume = true;
+        else if(!strcmp(argv[i], "-T") && ((i + 1) < argc))
+            options.tracePath = argv[++i];
+        else if(!strcmp(argv[i], "-e") && ((i + 1) < argc))
+            options.timelinePath = argv[++i];
+        else if(!strcmp(argv[i], "-P") && ((i + 1) < argc))
+            options.profilePath = argv[++i];
+        else if(!strcmp(argv[i], "-x") && ((i + 1) < argc))
+            junctionPath = argv[++i];
+        else if(!strcmp(argv[i], "-l"))
+            lookahead = true;
+        else if(!strcmp(argv[i], "-g"))
+            phases = true;
+        else if(!strcmp(argv[i], "-f"))
+            fixedPoint = true;
+        else
+        {
+            printf("Unknown option %s\r\n", argv[i]);
+            return 1;
+        }
+    }
+    if(options.resume && (NULL == options.checkpointPath))
+    {
+        printf("Resuming requires a checkpoint file\r\n");
+        return 1;
+    }
+
+    if(NULL != junctionPath)
+    {
+        //the policies of a compiled junction are part of its image
+        if(lookahead || phases || fixedPoint)
+        {
+            printf("Policies of a compiled junction are set in its configuration\r\n");
+            return 1;
+        }
+        struct SimState *junction = ConfigLoad(junctionPath);
+        if(NULL == junction)
+            return 1;
+        SimSelect(junction);
+        options.initialized = true;
+        int ret = JsonRunSimFromExternalData(argv[1], argv[2], &options);
+        SimRelease(junction);
+        return (0 == ret) ? 0 : 1;
+    }
 
-    JsonRunSimFromExternalData(argv[1], argv[2]);
+    SetupJunction();
+    if(lookahead)
+        SimConfig.selectionPolicy = SIM_LOOKAHEAD;
+    SimConfig.phaseScheduling = phases;
+    SimConfig.fixedPoint = fixedPoint;
+    return (0 == JsonRunSimFromExternalData(argv[1], argv[2], &options)) ? 0 : 1;
 }
@@ -0,0 +1,358 @@
+#include "output.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**
+ * @brief Submission and completion rings shared with the kernel
+ */
+struct OutputRing
+{
+    int fd; /**< Ring file descriptor, -1 if not set up */
+    unsigned int *sqTail; /**< Submission queue tail, advanced by the writer */
+    unsigned int *sqMask; /**< Submission queue index mask */
+    unsigned int *sqArray; /**< Submission queue entry indices */
+    struct io_uring_sqe *sqes; /**< Submission queue entries */
+    unsigned int *cqHead; /**< Completion queue head, advanced by the writer */
+    unsigned int *cqTail; /**< Completion queue tail, advanced by the kernel */
+    unsigned int *cqMask; /**< Completion queue index mask */
+    struct io_uring_cqe *cqes; /**< Completion queue entries */
+    void *sqMap; /**< Mapped submission ring */
+    size_t sqMapSize; /**< Mapped submission ring size */
+    void *cqMap; /**< Mapped completion ring, same as sqMap if mapped once */
+    size_t cqMapSize; /**< Mapped completion ring size */
+    size_t sqesSize; /**< Mapped submission queue entries size */
+};
+
+/**
+ * @brief Double-buffered output writer
+ */
+struct Output
+{
+    int fd; /**< Output file descriptor */
+    uint8_t *buffer[2]; /**< Buffers */
+    size_t capacity; /**< Size of each buffer */
+    uint8_t active; /**< Index of the buffer being filled */
+    size_t length; /**< Number of bytes in the active buffer */
+    uint64_t offset; /**< File offset of the active buffer */
+    bool pending; /**< The other buffer is being written */
+    size_t pendingLength; /**< Number of bytes being written from the other buffer */
+    uint64_t pendingOffset; /**< File offset the other buffer is written at */
+    bool noRing; /**< Write with pwrite(), io_uring is disabled or not available */
+    bool failed; /**< A write failed, no more data is written */
+    struct OutputRing ring; /**< io_uring rings */
+};
+
+/**
+ * @brief Write data synchronously
+ * @param *out Output writer
+ * @param *data Data
+ * @param size Data size
+ * @param offset File offset
+ * @return 0 on success, <0 on failure
+ */
+static int OutputWriteAt(struct Output *out, const uint8_t *data, size_t size, uint64_t offset)
+{
+    while(0 != size)
+    {
+        ssize_t n = pwrite(out->fd, data, size, offset);
+        if(n < 0)
+        {
+            if(EINTR == errno)
+                continue;
+            return -1;
+        }
+        if(0 == n)
+            return -1;
+        data += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Release rings
+ * @param *ring Rings
+ */
+static void OutputReleaseRing(struct OutputRing *ring)
+{
+    if(NULL != ring->sqes)
+        munmap(ring->sqes, ring->sqesSize);
+    if((NULL != ring->cqMap) && (ring->cqMap != ring->sqMap))
+        munmap(ring->cqMap, ring->cqMapSize);
+    if(NULL != ring->sqMap)
+        munmap(ring->sqMap, ring->sqMapSize);
+    if(ring->fd >= 0)
+        close(ring->fd);
+    *ring = (struct OutputRing){.fd = -1};
+}
+
+/**
+ * @brief Set up rings for one write at a time
+ * @param *ring Rings
+ * @return 0 on success, <0 if io_uring is not available
+ */
+static int OutputSetupRing(struct OutputRing *ring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    *ring = (struct OutputRing){.fd = -1};
+    long fd = syscall(__NR_io_uring_setup, 1, &params);
+    if(fd < 0)
+        return -1;
+    ring->fd = fd;
+
+    ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    //newer kernels map both rings at once
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cqMapSize > ring->sqMapSize)
+            ring->sqMapSize = ring->cqMapSize;
+        ring->cqMapSize = ring->sqMapSize;
+    }
+    ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(MAP_FAILED == ring->sqMap)
+    {
+        ring->sqMap = NULL;
+        goto failed;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cqMap = ring->sqMap;
+    else
+    {
+        ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(MAP_FAILED == ring->cqMap)
+        {
+            ring->cqMap = NULL;
+            goto failed;
+        }
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(MAP_FAILED == ring->sqes)
+    {
+        ring->sqes = NULL;
+        goto failed;
+    }
+
+    uint8_t *sq = ring->sqMap, *cq = ring->cqMap;
+    ring->sqTail = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned int*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+
+failed:
+    OutputReleaseRing(ring);
+    return -1;
+}
+
+/**
+ * @brief Submit write to ring
+ * @param *ring Rings
+ * @param fd File descriptor
+ * @param *data Data, must stay valid until the write completes
+ * @param size Data size
+ * @param offset File offset
+ * @return 0 on success, <0 on failure
+ */
+static int OutputRingSubmit(struct OutputRing *ring, int fd, const uint8_t *data, size_t size, uint64_t offset)
+{
+    //the writer is the only producer, the kernel only reads the tail
+    unsigned int tail = *ring->sqTail;
+    unsigned int index = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    //always hand the write to a kernel worker, even if it could be done (copied to the page cache) right away
+    sqe->flags = IOSQE_ASYNC;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = size;
+    sqe->off = offset;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    while(syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0)
+    {
+        if(EINTR != errno)
+        {
+            //take the entry back, nothing was consumed
+            __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Wait for the submitted write to complete
+ * @param *ring Rings
+ * @return Number of bytes written, <0 on failure
+ */
+static int64_t OutputRingWait(struct OutputRing *ring)
+{
+    unsigned int head = *ring->cqHead;
+    while(head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+        if((syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (EINTR != errno))
+            return -1;
+    }
+    int64_t res = ring->cqes[head & *ring->cqMask].res;
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+/**
+ * @brief Wait until the other buffer is written
+ * @param *out Output writer
+ * @return 0 on success, <0 on failure
+ */
+static int OutputWait(struct Output *out)
+{
+    if(!out->pending)
+        return 0;
+    out->pending = false;
+    const uint8_t *data = out->buffer[out->active ^ 1];
+    int64_t written = OutputRingWait(&out->ring);
+    //short or failed writes are finished synchronously, after a failure (e.g. write operation not supported
+    //by the kernel) the ring is not used anymore
+    if(written < 0)
+    {
+        out->noRing = true;
+        written = 0;
+    }
+    if(((size_t)written < out->pendingLength)
+        && (0 != OutputWriteAt(out, data + written, out->pendingLength - written, out->pendingOffset + written)))
+    {
+        out->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start writing the active buffer and switch to the other one
+ * @param *out Output writer
+ * @return 0 on success, <0 on failure
+ */
+static int OutputSwap(struct Output *out)
+{
+    if(0 != OutputWait(out))
+        return -1;
+    const uint8_t *data = out->buffer[out->active];
+    if(!out->noRing && (out->ring.fd < 0) && (0 != OutputSetupRing(&out->ring)))
+        out->noRing = true;
+    if(!out->noRing && (0 == OutputRingSubmit(&out->ring, out->fd, data, out->length, out->offset)))
+    {
+        out->pending = true;
+        out->pendingLength = out->length;
+        out->pendingOffset = out->offset;
+    }
+    else if(0 != OutputWriteAt(out, data, out->length, out->offset))
+    {
+        out->failed = true;
+        return -1;
+    }
+    out->offset += out->length;
+    out->length = 0;
+    out->active ^= 1;
+    return 0;
+}
+
+struct Output* OutputOpen(int fd, uint64_t offset, const struct OutputOptions *options)
+{
+    static const struct OutputOptions defaultOptions = {.bufferSize = 0, .noRing = false};
+    if(NULL == options)
+        options = &defaultOptions;
+
+    struct Output *out = malloc(sizeof(*out));
+    if(NULL == out)
+        return NULL;
+    *out = (struct Output){.fd = fd, .offset = offset, .noRing = options->noRing, .ring = {.fd = -1}};
+    out->capacity = (0 != options->bufferSize) ? options->bufferSize : OUTPUT_DEFAULT_BUFFER_SIZE;
+    out->buffer[0] = malloc(out->capacity);
+    out->buffer[1] = malloc(out->capacity);
+    if((NULL == out->buffer[0]) || (NULL == out->buffer[1]))
+    {
+        free(out->buffer[0]);
+        free(out->buffer[1]);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+int OutputWrite(struct Output *out, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    while(!out->failed && (0 != size))
+    {
+        if((out->length == out->capacity) && (0 != OutputSwap(out)))
+            break;
+        size_t n = out->capacity - out->length;
+        if(n > size)
+            n = size;
+        memcpy(out->buffer[out->active] + out->length, p, n);
+        out->length += n;
+        p += n;
+        size -= n;
+    }
+    return out->failed ? -1 : 0;
+}
+
+void OutputRewind(struct Output *out, size_t count)
+{
+    //the buffer being written is not touched, its bytes are overwritten by a later write at the same offset
+    if(count <= out->length)
+        out->length -= count;
+    else
+    {
+        out->offset -= count - out->length;
+        out->length = 0;
+    }
+}
+
+uint64_t OutputTell(const struct Output *out)
+{
+    return out->offset + out->length;
+}
+
+int OutputFlush(struct Output *out)
+{
+    if((0 != OutputWait(out)) || out->failed)
+        return -1;
+    if(0 != OutputWriteAt(out, out->buffer[out->active], out->length, out->offset))
+    {
+        out->failed = true;
+        return -1;
+    }
+    out->offset += out->length;
+    out->length = 0;
+    return 0;
+}
+
+bool OutputUsesRing(const struct Output *out)
+{
+    return out->ring.fd >= 0;
+}
+
+int OutputClose(struct Output *out)
+{
+    if(NULL == out)
+        return 0;
+    int ret = OutputFlush(out);
+    OutputReleaseRing(&out->ring);
+    free(out->buffer[0]);
+    free(out->buffer[1]);
+    free(out);
+    return ret;
+}
@@ -0,0 +1,93 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define OUTPUT_DEFAULT_BUFFER_SIZE (1 << 20) /**< Default size of each output buffer */
+
+/**
+ * @brief Output writer options
+ */
+struct OutputOptions
+{
+    size_t bufferSize; /**< Size of each of the two buffers, 0 for the default */
+    bool noRing; /**< Write with pwrite() even if io_uring is available */
+};
+
+struct Output;
+
+/**
+ * @brief Start writing to a file
+ *
+ * Data is collected in one buffer while the previous one is being written. A full buffer is submitted to io_uring
+ * and written by a kernel worker, so the caller only waits if the storage is slower than the data is produced.
+ * The ring is set up when the first buffer fills up, so short outputs are written with a single pwrite().
+ * If io_uring is not available, the full buffers are written with pwrite() by the caller.
+ * @param fd File descriptor, must stay open until OutputClose()
+ * @param offset File offset to start writing at
+ * @param *options Options, NULL for defaults
+ * @return Output writer, NULL on failure
+ */
+struct Output* OutputOpen(int fd, uint64_t offset, const struct OutputOptions *options);
+
+/**
+ * @brief Write data
+ * @param *out Output writer
+ * @param *data Data
+ * @param size Data size
+ * @return 0 on success, <0 if this or any earlier write failed
+ */
+int OutputWrite(struct Output *out, const void *data, size_t size);
+
+/**
+ * @brief Write null-terminated string (without the terminator)
+ * @param *out Output writer
+ * @param *str String
+ * @return 0 on success, <0 if this or any earlier write failed
+ */
+static inline int OutputWriteString(struct Output *out, const char *str)
+{
+    return OutputWrite(out, str, strlen(str));
+}
+
+/**
+ * @brief Move write position back, so that the last bytes are overwritten by the following data
+ * @param *out Output writer
+ * @param count Number of bytes, not more than written since the start offset
+ * @note Bytes already written to the file stay there unless overwritten or truncated
+ */
+void OutputRewind(struct Output *out, size_t count);
+
+/**
+ * @brief Get current file offset
+ * @param *out Output writer
+ * @return File offset the next byte is written at
+ */
+uint64_t OutputTell(const struct Output *out);
+
+/**
+ * @brief Write all buffered data and wait until it is written
+ * @param *out Output writer
+ * @return 0 on success, <0 if any write failed
+ */
+int OutputFlush(struct Output *out);
+
+/**
+ * @brief Check if output writer writes through io_uring
+ * @param *out Output writer
+ * @return True if the ring is set up (a full buffer was written and io_uring is available), false otherwise
+ */
+bool OutputUsesRing(const struct Output *out);
+
+/**
+ * @brief Write all buffered data and release output writer
+ * @param *out Output writer, can be NULL
+ * @return 0 on success, <0 if any write failed
+ * @note The file descriptor is not closed
+ */
+int OutputClose(struct Output *out);
+
+#endif
@@ -0,0 +1,649 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+/*
+Python extension running simulations in-process.
+
+Each Simulation object is a separate simulation instance, forked from a junction initialized from the given
+configuration. Exited vehicles are logged in native arrays, which are handed over to Python without copying
+as read-only buffer objects (e.g. for numpy.frombuffer() or memoryview()).
+*/
+
+/**
+ * @brief Read-only typed array exposed through the buffer protocol
+ */
+typedef struct
+{
+    PyObject_HEAD
+    void *data; /**< Array data, owned */
+    Py_ssize_t length; /**< Number of elements */
+    Py_ssize_t itemSize; /**< Element size */
+    char *format; /**< Element format (struct module syntax) */
+} TrafficSimArray;
+
+/**
+ * @brief Simulation instance
+ */
+typedef struct
+{
+    PyObject_HEAD
+    struct SimState *sim; /**< Simulation instance */
+    uint32_t step; /**< Current step */
+    uint32_t *exitSteps; /**< Step of each exit */
+    uint64_t *exitIds; /**< Sequential index of each exited vehicle */
+    PyObject *exitNames; /**< Names of the exited vehicles, NULL if not recorded */
+    size_t exitCount; /**< Number of logged exits */
+    size_t exitCapacity; /**< Exit log capacity */
+    int failed; /**< Exit log could not be extended */
+} TrafficSimObject;
+
+static void TrafficSimArrayDealloc(TrafficSimArray *self)
+{
+    free(self->data);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int TrafficSimArrayGetBuffer(TrafficSimArray *self, Py_buffer *view, int flags)
+{
+    if(flags & PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "Array is read-only");
+        return -1;
+    }
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->length * self->itemSize;
+    view->readonly = 1;
+    view->itemsize = self->itemSize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->length : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? &self->itemSize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static Py_ssize_t TrafficSimArrayLength(TrafficSimArray *self)
+{
+    return self->length;
+}
+
+static PyBufferProcs TrafficSimArrayBuffer = {
+    .bf_getbuffer = (getbufferproc)TrafficSimArrayGetBuffer,
+};
+
+static PySequenceMethods TrafficSimArraySequence = {
+    .sq_length = (lenfunc)TrafficSimArrayLength,
+};
+
+static PyTypeObject TrafficSimArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "trafficsim.Array",
+    .tp_doc = "Read-only typed array, use memoryview() or numpy.frombuffer() to access the elements",
+    .tp_basicsize = sizeof(TrafficSimArray),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)TrafficSimArrayDealloc,
+    .tp_as_buffer = &TrafficSimArrayBuffer,
+    .tp_as_sequence = &TrafficSimArraySequence,
+};
+
+/**
+ * @brief Create array object taking ownership of the data
+ * @param *data Array data, released on failure
+ * @param length Number of elements
+ * @param itemSize Element size
+ * @param *format Element format, must be a static string
+ * @return Array object, NULL on failure
+ */
+static PyObject* TrafficSimArrayCreate(void *data, size_t length, size_t itemSize, char *format)
+{
+    TrafficSimArray *array = PyObject_New(TrafficSimArray, &TrafficSimArrayType);
+    if(NULL == array)
+    {
+        free(data);
+        return NULL;
+    }
+    array->data = data;
+    array->length = length;
+    array->itemSize = itemSize;
+    array->format = format;
+    return (PyObject*)array;
+}
+
+static void TrafficSimVehicleExited(struct Vehicle *vehicle, void *context)
+{
+    TrafficSimObject *self = context;
+    if(self->exitCount == self->exitCapacity)
+    {
+        size_t capacity = (0 == self->exitCapacity) ? 1024 : (2 * self->exitCapacity);
+        uint32_t *steps = realloc(self->exitSteps, capacity * sizeof(*steps));
+        if(NULL != steps)
+            self->exitSteps = steps;
+        uint64_t *ids = realloc(self->exitIds, capacity * sizeof(*ids));
+        if(NULL != ids)
+            self->exitIds = ids;
+        if((NULL == steps) || (NULL == ids))
+        {
+            self->failed = 1;
+            free(vehicle);
+            return;
+        }
+        self->exitCapacity = capacity;
+    }
+    self->exitSteps[self->exitCount] = self->step;
+    self->exitIds[self->exitCount] = vehicle->index;
+    ++self->exitCount;
+    if(NULL != self->exitNames)
+    {
+        PyObject *name = PyUnicode_FromString(vehicle->name);
+        if((NULL == name) || (0 != PyList_Append(self->exitNames, name)))
+            self->failed = 1;
+        Py_XDECREF(name);
+    }
+    free(vehicle);
+}
+
+/**
+ * @brief Get integer item from a dictionary
+ * @param *dict Dictionary
+ * @param *key Key
+ * @param defaultValue Value used if there is no such key
+ * @param *value Output value
+ * @return 0 on success, <0 on failure (exception set)
+ */
+static int TrafficSimGetLong(PyObject *dict, const char *key, long defaultValue, long *value)
+{
+    PyObject *item = PyDict_GetItemString(dict, key);
+    *value = defaultValue;
+    if(NULL == item)
+        return 0;
+    *value = PyLong_AsLong(item);
+    return ((-1 == *value) && PyErr_Occurred()) ? -1 : 0;
+}
+
+/**
+ * @brief Fill lane configuration from a dictionary
+ * @param *dict Lane dictionary
+ * @param *lane Lane
+ * @return 0 on success, <0 on failure (exception set)
+ */
+static int TrafficSimParseLane(PyObject *dict, struct Lane *lane)
+{
+    if(!PyDict_Check(dict))
+    {
+        PyErr_SetString(PyExc_TypeError, "Lane must be a dictionary");
+        return -1;
+    }
+
+    PyObject *directions = PyDict_GetItemString(dict, "directions");
+    if((NULL == directions) || !PySequence_Check(directions))
+    {
+        PyErr_SetString(PyExc_ValueError, "Lane must have a sequence of directions");
+        return -1;
+    }
+    for(Py_ssize_t i = 0; i < PySequence_Size(directions); i++)
+    {
+        PyObject *item = PySequence_GetItem(directions, i);
+        long direction = (NULL != item) ? PyLong_AsLong(item) : -1;
+        Py_XDECREF(item);
+        if((direction < 0) || (direction >= MAX_ROADS))
+        {
+            if(!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError, "Invalid direction");
+            return -1;
+        }
+        lane->direction.mask |= 1u << direction;
+    }
+
+    long permissive, minGreenTime, maxGreenTime, minRedTime, stepsPerVehicle, saturationFlow, startupLostTime;
+    if((0 != TrafficSimGetLong(dict, "permissive", 0, &permissive))
+        || (0 != TrafficSimGetLong(dict, "minGreenTime", 1, &minGreenTime))
+        || (0 != TrafficSimGetLong(dict, "maxGreenTime", 10, &maxGreenTime))
+        || (0 != TrafficSimGetLong(dict, "minRedTime", 1, &minRedTime))
+        || (0 != TrafficSimGetLong(dict, "stepsPerVehicle", 0, &stepsPerVehicle))
+        || (0 != TrafficSimGetLong(dict, "saturationFlow", 1, &saturationFlow))
+        || (0 != TrafficSimGetLong(dict, "startupLostTime", 0, &startupLostTime)))
+        return -1;
+    lane->permissive = (0 != permissive);
+    lane->minGreenTime = minGreenTime;
+    lane->maxGreenTime = maxGreenTime;
+    lane->minRedTime = minRedTime;
+    lane->stepsPerVehicle = stepsPerVehicle;
+    lane->saturationFlow = saturationFlow;
+    lane->startupLostTime = startupLostTime;
+
+    lane->priority = 1.f;
+    PyObject *priority = PyDict_GetItemString(dict, "priority");
+    if(NULL != priority)
+    {
+        lane->priority = PyFloat_AsDouble(priority);
+        if(PyErr_Occurred())
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Fill junction configuration from a sequence of road dictionaries
+ * @param *roads Road sequence
+ * @param *config Configuration, roads and lanes are allocated in one block
+ * @return 0 on success, <0 on failure (exception set)
+ */
+static int TrafficSimParseRoads(PyObject *roads, struct SimConfig *config)
+{
+    if(!PySequence_Check(roads) || (PySequence_Size(roads) < 1) || (PySequence_Size(roads) > MAX_ROADS))
+    {
+        PyErr_Format(PyExc_ValueError, "Junction must have from 1 to %d roads", MAX_ROADS);
+        return -1;
+    }
+
+    PyObject *items[MAX_ROADS] = {NULL};
+    PyObject *lanes[MAX_ROADS] = {NULL};
+    size_t roadCount = PySequence_Size(roads);
+    size_t laneCount = 0;
+    int ret = -1;
+    for(size_t i = 0; i < roadCount; i++)
+    {
+        items[i] = PySequence_GetItem(roads, i);
+        if((NULL == items[i]) || !PyDict_Check(items[i]))
+        {
+            PyErr_SetString(PyExc_TypeError, "Road must be a dictionary");
+            goto cleanup;
+        }
+        lanes[i] = PyDict_GetItemString(items[i], "lanes");
+        if((NULL == lanes[i]) || !PySequence_Check(lanes[i]))
+        {
+            PyErr_SetString(PyExc_ValueError, "Road must have a sequence of lanes");
+            goto cleanup;
+        }
+        laneCount += PySequence_Size(lanes[i]);
+    }
+
+    //lanes follow the roads, starting at a cache line
+    size_t roadsSize = (roadCount * sizeof(struct Road) + SIM_CACHE_LINE - 1) & ~(size_t)(SIM_CACHE_LINE - 1);
+    struct Road *road = aligned_alloc(SIM_CACHE_LINE, roadsSize + laneCount * sizeof(struct Lane));
+    if(NULL == road)
+    {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+    memset(road, 0, roadsSize + laneCount * sizeof(struct Lane));
+    config->road = road;
+    config->roadCount = roadCount;
+    struct Lane *lane = (struct Lane*)((uint8_t*)road + roadsSize);
+    for(size_t i = 0; i < roadCount; i++)
+    {
+        long bearing;
+        if(0 != TrafficSimGetLong(items[i], "bearing", 0, &bearing))
+            goto cleanup;
+        road[i].position = i;
+        road[i].bearing = bearing;
+        road[i].lane = lane;
+        road[i].laneCount = PySequence_Size(lanes[i]);
+        for(size_t k = 0; k < road[i].laneCount; k++)
+        {
+            PyObject *item = PySequence_GetItem(lanes[i], k);
+            lane->road = &road[i];
+            int parsed = (NULL != item) ? TrafficSimParseLane(item, lane) : -1;
+            Py_XDECREF(item);
+            if(0 != parsed)
+                goto cleanup;
+            ++lane;
+        }
+    }
+    ret = 0;
+
+cleanup:
+    for(size_t i = 0; i < roadCount; i++)
+        Py_XDECREF(items[i]);
+    return ret;
+}
+
+/**
+ * @brief Select simulation instance of the object, raise exception if the log could not be extended
+ * @param *self Simulation object
+ * @return 0 on success, <0 on failure (exception set)
+ */
+static int TrafficSimSelect(TrafficSimObject *self)
+{
+    if(NULL == self->sim)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Simulation is not initialized");
+        return -1;
+    }
+    SimSelect(self->sim);
+    return 0;
+}
+
+/**
+ * @brief Release simulation instance of the object, along with its waiting vehicles and the exit log
+ * @param *self Simulation object
+ */
+static void TrafficSimRelease(TrafficSimObject *self)
+{
+    if(NULL != self->sim)
+    {
+        //vehicles are owned by the object
+        SimSelect(self->sim);
+        struct SimConfig *config = SimGetConfig();
+        for(size_t i = 0; i < config->roadCount; i++)
+        {
+            for(size_t k = 0; k < config->road[i].laneCount; k++)
+            {
+                struct Lane *lane = &config->road[i].lane[k];
+                while(0 != lane->vehicleCount)
+                {
+                    struct Vehicle *v = lane->vehicles;
+                    SimRemoveVehicle(v);
+                    free(v);
+                }
+            }
+        }
+        SimRelease(self->sim);
+        self->sim = NULL;
+    }
+    free(self->exitSteps);
+    self->exitSteps = NULL;
+    free(self->exitIds);
+    self->exitIds = NULL;
+    Py_CLEAR(self->exitNames);
+    self->exitCount = 0;
+    self->exitCapacity = 0;
+    self->failed = 0;
+    self->step = 0;
+}
+
+static int TrafficSimInit(TrafficSimObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"roads", "selection_policy", "time_policy", "record_names", NULL};
+    PyObject *roads;
+    int selectionPolicy = SIM_DYNAMIC, timePolicy = SIM_TIME_PRIORITIZED, recordNames = 0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iip", keywords, &roads, &selectionPolicy, &timePolicy, &recordNames))
+        return -1;
+
+    //calling __init__ again starts over with a new instance
+    TrafficSimRelease(self);
+
+    //the junction is initialized as the main instance and then forked, so that each object has its own copy
+    //events are not logged, neither by the main instance nor by the forks inheriting the setting
+    SimSelect(NULL);
+    SimSetEventLogging(false);
+    SimConfig.road = NULL;
+    SimConfig.roadCount = 0;
+    SimConfig.selectionPolicy = selectionPolicy;
+    SimConfig.timePolicy = timePolicy;
+    int ret = TrafficSimParseRoads(roads, &SimConfig);
+    if(0 == ret)
+    {
+        if(0 != SimInit())
+        {
+            PyErr_SetString(PyExc_ValueError, "Invalid junction configuration");
+            ret = -1;
+        }
+        else if(NULL == (self->sim = SimFork()))
+        {
+            PyErr_NoMemory();
+            ret = -1;
+        }
+    }
+    free(SimConfig.road);
+    SimConfig.road = NULL;
+    SimConfig.roadCount = 0;
+    if(0 != ret)
+        return -1;
+
+    if(recordNames && (NULL == (self->exitNames = PyList_New(0))))
+        return -1;
+    SimSelect(self->sim);
+    SimRegisterVehicleExitedCallback(TrafficSimVehicleExited, self);
+    return 0;
+}
+
+static void TrafficSimDealloc(TrafficSimObject *self)
+{
+    TrafficSimRelease(self);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* TrafficSimAddVehicle(TrafficSimObject *self, PyObject *args)
+{
+    const char *name;
+    Py_ssize_t length;
+    int start, end;
+    if(!PyArg_ParseTuple(args, "s#ii", &name, &length, &start, &end) || (0 != TrafficSimSelect(self)))
+        return NULL;
+    if((start < 0) || (end < 0))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid road");
+        return NULL;
+    }
+
+    struct Vehicle *v = malloc(sizeof(*v) + length + 1);
+    if(NULL == v)
+        return PyErr_NoMemory();
+    memcpy(v->name, name, length + 1);
+    v->direction = end;
+    if(0 != SimPlaceVehicle(v, SimSelectLane(start, end)))
+    {
+        free(v);
+        PyErr_SetString(PyExc_ValueError, "No lane for this vehicle");
+        return NULL;
+    }
+    return PyLong_FromSize_t(v->index);
+}
+
+static PyObject* TrafficSimStep(TrafficSimObject *self, PyObject *args)
+{
+    unsigned long count = 1;
+    if(!PyArg_ParseTuple(args, "|k", &count) || (0 != TrafficSimSelect(self)))
+        return NULL;
+
+    size_t exited = self->exitCount;
+    for(unsigned long i = 0; i < count; i++)
+    {
+        SimDoStep();
+        ++self->step;
+    }
+    if(self->failed)
+    {
+        self->failed = 0;
+        return PyErr_NoMemory();
+    }
+    return PyLong_FromSize_t(self->exitCount - exited);
+}
+
+static PyObject* TrafficSimTakeExits(TrafficSimObject *self, PyObject *Py_UNUSED(ignored))
+{
+    //the log is handed over to the arrays and a new one is started
+    PyObject *steps = TrafficSimArrayCreate(self->exitSteps, self->exitCount, sizeof(*self->exitSteps), "I");
+    self->exitSteps = NULL;
+    PyObject *ids = TrafficSimArrayCreate(self->exitIds, self->exitCount, sizeof(*self->exitIds), "Q");
+    self->exitIds = NULL;
+    self->exitCount = 0;
+    self->exitCapacity = 0;
+
+    PyObject *names = Py_None;
+    Py_INCREF(names);
+    if(NULL != self->exitNames)
+    {
+        Py_DECREF(names);
+        names = self->exitNames;
+        self->exitNames = PyList_New(0);
+    }
+
+    if((NULL == steps) || (NULL == ids) || (NULL == names))
+    {
+        Py_XDECREF(steps);
+        Py_XDECREF(ids);
+        Py_XDECREF(names);
+        return NULL;
+    }
+    return Py_BuildValue("(NNN)", steps, ids, names);
+}
+
+/**
+ * @brief Find waiting vehicle by name
+ * @param *self Simulation object
+ * @param *name Vehicle name
+ * @return Vehicle, NULL if not found (exception set)
+ */
+static struct Vehicle* TrafficSimFind(TrafficSimObject *self, const char *name)
+{
+    if(0 != TrafficSimSelect(self))
+        return NULL;
+    struct Vehicle *v = SimFindVehicle(name);
+    if(NULL == v)
+        PyErr_Format(PyExc_KeyError, "Vehicle %s is not waiting", name);
+    return v;
+}
+
+static PyObject* TrafficSimRemoveVehicle(TrafficSimObject *self, PyObject *args)
+{
+    const char *name;
+    struct Vehicle *v;
+    if(!PyArg_ParseTuple(args, "s", &name) || (NULL == (v = TrafficSimFind(self, name))))
+        return NULL;
+    if(0 != SimRemoveVehicle(v))
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to remove vehicle");
+        return NULL;
+    }
+    free(v);
+    Py_RETURN_NONE;
+}
+
+static PyObject* TrafficSimChangeLane(TrafficSimObject *self, PyObject *args)
+{
+    const char *name;
+    unsigned int lane;
+    struct Vehicle *v;
+    if(!PyArg_ParseTuple(args, "sI", &name, &lane) || (NULL == (v = TrafficSimFind(self, name))))
+        return NULL;
+    if((lane >= v->lane->road->laneCount) || (0 != SimChangeLane(v, &v->lane->road->lane[lane])))
+    {
+        PyErr_SetString(PyExc_ValueError, "Unable to change lane");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* TrafficSimRerouteVehicle(TrafficSimObject *self, PyObject *args)
+{
+    const char *name;
+    int end;
+    struct Vehicle *v;
+    if(!PyArg_ParseTuple(args, "si", &name, &end) || (NULL == (v = TrafficSimFind(self, name))))
+        return NULL;
+    if((end < 0) || ((size_t)end >= SimGetConfig()->roadCount))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid road");
+        return NULL;
+    }
+    if(0 != SimRerouteVehicle(v, end))
+    {
+        PyErr_SetString(PyExc_ValueError, "Unable to reroute vehicle");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* TrafficSimLights(TrafficSimObject *self, PyObject *Py_UNUSED(ignored))
+{
+    if(0 != TrafficSimSelect(self))
+        return NULL;
+    struct SimConfig *config = SimGetConfig();
+    size_t count = 0;
+    for(size_t i = 0; i < config->roadCount; i++)
+        count += config->road[i].laneCount;
+    uint8_t *lights = malloc(count + 1);
+    if(NULL == lights)
+        return PyErr_NoMemory();
+    count = 0;
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+            lights[count++] = config->road[i].lane[k].light;
+    }
+    return TrafficSimArrayCreate(lights, count, sizeof(*lights), "B");
+}
+
+static PyObject* TrafficSimStats(TrafficSimObject *self, PyObject *Py_UNUSED(ignored))
+{
+    if(0 != TrafficSimSelect(self))
+        return NULL;
+    struct SimStats stats;
+    SimGetStats(&stats);
+    return Py_BuildValue("{s:k,s:n,s:n,s:K}", "step", (unsigned long)stats.step, "waiting", (Py_ssize_t)stats.waitingVehicles,
+        "exited", (Py_ssize_t)stats.exitedVehicles, "total_delay", (unsigned long long)stats.totalDelay);
+}
+
+static PyMethodDef TrafficSimMethods[] = {
+    {"add_vehicle", (PyCFunction)TrafficSimAddVehicle, METH_VARARGS,
+        "add_vehicle(name, start, end) -> vehicle sequential index\n\nPlace vehicle on the best lane from start to end road"},
+    {"step", (PyCFunction)TrafficSimStep, METH_VARARGS,
+        "step(count=1) -> number of exited vehicles\n\nPerform simulation steps"},
+    {"take_exits", (PyCFunction)TrafficSimTakeExits, METH_NOARGS,
+        "take_exits() -> (steps, ids, names)\n\nTake exits logged so far: step numbers (uint32 array), "
+        "vehicle sequential indexes (uint64 array) and names (list, None if not recorded)"},
+    {"remove_vehicle", (PyCFunction)TrafficSimRemoveVehicle, METH_VARARGS, "remove_vehicle(name)"},
+    {"change_lane", (PyCFunction)TrafficSimChangeLane, METH_VARARGS, "change_lane(name, lane index on the vehicle road)"},
+    {"reroute_vehicle", (PyCFunction)TrafficSimRerouteVehicle, METH_VARARGS, "reroute_vehicle(name, end)"},
+    {"lights", (PyCFunction)TrafficSimLights, METH_NOARGS, "lights() -> uint8 array of lane lights, in road-major order"},
+    {"stats", (PyCFunction)TrafficSimStats, METH_NOARGS, "stats() -> dictionary of outcome statistics"},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyTypeObject TrafficSimType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "trafficsim.Simulation",
+    .tp_doc = "Simulation(roads, selection_policy=3, time_policy=2, record_names=False)\n\n"
+        "roads is a sequence of road dictionaries: {'bearing': degrees, 'lanes': [lane, ...]}, "
+        "lane is a dictionary: {'directions': [road index, ...], 'permissive': bool, 'priority': float, "
+        "'minGreenTime', 'maxGreenTime', 'minRedTime', 'stepsPerVehicle', 'saturationFlow', 'startupLostTime'}",
+    .tp_basicsize = sizeof(TrafficSimObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)TrafficSimInit,
+    .tp_dealloc = (destructor)TrafficSimDealloc,
+    .tp_methods = TrafficSimMethods,
+};
+
+static struct PyModuleDef TrafficSimModule = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "trafficsim",
+    .m_doc = "In-process intersection simulator",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_trafficsim(void)
+{
+    if((PyType_Ready(&TrafficSimType) < 0) || (PyType_Ready(&TrafficSimArrayType) < 0))
+        return NULL;
+
+    PyObject *module = PyModule_Create(&TrafficSimModule);
+    if(NULL == module)
+        return NULL;
+
+    Py_INCREF(&TrafficSimType);
+    Py_INCREF(&TrafficSimArrayType);
+    if((0 != PyModule_AddObject(module, "Simulation", (PyObject*)&TrafficSimType))
+        || (0 != PyModule_AddObject(module, "Array", (PyObject*)&TrafficSimArrayType))
+        || (0 != PyModule_AddIntConstant(module, "RIGHT_HAND_RULE", SIM_RIGHT_HAND_RULE))
+        || (0 != PyModule_AddIntConstant(module, "FCFS", SIM_FCFS))
+        || (0 != PyModule_AddIntConstant(module, "HLFS", SIM_HLFS))
+        || (0 != PyModule_AddIntConstant(module, "DYNAMIC", SIM_DYNAMIC))
+        || (0 != PyModule_AddIntConstant(module, "TIME_FIXED", SIM_TIME_FIXED))
+        || (0 != PyModule_AddIntConstant(module, "TIME_PROPORTIONAL", SIM_TIME_PROPORTIONAL))
+        || (0 != PyModule_AddIntConstant(module, "TIME_PRIORITIZED", SIM_TIME_PRIORITIZED)))
+    {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
@@ -0,0 +1,175 @@
+#include "replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+#include "trace.h"
+#include "command.h"
+
+static const char *ReplayLightToString[] = {
+    [LIGHT_DISABLED] = "disabled",
+    [LIGHT_RED] = "red",
+    [LIGHT_RED_YELLOW] = "red-yellow",
+    [LIGHT_YELLOW] = "yellow",
+    [LIGHT_GREEN] = "green",
+    [LIGHT_ARROW] = "arrow",
+};
+
+static void ReplayVehicleExitedCallback(struct Vehicle *vehicle, void *context)
+{
+    (void)context;
+    free(vehicle);
+}
+
+/**
+ * @brief Print trace event
+ * @param *event Event
+ */
+static void ReplayPrintEvent(const struct SimTraceEvent *event)
+{
+    if(SIM_TRACE_LIGHT == event->type)
+        printf("light at lane %llu switched to %s in step %lu", (unsigned long long)event->id,
+            (event->light <= LIGHT_ARROW) ? ReplayLightToString[event->light] : "?", (unsigned long)event->step);
+    else if(SIM_TRACE_EXIT == event->type)
+        printf("vehicle %llu exited in step %lu", (unsigned long long)event->id, (unsigned long)event->step);
+    else
+        printf("nothing");
+}
+
+/**
+ * @brief Execute recorded command
+ * @param *cmd Command
+ * @return 0 on success, <0 on failure
+ * @note Commands referring to vehicles that are not waiting are ignored, as they were when recorded
+ */
+static int ReplayExecute(const struct SimTraceCommand *cmd)
+{
+    if(COMMAND_STEP == cmd->type)
+    {
+        SimDoStep();
+        return 0;
+    }
+    if(COMMAND_ADD_VEHICLE == cmd->type)
+    {
+        struct Vehicle *v = malloc(sizeof(*v) + cmd->length + 1);
+        if(NULL == v)
+        {
+            printf("Memory allocation failed\r\n");
+            return -1;
+        }
+        memcpy(v->name, cmd->name, cmd->length + 1);
+        v->direction = cmd->endRoad;
+        if(0 != SimPlaceVehicle(v, SimSelectLane(cmd->startRoad, cmd->endRoad)))
+            free(v);
+        return 0;
+    }
+
+    if(COMMAND_ANNOUNCE_VEHICLE == cmd->type)
+    {
+        uint32_t step;
+        if(sizeof(step) != cmd->length)
+        {
+            printf("Malformed recorded arrival\r\n");
+            return -1;
+        }
+        memcpy(&step, cmd->name, sizeof(step));
+        SimAnnounceVehicle(cmd->startRoad, cmd->endRoad, step);
+        return 0;
+    }
+
+    struct Vehicle *v = SimFindVehicle(cmd->name);
+    if(NULL == v)
+        return 0;
+    if(COMMAND_REMOVE_VEHICLE == cmd->type)
+    {
+        if(0 == SimRemoveVehicle(v))
+            free(v);
+    }
+    else if(COMMAND_CHANGE_LANE == cmd->type)
+    {
+        struct Road *road = v->lane->road;
+        if(cmd->endRoad < road->laneCount)
+            SimChangeLane(v, &road->lane[cmd->endRoad]);
+    }
+    else if(COMMAND_REROUTE_VEHICLE == cmd->type)
+        SimRerouteVehicle(v, cmd->endRoad);
+    else
+    {
+        printf("Unknown recorded command: %u\r\n", (unsigned int)cmd->type);
+        return -1;
+    }
+    return 0;
+}
+
+int ReplayRun(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if(NULL == f)
+    {
+        printf("Unable to open %s\r\n", path);
+        return -1;
+    }
+
+    SimSetEventLogging(false);
+    SimRegisterVehicleExitedCallback(ReplayVehicleExitedCallback, NULL);
+    struct SimTrace *trace = SimTraceStartReplay(f, NULL, NULL);
+    if(NULL == trace)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct SimTraceCommand cmd;
+    uint64_t commands = 0, steps = 0;
+    int ret;
+    while(1 == (ret = SimTraceReadCommand(trace, &cmd)))
+    {
+        if(0 != ReplayExecute(&cmd))
+            break;
+        ++commands;
+        steps += (COMMAND_STEP == cmd.type);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    struct SimTraceEvent expected, actual;
+    if(1 == ret)
+        ret = -1;
+    else if(SimTraceGetDivergence(trace, &expected, &actual))
+    {
+        printf("Replay diverged after %llu commands: expected ", (unsigned long long)commands);
+        ReplayPrintEvent(&expected);
+        printf(", got ");
+        ReplayPrintEvent(&actual);
+        printf("\r\n");
+        ret = 1;
+    }
+    else if(0 != ret)
+        printf("Trace %s is broken\r\n", path);
+    else
+        printf("Replayed %llu commands, %llu steps in %.3f s (%.0f steps/s), no divergence\r\n",
+            (unsigned long long)commands, (unsigned long long)steps, elapsed, (elapsed > 0.) ? (steps / elapsed) : 0.);
+
+    SimTraceStop(trace);
+    fclose(f);
+    //release remaining vehicles
+    struct SimConfig *config = SimGetConfig();
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            struct Lane *lane = &config->road[i].lane[k];
+            while(0 != lane->vehicleCount)
+            {
+                struct Vehicle *v = lane->vehicles;
+                if(0 == SimRemoveVehicle(v))
+                    free(v);
+            }
+        }
+    }
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+    return ret;
+}
@@ -0,0 +1,15 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/**
+ * @brief Replay trace and compare the simulation with it
+ *
+ * The simulation is restored from the trace, the recorded commands are executed and the light transitions
+ * and vehicle exits are compared to the recorded ones. The replay stops at the first divergence.
+ * @param *path Trace file path
+ * @return 0 if the replay matches the trace, 1 on divergence, <0 on failure
+ * @attention The junction must be configured before calling this function
+ */
+int ReplayRun(const char *path);
+
+#endif
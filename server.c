@@ -0,0 +1,394 @@
+#include "server.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sim.h"
+#include "command.h"
+
+#define SERVER_MAX_CLIENTS 64 /**< Maximum number of simultaneous connections */
+#define SERVER_READ_SIZE 65536 /**< Number of bytes read at once */
+
+/**
+ * @brief Client connection
+ */
+struct ServerClient
+{
+    int fd; /**< Socket */
+    struct SimState *sim; /**< Simulation instance of this client */
+    uint8_t *in; /**< Received data */
+    size_t inSize; /**< Number of received bytes */
+    uint8_t *out; /**< Data to be sent */
+    size_t outSize; /**< Number of bytes to be sent */
+    size_t outCapacity; /**< Output buffer capacity */
+    size_t outSent; /**< Number of bytes already sent */
+    uint32_t count; /**< Number of payload elements of the current response */
+    bool failed; /**< Output buffer could not be extended */
+    bool closing; /**< Connection is closed once the output is sent */
+};
+
+static volatile sig_atomic_t ServerStop = 0;
+
+static void ServerSignalHandler(int signum)
+{
+    (void)signum;
+    ServerStop = 1;
+}
+
+/**
+ * @brief Append data to client output buffer
+ * @param *client Client
+ * @param *data Data
+ * @param size Number of bytes
+ * @return 0 on success, <0 on failure
+ */
+static int ServerAppend(struct ServerClient *client, const void *data, size_t size)
+{
+    if((client->outSize + size) > client->outCapacity)
+    {
+        size_t capacity = (0 == client->outCapacity) ? SERVER_READ_SIZE : client->outCapacity;
+        while(capacity < (client->outSize + size))
+            capacity *= 2;
+        uint8_t *out = realloc(client->out, capacity);
+        if(NULL == out)
+        {
+            printf("Memory allocation failed\r\n");
+            client->failed = true;
+            return -1;
+        }
+        client->out = out;
+        client->outCapacity = capacity;
+    }
+    memcpy(client->out + client->outSize, data, size);
+    client->outSize += size;
+    return 0;
+}
+
+static void ServerVehicleExitedCallback(struct Vehicle *vehicle, void *context)
+{
+    struct ServerClient *client = context;
+    uint16_t length = strlen(vehicle->name);
+    if((0 == ServerAppend(client, &length, sizeof(length))) && (0 == ServerAppend(client, vehicle->name, length)))
+        ++client->count;
+    free(vehicle);
+}
+
+/**
+ * @brief Remove and release all vehicles of the selected instance
+ */
+static void ServerDrainVehicles(void)
+{
+    struct SimConfig *config = SimGetConfig();
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            struct Lane *lane = &config->road[i].lane[k];
+            while(0 != lane->vehicleCount)
+            {
+                struct Vehicle *v = lane->vehicles;
+                SimRemoveVehicle(v);
+                free(v);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Start a new simulation for given client, forked from the initial state
+ * @param *client Client
+ * @return 0 on success, <0 on failure
+ */
+static int ServerStartSimulation(struct ServerClient *client)
+{
+    SimSelect(NULL);
+    client->sim = SimFork();
+    if(NULL == client->sim)
+        return -1;
+    SimSelect(client->sim);
+    //events of the client simulations would flood the server output
+    SimSetEventLogging(false);
+    SimRegisterVehicleExitedCallback(ServerVehicleExitedCallback, client);
+    return 0;
+}
+
+/**
+ * @brief Stop simulation of given client and release its vehicles
+ * @param *client Client
+ */
+static void ServerStopSimulation(struct ServerClient *client)
+{
+    if(NULL == client->sim)
+        return;
+    SimSelect(client->sim);
+    ServerDrainVehicles();
+    SimRelease(client->sim);
+    client->sim = NULL;
+}
+
+/**
+ * @brief Handle one request
+ * @param *client Client
+ * @param *cmd Request
+ * @param *name Vehicle name (null-terminated)
+ * @return Response status
+ */
+static enum ServerStatus ServerHandleRequest(struct ServerClient *client, const struct InCommand *cmd, const char *name)
+{
+    struct SimConfig *config = SimGetConfig();
+    struct Vehicle *v;
+    switch(cmd->type)
+    {
+        case COMMAND_ADD_VEHICLE:
+            v = malloc(sizeof(*v) + cmd->length + 1);
+            if(NULL == v)
+                return SERVER_FAILED;
+            memcpy(v->name, name, cmd->length + 1);
+            v->direction = cmd->endRoad;
+            if(0 != SimPlaceVehicle(v, SimSelectLane(cmd->startRoad, cmd->endRoad)))
+            {
+                free(v);
+                return SERVER_FAILED;
+            }
+            return SERVER_OK;
+        case COMMAND_STEP:
+            SimDoStep();
+            return SERVER_OK;
+        case COMMAND_REMOVE_VEHICLE:
+            v = SimFindVehicle(name);
+            if((NULL == v) || (0 != SimRemoveVehicle(v)))
+                return SERVER_FAILED;
+            free(v);
+            return SERVER_OK;
+        case COMMAND_CHANGE_LANE:
+            v = SimFindVehicle(name);
+            if((NULL == v) || (cmd->endRoad >= v->lane->road->laneCount)
+                || (0 != SimChangeLane(v, &v->lane->road->lane[cmd->endRoad])))
+                return SERVER_FAILED;
+            return SERVER_OK;
+        case COMMAND_REROUTE_VEHICLE:
+            v = SimFindVehicle(name);
+            if((NULL == v) || (0 != SimRerouteVehicle(v, cmd->endRoad)))
+                return SERVER_FAILED;
+            return SERVER_OK;
+        case COMMAND_QUERY_LIGHTS:
+            for(size_t i = 0; i < config->roadCount; i++)
+            {
+                for(size_t k = 0; k < config->road[i].laneCount; k++)
+                {
+                    uint8_t light = config->road[i].lane[k].light;
+                    if(0 != ServerAppend(client, &light, sizeof(light)))
+                        return SERVER_FAILED;
+                    ++client->count;
+                }
+            }
+            return SERVER_OK;
+        case COMMAND_RESET:
+            ServerStopSimulation(client);
+            return (0 == ServerStartSimulation(client)) ? SERVER_OK : SERVER_FAILED;
+        default:
+            return SERVER_BAD_REQUEST;
+    }
+}
+
+/**
+ * @brief Send as much of the client output as the socket takes without blocking
+ * @param *client Client
+ * @return 0 on success (the output might be sent only partially), <0 if the connection must be closed
+ */
+static int ServerSend(struct ServerClient *client)
+{
+    while(client->outSent < client->outSize)
+    {
+        ssize_t size = send(client->fd, client->out + client->outSent, client->outSize - client->outSent, MSG_DONTWAIT);
+        if(size < 0)
+        {
+            if(EINTR == errno)
+                continue;
+            //the rest is sent when the socket becomes writable again
+            if((EAGAIN == errno) || (EWOULDBLOCK == errno))
+                return 0;
+            return -1;
+        }
+        client->outSent += size;
+    }
+    client->outSize = 0;
+    client->outSent = 0;
+    return client->closing ? -1 : 0;
+}
+
+/**
+ * @brief Read and handle all complete requests from the client, then start sending responses
+ * @param *client Client
+ * @return 0 on success, <0 if the connection must be closed
+ */
+static int ServerServe(struct ServerClient *client)
+{
+    ssize_t size = read(client->fd, client->in + client->inSize, SERVER_READ_SIZE - client->inSize);
+    if(size <= 0)
+        return ((size < 0) && (EINTR == errno)) ? 0 : -1;
+    client->inSize += size;
+
+    SimSelect(client->sim);
+    size_t position = 0;
+    while(!client->closing && ((client->inSize - position) >= sizeof(struct InCommand)))
+    {
+        struct InCommand cmd;
+        memcpy(&cmd, client->in + position, sizeof(cmd));
+        struct ServerResponse response = {.type = cmd.type, .status = SERVER_OK, .count = 0, .length = 0};
+        char name[SERVER_MAX_NAME_LENGTH + 1];
+        size_t header = client->outSize;
+        if(cmd.length > SERVER_MAX_NAME_LENGTH)
+            response.status = SERVER_BAD_REQUEST;
+        else if((client->inSize - position) < (sizeof(cmd) + cmd.length))
+            break; //wait for the rest of the request
+        else if(0 == ServerAppend(client, &response, sizeof(response)))
+        {
+            memcpy(name, client->in + position + sizeof(cmd), cmd.length);
+            name[cmd.length] = '\0';
+            client->count = 0;
+            response.status = ServerHandleRequest(client, &cmd, name);
+            //the instance is replaced on reset
+            SimSelect(client->sim);
+            response.count = client->count;
+            response.length = client->outSize - header - sizeof(response);
+            memcpy(client->out + header, &response, sizeof(response));
+        }
+
+        if((SERVER_BAD_REQUEST == response.status) || client->failed)
+        {
+            client->outSize = header;
+            response.count = 0;
+            response.length = 0;
+            ServerAppend(client, &response, sizeof(response));
+            client->closing = true;
+        }
+        position += sizeof(cmd) + cmd.length;
+    }
+    client->inSize -= (position < client->inSize) ? position : client->inSize;
+    memmove(client->in, client->in + position, client->inSize);
+
+    //send all responses at once, the rest is sent when the socket becomes writable
+    return ServerSend(client);
+}
+
+/**
+ * @brief Close client connection and release its resources
+ * @param *client Client
+ */
+static void ServerClose(struct ServerClient *client)
+{
+    ServerStopSimulation(client);
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+}
+
+int ServerRun(const char *socketPath)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if(strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        printf("Socket path is too long\r\n");
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    if(0 != SimInit())
+        return -1;
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0)
+    {
+        printf("Unable to create socket\r\n");
+        return -1;
+    }
+    unlink(socketPath);
+    if((0 != bind(listenFd, (struct sockaddr*)&address, sizeof(address))) || (0 != listen(listenFd, 16)))
+    {
+        printf("Unable to listen on %s\r\n", socketPath);
+        close(listenFd);
+        return -1;
+    }
+
+    struct sigaction action = {.sa_handler = ServerSignalHandler};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    //broken connections are reported by send()
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Listening on %s\r\n", socketPath);
+
+    static struct ServerClient clients[SERVER_MAX_CLIENTS];
+    struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+    size_t clientCount = 0;
+    while(!ServerStop)
+    {
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        //no more requests are read from a client until its responses are sent, so a client that does not read
+        //only stalls itself
+        for(size_t i = 0; i < clientCount; i++)
+        {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = (0 != clients[i].outSize) ? POLLOUT : POLLIN;
+        }
+        if(poll(fds, clientCount + 1, -1) < 0)
+        {
+            if(EINTR == errno)
+                continue;
+            printf("Polling failed\r\n");
+            break;
+        }
+
+        //go backwards, so that closed clients can be replaced with the last one
+        for(size_t i = clientCount; i > 0; i--)
+        {
+            struct ServerClient *client = &clients[i - 1];
+            if(0 == fds[i].revents)
+                continue;
+            if(0 != ((0 != client->outSize) ? ServerSend(client) : ServerServe(client)))
+            {
+                ServerClose(client);
+                *client = clients[--clientCount];
+            }
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            int fd = accept(listenFd, NULL, NULL);
+            if(fd < 0)
+                continue;
+            if(SERVER_MAX_CLIENTS == clientCount)
+            {
+                printf("Connection rejected, too many clients\r\n");
+                close(fd);
+                continue;
+            }
+            struct ServerClient *client = &clients[clientCount];
+            *client = (struct ServerClient){.fd = fd};
+            client->in = malloc(SERVER_READ_SIZE);
+            if((NULL == client->in) || (0 != ServerStartSimulation(client)))
+            {
+                printf("Connection rejected\r\n");
+                ServerClose(client);
+                continue;
+            }
+            ++clientCount;
+        }
+    }
+
+    for(size_t i = 0; i < clientCount; i++)
+        ServerClose(&clients[i]);
+    close(listenFd);
+    unlink(socketPath);
+    printf("Server stopped\r\n");
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+/*
+Server protocol (native byte order, no padding):
+* requests are InCommand structures (see command.h) followed by the vehicle name, if any,
+* each request is answered with a ServerResponse header followed by its payload:
+    - step: exited vehicles, each one as a 16-bit name length and the name,
+    - light query: one byte (enum Light) per lane, in road-major order,
+    - other requests have no payload.
+All requests received in one read are handled together and their responses are sent together. No more requests
+are read from a connection until all its responses are sent.
+*/
+
+#define SERVER_MAX_NAME_LENGTH 255 /**< Maximum vehicle name length accepted by the server */
+
+/**
+ * @brief Response status
+ */
+enum ServerStatus
+{
+    SERVER_OK = 0, /**< Request handled */
+    SERVER_FAILED = 1, /**< Request is valid, but could not be handled (e.g. no such vehicle) */
+    SERVER_BAD_REQUEST = 2, /**< Request is malformed, the connection is closed */
+};
+
+/**
+ * @brief Response header, followed by @p length bytes of payload
+ */
+struct ServerResponse
+{
+    uint8_t type; /**< Request type */
+    uint8_t status; /**< Status (enum ServerStatus) */
+    uint32_t count; /**< Number of payload elements */
+    uint32_t length; /**< Payload length in bytes */
+} __attribute__ ((packed));
+
+/**
+ * @brief Run simulation server on a Unix domain socket
+ *
+ * The simulation is initialized once and each connection gets its own instance forked from the initial state,
+ * so that clients can run independent simulations without paying the initialization cost.
+ * The server runs until SIGINT or SIGTERM is received.
+ * @param *socketPath Socket path, an existing file is replaced
+ * @return 0 on success, <0 on failure
+ * @attention The junction must be configured before calling this function
+ */
+int ServerRun(const char *socketPath);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * @brief Get number of words needed for a bitset
+ * @param bits Number of bits
+ * @return Number of words
+ */
+static inline size_t SimBitsetWords(size_t bits)
+{
+    return (bits + 63) / 64;
+}
+
+/**
+ * @brief Set bit
+ * @param *set Bitset
+ * @param bit Bit index
+ */
+static inline void SimBitsetSet(uint64_t *set, size_t bit)
+{
+    set[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+/**
+ * @brief Clear bit
+ * @param *set Bitset
+ * @param bit Bit index
+ */
+static inline void SimBitsetReset(uint64_t *set, size_t bit)
+{
+    set[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+}
+
+/**
+ * @brief Set or clear bit
+ * @param *set Bitset
+ * @param bit Bit index
+ * @param value True to set, false to clear
+ */
+static inline void SimBitsetAssign(uint64_t *set, size_t bit, bool value)
+{
+    if(value)
+        SimBitsetSet(set, bit);
+    else
+        SimBitsetReset(set, bit);
+}
+
+/**
+ * @brief Check bit
+ * @param *set Bitset
+ * @param bit Bit index
+ * @return True if set, false otherwise
+ */
+static inline bool SimBitsetTest(const uint64_t *set, size_t bit)
+{
+    return 0 != (set[bit / 64] & ((uint64_t)1 << (bit % 64)));
+}
+
+/**
+ * @brief Clear all bits
+ * @param *set Bitset
+ * @param words Number of words
+ */
+static inline void SimBitsetClear(uint64_t *set, size_t words)
+{
+    memset(set, 0, words * sizeof(*set));
+}
+
+/**
+ * @brief Check whether two bitsets have any common bit
+ * @param *a Bitset A
+ * @param *b Bitset B
+ * @param words Number of words
+ * @return True if there is at least one common bit, false otherwise
+ */
+static inline bool SimBitsetIntersects(const uint64_t *a, const uint64_t *b, size_t words)
+{
+    while(words--)
+    {
+        if(0 != (*a++ & *b++))
+            return true;
+    }
+    return false;
+}
+
+#endif
@@ -3,6 +3,126 @@
 
 #include "types.h"
 
+/**
+ * @brief Path type, relative to the starting road
+ */
+enum SimTurn
+{
+    SIM_TURN_U = 0, /**< U-turn */
+    SIM_TURN_RIGHT = 1, /**< Right turn */
+    SIM_TURN_STRAIGHT = 2, /**< Straight or slight turn */
+    SIM_TURN_LEFT = 3, /**< Left turn */
+};
+
+/**
+ * @brief Clockwise order of the roads of a four-leg junction
+ */
+static const uint8_t SimCompassOrder[] = {[NORTH] = 0, [SOUTH] = 2, [WEST] = 3, [EAST] = 1};
+
+/**
+ * @brief Get path type
+ * @param start Path start road order
+ * @param end Path end road order
+ * @param roadCount Number of roads in the junction
+ * @return Path type
+ */
+static inline enum SimTurn SimGetTurn(uint8_t start, uint8_t end, uint8_t roadCount)
+{
+    //offset of the end road, counting clockwise
+    uint8_t offset = (end + roadCount - start) % roadCount;
+    if(0 == offset)
+        return SIM_TURN_U;
+    else if((roadCount - 1) == offset)
+        return SIM_TURN_RIGHT;
+    else if(1 == offset)
+        return SIM_TURN_LEFT;
+    else
+        return SIM_TURN_STRAIGHT;
+}
+
+/**
+ * @brief Check if point x lies strictly inside the clockwise arc from a to b
+ * @param x Checked point
+ * @param a Arc start
+ * @param b Arc end
+ * @param count Number of points on the circle
+ * @return True if inside, false otherwise
+ */
+static inline bool SimIsInsideArc(uint8_t x, uint8_t a, uint8_t b, uint8_t count)
+{
+    return (x != a) && (((x + count - a) % count) < ((b + count - a) % count));
+}
+
+/**
+ * @brief Check if two paths cross each other
+ *
+ * Each road has an incoming and an outgoing side, which are placed on a circle around the junction
+ * (right hand traffic). Paths with distinct ends cross if their chords intersect.
+ * @param startA Path A start road order
+ * @param endA Path A end road order
+ * @param startB Path B start road order
+ * @param endB Path B end road order
+ * @param roadCount Number of roads in the junction
+ * @return True if crossing, false otherwise
+ */
+static inline bool SimArePathsCrossing(uint8_t startA, uint8_t endA, uint8_t startB, uint8_t endB, uint8_t roadCount)
+{
+    uint8_t inA = 2 * startA, outA = 2 * endA + 1, inB = 2 * startB, outB = 2 * endB + 1;
+    uint8_t count = 2 * roadCount;
+    if((inA == inB) || (outA == outB))
+        return false;
+    return SimIsInsideArc(inB, inA, outA, count) != SimIsInsideArc(outB, inA, outA, count);
+}
+
+/**
+ * @brief Check whether two paths are colliding
+ * @param startA Path A start road order
+ * @param endA Path A end road order
+ * @param startB Path B start road order
+ * @param endB Path B end road order
+ * @param roadCount Number of roads in the junction
+ * @return True if colliding, false otherwise
+ */
+static inline bool SimArePathsColliding(uint8_t startA, uint8_t endA, uint8_t startB, uint8_t endB, uint8_t roadCount)
+{
+    if(endA == endB)
+        return true;
+
+    enum SimTurn turnA = SimGetTurn(startA, endA, roadCount), turnB = SimGetTurn(startB, endB, roadCount);
+
+    if((SIM_TURN_STRAIGHT == turnA) && (SIM_TURN_STRAIGHT == turnB))
+        return SimArePathsCrossing(startA, endA, startB, endB, roadCount);
+
+    if(((SIM_TURN_STRAIGHT == turnA) && (SIM_TURN_LEFT == turnB))
+    || ((SIM_TURN_LEFT == turnA) && (SIM_TURN_STRAIGHT == turnB)))
+        return true;
+
+    return false;
+}
+
+/**
+ * @brief Fill clockwise order and right hand side road of all roads in a junction, based on road bearings
+ * @param *road Roads
+ * @param roadCount Number of roads, up to MAX_ROADS
+ */
+static inline void SimSetupRoadGeometry(struct Road *road, uint8_t roadCount)
+{
+    uint8_t byOrder[MAX_ROADS];
+    for(uint8_t i = 0; i < roadCount; i++)
+    {
+        //roads with equal bearings are ordered by index
+        road[i].order = 0;
+        for(uint8_t k = 0; k < roadCount; k++)
+        {
+            if((road[k].bearing < road[i].bearing) || ((road[k].bearing == road[i].bearing) && (k < i)))
+                ++road[i].order;
+        }
+        byOrder[road[i].order] = i;
+    }
+    for(uint8_t i = 0; i < roadCount; i++)
+        road[i].right = byOrder[(road[i].order + roadCount - 1) % roadCount];
+}
+
 /**
  * @brief Check if given path is a straight path (N-S or W-E)
  * @param start Path start
@@ -11,13 +131,7 @@
  */
 static inline bool SimIsFlowStraight(enum Direction start, enum Direction end)
 {
-    if(((NORTH == start) && (SOUTH == end))
-        || ((SOUTH == start) && (NORTH == end))
-        || ((WEST == start) && (EAST == end))
-        || ((EAST == start) && (WEST == end)))
-        return true;
-    else
-        return false;
+    return SIM_TURN_STRAIGHT == SimGetTurn(SimCompassOrder[start], SimCompassOrder[end], 4);
 }
 
 /**
@@ -30,12 +144,8 @@ static inline bool SimAreFlowsIdentical(const struct Lane *laneA, const struct L
 {
     if(laneA->road != laneB->road)
         return false;
-    
-    if((laneA->direction.north && laneB->direction.north) || (laneA->direction.south && laneB->direction.south)
-    || (laneA->direction.west && laneB->direction.west) || (laneA->direction.east && laneB->direction.east))
-        return true;
 
-    return false;
+    return 0 != (laneA->direction.mask & laneB->direction.mask);
 }
 
 /**
@@ -49,12 +159,8 @@ static inline bool SimAreFlowsIdentical(const struct Lane *laneA, const struct L
 static inline bool SimIsFlowPerpendicular(enum Direction startA, enum Direction endA, enum Direction startB, enum Direction endB)
 {
     if(SimIsFlowStraight(startA, endA) && SimIsFlowStraight(startB, endB))
-    {
-        if(((NORTH == startA) || (SOUTH == startA)) && ((WEST == startB) || (EAST == startB)))
-            return true;
-        else if(((NORTH == startB) || (SOUTH == startB)) && ((WEST == startA) || (EAST == startA)))
-            return true;
-    }
+        return SimArePathsCrossing(SimCompassOrder[startA], SimCompassOrder[endA],
+            SimCompassOrder[startB], SimCompassOrder[endB], 4);
     return false;
 }
 
@@ -66,13 +172,7 @@ static inline bool SimIsFlowPerpendicular(enum Direction startA, enum Direction
  */
 static inline bool SimIsLeftTurn(enum Direction start, enum Direction end)
 {
-    if(((NORTH == start) && (EAST == end))
-    || ((SOUTH == start) && (WEST == end))
-    || ((WEST == start) && (NORTH == end))
-    || ((EAST == start) && (SOUTH == end)))
-        return true;
-    else
-        return false;
+    return SIM_TURN_LEFT == SimGetTurn(SimCompassOrder[start], SimCompassOrder[end], 4);
 }
 
 /**
@@ -83,13 +183,7 @@ static inline bool SimIsLeftTurn(enum Direction start, enum Direction end)
  */
 static inline bool SimIsRightTurn(enum Direction start, enum Direction end)
 {
-    if(((NORTH == start) && (WEST == end))
-    || ((SOUTH == start) && (EAST == end))
-    || ((WEST == start) && (SOUTH == end))
-    || ((EAST == start) && (NORTH == end)))
-        return true;
-    else
-        return false;
+    return SIM_TURN_RIGHT == SimGetTurn(SimCompassOrder[start], SimCompassOrder[end], 4);
 }
 
 /**
@@ -99,16 +193,7 @@ static inline bool SimIsRightTurn(enum Direction start, enum Direction end)
  */
 static inline bool SimCanTurnRightFromLane(const struct Lane *lane)
 {
-    if((NORTH == lane->road->position) && lane->direction.west)
-        return true;
-    else if((WEST == lane->road->position) && lane->direction.south)
-        return true;
-    else if((SOUTH == lane->road->position) && lane->direction.east)
-        return true;
-    else if((EAST == lane->road->position) && lane->direction.north)
-        return true;
-    else
-        return false;
+    return 0 != (lane->direction.mask & (1u << lane->road->right));
 }
 
 /**
@@ -120,147 +205,90 @@ static inline bool SimIsVehicleReady(const struct Lane *lane)
 {
     if((0 == lane->vehicleCount) || lane->blocked)
         return false;
-    
+
     if((LIGHT_DISABLED == lane->light) || (LIGHT_GREEN == lane->light))
         return true;
-    
-    if((LIGHT_ARROW == lane->light) && SimIsRightTurn(lane->road->position, lane->vehicles->direction))
+
+    if((LIGHT_ARROW == lane->light) && (lane->road->right == lane->vehicles->direction))
         return true;
-    
+
     return false;
 }
 
 /**
- * @brief Check whether two flows are colliding
- * @param *laneA Vehicle A starting lane
- * @param directionA Vehicle A direction
- * @param *laneB Vehicle B starting lane
- * @param direciotnB Vehicle B direction
- * @return True if colliding, false otherwise
+ * @brief Get maximum number of vehicles that can leave given lane in one step
+ * @param *lane Target lane
+ * @return Saturation flow, at least 1
  */
-static inline bool SimAreFlowsColliding(const struct Lane *laneA, enum Direction directionA, 
-    const struct Lane *laneB, enum Direction directionB)
+static inline uint32_t SimGetSaturationFlow(const struct Lane *lane)
 {
-    if(directionA == directionB)
-        return true;
-
-    if(SimIsFlowPerpendicular(laneA->road->position, directionA, laneB->road->position, directionB))
-        return true;
-    
-    if((SimIsFlowStraight(laneA->road->position, directionA) && SimIsLeftTurn(laneB->road->position, directionB))
-    || (SimIsLeftTurn(laneA->road->position, directionA) && SimIsFlowStraight(laneB->road->position, directionB)))
-        return true;
-    
-    return false;
+    return (0 == lane->saturationFlow) ? 1 : lane->saturationFlow;
 }
 
 /**
- * @brief Check whether one flow is colliding with other flows
- * @param *laneA Lane A
- * @param directionA Direction from lane A
- * @param *laneB Lane B
- * @return True if colliding, false otherwise
+ * @brief Convert lane parameter to fixed-point representation
+ * @param value Value
+ * @return Value in 1/SIM_FIXED_ONE units, rounded to nearest
+ * @note Scaling by a power of two is exact, so the result does not depend on the compiler or FPU settings
  */
-static inline bool SimIsOneFlowCollidingWithOthers(const struct Lane *laneA, enum Direction directionA, const struct Lane *laneB)
+static inline int64_t SimToFixed(float value)
 {
-    if(laneB->direction.north)
-        if(SimAreFlowsColliding(laneA, directionA, laneB, NORTH))
-            return true;
-    if(laneB->direction.south)
-        if(SimAreFlowsColliding(laneA, directionA, laneB, SOUTH))
-            return true;   
-    if(laneB->direction.west)
-        if(SimAreFlowsColliding(laneA, directionA, laneB, WEST))
-            return true;
-    if(laneB->direction.east)
-        if(SimAreFlowsColliding(laneA, directionA, laneB, EAST))
-            return true;
-    
-    return false;
+    float scaled = value * (float)SIM_FIXED_ONE;
+    return (scaled < 0.f) ? -(int64_t)(0.5f - scaled) : (int64_t)(scaled + 0.5f);
 }
 
 /**
- * @brief Check whether any two flows are colliding
- * @param *laneA Lane A
- * @param *laneB Lane B
- * @return True if colliding, false otherwise
+ * @brief Multiply two fixed-point values
+ * @param a Value A, in 1/SIM_FIXED_ONE units
+ * @param b Value B, in 1/SIM_FIXED_ONE units
+ * @return Product in 1/SIM_FIXED_ONE units, rounded toward negative infinity
  */
-static inline bool SimAreAnyFlowsColliding(const struct Lane *laneA, const struct Lane *laneB)
+static inline int64_t SimFixedMul(int64_t a, int64_t b)
 {
-    if(laneA->direction.north)
-        if(SimIsOneFlowCollidingWithOthers(laneA, NORTH, laneB))
-            return true;
-    if(laneA->direction.south)
-        if(SimIsOneFlowCollidingWithOthers(laneA, SOUTH, laneB))
-            return true;
-    if(laneA->direction.west)
-        if(SimIsOneFlowCollidingWithOthers(laneA, WEST, laneB))
-            return true;
-    if(laneA->direction.east)
-        if(SimIsOneFlowCollidingWithOthers(laneA, EAST, laneB))
-            return true;            
-    return false;
+    //the intermediate product may not fit 64 bits
+    return (int64_t)(((__int128)a * b) >> SIM_FIXED_SHIFT);
 }
 
 /**
- * @brief Check whether two vehicles are on a colliding paths
- * @param *vA Vehicle A
- * @param *vB Vehicle B
- * @return True if both vehicles are on a colliding paths, false otherwise
+ * @brief Check if the first vehicle at given lane is ready and the start-up lost time has elapsed
+ * @param *lane Target lane
+ * @return True if vehicles are flowing, false otherwise
  */
-static inline bool SimAreVehiclesColliding(const struct Vehicle *vA, const struct Vehicle *vB)
+static inline bool SimIsLaneFlowing(const struct Lane *lane)
 {
-    //corner case when vehicles are on the same road, but different lanes and have the same direction
-    //such a case is not a collision
-    if((vA->lane->road == vB->lane->road) && (vA->direction == vB->direction))
-        return false;
-    return SimAreFlowsColliding(vA->lane, vA->direction, vB->lane, vB->direction);
+    return (0 == lane->lostTimeLeft) && SimIsVehicleReady(lane);
 }
 
 /**
- * @brief Check whether Vehicle A is at the right hand side of the Vehicle B
- * @param *vA Vehicle A
- * @param *vB Vehicle B
- * @return True if Vehicle A is at the right hand side of the Vehicle B, false otherwise
+ * @brief Check if the first vehicle at given lane can leave in the current step
+ * @param *lane Target lane
+ * @return True if the vehicle can leave, false otherwise
  */
-static inline bool SimIsAtRightHand(const struct Vehicle *vA, const struct Vehicle *vB)
+static inline bool SimCanDischarge(const struct Lane *lane)
 {
-    enum Direction pA, pB;
-    pA = vA->lane->road->position;
-    pB = vB->lane->road->position;
+    return (lane->dischargedCount < SimGetSaturationFlow(lane)) && SimIsLaneFlowing(lane);
+}
 
-    if(((NORTH == pA) && (EAST == pB))
-    || ((WEST == pA) && (NORTH == pB))
-    || ((SOUTH == pA) && (WEST == pB))
-    || ((EAST == pA) && (SOUTH == pB)))
-        return true;
-    else
-        return false;
+/**
+ * @brief Check whether road A is at the right hand side of the road B
+ * @param *roadA Road A
+ * @param *roadB Road B
+ * @return True if road A is at the right hand side of the road B, false otherwise
+ */
+static inline bool SimIsRoadAtRightHand(const struct Road *roadA, const struct Road *roadB)
+{
+    return (roadA != roadB) && (roadB->right == roadA->position);
 }
 
 /**
- * @brief Check whether vehicle A takes precendce over vehicle B on a colliding path
+ * @brief Check whether Vehicle A is at the right hand side of the Vehicle B
  * @param *vA Vehicle A
  * @param *vB Vehicle B
- * @return True if Vehicle A has precedence over Vehicle B
+ * @return True if Vehicle A is at the right hand side of the Vehicle B, false otherwise
  */
-static bool SimTakesPrecedence(const struct Vehicle *vA, const struct Vehicle *vB)
+static inline bool SimIsAtRightHand(const struct Vehicle *vA, const struct Vehicle *vB)
 {
-    /*
-    A takes precedence over B when:
-    1. A has green light and B has green arrow
-    2. Both have green or lights are disabled and A is at the right side of B
-    3. Both have green or lights are disabled and B is not at the right side of B and
-        B is trying to turn left
-    */
-    if((LIGHT_GREEN == vA->lane->light) && (LIGHT_ARROW == vB->lane->light))
-        return true;
-    else if(SimIsAtRightHand(vA, vB))
-        return true;
-    else if(!SimIsAtRightHand(vB, vA) && SimIsLeftTurn(vB->lane->road->position, vB->direction))
-        return true;
-
-    return false;
+    return SimIsRoadAtRightHand(vA->lane->road, vB->lane->road);
 }
 
-#endif
\ No newline at end of file
+#endif
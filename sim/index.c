@@ -0,0 +1,173 @@
+#include "state.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Vehicle index is an open addressing hash table (linear probing) of vehicle pointers, keyed by vehicle names.
+Entries are removed using backward shift deletion, so there are no tombstones and lookups stay short.
+Vehicles with the same name are allowed, each one has its own entry.
+*/
+
+#define SIM_INDEX_MIN_CAPACITY 64 /**< Initial number of slots, must be a power of 2 */
+
+/**
+ * @brief Hash vehicle name (FNV-1a)
+ * @param *name Vehicle name
+ * @return Hash
+ */
+static size_t SimIndexHash(const char *name)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    while('\0' != *name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 0x100000001B3ULL;
+    }
+    return (size_t)hash;
+}
+
+/**
+ * @brief Resize index and rehash all entries
+ * @param *index Vehicle index
+ * @param capacity New capacity, must be a power of 2
+ * @return 0 on success, <0 on failure
+ */
+static int SimIndexResize(struct SimVehicleIndex *index, size_t capacity)
+{
+    struct Vehicle **slots = calloc(capacity, sizeof(*slots));
+    if(NULL == slots)
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+    for(size_t i = 0; i < index->capacity; i++)
+    {
+        if(NULL == index->slots[i])
+            continue;
+        size_t k = SimIndexHash(index->slots[i]->name) & (capacity - 1);
+        while(NULL != slots[k])
+            k = (k + 1) & (capacity - 1);
+        slots[k] = index->slots[i];
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return 0;
+}
+
+int SimIndexInsert(struct SimVehicleIndex *index, struct Vehicle *vehicle)
+{
+    //keep load factor at or below 1/2
+    if((2 * (index->count + 1)) > index->capacity)
+    {
+        if(0 != SimIndexResize(index, (0 == index->capacity) ? SIM_INDEX_MIN_CAPACITY : (2 * index->capacity)))
+            return -1;
+    }
+    size_t k = SimIndexHash(vehicle->name) & (index->capacity - 1);
+    while(NULL != index->slots[k])
+        k = (k + 1) & (index->capacity - 1);
+    index->slots[k] = vehicle;
+    ++index->count;
+    return 0;
+}
+
+int SimIndexReserve(struct SimVehicleIndex *index, size_t count)
+{
+    size_t capacity = (0 == index->capacity) ? SIM_INDEX_MIN_CAPACITY : index->capacity;
+    while((2 * count) > capacity)
+        capacity *= 2;
+    if(capacity == index->capacity)
+        return 0;
+    return SimIndexResize(index, capacity);
+}
+
+void SimIndexRemove(struct SimVehicleIndex *index, const struct Vehicle *vehicle)
+{
+    if(0 == index->count)
+        return;
+
+    size_t mask = index->capacity - 1;
+    size_t k = SimIndexHash(vehicle->name) & mask;
+    while(vehicle != index->slots[k])
+    {
+        if(NULL == index->slots[k])
+            return;
+        k = (k + 1) & mask;
+    }
+
+    //shift back entries that would not be reachable through the emptied slot
+    size_t hole = k;
+    while(1)
+    {
+        k = (k + 1) & mask;
+        if(NULL == index->slots[k])
+            break;
+        size_t home = SimIndexHash(index->slots[k]->name) & mask;
+        if(((k - home) & mask) >= ((k - hole) & mask))
+        {
+            index->slots[hole] = index->slots[k];
+            hole = k;
+        }
+    }
+    index->slots[hole] = NULL;
+    --index->count;
+}
+
+bool SimIndexContains(const struct SimVehicleIndex *index, const struct Vehicle *vehicle)
+{
+    if(0 == index->count)
+        return false;
+
+    size_t mask = index->capacity - 1;
+    size_t k = SimIndexHash(vehicle->name) & mask;
+    while(NULL != index->slots[k])
+    {
+        if(vehicle == index->slots[k])
+            return true;
+        k = (k + 1) & mask;
+    }
+    return false;
+}
+
+struct Vehicle* SimIndexFind(const struct SimVehicleIndex *index, const char *name)
+{
+    if(0 == index->count)
+        return NULL;
+
+    size_t mask = index->capacity - 1;
+    size_t k = SimIndexHash(name) & mask;
+    while(NULL != index->slots[k])
+    {
+        if(!strcmp(index->slots[k]->name, name))
+            return index->slots[k];
+        k = (k + 1) & mask;
+    }
+    return NULL;
+}
+
+void SimIndexClear(struct SimVehicleIndex *index)
+{
+    if(NULL != index->slots)
+        memset(index->slots, 0, index->capacity * sizeof(*index->slots));
+    index->count = 0;
+}
+
+int SimIndexCopy(struct SimVehicleIndex *dst, const struct SimVehicleIndex *src)
+{
+    dst->slots = NULL;
+    dst->capacity = 0;
+    dst->count = 0;
+    if(0 == src->capacity)
+        return 0;
+
+    dst->slots = malloc(src->capacity * sizeof(*dst->slots));
+    if(NULL == dst->slots)
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+    memcpy(dst->slots, src->slots, src->capacity * sizeof(*dst->slots));
+    dst->capacity = src->capacity;
+    dst->count = src->count;
+    return 0;
+}
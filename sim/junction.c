@@ -0,0 +1,365 @@
+#include "sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+#include "helpers.h"
+#include "state.h"
+
+/*
+Junction image layout (native byte order, no padding):
+* header,
+* one record per road, in road index order,
+* one record per lane, road after road,
+* path type (enum SimTurn) for each pair of roads, MAX_ROADS x MAX_ROADS bytes,
+* flow conflict bitsets, MAX_ROADS * MAX_ROADS words,
+* lane conflict bitsets, one bitset of laneWords words per lane,
+* phase bitsets, laneWords words per phase.
+The checksum (64-bit FNV-1a) covers everything following the header. The image holds no state, an instance
+loaded from it is initialized as by SimInit().
+*/
+
+#define SIM_JUNCTION_MAGIC 0x4E4A5354 /**< "TSJN" */
+#define SIM_JUNCTION_VERSION 1 /**< Junction image format version */
+
+#define SIM_FNV_OFFSET 0xCBF29CE484222325ULL /**< FNV-1a offset basis */
+#define SIM_FNV_PRIME 0x100000001B3ULL /**< FNV-1a prime */
+
+struct SimJunctionHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t selectionPolicy;
+    uint8_t timePolicy;
+    uint8_t phaseScheduling;
+    uint8_t fixedPoint;
+    uint8_t roadCount;
+    uint16_t numLanes;
+    uint16_t numPhases;
+    uint64_t size; /**< Image size, including the header */
+    uint64_t checksum; /**< Checksum of the image following the header */
+} __attribute__ ((packed));
+
+struct SimJunctionRoad
+{
+    uint16_t bearing;
+    uint8_t order;
+    uint8_t right;
+    uint16_t laneCount;
+} __attribute__ ((packed));
+
+struct SimJunctionLane
+{
+    uint8_t direction; /**< Allowed directions, bit n for road n */
+    uint8_t permissive;
+    float priority;
+    uint32_t minGreenTime;
+    uint32_t minRedTime;
+    uint32_t maxGreenTime;
+    uint32_t stepsPerVehicle;
+    uint32_t saturationFlow;
+    uint32_t startupLostTime;
+} __attribute__ ((packed));
+
+/**
+ * @brief Get junction image size
+ * @param roadCount Number of roads
+ * @param numLanes Number of lanes
+ * @param numPhases Number of phases
+ * @return Image size in bytes
+ */
+static size_t SimJunctionSize(size_t roadCount, size_t numLanes, size_t numPhases)
+{
+    return sizeof(struct SimJunctionHeader) + roadCount * sizeof(struct SimJunctionRoad)
+        + numLanes * sizeof(struct SimJunctionLane) + MAX_ROADS * MAX_ROADS
+        + (MAX_ROADS * MAX_ROADS + (numLanes + numPhases) * SimBitsetWords(numLanes)) * sizeof(uint64_t);
+}
+
+/**
+ * @brief Compute checksum of image data
+ * @param *data Data
+ * @param size Data size
+ * @return 64-bit FNV-1a hash
+ */
+static uint64_t SimJunctionChecksum(const uint8_t *data, size_t size)
+{
+    uint64_t hash = SIM_FNV_OFFSET;
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * SIM_FNV_PRIME;
+    return hash;
+}
+
+/**
+ * @brief Check that lane bitsets have no bits set above the last lane
+ * @param *data First bitset (not aligned)
+ * @param count Number of bitsets
+ * @param numLanes Number of lanes
+ * @return True if valid, false otherwise
+ */
+static bool SimJunctionBitsetsValid(const uint8_t *data, size_t count, size_t numLanes)
+{
+    size_t words = SimBitsetWords(numLanes);
+    if(0 == (numLanes % 64))
+        return true;
+    uint64_t unused = ~(((uint64_t)1 << (numLanes % 64)) - 1);
+    for(size_t i = 0; i < count; i++)
+    {
+        uint64_t last;
+        memcpy(&last, data + ((i + 1) * words - 1) * sizeof(last), sizeof(last));
+        if(last & unused)
+            return false;
+    }
+    return true;
+}
+
+int SimCompileJunction(struct SimConfig *config, FILE *f)
+{
+    if((NULL == config) || (NULL == f))
+        return -1;
+
+    int ret = -1;
+    uint8_t *image = NULL;
+    struct SimState state = {.config = config, .laneConflicts = NULL, .phases = NULL, .stepKey = UINT32_MAX};
+    if(0 != SimBuildTables(&state))
+        goto cleanup;
+    if(state.numLanes > UINT16_MAX)
+    {
+        printf("Junction has too many lanes\r\n");
+        goto cleanup;
+    }
+
+    size_t size = SimJunctionSize(config->roadCount, state.numLanes, state.numPhases);
+    image = malloc(size);
+    if(NULL == image)
+    {
+        printf("Memory allocation failed\r\n");
+        goto cleanup;
+    }
+
+    struct SimJunctionHeader header = {
+        .magic = SIM_JUNCTION_MAGIC,
+        .version = SIM_JUNCTION_VERSION,
+        .selectionPolicy = config->selectionPolicy,
+        .timePolicy = config->timePolicy,
+        .phaseScheduling = config->phaseScheduling,
+        .fixedPoint = config->fixedPoint,
+        .roadCount = config->roadCount,
+        .numLanes = state.numLanes,
+        .numPhases = state.numPhases,
+        .size = size,
+    };
+    uint8_t *p = image + sizeof(header);
+    for(uint8_t i = 0; i < config->roadCount; i++)
+    {
+        struct SimJunctionRoad road = {
+            .bearing = config->road[i].bearing,
+            .order = config->road[i].order,
+            .right = config->road[i].right,
+            .laneCount = config->road[i].laneCount,
+        };
+        memcpy(p, &road, sizeof(road));
+        p += sizeof(road);
+    }
+    for(size_t i = 0; i < state.numLanes; i++)
+    {
+        const struct Lane *lane = state.laneById[i];
+        struct SimJunctionLane record = {
+            .direction = lane->direction.mask,
+            .permissive = lane->permissive,
+            .priority = lane->priority,
+            .minGreenTime = lane->minGreenTime,
+            .minRedTime = lane->minRedTime,
+            .maxGreenTime = lane->maxGreenTime,
+            .stepsPerVehicle = lane->stepsPerVehicle,
+            .saturationFlow = lane->saturationFlow,
+            .startupLostTime = lane->startupLostTime,
+        };
+        memcpy(p, &record, sizeof(record));
+        p += sizeof(record);
+    }
+    memcpy(p, state.turn, sizeof(state.turn));
+    p += sizeof(state.turn);
+    memcpy(p, state.flowConflicts, sizeof(state.flowConflicts));
+    p += sizeof(state.flowConflicts);
+    memcpy(p, state.laneConflicts, state.numLanes * state.laneWords * sizeof(uint64_t));
+    p += state.numLanes * state.laneWords * sizeof(uint64_t);
+    if(0 != state.numPhases)
+        memcpy(p, state.phases, state.numPhases * state.laneWords * sizeof(uint64_t));
+
+    header.checksum = SimJunctionChecksum(image + sizeof(header), size - sizeof(header));
+    memcpy(image, &header, sizeof(header));
+    if(1 != fwrite(image, size, 1, f))
+    {
+        printf("Unable to write junction image\r\n");
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    free(image);
+    free(state.laneConflicts);
+    free(state.phases);
+    return ret;
+}
+
+struct SimState* SimLoadJunction(const void *image, size_t size)
+{
+    const uint8_t *data = image;
+    struct SimJunctionHeader header;
+    if((NULL == data) || (size < sizeof(header)))
+    {
+        printf("Junction image is truncated\r\n");
+        return NULL;
+    }
+    memcpy(&header, data, sizeof(header));
+    if((SIM_JUNCTION_MAGIC != header.magic) || (SIM_JUNCTION_VERSION != header.version))
+    {
+        printf("Not a junction image or unsupported version\r\n");
+        return NULL;
+    }
+    if((0 == header.roadCount) || (header.roadCount > MAX_ROADS) || (header.numPhases > SIM_MAX_PHASES)
+        || (header.phaseScheduling > 1) || (header.fixedPoint > 1) || (!header.phaseScheduling && (0 != header.numPhases))
+        || (header.size != size) || (SimJunctionSize(header.roadCount, header.numLanes, header.numPhases) != size))
+    {
+        printf("Junction image is malformed\r\n");
+        return NULL;
+    }
+    if(SimJunctionChecksum(data + sizeof(header), size - sizeof(header)) != header.checksum)
+    {
+        printf("Junction image checksum mismatch\r\n");
+        return NULL;
+    }
+
+    size_t numLanes = header.numLanes, words = SimBitsetWords(numLanes);
+    const uint8_t *roadData = data + sizeof(header);
+    const uint8_t *laneData = roadData + header.roadCount * sizeof(struct SimJunctionRoad);
+    const uint8_t *turnData = laneData + numLanes * sizeof(struct SimJunctionLane);
+    const uint8_t *flowData = turnData + MAX_ROADS * MAX_ROADS;
+    const uint8_t *conflictData = flowData + MAX_ROADS * MAX_ROADS * sizeof(uint64_t);
+    const uint8_t *phaseData = conflictData + numLanes * words * sizeof(uint64_t);
+
+    //tables are used as they are, so everything they refer to must be within the junction
+    struct SimJunctionRoad roads[MAX_ROADS];
+    memcpy(roads, roadData, header.roadCount * sizeof(*roads));
+    size_t laneSum = 0;
+    uint8_t orders = 0;
+    bool valid = true;
+    for(uint8_t i = 0; i < header.roadCount; i++)
+    {
+        valid &= (roads[i].order < header.roadCount) && (roads[i].right < header.roadCount);
+        orders |= (uint8_t)(1u << (roads[i].order % MAX_ROADS));
+        laneSum += roads[i].laneCount;
+    }
+    valid &= (laneSum == numLanes) && (orders == (uint8_t)((1u << header.roadCount) - 1));
+    for(size_t i = 0; valid && (i < numLanes); i++)
+    {
+        struct SimJunctionLane lane;
+        memcpy(&lane, laneData + i * sizeof(lane), sizeof(lane));
+        valid &= (0 == (lane.direction >> header.roadCount)) && (lane.permissive <= 1);
+    }
+    for(size_t i = 0; i < (MAX_ROADS * MAX_ROADS); i++)
+        valid &= (turnData[i] <= SIM_TURN_LEFT);
+    for(size_t i = 0; i < (MAX_ROADS * MAX_ROADS); i++)
+    {
+        uint64_t conflicts;
+        memcpy(&conflicts, flowData + i * sizeof(conflicts), sizeof(conflicts));
+        for(uint8_t k = 0; k < MAX_ROADS; k++)
+        {
+            //flows starting or ending at a road that does not exist
+            if(((i / MAX_ROADS) >= header.roadCount) || ((i % MAX_ROADS) >= header.roadCount) || (k >= header.roadCount))
+                valid &= (0 == (uint8_t)(conflicts >> (k * MAX_ROADS)));
+            else
+                valid &= (0 == ((uint8_t)(conflicts >> (k * MAX_ROADS)) >> header.roadCount));
+        }
+    }
+    valid &= SimJunctionBitsetsValid(conflictData, numLanes, numLanes)
+        && SimJunctionBitsetsValid(phaseData, header.numPhases, numLanes);
+    if(!valid)
+    {
+        printf("Junction image is malformed\r\n");
+        return NULL;
+    }
+
+    struct SimState *instance = malloc(sizeof(*instance));
+    if(NULL == instance)
+    {
+        printf("Memory allocation failed\r\n");
+        return NULL;
+    }
+    *instance = (struct SimState){.nextVehicle = 1, .logEvents = SimState->logEvents, .stepKey = UINT32_MAX};
+    instance->forkedConfig = (struct SimConfig){
+        .roadCount = header.roadCount,
+        .selectionPolicy = header.selectionPolicy,
+        .timePolicy = header.timePolicy,
+        .phaseScheduling = header.phaseScheduling,
+        .fixedPoint = header.fixedPoint,
+    };
+    instance->config = &instance->forkedConfig;
+
+    //roads and lanes are allocated in one block, as for a forked instance
+    size_t roadsSize = (header.roadCount * sizeof(struct Road) + SIM_CACHE_LINE - 1) & ~(size_t)(SIM_CACHE_LINE - 1);
+    struct Road *road = aligned_alloc(SIM_CACHE_LINE, roadsSize + numLanes * sizeof(struct Lane));
+    if(NULL == road)
+    {
+        printf("Memory allocation failed\r\n");
+        free(instance);
+        return NULL;
+    }
+    struct Lane *lanes = (struct Lane*)((uint8_t*)road + roadsSize);
+    memset(road, 0, roadsSize + numLanes * sizeof(struct Lane));
+    instance->config->road = road;
+    for(uint8_t i = 0; i < header.roadCount; i++)
+    {
+        road[i].position = i;
+        road[i].bearing = roads[i].bearing;
+        road[i].order = roads[i].order;
+        road[i].right = roads[i].right;
+        road[i].laneCount = roads[i].laneCount;
+        road[i].lane = lanes;
+        for(size_t k = 0; k < road[i].laneCount; k++)
+        {
+            struct SimJunctionLane record;
+            memcpy(&record, laneData, sizeof(record));
+            laneData += sizeof(record);
+            struct Lane *lane = &lanes[k];
+            lane->road = &road[i];
+            lane->direction.mask = record.direction;
+            lane->permissive = record.permissive;
+            lane->priority = record.priority;
+            lane->minGreenTime = record.minGreenTime;
+            lane->minRedTime = record.minRedTime;
+            lane->maxGreenTime = record.maxGreenTime;
+            lane->stepsPerVehicle = record.stepsPerVehicle;
+            lane->saturationFlow = record.saturationFlow;
+            lane->startupLostTime = record.startupLostTime;
+        }
+        lanes += road[i].laneCount;
+    }
+
+    if(0 != SimAllocateTables(instance))
+    {
+        SimRelease(instance);
+        return NULL;
+    }
+    if(0 != header.numPhases)
+    {
+        instance->phases = malloc(header.numPhases * words * sizeof(uint64_t));
+        if(NULL == instance->phases)
+        {
+            printf("Memory allocation failed\r\n");
+            SimRelease(instance);
+            return NULL;
+        }
+        memcpy(instance->phases, phaseData, header.numPhases * words * sizeof(uint64_t));
+    }
+    instance->numPhases = header.numPhases;
+    memcpy(instance->turn, turnData, sizeof(instance->turn));
+    memcpy(instance->flowConflicts, flowData, sizeof(instance->flowConflicts));
+    memcpy(instance->laneConflicts, conflictData, numLanes * words * sizeof(uint64_t));
+    SimResetSchedule(instance);
+
+    struct SimState *selected = SimState;
+    SimState = instance;
+    SimResetState();
+    SimState = selected;
+    return instance;
+}
@@ -0,0 +1,129 @@
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+#include "state.h"
+
+/**
+ * @brief Phase enumeration context
+ */
+struct SimPhaseSearch
+{
+    struct SimState *state; /**< Simulation instance */
+    const uint64_t *compatible; /**< For each lane: bitset of lanes that may have green light at the same time */
+    uint64_t *scratch; /**< Bitsets of all recursion levels */
+    bool overflow; /**< Too many phases */
+};
+
+/**
+ * @brief Find all maximal cliques extending given one (Bron-Kerbosch algorithm with pivoting)
+ * @param *search Search context
+ * @param *r Current clique
+ * @param *p Candidate lanes, compatible with the whole clique
+ * @param *x Lanes compatible with the whole clique, already used as an extension in another branch
+ */
+static void SimFindPhases(struct SimPhaseSearch *search, const uint64_t *r, uint64_t *p, uint64_t *x)
+{
+    struct SimState *state = search->state;
+    size_t words = state->laneWords;
+    if(!SimBitsetIntersects(p, p, words) && !SimBitsetIntersects(x, x, words))
+    {
+        if(SIM_MAX_PHASES == state->numPhases)
+        {
+            search->overflow = true;
+            return;
+        }
+        memcpy(&state->phases[state->numPhases++ * words], r, words * sizeof(*r));
+        return;
+    }
+
+    //pivot: the lane compatible with most candidates, only its incompatible candidates are branched on
+    size_t pivot = 0, best = 0;
+    for(size_t i = 0; i < state->numLanes; i++)
+    {
+        if(!SimBitsetTest(p, i) && !SimBitsetTest(x, i))
+            continue;
+        size_t count = 0;
+        for(size_t w = 0; w < words; w++)
+            count += __builtin_popcountll(p[w] & search->compatible[i * words + w]);
+        if(count >= best)
+        {
+            best = count;
+            pivot = i;
+        }
+    }
+
+    uint64_t *nextR = search->scratch;
+    uint64_t *nextP = nextR + words;
+    uint64_t *nextX = nextP + words;
+    search->scratch += 3 * words;
+    for(size_t i = 0; (i < state->numLanes) && !search->overflow; i++)
+    {
+        const uint64_t *neighbours = &search->compatible[i * words];
+        if(!SimBitsetTest(p, i) || SimBitsetTest(&search->compatible[pivot * words], i))
+            continue;
+        for(size_t w = 0; w < words; w++)
+        {
+            nextR[w] = r[w];
+            nextP[w] = p[w] & neighbours[w];
+            nextX[w] = x[w] & neighbours[w];
+        }
+        SimBitsetSet(nextR, i);
+        SimFindPhases(search, nextR, nextP, nextX);
+        SimBitsetReset(p, i);
+        SimBitsetSet(x, i);
+    }
+    search->scratch -= 3 * words;
+}
+
+int SimBuildPhases(struct SimState *state)
+{
+    free(state->phases);
+    state->phases = NULL;
+    state->numPhases = 0;
+    if(!state->config->phaseScheduling)
+        return 0;
+
+    size_t words = state->laneWords, numLanes = state->numLanes;
+    //compatibility matrix, then the bitsets of each recursion level (at most one level per lane) and the root sets
+    uint64_t *block = malloc((numLanes + 3 * (numLanes + 2)) * words * sizeof(uint64_t));
+    state->phases = malloc(SIM_MAX_PHASES * words * sizeof(uint64_t));
+    if((NULL == block) || (NULL == state->phases))
+    {
+        printf("Memory allocation failed\r\n");
+        free(block);
+        free(state->phases);
+        state->phases = NULL;
+        return -1;
+    }
+
+    uint64_t *compatible = block;
+    for(size_t i = 0; i < numLanes; i++)
+    {
+        SimBitsetClear(&compatible[i * words], words);
+        for(size_t k = 0; k < numLanes; k++)
+        {
+            if((i != k) && !SimBitsetTest(&state->laneConflicts[i * words], k)
+                && !SimBitsetTest(&state->laneConflicts[k * words], i))
+                SimBitsetSet(&compatible[i * words], k);
+        }
+    }
+
+    uint64_t *r = compatible + numLanes * words, *p = r + words, *x = p + words;
+    SimBitsetClear(r, 3 * words);
+    for(size_t i = 0; i < numLanes; i++)
+        SimBitsetSet(p, i);
+    struct SimPhaseSearch search = {.state = state, .compatible = compatible, .scratch = x + words, .overflow = false};
+    SimFindPhases(&search, r, p, x);
+    free(block);
+    if(search.overflow)
+    {
+        printf("Junction has more than %u phases, use lane scheduling instead\r\n", (unsigned int)SIM_MAX_PHASES);
+        free(state->phases);
+        state->phases = NULL;
+        state->numPhases = 0;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,524 @@
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "state.h"
+#include "bitset.h"
+
+#define SIM_PROFILE_RING_SIZE (1 << 15) /**< Number of units in the ring buffer, power of 2 (512 KiB, stays in cache) */
+#define SIM_PROFILE_DELTA_SHIFT 4 /**< Times relative to a step start or span end are stored in units of 16 ticks */
+#define SIM_PROFILE_BUFFER_SIZE 65536 /**< Size of the output text buffer */
+#define SIM_PROFILE_MAX_EVENT 256 /**< Maximum length of an event text */
+#define SIM_PROFILE_RELEASE_INTERVAL 256 /**< Units converted before the ring space is given back to the simulation */
+#define SIM_PROFILE_IDLE_NS 1000000 /**< Writer sleep time when the ring buffer is empty */
+#define SIM_PROFILE_CALIBRATION_NS 2000000 /**< Time the ticks are calibrated over */
+
+/**
+ * @brief Profile record type
+ */
+enum SimProfileRecordType
+{
+    SIM_PROFILE_RECORD_STEP = 1, /**< Step with all phases, followed by a unit of phase times */
+    SIM_PROFILE_RECORD_STEP_VEHICLES, /**< Step with vehicle movement only (right-hand rule), followed by a unit of phase times */
+    SIM_PROFILE_RECORD_SPAN, /**< Span recorded by the driver */
+    SIM_PROFILE_RECORD_QUEUE, /**< Queue length at the end of the last step */
+};
+
+/**
+ * @brief Record passed from the simulation to the writer, one ring buffer unit
+ *
+ * A step takes two units, the second one holds the selection, switching and vehicle movement start
+ * and the step end relative to the step start (see SIM_PROFILE_DELTA_SHIFT). Records are kept this small,
+ * so that the ring buffer stays in cache and every step writes only a few cache lines.
+ */
+union SimProfileRecord
+{
+    struct
+    {
+        uint8_t type; /**< Record type */
+        uint8_t span; /**< Span (span) */
+        uint16_t unused;
+        uint32_t value; /**< Step (step), duration relative to the end (span), lane index (queue) */
+        uint64_t time; /**< Start (step), end (span), queue length (queue) */
+    };
+    uint32_t delta[SIM_PROFILE_MARKS]; /**< Phase starts following the first one and step end (second unit of a step) */
+};
+
+_Static_assert(16 == sizeof(union SimProfileRecord), "Profile record must be 16 bytes");
+
+struct SimProfile
+{
+    FILE *f; /**< Profile file */
+    struct SimState *state; /**< Instance the profile is attached to */
+    union SimProfileRecord *ring; /**< Ring buffer */
+    uint8_t *laneRoad; /**< Road index of each lane */
+    uint32_t *laneIndex; /**< Index of each lane within its road */
+    uint64_t origin; /**< Ticks at the start of the recording */
+    double nsPerTick; /**< Tick length */
+    atomic_bool stop; /**< Writer must convert the remaining records and exit */
+    pthread_t writer; /**< Writer thread */
+    //written by the simulation
+    _Alignas(SIM_CACHE_LINE) atomic_size_t head; /**< Number of units put by the simulation */
+    size_t cachedTail; /**< Last tail read by the simulation */
+    size_t dropped; /**< Number of records dropped, because the ring buffer was full */
+    uint64_t last; /**< End of the last span or step */
+    uint64_t marks[SIM_PROFILE_MARKS]; /**< Phase starts of the current step */
+    uint32_t *queue; /**< Last recorded queue length of each lane */
+    uint64_t *changed; /**< Bitset of lanes whose queue changed since the last recorded step */
+    //written by the writer thread
+    _Alignas(SIM_CACHE_LINE) atomic_size_t tail; /**< Number of units taken by the writer */
+    uint64_t stepEnd; /**< End of the last converted step */
+    char *buffer; /**< Output text buffer */
+    size_t size; /**< Number of bytes in the output text buffer */
+    bool failed; /**< Profile could not be written */
+};
+
+static const char *const SimProfileSpanNames[] = {
+    [SIM_PROFILE_COMMANDS] = "Commands", [SIM_PROFILE_OUTPUT] = "Output",
+    [SIM_PROFILE_CHECKPOINT] = "Checkpoint", [SIM_PROFILE_FINISH] = "Finish",
+};
+
+static const char *const SimProfilePhaseNames[SIM_PROFILE_MARKS] = {
+    [SIM_PROFILE_STEP_START] = "SimHandleRedLights", [SIM_PROFILE_SELECTION_START] = "SimHandleSelection",
+    [SIM_PROFILE_SWITCH_START] = "SimHandleSwitchToGreen", [SIM_PROFILE_VEHICLES_START] = "SimHandleVehicles",
+};
+
+/**
+ * @brief Get ring buffer space for a record
+ * @param *profile Profile
+ * @param count Number of units
+ * @return Unit to fill first (the following ones are get with SimProfileUnit()), NULL if the ring buffer is full
+ * (the record is dropped)
+ */
+static inline union SimProfileRecord* SimProfileReserve(struct SimProfile *profile, size_t count)
+{
+    size_t head = atomic_load_explicit(&profile->head, memory_order_relaxed);
+    //the tail is read again only when the ring buffer looks full
+    if((head + count - profile->cachedTail) > SIM_PROFILE_RING_SIZE)
+    {
+        profile->cachedTail = atomic_load_explicit(&profile->tail, memory_order_acquire);
+        if((head + count - profile->cachedTail) > SIM_PROFILE_RING_SIZE)
+        {
+            ++profile->dropped;
+            return NULL;
+        }
+    }
+    return &profile->ring[head & (SIM_PROFILE_RING_SIZE - 1)];
+}
+
+/**
+ * @brief Get ring buffer unit following the reserved or the converted one
+ * @param *profile Profile
+ * @param position Unit position (head or tail) plus offset
+ * @return Unit
+ */
+static inline union SimProfileRecord* SimProfileUnit(struct SimProfile *profile, size_t position)
+{
+    return &profile->ring[position & (SIM_PROFILE_RING_SIZE - 1)];
+}
+
+/**
+ * @brief Pass record filled after SimProfileReserve() to the writer
+ * @param *profile Profile
+ * @param count Number of units
+ */
+static inline void SimProfileCommit(struct SimProfile *profile, size_t count)
+{
+    size_t head = atomic_load_explicit(&profile->head, memory_order_relaxed);
+    atomic_store_explicit(&profile->head, head + count, memory_order_release);
+}
+
+/**
+ * @brief Get time relative to an earlier time
+ * @param from Earlier time
+ * @param to Time
+ * @return Difference in units of SIM_PROFILE_DELTA_SHIFT ticks, saturated
+ */
+static inline uint32_t SimProfileDelta(uint64_t from, uint64_t to)
+{
+    uint64_t delta = (to - from) >> SIM_PROFILE_DELTA_SHIFT;
+    return (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t)delta;
+}
+
+void SimProfileSpan(struct SimProfile *profile, enum SimProfileSpan span)
+{
+    uint64_t end = SimProfileNow();
+    union SimProfileRecord *record = SimProfileReserve(profile, 1);
+    if(NULL != record)
+    {
+        record->type = SIM_PROFILE_RECORD_SPAN;
+        record->span = span;
+        record->value = SimProfileDelta(profile->last, end);
+        record->time = end;
+        SimProfileCommit(profile, 1);
+    }
+    profile->last = end;
+}
+
+void SimProfileMarkQueue(struct SimProfile *profile, const struct Lane *lane)
+{
+    SimBitsetSet(profile->changed, lane->id);
+}
+
+void SimProfileEndStep(struct SimProfile *profile)
+{
+    struct SimState *state = profile->state;
+    uint64_t end = SimProfileNow();
+    profile->last = end;
+    union SimProfileRecord *record = SimProfileReserve(profile, 2);
+    if(NULL != record)
+    {
+        uint64_t start = profile->marks[SIM_PROFILE_STEP_START];
+        record->type = (SIM_RIGHT_HAND_RULE == state->config->selectionPolicy)
+            ? SIM_PROFILE_RECORD_STEP_VEHICLES : SIM_PROFILE_RECORD_STEP;
+        record->value = state->step - 1;
+        record->time = start;
+        size_t head = atomic_load_explicit(&profile->head, memory_order_relaxed);
+        uint32_t *delta = SimProfileUnit(profile, head + 1)->delta;
+        for(size_t i = 1; i < SIM_PROFILE_MARKS; i++)
+            delta[i - 1] = SimProfileDelta(start, profile->marks[i]);
+        delta[SIM_PROFILE_MARKS - 1] = SimProfileDelta(start, end);
+        SimProfileCommit(profile, 2);
+    }
+
+    //queue records take the time of the step they follow
+    for(size_t w = 0; w < state->laneWords; w++)
+    {
+        for(uint64_t bits = profile->changed[w]; 0 != bits; bits &= bits - 1)
+        {
+            size_t id = w * 64 + __builtin_ctzll(bits);
+            uint32_t length = state->laneById[id]->vehicleCount;
+            //vehicles that arrived and left within the step cancel out
+            if(length == profile->queue[id])
+                continue;
+            profile->queue[id] = length;
+            union SimProfileRecord *queue = SimProfileReserve(profile, 1);
+            if(NULL == queue)
+                continue;
+            queue->type = SIM_PROFILE_RECORD_QUEUE;
+            queue->value = id;
+            queue->time = length;
+            SimProfileCommit(profile, 1);
+        }
+        profile->changed[w] = 0;
+    }
+}
+
+/**
+ * @brief Write buffered text to the file
+ * @param *profile Profile
+ */
+static void SimProfileFlush(struct SimProfile *profile)
+{
+    if((0 != profile->size) && (profile->size != fwrite(profile->buffer, 1, profile->size, profile->f)))
+        profile->failed = true;
+    profile->size = 0;
+}
+
+/**
+ * @brief Append string to the text buffer
+ * @param *profile Profile
+ * @param *str String
+ */
+static void SimProfileAppend(struct SimProfile *profile, const char *str)
+{
+    size_t length = strlen(str);
+    memcpy(profile->buffer + profile->size, str, length);
+    profile->size += length;
+}
+
+/**
+ * @brief Append decimal number to the text buffer
+ * @param *profile Profile
+ * @param value Number
+ */
+static void SimProfileAppendNumber(struct SimProfile *profile, uint64_t value)
+{
+    char digits[20];
+    size_t n = 0;
+    do
+    {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    }
+    while(0 != value);
+    while(0 != n)
+        profile->buffer[profile->size++] = digits[--n];
+}
+
+/**
+ * @brief Convert ticks to nanoseconds since the start of the recording
+ * @param *profile Profile
+ * @param ticks Time (see SimProfileNow())
+ * @return Nanoseconds
+ */
+static uint64_t SimProfileToNs(const struct SimProfile *profile, uint64_t ticks)
+{
+    return (ticks > profile->origin) ? (uint64_t)((double)(ticks - profile->origin) * profile->nsPerTick) : 0;
+}
+
+/**
+ * @brief Append nanoseconds as microseconds with 3 decimal places to the text buffer
+ * @param *profile Profile
+ * @param ns Nanoseconds
+ */
+static void SimProfileAppendMicros(struct SimProfile *profile, uint64_t ns)
+{
+    SimProfileAppendNumber(profile, ns / 1000);
+    unsigned int fraction = ns % 1000;
+    char text[5] = {'.', '0' + (fraction / 100), '0' + ((fraction / 10) % 10), '0' + (fraction % 10), '\0'};
+    SimProfileAppend(profile, text);
+}
+
+/**
+ * @brief Append complete event (span) to the text buffer, without the closing brace
+ * @param *profile Profile
+ * @param *name Event name
+ * @param start Start time
+ * @param end End time
+ */
+static void SimProfileAppendSpan(struct SimProfile *profile, const char *name, uint64_t start, uint64_t end)
+{
+    if((profile->size + SIM_PROFILE_MAX_EVENT) > SIM_PROFILE_BUFFER_SIZE)
+        SimProfileFlush(profile);
+    //the duration is the difference of the converted times, so that nested spans share their bounds exactly
+    uint64_t startNs = SimProfileToNs(profile, start);
+    uint64_t endNs = SimProfileToNs(profile, end);
+    SimProfileAppend(profile, ",\n{\"name\":\"");
+    SimProfileAppend(profile, name);
+    SimProfileAppend(profile, "\",\"ph\":\"X\",\"ts\":");
+    SimProfileAppendMicros(profile, startNs);
+    SimProfileAppend(profile, ",\"dur\":");
+    SimProfileAppendMicros(profile, (endNs > startNs) ? (endNs - startNs) : 0);
+    SimProfileAppend(profile, ",\"pid\":1,\"tid\":1");
+}
+
+/**
+ * @brief Append queue length counter event to the text buffer
+ * @param *profile Profile
+ * @param id Lane index
+ * @param length Queue length
+ * @param time Time
+ */
+static void SimProfileAppendQueue(struct SimProfile *profile, size_t id, uint32_t length, uint64_t time)
+{
+    if((profile->size + SIM_PROFILE_MAX_EVENT) > SIM_PROFILE_BUFFER_SIZE)
+        SimProfileFlush(profile);
+    SimProfileAppend(profile, ",\n{\"name\":\"Road ");
+    SimProfileAppendNumber(profile, profile->laneRoad[id]);
+    SimProfileAppend(profile, " lane ");
+    SimProfileAppendNumber(profile, profile->laneIndex[id]);
+    SimProfileAppend(profile, "\",\"ph\":\"C\",\"ts\":");
+    SimProfileAppendMicros(profile, SimProfileToNs(profile, time));
+    SimProfileAppend(profile, ",\"pid\":1,\"args\":{\"queue\":");
+    SimProfileAppendNumber(profile, length);
+    SimProfileAppend(profile, "}}");
+}
+
+/**
+ * @brief Convert record to events
+ * @param *profile Profile
+ * @param position Position of the first record unit
+ * @return Number of units converted
+ */
+static size_t SimProfileConvert(struct SimProfile *profile, size_t position)
+{
+    const union SimProfileRecord *record = SimProfileUnit(profile, position);
+    switch(record->type)
+    {
+        case SIM_PROFILE_RECORD_STEP:
+        case SIM_PROFILE_RECORD_STEP_VEHICLES:
+        {
+            const uint32_t *delta = SimProfileUnit(profile, position + 1)->delta;
+            uint64_t time[SIM_PROFILE_MARKS + 1];
+            time[SIM_PROFILE_STEP_START] = record->time;
+            for(size_t i = 1; i <= SIM_PROFILE_MARKS; i++)
+                time[i] = record->time + ((uint64_t)delta[i - 1] << SIM_PROFILE_DELTA_SHIFT);
+            SimProfileAppendSpan(profile, "Step", time[SIM_PROFILE_STEP_START], time[SIM_PROFILE_MARKS]);
+            SimProfileAppend(profile, ",\"args\":{\"step\":");
+            SimProfileAppendNumber(profile, record->value);
+            SimProfileAppend(profile, "}}");
+            for(size_t i = (SIM_PROFILE_RECORD_STEP == record->type) ? 0 : SIM_PROFILE_VEHICLES_START; i < SIM_PROFILE_MARKS; i++)
+            {
+                SimProfileAppendSpan(profile, SimProfilePhaseNames[i], time[i], time[i + 1]);
+                SimProfileAppend(profile, "}");
+            }
+            profile->stepEnd = time[SIM_PROFILE_MARKS];
+            return 2;
+        }
+        case SIM_PROFILE_RECORD_SPAN:
+            SimProfileAppendSpan(profile, SimProfileSpanNames[record->span],
+                record->time - ((uint64_t)record->value << SIM_PROFILE_DELTA_SHIFT), record->time);
+            SimProfileAppend(profile, "}");
+            return 1;
+        case SIM_PROFILE_RECORD_QUEUE:
+            SimProfileAppendQueue(profile, record->value, record->time, profile->stepEnd);
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief Convert all records put to the ring buffer so far
+ * @param *profile Profile
+ * @return Number of units converted
+ */
+static size_t SimProfileDrain(struct SimProfile *profile)
+{
+    size_t tail = atomic_load_explicit(&profile->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&profile->head, memory_order_acquire);
+    size_t released = tail;
+    for(size_t i = tail; i != head; )
+    {
+        i += SimProfileConvert(profile, i);
+        if((i - released) >= SIM_PROFILE_RELEASE_INTERVAL)
+        {
+            atomic_store_explicit(&profile->tail, i, memory_order_release);
+            released = i;
+        }
+    }
+    atomic_store_explicit(&profile->tail, head, memory_order_release);
+    return head - tail;
+}
+
+/**
+ * @brief Writer thread: convert records until stopped
+ * @param *arg Profile
+ * @return NULL
+ */
+static void* SimProfileWriter(void *arg)
+{
+    struct SimProfile *profile = arg;
+    while(1)
+    {
+        //records put before the stop request are converted by the last pass
+        bool stop = atomic_load_explicit(&profile->stop, memory_order_acquire);
+        size_t converted = SimProfileDrain(profile);
+        if(stop)
+            break;
+        if(0 == converted)
+        {
+            SimProfileFlush(profile);
+            nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = SIM_PROFILE_IDLE_NS}, NULL);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Measure tick length
+ * @return Nanoseconds per tick
+ */
+static double SimProfileCalibrate(void)
+{
+#ifdef SIM_PROFILE_TSC
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t startTicks = SimProfileNow();
+    nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = SIM_PROFILE_CALIBRATION_NS}, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t endTicks = SimProfileNow();
+    double ns = (double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec);
+    return (endTicks > startTicks) ? (ns / (double)(endTicks - startTicks)) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+/**
+ * @brief Release profile memory
+ * @param *profile Profile
+ */
+static void SimProfileFree(struct SimProfile *profile)
+{
+    free(profile->ring);
+    free(profile->queue);
+    free(profile->changed);
+    free(profile->laneRoad);
+    free(profile->laneIndex);
+    free(profile->buffer);
+    free(profile);
+}
+
+struct SimProfile* SimProfileStart(FILE *f)
+{
+    struct SimProfile *profile = aligned_alloc(SIM_CACHE_LINE, (sizeof(*profile) + SIM_CACHE_LINE - 1) & ~(size_t)(SIM_CACHE_LINE - 1));
+    if(NULL == profile)
+    {
+        printf("Memory allocation failed\r\n");
+        return NULL;
+    }
+    memset(profile, 0, sizeof(*profile));
+    size_t numLanes = SimState->numLanes;
+    profile->ring = aligned_alloc(SIM_CACHE_LINE, SIM_PROFILE_RING_SIZE * sizeof(*profile->ring));
+    profile->queue = malloc(numLanes * sizeof(*profile->queue) + 1);
+    profile->changed = calloc(SimState->laneWords + 1, sizeof(*profile->changed));
+    profile->laneRoad = malloc(numLanes + 1);
+    profile->laneIndex = malloc(numLanes * sizeof(*profile->laneIndex) + 1);
+    profile->buffer = malloc(SIM_PROFILE_BUFFER_SIZE);
+    if((NULL == profile->ring) || (NULL == profile->queue) || (NULL == profile->changed) || (NULL == profile->laneRoad)
+        || (NULL == profile->laneIndex) || (NULL == profile->buffer))
+    {
+        printf("Memory allocation failed\r\n");
+        SimProfileFree(profile);
+        return NULL;
+    }
+    profile->f = f;
+    profile->state = SimState;
+    atomic_init(&profile->stop, false);
+    atomic_init(&profile->head, 0);
+    atomic_init(&profile->tail, 0);
+    profile->nsPerTick = SimProfileCalibrate();
+    profile->origin = SimProfileNow();
+    profile->last = profile->origin;
+    profile->stepEnd = profile->origin;
+
+    SimProfileAppend(profile, "{\"traceEvents\":[\n"
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Simulation\"}}");
+    //counters start with the current queue lengths
+    for(size_t i = 0; i < numLanes; i++)
+    {
+        const struct Lane *lane = SimState->laneById[i];
+        profile->laneRoad[i] = lane->road->position;
+        profile->laneIndex[i] = lane - lane->road->lane;
+        profile->queue[i] = lane->vehicleCount;
+        SimProfileAppendQueue(profile, i, profile->queue[i], profile->origin);
+    }
+    SimProfileFlush(profile);
+    if(profile->failed || (0 != pthread_create(&profile->writer, NULL, SimProfileWriter, profile)))
+    {
+        printf("Unable to start profile\r\n");
+        SimProfileFree(profile);
+        return NULL;
+    }
+    SimState->profile = profile;
+    SimState->stepMarks = profile->marks;
+    return profile;
+}
+
+int SimProfileStop(struct SimProfile *profile)
+{
+    if(NULL == profile)
+        return -1;
+    atomic_store_explicit(&profile->stop, true, memory_order_release);
+    pthread_join(profile->writer, NULL);
+    if(profile->state->profile == profile)
+    {
+        profile->state->profile = NULL;
+        profile->state->stepMarks = NULL;
+    }
+    if(0 != profile->dropped)
+        printf("Profile: %zu events dropped\r\n", profile->dropped);
+
+    SimProfileAppend(profile, "\n],\n\"otherData\":{\"droppedEvents\":");
+    SimProfileAppendNumber(profile, profile->dropped);
+    SimProfileAppend(profile, "}}\n");
+    SimProfileFlush(profile);
+    if(0 != fflush(profile->f))
+        profile->failed = true;
+    int ret = profile->failed ? -1 : 0;
+    SimProfileFree(profile);
+    return ret;
+}
@@ -0,0 +1,90 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "sim.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SIM_PROFILE_TSC
+#endif
+
+/*
+Profile (trace-event JSON, loaded by chrome://tracing and Perfetto):
+{"traceEvents": [
+    {"name": "Step", "ph": "X", "ts": start, "dur": duration, "pid": 1, "tid": 1, "args": {"step": step}},
+    {"name": "SimHandleRedLights" | "SimHandleSelection" | "SimHandleSwitchToGreen" | "SimHandleVehicles", "ph": "X", ...},
+    {"name": "Commands" | "Output" | "Checkpoint" | "Finish", "ph": "X", ...},
+    {"name": "Road <road> lane <lane>", "ph": "C", "ts": time, "pid": 1, "args": {"queue": length}},
+    ...
+],
+"otherData": {"droppedEvents": count}}
+Times are in microseconds since the start of the recording. Each step is a span holding a span for each
+of its phases, the right-hand rule has no light phases. Queue lengths are counters, recorded at the end
+of the steps they changed in (including the changes made by the commands preceding the step).
+Phase bounds are recorded relative to the step start and span lengths relative to the span end in units
+of 16 ticks, so the times are exact to a few nanoseconds and spans longer than 2^36 ticks are cut.
+*/
+
+/**
+ * @brief Span recorded by the simulation driver
+ */
+enum SimProfileSpan
+{
+    SIM_PROFILE_COMMANDS = 0, /**< Reading and handling the input commands preceding a step */
+    SIM_PROFILE_OUTPUT, /**< Writing the output of a step */
+    SIM_PROFILE_CHECKPOINT, /**< Writing a checkpoint */
+    SIM_PROFILE_FINISH, /**< Writing the remaining output */
+};
+
+struct SimProfile; /**< Profile recorder (opaque) */
+
+/**
+ * @brief Get current time in profile ticks
+ * @return Ticks (time stamp counter on x86, nanoseconds otherwise)
+ */
+static inline uint64_t SimProfileNow(void)
+{
+#ifdef SIM_PROFILE_TSC
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Start profiling the selected instance
+ *
+ * The steps (split into phases), the spans recorded with SimProfileSpan() and the queue lengths are put
+ * to a lock-free ring buffer by the thread running the instance. The events are converted to trace-event JSON
+ * and written by a background thread. If the writer can't keep up, the events that don't fit the ring
+ * buffer are dropped and counted, the simulation never waits for it.
+ * @param *f Output file, must stay open until the recording is stopped
+ * @return Profile, NULL on failure
+ * @note The recording must be started after SimInit()
+ */
+struct SimProfile* SimProfileStart(FILE *f);
+
+/**
+ * @brief Record span ending now
+ *
+ * The span starts at the end of the previous span or step (or at the start of the recording), so the driver
+ * work between the steps is covered by taking a single timestamp per span.
+ * @param *profile Profile
+ * @param span Span
+ * @attention Must be called by the thread running the profiled instance
+ */
+void SimProfileSpan(struct SimProfile *profile, enum SimProfileSpan span);
+
+/**
+ * @brief Write remaining events, detach the profile from its instance and release it
+ * @param *profile Profile
+ * @return 0 on success, <0 if the profile could not be written
+ */
+int SimProfileStop(struct SimProfile *profile);
+
+#endif
@@ -1,26 +1,26 @@
 #include "sim.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "helpers.h"
+#include "bitset.h"
+#include "state.h"
 
-struct SimConfig SimConfig = {.road[0].position = NORTH, .road[0].laneCount = 0,
-    .road[1].position = SOUTH, .road[1].laneCount = 0,
-    .road[2].position = EAST, .road[2].laneCount = 0,
-    .road[3].position = WEST, .road[3].laneCount = 0};
+_Static_assert(offsetof(struct Lane, road) == SIM_CACHE_LINE, "Lane state used by every step must fit one cache line");
 
-static struct 
-{
-    SimVehicleExitedCallback vehicleExitCallback; /**< Vehicle exit callback */
-    void *context; /**< Vehicle exit callback context */
-    size_t nextVehicle; /**< Next vehicle sequential index */
-    uint32_t step; /**< Current simulation step */
-    struct Lane *lanes[MAX_LANES * 4]; /**< List of lanes */
-    size_t numLanes; /**< Number of lanes */
-    size_t numVehicles; /**< Number of vehicles */
-} SimState = {.vehicleExitCallback = NULL, .nextVehicle = 0, .step = 0, .numLanes = 0, .numVehicles = 0};
+struct SimConfig SimConfig = {.road = NULL, .roadCount = 0};
+
+static struct SimState SimMainState = {.config = &SimConfig, .vehicleExitCallback = NULL, .nextVehicle = 0, .step = 0, 
+    .lanes = NULL, .numLanes = 0, .laneConflicts = NULL, .numVehicles = 0, .exitedVehicles = 0, .totalDelay = 0,
+    .logEvents = true, .stepFunction = NULL, .stepKey = UINT32_MAX};
 
-static const char SimDirectionToChar[] = {[NORTH] = 'N', [SOUTH] = 'S', [WEST] = 'W', [EAST] = 'E'};
-static const char *SimDirectionToString[] = {[NORTH] = "north", [SOUTH] = "south", [WEST] = "west", [EAST] = "east"};
+_Thread_local struct SimState *SimState = &SimMainState;
+
+static const char SimDirectionToChar[MAX_ROADS] = {[NORTH] = 'N', [SOUTH] = 'S', [WEST] = 'W', [EAST] = 'E',
+    '4', '5', '6', '7'};
+static const char *SimDirectionToString[MAX_ROADS] = {[NORTH] = "north", [SOUTH] = "south", [WEST] = "west", [EAST] = "east",
+    "road 4", "road 5", "road 6", "road 7"};
 static const char *SimLightToString[] = {
     [LIGHT_RED] = "red",
     [LIGHT_RED_YELLOW] = "red+yellow",
@@ -32,36 +32,251 @@ static const char *SimLightToString[] = {
 /**
  * @brief Get lane attractiveness for placing new vehicles
  * @param *lane Target lane
- * @return Attractiveness
+ * @return Attractiveness: lane priority divided by the expected number of green steps before a new vehicle leaves
+ * @note Only the lane state maintained on each placement and exit is used, so this is constant time
  */
 static inline float SimGetLaneAtractiveness(const struct Lane *lane)
 {
-    if(0 != lane->vehicleCount)
-        return lane->priority;
-    else
-        return lane->priority / (float)lane->vehicleCount;
+    //discharge time of the queue including the new vehicle, plus the start-up lost time still ahead
+    uint32_t flow = SimGetSaturationFlow(lane);
+    uint32_t steps = (uint32_t)((lane->vehicleCount + flow) / flow);
+    steps += (LIGHT_GREEN == lane->light) ? lane->lostTimeLeft : lane->startupLostTime;
+    return lane->priority / (float)steps;
+}
+
+/**
+ * @brief Get lane attractiveness for placing new vehicles in fixed-point mode
+ * @param *lane Target lane
+ * @return Attractiveness as in SimGetLaneAtractiveness(), in 1/SIM_FIXED_ONE units
+ */
+static inline int64_t SimGetFixedLaneAtractiveness(const struct Lane *lane)
+{
+    uint32_t flow = SimGetSaturationFlow(lane);
+    uint64_t steps = (lane->vehicleCount + flow) / flow;
+    steps += (LIGHT_GREEN == lane->light) ? lane->lostTimeLeft : lane->startupLostTime;
+    return SimToFixed(lane->priority) * SIM_FIXED_ONE / (int64_t)steps;
+}
+
+/**
+ * @brief Get position of a vehicle among the vehicles shared with forked instances
+ * @param *lane Lane the vehicle is waiting on
+ * @param *vehicle Vehicle
+ * @param **prev Output previous vehicle in line (if shared), can be NULL
+ * @return Position in line, lane->sharedCount if the vehicle is not shared
+ */
+static size_t SimGetSharedPosition(const struct Lane *lane, const struct Vehicle *vehicle, struct Vehicle **prev)
+{
+    struct Vehicle *previous = NULL, *v = lane->vehicles;
+    size_t i = 0;
+    for(; i < lane->sharedCount; i++)
+    {
+        if(v == vehicle)
+            break;
+        previous = v;
+        v = SimGetNextVehicle(lane, v);
+    }
+    if(NULL != prev)
+        *prev = previous;
+    return i;
+}
+
+/**
+ * @brief Drop the link following a shared vehicle
+ * @param *lane Lane the vehicle is waiting on
+ * @param *vehicle Shared vehicle
+ */
+static void SimDropLink(struct Lane *lane, const struct Vehicle *vehicle)
+{
+    for(size_t i = 0; i < lane->linkCount; i++)
+    {
+        if(lane->links[i].vehicle == vehicle)
+        {
+            --lane->linkCount;
+            memmove(&lane->links[i], &lane->links[i + 1], (lane->linkCount - i) * sizeof(*lane->links));
+            //the last shared vehicle is gone, the lane owns no memory again
+            if(0 == lane->linkCount)
+            {
+                free(lane->links);
+                lane->links = NULL;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Set vehicle following given vehicle in line
+ * @param *lane Lane the vehicle is waiting on
+ * @param *vehicle Vehicle
+ * @param *next Next vehicle, NULL if this is the last one
+ * @param shared True if the vehicle is shared with forked instances and must be linked through the lane
+ * @return 0 on success, <0 on failure
+ */
+static int SimSetNextVehicle(struct Lane *lane, struct Vehicle *vehicle, struct Vehicle *next, bool shared)
+{
+    if(!shared)
+    {
+        vehicle->next = next;
+        return 0;
+    }
+
+    for(size_t i = 0; i < lane->linkCount; i++)
+    {
+        if(lane->links[i].vehicle == vehicle)
+        {
+            lane->links[i].next = next;
+            return 0;
+        }
+    }
+    struct VehicleLink *links = realloc(lane->links, (lane->linkCount + 1) * sizeof(*links));
+    if(NULL == links)
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+    links[lane->linkCount].vehicle = vehicle;
+    links[lane->linkCount].next = next;
+    lane->links = links;
+    ++lane->linkCount;
+    return 0;
+}
+
+/**
+ * @brief Unlink vehicle from any position in line
+ * @param *lane Lane the vehicle is waiting on
+ * @param *vehicle Vehicle
+ * @return 0 on success, <0 on failure (the line is not modified)
+ * @note This is O(1), unless the lane has vehicles shared with forked instances
+ */
+static int SimUnlinkVehicle(struct Lane *lane, struct Vehicle *vehicle)
+{
+    struct Vehicle *prev = NULL;
+    size_t position = SimGetSharedPosition(lane, vehicle, &prev);
+    bool shared = (position < lane->sharedCount);
+    bool prevShared = shared;
+    bool nextShared = shared && ((position + 1) < lane->sharedCount);
+    if(!shared)
+    {
+        prev = vehicle->prev;
+        //only the last shared vehicle can be followed by a vehicle that is not shared
+        prevShared = (NULL != prev) && (0 != lane->sharedCount) && (SimGetSharedPosition(lane, prev, NULL) < lane->sharedCount);
+    }
+    struct Vehicle *next = SimGetNextVehicle(lane, vehicle);
+
+    if(NULL == prev)
+        lane->vehicles = next;
+    else if(0 != SimSetNextVehicle(lane, prev, next, prevShared))
+        return -1;
+
+    if(shared)
+    {
+        SimDropLink(lane, vehicle);
+        --lane->sharedCount;
+    }
+    if((NULL != next) && !nextShared)
+        next->prev = prev;
+    if(lane->lastVehicle == vehicle)
+        lane->lastVehicle = prev;
+    --lane->road->vehicleCount;
+    if(0 == --lane->vehicleCount)
+    {
+        lane->vehicles = NULL;
+        lane->lastVehicle = NULL;
+        SimBitsetReset(SimState->occupiedLanes, lane->id);
+    }
+    if(NULL != SimState->timeline)
+        SimTimelineMarkQueue(SimState->timeline, lane);
+    if(NULL != SimState->profile)
+        SimProfileMarkQueue(SimState->profile, lane);
+    return 0;
+}
+
+/**
+ * @brief Append vehicle to the end of the line
+ * @param *vehicle Vehicle, not shared with forked instances
+ * @param *lane Target lane
+ * @return 0 on success, <0 on failure
+ */
+static int SimAppendVehicle(struct Vehicle *vehicle, struct Lane *lane)
+{
+    if(0 == lane->vehicleCount)
+        lane->vehicles = vehicle;
+    //if the last vehicle is shared with other instances, then link the new one through the lane
+    else if(0 != SimSetNextVehicle(lane, lane->lastVehicle, vehicle, lane->vehicleCount == lane->sharedCount))
+        return -1;
+
+    vehicle->next = NULL;
+    vehicle->prev = lane->lastVehicle;
+    vehicle->lane = lane;
+    lane->lastVehicle = vehicle;
+    if(1 == ++lane->vehicleCount)
+        SimBitsetSet(SimState->occupiedLanes, lane->id);
+    ++lane->road->vehicleCount;
+    if(NULL != SimState->timeline)
+        SimTimelineMarkQueue(SimState->timeline, lane);
+    if(NULL != SimState->profile)
+        SimProfileMarkQueue(SimState->profile, lane);
+    return 0;
 }
 
 /**
- * @brief Exit vehicle/remove from simulation
- * @param *vehicle Vehicle pointer
+ * @brief Get lane of the selected instance corresponding to given lane of any instance
+ * @param *lane Lane of any instance
+ * @return Lane of the selected instance
+ * @note Vehicles shared with forked instances point to the lanes of the instance they were placed in
  */
-static void SimExitVehicle(struct Vehicle *vehicle)
+static struct Lane* SimGetInstanceLane(const struct Lane *lane)
 {
-    vehicle->lane->vehicles = vehicle->next;
-    --vehicle->lane->vehicleCount;
-    --SimState.numVehicles;
-    printf("Vehicle %s from %s exited at %s\r\n", vehicle->name,
-        SimDirectionToString[vehicle->lane->road->position], SimDirectionToString[vehicle->direction]);
-    if(NULL != SimState.vehicleExitCallback)
-        SimState.vehicleExitCallback(vehicle, SimState.context);
+    return &SimState->config->road[lane->road->position].lane[lane - lane->road->lane];
 }
 
+/**
+ * @brief Exit first vehicle in line/remove from simulation
+ * @param *lane Lane pointer
+ */
+static void SimExitVehicle(struct Lane *lane)
+{
+    struct Vehicle *vehicle = lane->vehicles;
+    if(0 != lane->sharedCount)
+    {
+        //the vehicle is shared with other instances and can't be modified, drop its link (if any) instead
+        lane->vehicles = SimGetNextVehicle(lane, vehicle);
+        SimDropLink(lane, vehicle);
+        --lane->sharedCount;
+    }
+    else
+        lane->vehicles = vehicle->next;
+
+    --lane->road->vehicleCount;
+    if(0 == --lane->vehicleCount)
+    {
+        lane->vehicles = NULL;
+        lane->lastVehicle = NULL;
+        SimBitsetReset(SimState->occupiedLanes, lane->id);
+    }
+    else if(0 == lane->sharedCount)
+        lane->vehicles->prev = NULL;
+    if(NULL != SimState->timeline)
+        SimTimelineMarkQueue(SimState->timeline, lane);
+    if(NULL != SimState->profile)
+        SimProfileMarkQueue(SimState->profile, lane);
+    SimIndexRemove(&SimState->vehicleIndex, vehicle);
+    --SimState->numVehicles;
+    ++SimState->exitedVehicles;
+    if(NULL != SimState->trace)
+        SimTraceEmit(SimState->trace, &(struct SimTraceEvent){.type = SIM_TRACE_EXIT, .step = SimState->step,
+            .id = vehicle->index});
+    if(SimState->logEvents)
+        printf("Vehicle %s from %s exited at %s\r\n", vehicle->name,
+            SimDirectionToString[lane->road->position], SimDirectionToString[vehicle->direction]);
+    if(NULL != SimState->vehicleExitCallback)
+        SimState->vehicleExitCallback(vehicle, SimState->context);
+}
 
 void SimRegisterVehicleExitedCallback(SimVehicleExitedCallback callback, void *context)
 {
-    SimState.vehicleExitCallback = callback;
-    SimState.context = context;
+    SimState->vehicleExitCallback = callback;
+    SimState->context = context;
 }
 
 int SimPlaceVehicle(struct Vehicle *vehicle, struct Lane *lane)
@@ -77,41 +292,152 @@ int SimPlaceVehicle(struct Vehicle *vehicle, struct Lane *lane)
         return -1;
     }
 
-    vehicle->index = SimState.nextVehicle++;
-    vehicle->next = NULL;
-    vehicle->lane = lane;
+    if(0 != SimIndexInsert(&SimState->vehicleIndex, vehicle))
+        return -1;
+    if(0 != SimAppendVehicle(vehicle, lane))
+    {
+        SimIndexRemove(&SimState->vehicleIndex, vehicle);
+        return -1;
+    }
 
-    if(NULL == lane->vehicles)
-        lane->vehicles = vehicle;
-    else
+    vehicle->index = SimState->nextVehicle++;
+    ++SimState->numVehicles;
+
+    return 0;
+}
+
+struct Vehicle* SimFindVehicle(const char *name)
+{
+    if(NULL == name)
+        return NULL;
+    return SimIndexFind(&SimState->vehicleIndex, name);
+}
+
+int SimRemoveVehicle(struct Vehicle *vehicle)
+{
+    if((NULL == vehicle) || !SimIndexContains(&SimState->vehicleIndex, vehicle))
+    {
+        printf("Vehicle is not waiting at the junction\r\n");
+        return -1;
+    }
+
+    struct Lane *lane = SimGetInstanceLane(vehicle->lane);
+    if(0 != SimUnlinkVehicle(lane, vehicle))
+        return -1;
+    SimIndexRemove(&SimState->vehicleIndex, vehicle);
+    --SimState->numVehicles;
+    if(SimState->logEvents)
+        printf("Vehicle %s removed from %s\r\n", vehicle->name, SimDirectionToString[lane->road->position]);
+    return 0;
+}
+
+int SimChangeLane(struct Vehicle *vehicle, struct Lane *lane)
+{
+    if((NULL == vehicle) || !SimIndexContains(&SimState->vehicleIndex, vehicle))
+    {
+        printf("Vehicle is not waiting at the junction\r\n");
+        return -1;
+    }
+    if(NULL == lane)
+    {
+        printf("Lane is NULL!\r\n");
+        return -1;
+    }
+
+    struct Lane *current = SimGetInstanceLane(vehicle->lane);
+    if((lane->road != current->road) || !(lane->direction.mask & (1u << vehicle->direction)))
+    {
+        printf("Vehicle %s can't change lane\r\n", vehicle->name);
+        return -1;
+    }
+    if(lane == current)
+        return 0;
+    if(SimGetSharedPosition(current, vehicle, NULL) < current->sharedCount)
+    {
+        printf("Vehicle %s is shared with a forked instance and can't be moved\r\n", vehicle->name);
+        return -1;
+    }
+
+    if(0 != SimUnlinkVehicle(current, vehicle))
+        return -1;
+    if(0 != SimAppendVehicle(vehicle, lane))
+    {
+        //the vehicle can't be placed anywhere, so it's dropped from the simulation
+        SimIndexRemove(&SimState->vehicleIndex, vehicle);
+        --SimState->numVehicles;
+        return -1;
+    }
+    return 0;
+}
+
+int SimRerouteVehicle(struct Vehicle *vehicle, enum Direction end)
+{
+    if(end >= SimState->config->roadCount)
+    {
+        printf("Destination road does not exist\r\n");
+        return -1;
+    }
+    if((NULL == vehicle) || !SimIndexContains(&SimState->vehicleIndex, vehicle))
+    {
+        printf("Vehicle is not waiting at the junction\r\n");
+        return -1;
+    }
+
+    struct Lane *current = SimGetInstanceLane(vehicle->lane);
+    if(SimGetSharedPosition(current, vehicle, NULL) < current->sharedCount)
+    {
+        printf("Vehicle %s is shared with a forked instance and can't be rerouted\r\n", vehicle->name);
+        return -1;
+    }
+
+    //stay on the current lane if possible
+    if(current->direction.mask & (1u << end))
     {
-        struct Vehicle *v = lane->vehicles;
-        while(NULL != v->next)
-            v = v->next;
-        
-        v->next = vehicle;
+        vehicle->direction = end;
+        return 0;
     }
-    ++lane->vehicleCount;
-    ++SimState.numVehicles;
 
+    struct Lane *lane = SimSelectLane(current->road->position, end);
+    if(NULL == lane)
+    {
+        printf("No lane from %s to %s\r\n", SimDirectionToString[current->road->position],
+            (end < MAX_ROADS) ? SimDirectionToString[end] : "?");
+        return -1;
+    }
+    enum Direction previous = vehicle->direction;
+    vehicle->direction = end;
+    if(0 != SimChangeLane(vehicle, lane))
+    {
+        vehicle->direction = previous;
+        return -1;
+    }
     return 0;
 }
 
 struct Lane* SimSelectLane(enum Direction start, enum Direction end)
 {
-    if((start > DIRECTION_LIMIT) || (end > DIRECTION_LIMIT))
+    if((start >= SimState->config->roadCount) || (end >= SimState->config->roadCount))
         return NULL;
     
-    struct Road *road = &SimConfig.road[start];
+    struct Road *road = &SimState->config->road[start];
     struct Lane *best = NULL;
     float bestAttractiveness = -1.f;
+    int64_t bestFixedAttractiveness = INT64_MIN;
 
     for(size_t i = 0; i < road->laneCount; i++)
     {
-        if(((NORTH == end) && road->lane[i].direction.north)
-        || ((SOUTH == end) && road->lane[i].direction.south)
-        || ((WEST == end) && road->lane[i].direction.west)
-        || ((EAST == end) && road->lane[i].direction.east))
+        if(!(road->lane[i].direction.mask & (1u << end)))
+            continue;
+        if(SimState->config->fixedPoint)
+        {
+            int64_t attractiveness = SimGetFixedLaneAtractiveness(&road->lane[i]);
+            if(attractiveness > bestFixedAttractiveness)
+            {
+                bestFixedAttractiveness = attractiveness;
+                best = &road->lane[i];
+            }
+        }
+        else
         {
             float attractiveness = SimGetLaneAtractiveness(&road->lane[i]);
             if(attractiveness > bestAttractiveness)
@@ -125,288 +451,1136 @@ struct Lane* SimSelectLane(enum Direction start, enum Direction end)
 }
 
 /**
- * @brief Clear "blocked" states for all lanes
+ * @brief Get flow of the first vehicle in line
+ * @param *lane Lane with at least one vehicle
+ * @return Flow index (start * MAX_ROADS + end)
  */
-static void SimClearBlockedStates(void)
+static inline uint8_t SimGetLaneFlow(const struct Lane *lane)
 {
-    struct Lane **lane = SimState.lanes;
-    size_t i = SimState.numLanes;
-    while(i--)
-    {
-        (*lane)->blocked = false;
-        (*lane)->unblocked = false;
-        ++lane;
-    }
+    return lane->road->position * MAX_ROADS + lane->vehicles->direction;
 }
 
 /**
- * @brief Handle vehicles in simulation step
+ * @brief Check whether the first vehicle on lane A takes precendce over the first vehicle on lane B on a colliding path
+ * @param *laneA Lane of vehicle A
+ * @param *laneB Lane of vehicle B
+ * @return True if Vehicle A has precedence over Vehicle B
+ * @note Lanes are used instead of vehicles, because vehicles might be shared between forked simulation instances
  */
-static void SimHandleVehicles(void)
+static bool SimTakesPrecedence(const struct Lane *laneA, const struct Lane *laneB)
 {
+    /*
+    A takes precedence over B when:
+    1. A has green light and B has green arrow
+    2. Both have green or lights are disabled and A is at the right side of B
+    3. Both have green or lights are disabled and B is not at the right side of B and
+        B is trying to turn left
+    */
+    if((LIGHT_GREEN == laneA->light) && (LIGHT_ARROW == laneB->light))
+        return true;
+    else if(SimIsRoadAtRightHand(laneA->road, laneB->road))
+        return true;
+    else if(!SimIsRoadAtRightHand(laneB->road, laneA->road)
+        && (SIM_TURN_LEFT == SimState->turn[laneB->road->position][laneB->vehicles->direction]))
+        return true;
 
-    //scan though all lanes for ready vehicles
-    struct Lane **lane = SimState.lanes;
-    size_t i = SimState.numLanes;
-    while(i)
+    return false;
+}
+
+/**
+ * @brief Do one pass of vehicle handling, at most one vehicle leaves each lane
+ * @param **ready Lanes that had a ready vehicle at the beginning of the step
+ * @param numReady Number of lanes
+ * @return Number of lanes that can discharge more vehicles in the current step
+ */
+static size_t SimHandleVehiclesPass(struct Lane **ready, size_t numReady)
+{
+    //count lanes with flowing vehicles per flow
+    //lanes that reached their saturation flow do not move, but still take part in resolving precedence
+    uint32_t flowCount[MAX_ROADS * MAX_ROADS] = {0};
+    uint64_t readyFlows = 0;
+    for(size_t i = 0; i < numReady; i++)
     {
-        if(SimIsVehicleReady(*lane))
+        if(SimIsLaneFlowing(ready[i]))
         {
-            //scan other lanes for collisions
-            struct Lane **other = SimState.lanes;
-            size_t k = SimState.numLanes;
-            while(k)
-            {
-                //collision can only happen when the vehicles on the other lane are ready
-                //of course skip comparing the same lanes...
-                if((*lane != *other) && SimIsVehicleReady(*other))
-                {
-                    if(SimAreVehiclesColliding((*lane)->vehicles, (*other)->vehicles))
-                    {
-                        if(SimTakesPrecedence((*lane)->vehicles, (*other)->vehicles))
-                            (*other)->blocked = true;
-                        else
-                            break;
-                    }
-                }
-                --k;
-                ++other;
-            }
-
-            if(0 == k)
-            {
-                struct Vehicle *v = (*lane)->vehicles;
-                SimExitVehicle(v);
-            }
-
+            uint8_t flow = SimGetLaneFlow(ready[i]);
+            if(0 == flowCount[flow]++)
+                readyFlows |= (uint64_t)1 << flow;
         }
-        --i;
-        ++lane;
     }
-}
-
-static void SimPrintLightState(const struct Lane *lane)
-{
-    char dest[5];
-    char *d = dest;
-    if(lane->direction.north)
-        *d++ = 'N';
-    if(lane->direction.south)
-        *d++ = 'S';
-    if(lane->direction.west)
-        *d++ = 'W';
-    if(lane->direction.east)
-        *d++ = 'E';
-    *d = '\0';
-
-    printf("Light at lane %c->%s switched to %s\r\n", 
-        SimDirectionToChar[lane->road->position], dest, SimLightToString[lane->light]);
-}
-
-static int SimComparePriorities(const void *a, const void *b)
-{
-    const struct Lane *const *laneA = a, *const *laneB = b;
-    if((*laneA)->dynamicPriority < (*laneB)->dynamicPriority)
-        return 1;
-    else if((*laneA)->dynamicPriority > (*laneB)->dynamicPriority)
-        return -1;
-    else
-        return 0;
-}
 
-static void SimHandleRedLights(void)
-{
-    struct Lane **lane = SimState.lanes;
-    size_t i = SimState.numLanes;
-    while(i)
+    size_t remaining = 0;
+    for(size_t i = 0; i < numReady; i++)
     {
-        if((LIGHT_GREEN == (*lane)->light))
+        struct Lane *lane = ready[i];
+        //the lane might have been blocked by a vehicle with precedence or might have reached its saturation flow
+        if(!SimCanDischarge(lane))
+            continue;
+
+        uint8_t flow = SimGetLaneFlow(lane);
+        uint64_t conflicts = SimState->flowConflicts[flow] & readyFlows;
+        bool exits = true;
+        //scan other ready lanes only if there is a ready vehicle on a colliding flow
+        if(0 != conflicts)
         {
-            if((0 == (*lane)->stepsBeforeChange--))
+            for(size_t k = 0; k < numReady; k++)
             {
-                (*lane)->light = LIGHT_YELLOW;
-                SimPrintLightState(*lane);
+                struct Lane *other = ready[k];
+                if((lane == other) || !SimIsLaneFlowing(other) || !(conflicts & ((uint64_t)1 << SimGetLaneFlow(other))))
+                    continue;
+
+                if(!SimTakesPrecedence(lane, other))
+                {
+                    exits = false;
+                    break;
+                }
+
+                other->blocked = true;
+                uint8_t otherFlow = SimGetLaneFlow(other);
+                if(0 == --flowCount[otherFlow])
+                    readyFlows &= ~((uint64_t)1 << otherFlow);
             }
         }
-        else if(LIGHT_YELLOW == (*lane)->light)
-        {
-            if(SimCanTurnRightFromLane(*lane))
-                (*lane)->light = LIGHT_ARROW;
-            else
-                (*lane)->light = LIGHT_RED;
 
-            SimPrintLightState(*lane);
-        }
-        else if((LIGHT_RED == (*lane)->light) || (LIGHT_ARROW == (*lane)->light))
+        if(exits)
         {
-            if(0 != (*lane)->vehicleCount)
+            if(0 == --flowCount[flow])
+                readyFlows &= ~((uint64_t)1 << flow);
+            SimExitVehicle(lane);
+            ++lane->dischargedCount;
+            //the next vehicle in line might be in the way of vehicles on the remaining lanes
+            if(SimIsLaneFlowing(lane))
             {
-                //always use some kind of a "dynamic priority"
-                //which can be based on different things depending on the policy
-                if(SIM_FCFS == SimConfig.selectionPolicy)
-                    (*lane)->dynamicPriority = 1.f / (float)(*lane)->vehicles->index;
-                else if(SIM_HLFS == SimConfig.selectionPolicy)
-                    (*lane)->dynamicPriority = (float)(*lane)->vehicleCount;
-                else if(SIM_DYNAMIC == SimConfig.selectionPolicy)
-                {
-                    (*lane)->dynamicPriority = (float)(*lane)->vehicleCount + (float)(*lane)->waitTime;
-                    (*lane)->dynamicPriority *= (*lane)->priority;
-                }
-                ++(*lane)->waitTime;
+                flow = SimGetLaneFlow(lane);
+                if(0 == flowCount[flow]++)
+                    readyFlows |= (uint64_t)1 << flow;
+                if(SimCanDischarge(lane))
+                    ++remaining;
             }
-            else
-                (*lane)->dynamicPriority = -1.f; //never promote lanes with no vehicles
         }
-        --i;
-        ++lane;
     }
+    return remaining;
 }
 
-static void SimHandleSelection(void)
+/**
+ * @brief Handle vehicles in simulation step
+ * @param selection Lane selection policy
+ * @note Only lanes with vehicles that may move are visited, other lanes can't get a ready vehicle during the step
+ */
+static SIM_ALWAYS_INLINE void SimHandleVehicles(enum SimSelectionPolicy selection)
 {
-    //sort lanes by highest dynamic priority first
-    qsort(SimState.lanes, SimState.numLanes, sizeof(*SimState.lanes), SimComparePriorities);
-
-    //starting from the highest priority waiting lane, check if it's safe to switch to green
-    struct Lane **lane = SimState.lanes;
-    size_t i = SimState.numLanes;
-    while(i)
+    struct Lane **ready = SimState->readyLanes;
+    size_t numReady = 0;
+    if(SIM_RIGHT_HAND_RULE == selection)
     {
-        if((LIGHT_RED == (*lane)->light) || ((LIGHT_ARROW == (*lane)->light)))
+        for(size_t w = 0; w < SimState->laneWords; w++)
         {
-            if(0 == (*lane)->vehicleCount) //always skip lanes with no vehicles
-            {
-                ++lane;
-                --i;
-                continue;
-            }
-
-            if((*lane)->waitTime < (*lane)->minRedTime)
-                break;
-            
-            struct Lane **other = SimState.lanes;
-            size_t k = SimState.numLanes;
-            while(k)
-            {
-                if(*lane == *other)
-                {
-                    ++other;
-                    --k;
-                    continue;
-                }
-                //check for colliding flows, which may disqualify the lane
-                //however, there are some cases when it is acceptable
-                //checking makes sense only when the other lane has green or red-yellow light, or has been just unblocked
-                if(((LIGHT_GREEN == (*other)->light) || (LIGHT_RED_YELLOW == (*other)->light) || (*other)->unblocked) 
-                    && SimAreAnyFlowsColliding(*lane, *other))
-                {
-                    //handle permissive intersections:
-                    //when two lanes are permissive, then check if they are at the opposing sides
-                    //this way we can simulate a real scenario of permissive left turns
-                    if(((*lane)->permissive && (*other)->permissive)
-                        && (SimIsFlowStraight((*lane)->road->position, (*other)->road->position) || SimAreFlowsIdentical(*lane, *other)))
-                    {
-
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-                --k;
-                ++other;
-            }
-            if(0 == k)
+            for(uint64_t bits = SimState->occupiedLanes[w] & SimState->movableLanes[w]; 0 != bits; bits &= bits - 1)
             {
-                //k=0, that is, there is no possible collision or the colision is "legal"
-                (*lane)->unblocked = true;
-                if(SIM_TIME_FIXED == SimConfig.timePolicy)
-                {
-                    (*lane)->stepsBeforeChange = (*lane)->greenTime;
-                }
-                else if((SIM_TIME_PROPORTIONAL == SimConfig.timePolicy)
-                    || (SIM_TIME_PRIORITIZED == SimConfig.timePolicy))
-                {
-                    (*lane)->stepsBeforeChange = (*lane)->vehicleCount * (*lane)->stepsPerVehicle;
-                    if(SIM_TIME_PRIORITIZED == SimConfig.timePolicy)
-                        (*lane)->stepsBeforeChange = (float)((*lane)->stepsBeforeChange) * (*lane)->priority;
-                    if((*lane)->stepsBeforeChange < (*lane)->minGreenTime)
-                        (*lane)->stepsBeforeChange = (*lane)->minGreenTime;
-                    else if((*lane)->stepsBeforeChange > (*lane)->maxGreenTime)
-                        (*lane)->stepsBeforeChange = (*lane)->maxGreenTime;
-                }
+                struct Lane *lane = SimState->laneById[w * 64 + __builtin_ctzll(bits)];
+                if(SimIsLaneFlowing(lane))
+                    ready[numReady++] = lane;
             }
-            else
-                break;
         }
-        --i;
-        ++lane;
     }
-}
-
-static void SimHandleSwitchToGreen(void)
-{
-    struct Lane **lane = SimState.lanes;
-    size_t i = SimState.numLanes;
-    while(i)
+    else
     {
-        if(((LIGHT_RED == (*lane)->light) || (LIGHT_ARROW == (*lane)->light)) && (*lane)->unblocked)
+        //every lane with a vehicle that may move is on the scheduling list,
+        //so that the lanes with higher priority resolve their conflicts first
+        for(size_t i = 0; i < SimState->numScheduled; i++)
         {
-            (*lane)->light = LIGHT_RED_YELLOW;
-            SimPrintLightState(*lane);
+            if(SimIsLaneFlowing(SimState->lanes[i]))
+                ready[numReady++] = SimState->lanes[i];
         }
-        else if(LIGHT_RED_YELLOW == (*lane)->light)
+    }
+
+    //vehicles leave in passes, so that lanes with higher saturation flow
+    //still give way to colliding vehicles that arrived at the stop line in the meantime
+    while(0 != SimHandleVehiclesPass(ready, numReady))
+        ;
+
+    //only ready lanes could have been blocked or discharged
+    for(size_t i = 0; i < numReady; i++)
+    {
+        ready[i]->blocked = false;
+        ready[i]->dischargedCount = 0;
+    }
+
+    for(size_t w = 0; w < SimState->laneWords; w++)
+    {
+        for(uint64_t bits = SimState->startingLanes[w]; 0 != bits; bits &= bits - 1)
         {
-            (*lane)->light = LIGHT_GREEN;
-            SimPrintLightState(*lane);
+            size_t id = w * 64 + __builtin_ctzll(bits);
+            if(0 == --SimState->laneById[id]->lostTimeLeft)
+                SimBitsetReset(SimState->startingLanes, id);
         }
-        --i;
-        ++lane;
     }
 }
 
-bool SimDoStep(void)
+/**
+ * @brief Report light change to the trace and the timeline and print it
+ * @param *lane Lane whose light changed
+ */
+static void SimReportLightState(const struct Lane *lane)
 {
-    SimClearBlockedStates();
-    if(SIM_RIGHT_HAND_RULE != SimConfig.selectionPolicy)
+    if(NULL != SimState->trace)
+        SimTraceEmit(SimState->trace, &(struct SimTraceEvent){.type = SIM_TRACE_LIGHT, .step = SimState->step,
+            .id = lane->id, .light = lane->light});
+    if(NULL != SimState->timeline)
+        SimTimelineEmitLight(SimState->timeline, lane);
+    if(!SimState->logEvents)
+        return;
+
+    char dest[MAX_ROADS + 1];
+    char *d = dest;
+    for(uint8_t i = 0; i < MAX_ROADS; i++)
     {
-        SimHandleRedLights();
-        SimHandleSelection();
-        SimHandleSwitchToGreen();
+        if(lane->direction.mask & (1u << i))
+            *d++ = SimDirectionToChar[i];
     }
-    SimHandleVehicles();
-    printf("Step done, %lu vehicles remaining\r\n", SimState.numVehicles);
-    return (0 != SimState.numVehicles);
+    *d = '\0';
+
+    printf("Light at lane %c->%s switched to %s\r\n", 
+        SimDirectionToChar[lane->road->position], dest, SimLightToString[lane->light]);
 }
 
-void SimInit(void)
+/**
+ * @brief Update lane bitsets of an instance for a lane light
+ * @param *state Simulation instance
+ * @param *lane Lane
+ */
+static void SimUpdateLightSets(struct SimState *state, const struct Lane *lane)
 {
-    printf("Initializing simulation...\r\n");
-    size_t index = 0;
-    for(uint8_t i = 0; i < (DIRECTION_LIMIT + 1); i++)
-    {
-        for(size_t k = 0; k < SimConfig.road[i].laneCount; k++)
-        {
-            if(SIM_RIGHT_HAND_RULE != SimConfig.selectionPolicy)
-            {
-                if(SimCanTurnRightFromLane(&SimConfig.road[i].lane[k]))
-                    SimConfig.road[i].lane[k].light = LIGHT_ARROW;
-                else
-                    SimConfig.road[i].lane[k].light = LIGHT_RED;
-            }
-            else
-                SimConfig.road[i].lane[k].light = LIGHT_DISABLED;
-                
-            SimPrintLightState(&SimConfig.road[i].lane[k]);
-            SimConfig.road[i].lane[k].dynamicPriority = -1.f;
+    enum Light light = lane->light;
+    SimBitsetAssign(state->redLanes, lane->id, (LIGHT_RED == light) || (LIGHT_ARROW == light));
+    SimBitsetAssign(state->movableLanes, lane->id,
+        (LIGHT_GREEN == light) || (LIGHT_ARROW == light) || (LIGHT_DISABLED == light));
+    SimBitsetAssign(state->activeLanes, lane->id, (LIGHT_GREEN == light) || (LIGHT_RED_YELLOW == light));
+}
 
-            SimState.lanes[index] = &SimConfig.road[i].lane[k];
-            ++index;
-        }
+/**
+ * @brief Change lane light, update lane bitsets and report the change
+ * @param *lane Lane
+ * @param light New light
+ */
+static void SimSetLight(struct Lane *lane, enum Light light)
+{
+    lane->light = light;
+    SimUpdateLightSets(SimState, lane);
+    SimReportLightState(lane);
+}
+
+/**
+ * @brief Sort scheduling list by highest dynamic priority first
+ * @param fixedPoint Sort by fixed-point priority
+ * @note This is a stable insertion sort: it does not allocate memory (unlike qsort()) and the lane order
+ * changes little between steps, so it is close to linear
+ */
+static SIM_ALWAYS_INLINE void SimSortLanes(bool fixedPoint)
+{
+    struct Lane **lanes = SimState->lanes;
+    for(size_t i = 1; i < SimState->numScheduled; i++)
+    {
+        struct Lane *lane = lanes[i];
+        size_t k = i;
+        while((k > 0) && (fixedPoint ? (lanes[k - 1]->fixedPriority < lane->fixedPriority)
+            : (lanes[k - 1]->dynamicPriority < lane->dynamicPriority)))
+        {
+            lanes[k] = lanes[k - 1];
+            --k;
+        }
+        lanes[k] = lane;
+    }
+}
+
+/**
+ * @brief Get number of announced arrivals on lane, weighted by their proximity
+ * @param *lane Lane
+ * @return Sum of weights, an arrival in the next step counts almost fully, arrivals beyond the horizon do not count
+ */
+static float SimGetForecast(const struct Lane *lane)
+{
+    return (float)lane->upcomingCount - (float)lane->upcomingDistance / (float)SIM_LOOKAHEAD_HORIZON;
+}
+
+/**
+ * @brief Drop arrivals announced for the new step and bring the others one step closer
+ * @note Each lane with announced arrivals is updated in constant time, independent of their number
+ */
+static void SimAdvanceForecast(void)
+{
+    size_t slot = SimState->step % SIM_LOOKAHEAD_HORIZON;
+    for(size_t w = 0; w < SimState->laneWords; w++)
+    {
+        for(uint64_t bits = SimState->announcedLanes[w]; 0 != bits; bits &= bits - 1)
+        {
+            struct Lane *lane = SimState->laneById[w * 64 + __builtin_ctzll(bits)];
+            uint32_t arrived = lane->upcoming[slot];
+            lane->upcoming[slot] = 0;
+            lane->upcomingCount -= arrived;
+            lane->upcomingDistance -= arrived + lane->upcomingCount;
+            if(0 == lane->upcomingCount)
+                SimBitsetReset(SimState->announcedLanes, lane->id);
+        }
+    }
+}
+
+int SimAnnounceVehicle(enum Direction start, enum Direction end, uint32_t step)
+{
+    if((SIM_LOOKAHEAD != SimState->config->selectionPolicy) || (step <= SimState->step)
+        || ((step - SimState->step) >= SIM_LOOKAHEAD_HORIZON))
+        return -1;
+    struct Lane *lane = SimSelectLane(start, end);
+    if(NULL == lane)
+        return -1;
+    ++lane->upcoming[step % SIM_LOOKAHEAD_HORIZON];
+    ++lane->upcomingCount;
+    SimBitsetSet(SimState->announcedLanes, lane->id);
+    lane->upcomingDistance += step - SimState->step;
+    return 0;
+}
+
+/**
+ * @brief Get queue the vehicles from lane join after leaving the junction
+ * @param *lane Lane
+ * @return Mean number of vehicles per lane on the connected entry roads, averaged over the lane targets
+ * @note Road queues are counted when vehicles are placed and leave, so this does not scan the neighbour lanes
+ */
+static float SimGetDownstreamQueue(const struct Lane *lane)
+{
+    float queue = 0.f;
+    unsigned int targets = 0;
+    for(uint8_t i = 0; i < SimState->config->roadCount; i++)
+    {
+        if(!(lane->direction.mask & (1u << i)))
+            continue;
+        ++targets;
+        const struct SimConnection *connection = &SimState->downstream[i];
+        if(NULL != connection->instance)
+        {
+            const struct Road *road = &connection->instance->config->road[connection->road];
+            if(0 != road->laneCount)
+                queue += (float)road->vehicleCount / (float)road->laneCount;
+        }
+    }
+    return (0 != targets) ? (queue / (float)targets) : 0.f;
+}
+
+/**
+ * @brief Get queue the vehicles from lane join after leaving the junction, in fixed-point mode
+ * @param *lane Lane
+ * @return Downstream queue as in SimGetDownstreamQueue(), in 1/SIM_FIXED_ONE units
+ */
+static int64_t SimGetFixedDownstreamQueue(const struct Lane *lane)
+{
+    int64_t queue = 0;
+    unsigned int targets = 0;
+    for(uint8_t i = 0; i < SimState->config->roadCount; i++)
+    {
+        if(!(lane->direction.mask & (1u << i)))
+            continue;
+        ++targets;
+        const struct SimConnection *connection = &SimState->downstream[i];
+        if(NULL != connection->instance)
+        {
+            const struct Road *road = &connection->instance->config->road[connection->road];
+            if(0 != road->laneCount)
+                queue += (int64_t)road->vehicleCount * SIM_FIXED_ONE / (int64_t)road->laneCount;
+        }
+    }
+    return (0 != targets) ? (queue / targets) : 0;
+}
+
+/**
+ * @brief Get dynamic priority of a lane with waiting vehicles in fixed-point mode
+ * @param *lane Lane
+ * @return Dynamic priority in 1/SIM_FIXED_ONE units, the same policies as the float priority apply
+ * @note FCFS priority is exact for any vehicle index, the float reciprocal can't tell indices apart above 2^24
+ */
+static SIM_ALWAYS_INLINE int64_t SimGetFixedPriority(const struct Lane *lane, enum SimSelectionPolicy selection)
+{
+    int64_t priority = SimToFixed(lane->priority);
+    switch(selection)
+    {
+        case SIM_FCFS:
+            return INT64_MAX - (int64_t)lane->vehicles->index;
+        case SIM_HLFS:
+            return (int64_t)lane->vehicleCount * SIM_FIXED_ONE;
+        case SIM_DYNAMIC:
+            return ((int64_t)lane->vehicleCount + lane->waitTime) * priority;
+        case SIM_LOOKAHEAD:
+            //forecast is counted in 1/SIM_LOOKAHEAD_HORIZON units
+            return (((int64_t)lane->vehicleCount + lane->waitTime + lane->upcomingCount) * SIM_LOOKAHEAD_HORIZON
+                - lane->upcomingDistance) * priority / SIM_LOOKAHEAD_HORIZON;
+        case SIM_MAX_PRESSURE:
+            return SimFixedMul((int64_t)lane->vehicleCount * SIM_FIXED_ONE - SimGetFixedDownstreamQueue(lane),
+                (int64_t)SimGetSaturationFlow(lane) * priority);
+        default:
+            return 0;
     }
-    SimState.numLanes = index;
-    SimState.nextVehicle = 1;
-    SimState.numVehicles = 0;
-    SimState.step = 0;
-    printf("Initialization finished\r\n\r\n");
-}
\ No newline at end of file
+}
+
+int SimConnectRoad(enum Direction exit, struct SimState *neighbour, enum Direction entry)
+{
+    if((exit >= SimState->config->roadCount) || ((NULL != neighbour) && (entry >= neighbour->config->roadCount)))
+        return -1;
+    SimState->downstream[exit].instance = neighbour;
+    SimState->downstream[exit].road = entry;
+    return 0;
+}
+
+/**
+ * @brief Update scheduling list: drop lanes that became idle and append lanes that started waiting for green light
+ * @note The order of the remaining lanes is kept, so that the list stays nearly sorted. Lanes with green light stay
+ * on the list with the priority they had when they were selected, lanes switching to red become idle in the next
+ * step at the earliest. New idle lanes are ranked ahead of the lanes that were idle before and lanes that start
+ * waiting are appended in the rank order. This way lanes with equal (non-negative) priority keep the same order
+ * as if all lanes were sorted, with -1 priority for the idle ones.
+ */
+static void SimUpdateSchedule(void)
+{
+    struct Lane **lanes = SimState->lanes;
+    size_t count = 0;
+    uint64_t base = SimState->nextIdleRank - SimState->numLanes;
+    bool dropped = false;
+    for(size_t i = 0; i < SimState->numScheduled; i++)
+    {
+        size_t id = lanes[i]->id;
+        if(SimBitsetTest(SimState->occupiedLanes, id) || !SimBitsetTest(SimState->redLanes, id))
+            lanes[count++] = lanes[i];
+        else
+        {
+            SimBitsetReset(SimState->scheduledLanes, id);
+            SimState->idleRank[id] = base + i;
+            dropped = true;
+        }
+    }
+    if(dropped)
+        SimState->nextIdleRank = base;
+
+    size_t first = count;
+    for(size_t w = 0; w < SimState->laneWords; w++)
+    {
+        //only red lanes leave the list, so only they can be missing
+        uint64_t bits = SimState->occupiedLanes[w] & SimState->redLanes[w] & ~SimState->scheduledLanes[w];
+        SimState->scheduledLanes[w] |= bits;
+        for(; 0 != bits; bits &= bits - 1)
+        {
+            struct Lane *lane = SimState->laneById[w * 64 + __builtin_ctzll(bits)];
+            size_t k = count++;
+            while((k > first) && (SimState->idleRank[lanes[k - 1]->id] > SimState->idleRank[lane->id]))
+            {
+                lanes[k] = lanes[k - 1];
+                --k;
+            }
+            lanes[k] = lane;
+        }
+    }
+    SimState->numScheduled = count;
+}
+
+/**
+ * @brief Advance green and yellow lights, update dynamic priority of lanes waiting for green light and the scheduling list
+ * @param selection Lane selection policy
+ * @param fixedPoint Use fixed-point priority
+ * @note Idle lanes (red light and no vehicles) are not visited
+ */
+static SIM_ALWAYS_INLINE void SimHandleRedLights(enum SimSelectionPolicy selection, bool fixedPoint)
+{
+    //lanes that switch to red in this step are not waiting yet, so they are handled last
+    for(size_t w = 0; w < SimState->laneWords; w++)
+    {
+        for(uint64_t bits = SimState->occupiedLanes[w] & SimState->redLanes[w]; 0 != bits; bits &= bits - 1)
+        {
+            struct Lane *lane = SimState->laneById[w * 64 + __builtin_ctzll(bits)];
+            //always use some kind of a "dynamic priority"
+            //which can be based on different things depending on the policy
+            if(fixedPoint)
+                lane->fixedPriority = SimGetFixedPriority(lane, selection);
+            else if(SIM_FCFS == selection)
+                lane->dynamicPriority = 1.f / (float)lane->vehicles->index;
+            else if(SIM_HLFS == selection)
+                lane->dynamicPriority = (float)lane->vehicleCount;
+            else if(SIM_DYNAMIC == selection)
+            {
+                lane->dynamicPriority = (float)lane->vehicleCount + (float)lane->waitTime;
+                lane->dynamicPriority *= lane->priority;
+            }
+            else if(SIM_LOOKAHEAD == selection)
+            {
+                lane->dynamicPriority = (float)lane->vehicleCount + (float)lane->waitTime
+                    + SimGetForecast(lane);
+                lane->dynamicPriority *= lane->priority;
+            }
+            else if(SIM_MAX_PRESSURE == selection)
+            {
+                lane->dynamicPriority = ((float)lane->vehicleCount - SimGetDownstreamQueue(lane))
+                    * (float)SimGetSaturationFlow(lane) * lane->priority;
+            }
+            ++lane->waitTime;
+        }
+    }
+
+    SimUpdateSchedule();
+
+    //lanes with green or yellow light are never dropped from the scheduling list
+    for(size_t i = 0; i < SimState->numScheduled; i++)
+    {
+        struct Lane *lane = SimState->lanes[i];
+        if(LIGHT_GREEN == lane->light)
+        {
+            if(0 == lane->stepsBeforeChange--)
+                SimSetLight(lane, LIGHT_YELLOW);
+        }
+        else if(LIGHT_YELLOW == lane->light)
+        {
+            if(SimCanTurnRightFromLane(lane))
+                SimSetLight(lane, LIGHT_ARROW);
+            else
+                SimSetLight(lane, LIGHT_RED);
+        }
+    }
+}
+
+/**
+ * @brief Unblock lane, so that its light changes to green, and set its green light time
+ * @param *lane Lane with red light, not conflicting with any active lane
+ * @param selection Lane selection policy
+ * @param timing Light timing policy
+ * @param fixedPoint Scale prioritized green time in fixed-point
+ */
+static SIM_ALWAYS_INLINE void SimUnblockLane(struct Lane *lane, enum SimSelectionPolicy selection,
+    enum SimTimePolicy timing, bool fixedPoint)
+{
+    lane->unblocked = true;
+    SimBitsetSet(SimState->activeLanes, lane->id);
+    if(SIM_TIME_FIXED == timing)
+    {
+        lane->stepsBeforeChange = lane->greenTime;
+    }
+    else if((SIM_TIME_PROPORTIONAL == timing) || (SIM_TIME_PRIORITIZED == timing))
+    {
+        //the number of steps needed to discharge all vehicles, plus the start-up lost time
+        //the look-ahead policy also keeps the light green for the announced arrivals
+        uint32_t flow = SimGetSaturationFlow(lane);
+        size_t count = lane->vehicleCount;
+        if(SIM_LOOKAHEAD == selection)
+            count += lane->upcomingCount;
+        lane->stepsBeforeChange = ((count + flow - 1) / flow) * lane->stepsPerVehicle
+            + lane->startupLostTime;
+        if((SIM_TIME_PRIORITIZED == timing) && fixedPoint)
+        {
+            //integer times fixed-point gives the integer part directly
+            int64_t steps = SimFixedMul(lane->stepsBeforeChange, SimToFixed(lane->priority));
+            lane->stepsBeforeChange = (steps < 0) ? 0 : ((steps > UINT32_MAX) ? UINT32_MAX : (uint32_t)steps);
+        }
+        else if(SIM_TIME_PRIORITIZED == timing)
+            lane->stepsBeforeChange = (float)(lane->stepsBeforeChange) * lane->priority;
+        if(lane->stepsBeforeChange < lane->minGreenTime)
+            lane->stepsBeforeChange = lane->minGreenTime;
+        else if(lane->stepsBeforeChange > lane->maxGreenTime)
+            lane->stepsBeforeChange = lane->maxGreenTime;
+    }
+}
+
+/**
+ * @brief Check if lane is waiting for green light and may get it
+ * @param *lane Lane
+ * @return True if the lane has red light, waiting vehicles and its minimum red time has elapsed
+ */
+static bool SimIsLaneWaiting(const struct Lane *lane)
+{
+    return ((LIGHT_RED == lane->light) || (LIGHT_ARROW == lane->light)) && (0 != lane->vehicleCount)
+        && (lane->waitTime >= lane->minRedTime);
+}
+
+/**
+ * @brief Start waiting lanes of the phase with the highest total dynamic priority
+ *
+ * Only the phase containing all active lanes can be extended. If another phase has higher priority, no lane
+ * is started until the active lanes switch to red, so that lower priority lanes can't hold the junction forever.
+ * @param selection Lane selection policy
+ * @param timing Light timing policy
+ * @param fixedPoint Use fixed-point priority
+ */
+static SIM_ALWAYS_INLINE void SimHandlePhaseSelection(enum SimSelectionPolicy selection, enum SimTimePolicy timing,
+    bool fixedPoint)
+{
+    size_t words = SimState->laneWords;
+    size_t best = SIZE_MAX;
+    float bestScore = 0.f;
+    __int128 bestFixedScore = 0; //a sum of many fixed-point priorities may not fit 64 bits
+    for(size_t i = 0; i < SimState->numPhases; i++)
+    {
+        const uint64_t *phase = &SimState->phases[i * words];
+        float score = 0.f;
+        __int128 fixedScore = 0;
+        for(size_t w = 0; w < words; w++)
+        {
+            for(uint64_t bits = phase[w] & SimState->occupiedLanes[w] & SimState->redLanes[w]; 0 != bits; bits &= bits - 1)
+            {
+                const struct Lane *lane = SimState->laneById[w * 64 + __builtin_ctzll(bits)];
+                if(SimIsLaneWaiting(lane))
+                {
+                    score += lane->dynamicPriority;
+                    fixedScore += lane->fixedPriority;
+                }
+            }
+        }
+        if(fixedPoint ? (fixedScore > bestFixedScore) : (score > bestScore))
+        {
+            bestScore = score;
+            bestFixedScore = fixedScore;
+            best = i;
+        }
+    }
+    if(SIZE_MAX == best)
+        return;
+
+    const uint64_t *phase = &SimState->phases[best * words];
+    for(size_t w = 0; w < words; w++)
+    {
+        if(0 != (SimState->activeLanes[w] & ~phase[w]))
+            return;
+    }
+    for(size_t w = 0; w < words; w++)
+    {
+        for(uint64_t bits = phase[w] & SimState->occupiedLanes[w] & SimState->redLanes[w]; 0 != bits; bits &= bits - 1)
+        {
+            struct Lane *lane = SimState->laneById[w * 64 + __builtin_ctzll(bits)];
+            if(SimIsLaneWaiting(lane))
+                SimUnblockLane(lane, selection, timing, fixedPoint);
+        }
+    }
+}
+
+/**
+ * @brief Select lanes switching to green light
+ * @param selection Lane selection policy
+ * @param timing Light timing policy
+ * @param fixedPoint Use fixed-point priority
+ */
+static SIM_ALWAYS_INLINE void SimHandleSelection(enum SimSelectionPolicy selection, enum SimTimePolicy timing,
+    bool fixedPoint)
+{
+    SimSortLanes(fixedPoint);
+
+    if(0 != SimState->numPhases)
+    {
+        SimHandlePhaseSelection(selection, timing, fixedPoint);
+        return;
+    }
+
+    //starting from the highest priority waiting lane, check if it's safe to switch to green
+    for(size_t i = 0; i < SimState->numScheduled; i++)
+    {
+        struct Lane *lane = SimState->lanes[i];
+        //lanes that have switched to red in this step might have no vehicles
+        if(!SimBitsetTest(SimState->redLanes, lane->id) || (0 == lane->vehicleCount))
+            continue;
+
+        if(lane->waitTime < lane->minRedTime)
+            break;
+
+        //check for colliding flows with lanes that have green or red-yellow light, or have been just unblocked
+        //permissive lanes that are allowed to have colliding traffic are not marked as conflicting
+        if(SimBitsetIntersects(&SimState->laneConflicts[lane->id * SimState->laneWords],
+            SimState->activeLanes, SimState->laneWords))
+            break;
+
+        //there is no possible collision or the colision is "legal"
+        SimUnblockLane(lane, selection, timing, fixedPoint);
+    }
+}
+
+/**
+ * @brief Switch unblocked lanes to red-yellow light and red-yellow lanes to green light
+ */
+static void SimHandleSwitchToGreen(void)
+{
+    //lanes changing light are on the scheduling list, so they are visited and reported in the priority order
+    for(size_t i = 0; i < SimState->numScheduled; i++)
+    {
+        struct Lane *lane = SimState->lanes[i];
+        if(LIGHT_RED_YELLOW == lane->light)
+        {
+            lane->lostTimeLeft = lane->startupLostTime;
+            if(0 != lane->lostTimeLeft)
+                SimBitsetSet(SimState->startingLanes, lane->id);
+            SimSetLight(lane, LIGHT_GREEN);
+        }
+        else if(lane->unblocked)
+        {
+            lane->unblocked = false;
+            SimSetLight(lane, LIGHT_RED_YELLOW);
+        }
+    }
+}
+
+/**
+ * @brief Perform simulation step with given policies
+ * @param selection Lane selection policy
+ * @param timing Light timing policy
+ * @param fixedPoint Use fixed-point priority
+ * @note This is instantiated for each policy combination with constant arguments (see SIM_DEFINE_STEP),
+ * so the per-lane loops are compiled without policy checks
+ */
+static SIM_ALWAYS_INLINE void SimStep(enum SimSelectionPolicy selection, enum SimTimePolicy timing, bool fixedPoint)
+{
+    uint64_t *marks = SimState->stepMarks;
+    SimProfileMarkStep(marks, SIM_PROFILE_STEP_START);
+    if(SIM_RIGHT_HAND_RULE != selection)
+    {
+        SimHandleRedLights(selection, fixedPoint);
+        SimProfileMarkStep(marks, SIM_PROFILE_SELECTION_START);
+        SimHandleSelection(selection, timing, fixedPoint);
+        SimProfileMarkStep(marks, SIM_PROFILE_SWITCH_START);
+        SimHandleSwitchToGreen();
+    }
+    SimProfileMarkStep(marks, SIM_PROFILE_VEHICLES_START);
+    SimHandleVehicles(selection);
+    ++SimState->step;
+    if(SIM_LOOKAHEAD == selection)
+        SimAdvanceForecast();
+}
+
+static void SimStepRightHandRule(void)
+{
+    SimStep(SIM_RIGHT_HAND_RULE, SIM_TIME_FIXED, false);
+}
+
+//timing policies for each selection policy
+#define SIM_TIME_POLICIES(X, selection) \
+    X(selection, SIM_TIME_FIXED) X(selection, SIM_TIME_PROPORTIONAL) X(selection, SIM_TIME_PRIORITIZED)
+
+//all policy combinations that control the lights
+#define SIM_POLICY_COMBINATIONS(X) \
+    SIM_TIME_POLICIES(X, SIM_FCFS) SIM_TIME_POLICIES(X, SIM_HLFS) SIM_TIME_POLICIES(X, SIM_DYNAMIC) \
+    SIM_TIME_POLICIES(X, SIM_LOOKAHEAD) SIM_TIME_POLICIES(X, SIM_MAX_PRESSURE)
+
+//float and fixed-point step function of a policy combination
+#define SIM_DEFINE_STEP(selection, timing) \
+    static void SimStep_##selection##_##timing(void) \
+    { \
+        SimStep(selection, timing, false); \
+    } \
+    static void SimStepFixed_##selection##_##timing(void) \
+    { \
+        SimStep(selection, timing, true); \
+    }
+
+#define SIM_STEP_ENTRY(selection, timing) \
+    [selection][timing] = {SimStep_##selection##_##timing, SimStepFixed_##selection##_##timing},
+
+SIM_POLICY_COMBINATIONS(SIM_DEFINE_STEP)
+
+/**
+ * @brief Step functions, indexed by selection policy, timing policy and fixed-point mode
+ */
+static const SimStepFunction SimStepFunctions[SIM_MAX_PRESSURE + 1][SIM_TIME_PRIORITIZED + 1][2] = {
+    SIM_POLICY_COMBINATIONS(SIM_STEP_ENTRY)
+};
+
+/**
+ * @brief Get policy combination of an instance configuration
+ * @param *config Configuration
+ * @return Combination key, compared to the key the step function was bound for
+ */
+static inline uint32_t SimGetStepKey(const struct SimConfig *config)
+{
+    return ((uint32_t)config->selectionPolicy << 16) | ((uint32_t)config->timePolicy << 1) | (config->fixedPoint ? 1 : 0);
+}
+
+/**
+ * @brief Bind step function matching the configured policies to an instance
+ * @param *state Simulation instance
+ * @return 0 on success, <0 if the policies are not valid
+ */
+static int SimBindStep(struct SimState *state)
+{
+    const struct SimConfig *config = state->config;
+    if(((unsigned int)config->selectionPolicy > SIM_MAX_PRESSURE)
+        || ((unsigned int)config->timePolicy > SIM_TIME_PRIORITIZED))
+    {
+        printf("Invalid lane selection or light timing policy\r\n");
+        return -1;
+    }
+    if(SIM_RIGHT_HAND_RULE == config->selectionPolicy)
+        state->stepFunction = SimStepRightHandRule;
+    else
+        state->stepFunction = SimStepFunctions[config->selectionPolicy][config->timePolicy][config->fixedPoint ? 1 : 0];
+    state->stepKey = SimGetStepKey(config);
+    return 0;
+}
+
+bool SimDoStep(void)
+{
+    //policies may be changed at any time, the step function is bound again on the next step
+    if((SimGetStepKey(SimState->config) != SimState->stepKey) && (0 != SimBindStep(SimState)))
+        return false;
+    SimState->stepFunction();
+    if(NULL != SimState->timeline)
+        SimTimelineEndStep(SimState->timeline, SimState->step - 1);
+    if(NULL != SimState->profile)
+        SimProfileEndStep(SimState->profile);
+    SimState->totalDelay += SimState->numVehicles;
+    if(SimState->logEvents)
+        printf("Step done, %lu vehicles remaining\r\n", SimState->numVehicles);
+    return (0 != SimState->numVehicles);
+}
+
+/**
+ * @brief Rebuild lane state bitsets of an instance from the lanes
+ * @param *state Simulation instance with tables built
+ * @note Lane flags valid only within a step (blocked, unblocked, discharged count) are cleared as well
+ */
+static void SimRebuildLaneSets(struct SimState *state)
+{
+    size_t words = state->laneWords;
+    SimBitsetClear(state->activeLanes, words);
+    SimBitsetClear(state->occupiedLanes, words);
+    SimBitsetClear(state->startingLanes, words);
+    SimBitsetClear(state->announcedLanes, words);
+    for(size_t i = 0; i < state->numLanes; i++)
+    {
+        struct Lane *lane = state->laneById[i];
+        SimUpdateLightSets(state, lane);
+        SimBitsetAssign(state->occupiedLanes, i, 0 != lane->vehicleCount);
+        SimBitsetAssign(state->startingLanes, i, 0 != lane->lostTimeLeft);
+        SimBitsetAssign(state->announcedLanes, i, 0 != lane->upcomingCount);
+        lane->blocked = false;
+        lane->unblocked = false;
+        lane->dischargedCount = 0;
+    }
+}
+
+int SimAllocateTables(struct SimState *state)
+{
+    struct SimConfig *config = state->config;
+    if((0 == config->roadCount) || (config->roadCount > MAX_ROADS) || (NULL == config->road))
+    {
+        printf("Invalid number of roads\r\n");
+        return -1;
+    }
+    if(0 != SimBindStep(state))
+        return -1;
+
+    size_t numLanes = 0;
+    for(uint8_t i = 0; i < config->roadCount; i++)
+    {
+        if(i != config->road[i].position)
+        {
+            printf("Road %u position must be equal to its index\r\n", (unsigned int)i);
+            return -1;
+        }
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            if((config->road[i].lane[k].direction.mask >> config->roadCount) || (&config->road[i] != config->road[i].lane[k].road))
+            {
+                printf("Lane %zu of road %u is misconfigured\r\n", k, (unsigned int)i);
+                return -1;
+            }
+        }
+        numLanes += config->road[i].laneCount;
+    }
+
+    //one block for lane bitsets (conflicts for each lane and the lane state sets), idle ranks and lane lists
+    size_t words = SimBitsetWords(numLanes);
+    uint64_t *block = malloc(((numLanes + SIM_LANE_SETS) * words + numLanes) * sizeof(uint64_t)
+        + 3 * numLanes * sizeof(struct Lane*));
+    if(NULL == block)
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+    free(state->laneConflicts);
+    state->laneConflicts = block;
+    state->activeLanes = block + numLanes * words;
+    state->occupiedLanes = state->activeLanes + words;
+    state->redLanes = state->occupiedLanes + words;
+    state->movableLanes = state->redLanes + words;
+    state->startingLanes = state->movableLanes + words;
+    state->announcedLanes = state->startingLanes + words;
+    state->scheduledLanes = state->announcedLanes + words;
+    state->idleRank = state->scheduledLanes + words;
+    state->lanes = (struct Lane**)(state->idleRank + numLanes);
+    state->readyLanes = state->lanes + numLanes;
+    state->laneById = state->readyLanes + numLanes;
+    state->laneWords = words;
+    state->numLanes = numLanes;
+
+    size_t index = 0;
+    for(uint8_t i = 0; i < config->roadCount; i++)
+    {
+        config->road[i].vehicleCount = 0;
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            config->road[i].vehicleCount += config->road[i].lane[k].vehicleCount;
+            config->road[i].lane[k].id = index;
+            state->laneById[index] = &config->road[i].lane[k];
+            state->lanes[index++] = &config->road[i].lane[k];
+        }
+    }
+    return 0;
+}
+
+void SimResetSchedule(struct SimState *state)
+{
+    //all lanes are scheduled, the idle lanes are dropped on the next step
+    state->numScheduled = state->numLanes;
+    state->nextIdleRank = UINT64_MAX;
+    SimBitsetClear(state->scheduledLanes, state->laneWords);
+    for(size_t i = 0; i < state->numLanes; i++)
+        SimBitsetSet(state->scheduledLanes, i);
+    SimRebuildLaneSets(state);
+}
+
+int SimBuildTables(struct SimState *state)
+{
+    if(0 != SimAllocateTables(state))
+        return -1;
+
+    struct SimConfig *config = state->config;
+    SimSetupRoadGeometry(config->road, config->roadCount);
+    for(uint8_t i = 0; i < config->roadCount; i++)
+    {
+        for(uint8_t k = 0; k < config->roadCount; k++)
+            state->turn[i][k] = SimGetTurn(config->road[i].order, config->road[k].order, config->roadCount);
+    }
+
+    //flows of vehicles: the same flow from different lanes is not a collision
+    memset(state->flowConflicts, 0, sizeof(state->flowConflicts));
+    for(uint8_t a = 0; a < (config->roadCount * MAX_ROADS); a++)
+    {
+        for(uint8_t b = 0; b < (config->roadCount * MAX_ROADS); b++)
+        {
+            uint8_t sA = a / MAX_ROADS, eA = a % MAX_ROADS, sB = b / MAX_ROADS, eB = b % MAX_ROADS;
+            if((a != b) && (eA < config->roadCount) && (eB < config->roadCount)
+                && SimArePathsColliding(config->road[sA].order, config->road[eA].order,
+                    config->road[sB].order, config->road[eB].order, config->roadCount))
+                state->flowConflicts[a] |= (uint64_t)1 << b;
+        }
+    }
+
+    //lanes that must not have green light at the same time:
+    //colliding flows are allowed only when both lanes are permissive and they are at the opposing sides
+    //(this way we can simulate a real scenario of permissive left turns) or allow identical flow
+    size_t numLanes = state->numLanes, words = state->laneWords;
+    SimBitsetClear(state->laneConflicts, numLanes * words);
+    for(size_t i = 0; i < numLanes; i++)
+    {
+        const struct Lane *lane = state->lanes[i];
+        for(size_t k = 0; k < numLanes; k++)
+        {
+            const struct Lane *other = state->lanes[k];
+            if(lane == other)
+                continue;
+
+            bool colliding = false;
+            for(uint8_t a = 0; a < config->roadCount; a++)
+            {
+                if(!(lane->direction.mask & (1u << a)))
+                    continue;
+                uint8_t flowA = lane->road->position * MAX_ROADS + a;
+                for(uint8_t b = 0; b < config->roadCount; b++)
+                {
+                    uint8_t flowB = other->road->position * MAX_ROADS + b;
+                    if((other->direction.mask & (1u << b)) 
+                        && ((flowA == flowB) || (state->flowConflicts[flowA] & ((uint64_t)1 << flowB))))
+                        colliding = true;
+                }
+            }
+
+            if(colliding && (lane->permissive && other->permissive)
+                && ((SIM_TURN_STRAIGHT == state->turn[lane->road->position][other->road->position]) || SimAreFlowsIdentical(lane, other)))
+                colliding = false;
+
+            if(colliding)
+                SimBitsetSet(&state->laneConflicts[i * words], k);
+        }
+    }
+
+    SimResetSchedule(state);
+    return SimBuildPhases(state);
+}
+
+void SimResetState(void)
+{
+    for(size_t i = 0; i < SimState->numLanes; i++)
+    {
+        struct Lane *lane = SimState->laneById[i];
+        lane->dynamicPriority = -1.f;
+        lane->fixedPriority = INT64_MIN;
+        lane->lostTimeLeft = 0;
+        SimClearForecast(lane);
+        if(SIM_RIGHT_HAND_RULE != SimState->config->selectionPolicy)
+        {
+            if(SimCanTurnRightFromLane(lane))
+                SimSetLight(lane, LIGHT_ARROW);
+            else
+                SimSetLight(lane, LIGHT_RED);
+        }
+        else
+            SimSetLight(lane, LIGHT_DISABLED);
+    }
+    SimRebuildLaneSets(SimState);
+    SimState->nextVehicle = 1;
+    SimState->numVehicles = 0;
+    SimIndexClear(&SimState->vehicleIndex);
+    SimState->exitedVehicles = 0;
+    SimState->totalDelay = 0;
+    SimState->step = 0;
+}
+
+int SimInit(void)
+{
+    if(SimState->logEvents)
+        printf("Initializing simulation...\r\n");
+    if(0 != SimBuildTables(SimState))
+        return -1;
+    SimResetState();
+    if(SimState->logEvents)
+        printf("Initialization finished\r\n\r\n");
+    return 0;
+}
+
+struct SimState* SimFork(void)
+{
+    struct SimState *parent = SimState;
+    struct SimState *child = malloc(sizeof(*child));
+    if(NULL == child)
+    {
+        printf("Memory allocation failed\r\n");
+        return NULL;
+    }
+
+    *child = *parent;
+    child->forkedConfig = *parent->config;
+    child->config = &child->forkedConfig;
+    child->vehicleExitCallback = NULL;
+    child->context = NULL;
+    child->laneConflicts = NULL;
+    child->trace = NULL;
+    child->timeline = NULL;
+    child->profile = NULL;
+    child->stepMarks = NULL;
+    child->phases = NULL;
+    if(0 != SimIndexCopy(&child->vehicleIndex, &parent->vehicleIndex))
+    {
+        free(child);
+        return NULL;
+    }
+
+    //roads and lanes are copied into one block, the lanes start at a cache line
+    size_t roadsSize = (parent->config->roadCount * sizeof(struct Road) + SIM_CACHE_LINE - 1) & ~(size_t)(SIM_CACHE_LINE - 1);
+    struct Road *roads = aligned_alloc(SIM_CACHE_LINE, roadsSize + parent->numLanes * sizeof(struct Lane));
+    if(NULL == roads)
+    {
+        printf("Memory allocation failed\r\n");
+        free(child->vehicleIndex.slots);
+        free(child);
+        return NULL;
+    }
+    struct Lane *lanes = (struct Lane*)((uint8_t*)roads + roadsSize);
+    child->config->road = roads;
+    for(uint8_t i = 0; i < child->config->roadCount; i++)
+    {
+        roads[i] = parent->config->road[i];
+        memcpy(lanes, parent->config->road[i].lane, roads[i].laneCount * sizeof(*lanes));
+        roads[i].lane = lanes;
+        for(size_t k = 0; k < roads[i].laneCount; k++)
+        {
+            roads[i].lane[k].road = &roads[i];
+            roads[i].lane[k].links = NULL;
+        }
+        lanes += roads[i].laneCount;
+    }
+
+    //links are the only per-lane data not shared, so that both instances can drop them independently
+    for(uint8_t i = 0; i < child->config->roadCount; i++)
+    {
+        for(size_t k = 0; k < roads[i].laneCount; k++)
+        {
+            struct Lane *lane = &roads[i].lane[k];
+            if(0 == lane->linkCount)
+                continue;
+            lane->links = malloc(lane->linkCount * sizeof(*lane->links));
+            if(NULL == lane->links)
+            {
+                printf("Memory allocation failed\r\n");
+                SimRelease(child);
+                return NULL;
+            }
+            memcpy(lane->links, parent->config->road[i].lane[k].links, lane->linkCount * sizeof(*lane->links));
+        }
+    }
+
+    if(0 != SimBuildTables(child))
+    {
+        SimRelease(child);
+        return NULL;
+    }
+    //restore the scheduling list of the parent
+    for(size_t i = 0; i < parent->numScheduled; i++)
+        child->lanes[i] = child->laneById[parent->lanes[i]->id];
+    child->numScheduled = parent->numScheduled;
+    memcpy(child->scheduledLanes, parent->scheduledLanes, child->laneWords * sizeof(*child->scheduledLanes));
+    memcpy(child->idleRank, parent->idleRank, child->numLanes * sizeof(*child->idleRank));
+    child->nextIdleRank = parent->nextIdleRank;
+
+    //from now on all waiting vehicles are shared by both instances
+    for(size_t i = 0; i < parent->numLanes; i++)
+    {
+        parent->laneById[i]->sharedCount = parent->laneById[i]->vehicleCount;
+        child->laneById[i]->sharedCount = child->laneById[i]->vehicleCount;
+    }
+
+    return child;
+}
+
+void SimSelect(struct SimState *instance)
+{
+    SimState = (NULL != instance) ? instance : &SimMainState;
+}
+
+void SimRelease(struct SimState *instance)
+{
+    if((NULL == instance) || (&SimMainState == instance))
+        return;
+
+    for(uint8_t i = 0; i < instance->config->roadCount; i++)
+    {
+        for(size_t k = 0; k < instance->config->road[i].laneCount; k++)
+            free(instance->config->road[i].lane[k].links);
+    }
+    if(SimState == instance)
+        SimState = &SimMainState;
+    free(instance->laneConflicts);
+    free(instance->phases);
+    free(instance->vehicleIndex.slots);
+    free(instance->config->road);
+    free(instance);
+}
+
+void SimSetEventLogging(bool enabled)
+{
+    SimState->logEvents = enabled;
+}
+
+int SimReserveVehicles(size_t count)
+{
+    return SimIndexReserve(&SimState->vehicleIndex, count);
+}
+
+struct SimConfig* SimGetConfig(void)
+{
+    return SimState->config;
+}
+
+void SimGetStats(struct SimStats *stats)
+{
+    stats->step = SimState->step;
+    stats->waitingVehicles = SimState->numVehicles;
+    stats->exitedVehicles = SimState->exitedVehicles;
+    stats->totalDelay = SimState->totalDelay;
+}
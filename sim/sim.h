@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include "types.h"
 
 enum SimSelectionPolicy
@@ -12,6 +13,8 @@ enum SimSelectionPolicy
     SIM_FCFS = 1, /**< First come, first served */
     SIM_HLFS = 2, /**< Highest load, first served */
     SIM_DYNAMIC = 3, /**< Dynamic priority-based aligorithm */
+    SIM_LOOKAHEAD = 4, /**< Dynamic priority including arrivals announced within the look-ahead horizon */
+    SIM_MAX_PRESSURE = 5, /**< Max-pressure: lane queue minus the queue of the connected downstream roads */
 };
 
 enum SimTimePolicy
@@ -23,12 +26,28 @@ enum SimTimePolicy
 
 struct SimConfig
 {
-    struct Road road[4]; /** Roads - always 4 */
+    struct Road *road; /**< Roads, indexed by their position */
+    size_t roadCount; /**< Number of roads, up to MAX_ROADS */
     enum SimSelectionPolicy selectionPolicy; /**< Lane selection policy */
     enum SimTimePolicy timePolicy; /**< Light timing policy */
+    bool phaseScheduling; /**< Start the best set of compatible lanes (phase) instead of promoting lanes one at a time */
+    bool fixedPoint; /**< Score lanes and scale green times with exact integer arithmetic instead of float */
 };
 
-extern struct SimConfig SimConfig; /**< Simulation configuration */
+extern struct SimConfig SimConfig; /**< Main simulation instance configuration */
+
+struct SimState; /**< Simulation instance (opaque) */
+
+/**
+ * @brief Simulation outcome statistics
+ */
+struct SimStats
+{
+    uint32_t step; /**< Current simulation step */
+    size_t waitingVehicles; /**< Number of vehicles waiting at the junction */
+    size_t exitedVehicles; /**< Number of vehicles that exited */
+    uint64_t totalDelay; /**< Vehicle-steps spent waiting at the junction */
+};
 
 typedef void (*SimVehicleExitedCallback)(struct Vehicle *vehicle, void *context);
 
@@ -53,16 +72,190 @@ int SimPlaceVehicle(struct Vehicle *vehicle, struct Lane *lane);
  */
 struct Lane* SimSelectLane(enum Direction start, enum Direction end);
 
+/**
+ * @brief Find waiting vehicle by name
+ * @param *name Vehicle name
+ * @return Vehicle, NULL if there is no such vehicle waiting at the junction
+ * @note If more vehicles have the same name, any of them is returned
+ */
+struct Vehicle* SimFindVehicle(const char *name);
+
+/**
+ * @brief Announce vehicle that will arrive in a future step, used by the look-ahead policy
+ * @param start Starting road direction
+ * @param end Ending road direction
+ * @param step Step the vehicle will be placed in (before the step is performed)
+ * @return 0 on success, <0 if the policy is not SIM_LOOKAHEAD, there is no lane or the step is not within
+ * the look-ahead horizon
+ * @note The arrival is counted on the lane selected now. It is dropped when its step is reached, the vehicle
+ * must still be placed with SimPlaceVehicle().
+ */
+int SimAnnounceVehicle(enum Direction start, enum Direction end, uint32_t step);
+
+/**
+ * @brief Remove vehicle from any position in line, without executing the vehicle exit callback
+ * @param *vehicle Waiting vehicle
+ * @return 0 on success, <0 on failure
+ * @note The vehicle is no longer used by the simulation and can be released by the caller
+ */
+int SimRemoveVehicle(struct Vehicle *vehicle);
+
+/**
+ * @brief Move vehicle to the end of the line of another lane on the same road
+ * @param *vehicle Waiting vehicle
+ * @param *lane Target lane, must allow the vehicle direction
+ * @return 0 on success, <0 on failure
+ * @attention Vehicles shared with forked instances can't be moved.
+ * If the vehicle could not be linked to the target lane (no memory), it is removed from the simulation.
+ */
+int SimChangeLane(struct Vehicle *vehicle, struct Lane *lane);
+
+/**
+ * @brief Change vehicle destination
+ *
+ * The vehicle stays on its lane if the lane allows the new direction. Otherwise it is moved
+ * to the end of the line of the best lane selected by SimSelectLane().
+ * @param *vehicle Waiting vehicle
+ * @param end New destination
+ * @return 0 on success, <0 on failure (including a destination road that does not exist)
+ * @attention Vehicles shared with forked instances can't be rerouted
+ */
+int SimRerouteVehicle(struct Vehicle *vehicle, enum Direction end);
+
 /**
  * @brief Perform simulation step
  * @return True if simulation not ended (vehicles still waiting), false otherwise
  */
 bool SimDoStep(void);
 
+/**
+ * @brief Vehicle allocator used when restoring vehicles from a snapshot
+ * @param nameLength Vehicle name length (without the terminating null character)
+ * @param *context User context
+ * @return Allocated vehicle with room for the name, NULL on failure
+ */
+typedef struct Vehicle* (*SimVehicleAllocator)(size_t nameLength, void *context);
+
+/**
+ * @brief Write a binary snapshot of the configuration, state and all queued vehicles
+ * @param *f Output file
+ * @return 0 on success, <0 on failure
+ */
+int SimSaveSnapshot(FILE *f);
+
+/**
+ * @brief Restore configuration, state and queued vehicles from a binary snapshot
+ * @param *f Input file
+ * @param allocator Vehicle allocator, NULL to use malloc(); the vehicles must be releasable with free()
+ * @param *context Allocator context
+ * @return 0 on success, <0 on failure
+ * @attention Call this function *instead of* SimInit(). The registered vehicle exit callback is preserved.
+ * On failure the vehicles restored so far are freed, the simulation state is undefined and must be reinitialized.
+ */
+int SimLoadSnapshot(FILE *f, SimVehicleAllocator allocator, void *context);
+
 /**
  * @brief Initialize simulation
- * @attention Call this function *before* placing vehicles
+ * @return 0 on success, <0 on failure (invalid configuration or no memory)
+ * @attention Call this function *before* placing vehicles.
+ * Lane directions and permissive flags are fixed by this call, other lane parameters may be changed at any time.
+ */
+int SimInit(void);
+
+/**
+ * @brief Fork currently selected simulation instance
+ * 
+ * The forked instance gets a private copy of the configuration and state, so that it can be advanced
+ * with different lane parameters or policies. Vehicles waiting at the junction are not copied, but shared
+ * copy-on-write by both instances: shared vehicles are never modified, vehicles placed later are private.
+ * @return Forked instance, NULL on failure
+ * @attention Shared vehicles must stay valid until all instances sharing them are released.
+ * The vehicle exit callback is not inherited.
+ */
+struct SimState* SimFork(void);
+
+/**
+ * @brief Write a precompiled junction image
+ *
+ * The configuration is validated and its geometry, conflict and phase tables are derived once, then the layout,
+ * policies and tables are written, so that SimLoadJunction() creates instances without deriving anything.
+ * @param *config Junction configuration, road geometry and lane indices are set in it as by SimInit()
+ * @param *f Output file
+ * @return 0 on success, <0 on failure
+ */
+int SimCompileJunction(struct SimConfig *config, FILE *f);
+
+/**
+ * @brief Create simulation instance from a precompiled junction image
+ *
+ * The image is validated (layout, table bounds and checksum) and copied, then the instance is initialized
+ * as by SimInit(). No vehicles are waiting and no roads are connected.
+ * @param *image Image written by SimCompileJunction(), e.g. a mapped file, not referenced after the call
+ * @param size Image size
+ * @return New instance, NULL on failure
+ * @note The instance is released with SimRelease(). Event logging setting is inherited from the selected instance.
+ */
+struct SimState* SimLoadJunction(const void *image, size_t size);
+
+/**
+ * @brief Select simulation instance used by all subsequent calls of the calling thread
+ *
+ * Each thread starts with the main instance selected. Distinct instances may be used by different threads
+ * at the same time, e.g. instances loaded with SimLoadJunction() by each thread.
+ * @param *instance Simulation instance, NULL for the main instance
+ * @attention The main instance, SimConfig and instances connected with SimConnectRoad() are not protected,
+ * they must be used by one thread at a time
+ */
+void SimSelect(struct SimState *instance);
+
+/**
+ * @brief Release forked or loaded simulation instance
+ * @param *instance Forked or loaded simulation instance. The main instance is selected if this instance was selected.
+ * @attention Vehicles are not released
+ */
+void SimRelease(struct SimState *instance);
+
+/**
+ * @brief Connect exit of the selected instance to an entry road of another instance (junction network)
+ *
+ * The max-pressure policy subtracts the queue of the connected entry road from the queue of the lanes
+ * leading to the exit. Vehicles are not moved between the instances, the user places them in the next junction.
+ * @param exit Exit road of the selected instance
+ * @param *neighbour Instance the exit leads to, NULL to disconnect the exit
+ * @param entry Road of the neighbour instance the vehicles enter
+ * @return 0 on success, <0 on failure
+ * @attention The neighbour must stay valid while connected. Forked instances inherit the connections.
+ */
+int SimConnectRoad(enum Direction exit, struct SimState *neighbour, enum Direction entry);
+
+/**
+ * @brief Enable or disable printing of simulation events by the selected instance
+ * @param enabled True to print initialization, vehicle exits, light changes and steps (default), false for a silent step path
+ * @note Forked instances inherit this setting
+ */
+void SimSetEventLogging(bool enabled);
+
+/**
+ * @brief Reserve room for waiting vehicles of the selected instance
+ *
+ * Placing vehicles does not allocate memory as long as the number of waiting vehicles does not exceed
+ * the reserved count (and no vehicles are shared with forked instances). Steps never allocate memory.
+ * @param count Number of vehicles
+ * @return 0 on success, <0 on failure
+ */
+int SimReserveVehicles(size_t count);
+
+/**
+ * @brief Get configuration of the currently selected instance
+ * @return Configuration pointer (&SimConfig for the main instance)
+ * @note Lane pointers of an instance must be used only with the same instance
+ */
+struct SimConfig* SimGetConfig(void);
+
+/**
+ * @brief Get outcome statistics of the currently selected instance
+ * @param *stats Output statistics
  */
-void SimInit(void);
+void SimGetStats(struct SimStats *stats);
 
 #endif
\ No newline at end of file
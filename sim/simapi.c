@@ -0,0 +1,428 @@
+#include "simapi.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+_Static_assert((int)SIM_API_DYNAMIC == (int)SIM_DYNAMIC, "Selection policies must match");
+_Static_assert((int)SIM_API_TIME_PRIORITIZED == (int)SIM_TIME_PRIORITIZED, "Time policies must match");
+_Static_assert((int)SIM_API_LIGHT_ARROW == (int)LIGHT_ARROW, "Lights must match");
+
+/**
+ * @brief Simulation handle
+ */
+struct SimApiHandle
+{
+    struct SimState *sim; /**< Simulation instance, NULL if not started */
+    struct Road road[MAX_ROADS]; /**< Junction description, used until the simulation is started */
+    size_t roadCount; /**< Number of roads */
+    enum SimSelectionPolicy selectionPolicy; /**< Lane selection policy */
+    enum SimTimePolicy timePolicy; /**< Light timing policy */
+    uint32_t step; /**< Current step */
+    uint32_t *exitSteps; /**< Step of each logged exit */
+    uint64_t *exitIds; /**< Sequential index of each exited vehicle */
+    size_t exitCount; /**< Number of logged exits */
+    size_t exitRead; /**< Number of exits already taken */
+    size_t exitCapacity; /**< Exit log capacity */
+    bool failed; /**< Exit log could not be extended */
+    SimApiExitCallback callback; /**< User exit callback */
+    void *context; /**< User exit callback context */
+};
+
+static void SimApiVehicleExited(struct Vehicle *vehicle, void *context)
+{
+    struct SimApiHandle *handle = context;
+    if(NULL != handle->callback)
+        handle->callback(vehicle->name, vehicle->index, handle->step, handle->context);
+
+    if(handle->exitCount == handle->exitCapacity)
+    {
+        //drop taken exits before growing the log
+        if(0 != handle->exitRead)
+        {
+            handle->exitCount -= handle->exitRead;
+            memmove(handle->exitSteps, handle->exitSteps + handle->exitRead, handle->exitCount * sizeof(*handle->exitSteps));
+            memmove(handle->exitIds, handle->exitIds + handle->exitRead, handle->exitCount * sizeof(*handle->exitIds));
+            handle->exitRead = 0;
+        }
+        if(handle->exitCount == handle->exitCapacity)
+        {
+            size_t capacity = (0 == handle->exitCapacity) ? 1024 : (2 * handle->exitCapacity);
+            uint32_t *steps = realloc(handle->exitSteps, capacity * sizeof(*steps));
+            if(NULL != steps)
+                handle->exitSteps = steps;
+            uint64_t *ids = realloc(handle->exitIds, capacity * sizeof(*ids));
+            if(NULL != ids)
+                handle->exitIds = ids;
+            if((NULL == steps) || (NULL == ids))
+            {
+                printf("Memory allocation failed\r\n");
+                handle->failed = true;
+                free(vehicle);
+                return;
+            }
+            handle->exitCapacity = capacity;
+        }
+    }
+    handle->exitSteps[handle->exitCount] = handle->step;
+    handle->exitIds[handle->exitCount] = vehicle->index;
+    ++handle->exitCount;
+    free(vehicle);
+}
+
+/**
+ * @brief Select simulation instance of a started simulation
+ * @param *handle Simulation handle
+ * @return 0 on success, <0 if the simulation is not started
+ */
+static int SimApiSelect(struct SimApiHandle *handle)
+{
+    if((NULL == handle) || (NULL == handle->sim))
+        return -1;
+    SimSelect(handle->sim);
+    return 0;
+}
+
+/**
+ * @brief Get lane of the junction
+ * @param *handle Simulation handle
+ * @param road Road index
+ * @param lane Lane index on the road
+ * @return Lane (of the instance, if started), NULL if there is no such lane
+ */
+static struct Lane* SimApiGetLane(struct SimApiHandle *handle, unsigned int road, unsigned int lane)
+{
+    if(NULL == handle)
+        return NULL;
+    struct Road *roads = handle->road;
+    size_t roadCount = handle->roadCount;
+    if(0 == SimApiSelect(handle))
+    {
+        roads = SimGetConfig()->road;
+        roadCount = SimGetConfig()->roadCount;
+    }
+    if((road >= roadCount) || (lane >= roads[road].laneCount))
+        return NULL;
+    return &roads[road].lane[lane];
+}
+
+/**
+ * @brief Find waiting vehicle of a started simulation
+ * @param *handle Simulation handle
+ * @param *name Vehicle name
+ * @return Vehicle, NULL if not found
+ */
+static struct Vehicle* SimApiFind(struct SimApiHandle *handle, const char *name)
+{
+    if((0 != SimApiSelect(handle)) || (NULL == name))
+        return NULL;
+    return SimFindVehicle(name);
+}
+
+uint32_t SimApiGetVersion(void)
+{
+    return SIM_API_VERSION;
+}
+
+struct SimApiHandle* SimApiCreate(uint32_t version)
+{
+    //users built against a newer minor version may use functions this library does not have
+    if(((version >> 16) != SIM_API_VERSION_MAJOR) || ((version & 0xFFFF) > SIM_API_VERSION_MINOR))
+    {
+        printf("Incompatible API version %u.%u\r\n", (unsigned int)(version >> 16), (unsigned int)(version & 0xFFFF));
+        return NULL;
+    }
+    struct SimApiHandle *handle = calloc(1, sizeof(*handle));
+    if(NULL == handle)
+    {
+        printf("Memory allocation failed\r\n");
+        return NULL;
+    }
+    handle->selectionPolicy = SIM_DYNAMIC;
+    handle->timePolicy = SIM_TIME_PRIORITIZED;
+    return handle;
+}
+
+void SimApiDestroy(struct SimApiHandle *handle)
+{
+    if(NULL == handle)
+        return;
+    if(0 == SimApiSelect(handle))
+    {
+        //vehicles are owned by the library
+        struct SimConfig *config = SimGetConfig();
+        for(size_t i = 0; i < config->roadCount; i++)
+        {
+            for(size_t k = 0; k < config->road[i].laneCount; k++)
+            {
+                struct Lane *lane = &config->road[i].lane[k];
+                while(0 != lane->vehicleCount)
+                {
+                    struct Vehicle *v = lane->vehicles;
+                    SimRemoveVehicle(v);
+                    free(v);
+                }
+            }
+        }
+        SimRelease(handle->sim);
+    }
+    for(size_t i = 0; i < handle->roadCount; i++)
+        free(handle->road[i].lane);
+    free(handle->exitSteps);
+    free(handle->exitIds);
+    free(handle);
+}
+
+int SimApiSetPolicy(struct SimApiHandle *handle, enum SimApiSelectionPolicy selectionPolicy, enum SimApiTimePolicy timePolicy)
+{
+    if((NULL == handle) || (NULL != handle->sim) || (selectionPolicy > SIM_API_DYNAMIC) || (timePolicy > SIM_API_TIME_PRIORITIZED))
+        return -1;
+    handle->selectionPolicy = (enum SimSelectionPolicy)selectionPolicy;
+    handle->timePolicy = (enum SimTimePolicy)timePolicy;
+    return 0;
+}
+
+int SimApiAddRoad(struct SimApiHandle *handle, uint16_t bearing)
+{
+    if((NULL == handle) || (NULL != handle->sim) || (MAX_ROADS == handle->roadCount))
+        return -1;
+    struct Road *road = &handle->road[handle->roadCount];
+    road->position = handle->roadCount;
+    road->bearing = bearing;
+    return handle->roadCount++;
+}
+
+int SimApiAddLane(struct SimApiHandle *handle, unsigned int road, uint8_t directions)
+{
+    if((NULL == handle) || (NULL != handle->sim) || (road >= handle->roadCount))
+        return -1;
+    struct Road *r = &handle->road[road];
+    //lanes must be aligned to cache lines, which realloc() does not guarantee
+    struct Lane *lanes = aligned_alloc(SIM_CACHE_LINE, (r->laneCount + 1) * sizeof(*lanes));
+    if(NULL == lanes)
+    {
+        printf("Memory allocation failed\r\n");
+        return -1;
+    }
+    if(0 != r->laneCount)
+        memcpy(lanes, r->lane, r->laneCount * sizeof(*lanes));
+    free(r->lane);
+    r->lane = lanes;
+    struct Lane *lane = &lanes[r->laneCount];
+    memset(lane, 0, sizeof(*lane));
+    lane->direction.mask = directions;
+    lane->priority = 1.f;
+    lane->minGreenTime = 1;
+    lane->maxGreenTime = 10;
+    lane->minRedTime = 1;
+    lane->saturationFlow = 1;
+    return r->laneCount++;
+}
+
+int SimApiSetLaneParameter(struct SimApiHandle *handle, unsigned int road, unsigned int lane,
+    enum SimApiLaneParameter parameter, double value)
+{
+    struct Lane *l = SimApiGetLane(handle, road, lane);
+    //the value is converted to an unsigned 32-bit integer for most parameters, so it must be representable
+    if((NULL == l) || !isfinite(value) || (value < 0.) || (value > UINT32_MAX))
+        return -1;
+    switch(parameter)
+    {
+        case SIM_API_LANE_PERMISSIVE:
+            if(NULL != handle->sim)
+                return -1;
+            l->permissive = (0. != value);
+            break;
+        case SIM_API_LANE_PRIORITY:
+            l->priority = value;
+            break;
+        case SIM_API_LANE_MIN_GREEN_TIME:
+            l->minGreenTime = value;
+            break;
+        case SIM_API_LANE_MAX_GREEN_TIME:
+            l->maxGreenTime = value;
+            break;
+        case SIM_API_LANE_MIN_RED_TIME:
+            l->minRedTime = value;
+            break;
+        case SIM_API_LANE_STEPS_PER_VEHICLE:
+            l->stepsPerVehicle = value;
+            break;
+        case SIM_API_LANE_SATURATION_FLOW:
+            l->saturationFlow = value;
+            break;
+        case SIM_API_LANE_STARTUP_LOST_TIME:
+            l->startupLostTime = value;
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+void SimApiSetExitCallback(struct SimApiHandle *handle, SimApiExitCallback callback, void *context)
+{
+    if(NULL == handle)
+        return;
+    handle->callback = callback;
+    handle->context = context;
+}
+
+int SimApiStart(struct SimApiHandle *handle)
+{
+    if((NULL == handle) || (NULL != handle->sim))
+        return -1;
+
+    //the junction is initialized as the main instance and then forked, so that each handle has its own copy
+    for(size_t i = 0; i < handle->roadCount; i++)
+    {
+        for(size_t k = 0; k < handle->road[i].laneCount; k++)
+            handle->road[i].lane[k].road = &handle->road[i];
+    }
+    SimSelect(NULL);
+    SimConfig.road = handle->road;
+    SimConfig.roadCount = handle->roadCount;
+    SimConfig.selectionPolicy = handle->selectionPolicy;
+    SimConfig.timePolicy = handle->timePolicy;
+    if(0 == SimInit())
+        handle->sim = SimFork();
+    SimConfig.road = NULL;
+    SimConfig.roadCount = 0;
+    if(NULL == handle->sim)
+        return -1;
+
+    for(size_t i = 0; i < handle->roadCount; i++)
+    {
+        free(handle->road[i].lane);
+        handle->road[i].lane = NULL;
+    }
+    handle->roadCount = 0;
+    SimSelect(handle->sim);
+    SimRegisterVehicleExitedCallback(SimApiVehicleExited, handle);
+    return 0;
+}
+
+int SimApiPlaceVehicles(struct SimApiHandle *handle, size_t count, const char *const *names,
+    const uint8_t *start, const uint8_t *end, uint64_t *ids)
+{
+    if((0 != SimApiSelect(handle)) || (NULL == names) || (NULL == start) || (NULL == end))
+        return -1;
+    int ret = 0;
+    for(size_t i = 0; i < count; i++)
+    {
+        size_t length = strlen(names[i]);
+        struct Vehicle *v = malloc(sizeof(*v) + length + 1);
+        if(NULL != v)
+        {
+            memcpy(v->name, names[i], length + 1);
+            v->direction = end[i];
+            if(0 != SimPlaceVehicle(v, SimSelectLane(start[i], end[i])))
+            {
+                free(v);
+                v = NULL;
+            }
+        }
+        if(NULL != ids)
+            ids[i] = (NULL != v) ? v->index : SIM_API_NO_VEHICLE;
+        if(NULL == v)
+            ret = -1;
+    }
+    return ret;
+}
+
+int SimApiRemoveVehicle(struct SimApiHandle *handle, const char *name)
+{
+    struct Vehicle *v = SimApiFind(handle, name);
+    if((NULL == v) || (0 != SimRemoveVehicle(v)))
+        return -1;
+    free(v);
+    return 0;
+}
+
+int SimApiChangeLane(struct SimApiHandle *handle, const char *name, unsigned int lane)
+{
+    struct Vehicle *v = SimApiFind(handle, name);
+    if((NULL == v) || (lane >= v->lane->road->laneCount))
+        return -1;
+    return SimChangeLane(v, &v->lane->road->lane[lane]);
+}
+
+int SimApiRerouteVehicle(struct SimApiHandle *handle, const char *name, unsigned int end)
+{
+    struct Vehicle *v = SimApiFind(handle, name);
+    if((NULL == v) || (end >= SimGetConfig()->roadCount))
+        return -1;
+    return SimRerouteVehicle(v, end);
+}
+
+int SimApiStep(struct SimApiHandle *handle, uint32_t count, size_t *exited)
+{
+    if(0 != SimApiSelect(handle))
+        return -1;
+    size_t logged = handle->exitCount - handle->exitRead;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        SimDoStep();
+        ++handle->step;
+    }
+    if(NULL != exited)
+        *exited = handle->exitCount - handle->exitRead - logged;
+    if(handle->failed)
+    {
+        handle->failed = false;
+        return -1;
+    }
+    return 0;
+}
+
+size_t SimApiTakeExits(struct SimApiHandle *handle, uint32_t *steps, uint64_t *ids, size_t max)
+{
+    if(NULL == handle)
+        return 0;
+    size_t count = handle->exitCount - handle->exitRead;
+    if(count > max)
+        count = max;
+    if(NULL != steps)
+        memcpy(steps, handle->exitSteps + handle->exitRead, count * sizeof(*steps));
+    if(NULL != ids)
+        memcpy(ids, handle->exitIds + handle->exitRead, count * sizeof(*ids));
+    handle->exitRead += count;
+    if(handle->exitRead == handle->exitCount)
+    {
+        handle->exitRead = 0;
+        handle->exitCount = 0;
+    }
+    return count;
+}
+
+size_t SimApiGetLights(struct SimApiHandle *handle, uint8_t *lights, size_t max)
+{
+    if(0 != SimApiSelect(handle))
+        return 0;
+    struct SimConfig *config = SimGetConfig();
+    size_t count = 0;
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        for(size_t k = 0; k < config->road[i].laneCount; k++)
+        {
+            if((NULL != lights) && (count < max))
+                lights[count] = config->road[i].lane[k].light;
+            ++count;
+        }
+    }
+    return count;
+}
+
+int SimApiGetStats(struct SimApiHandle *handle, struct SimApiStats *stats)
+{
+    if((0 != SimApiSelect(handle)) || (NULL == stats))
+        return -1;
+    struct SimStats s;
+    SimGetStats(&s);
+    stats->step = s.step;
+    stats->waitingVehicles = s.waitingVehicles;
+    stats->exitedVehicles = s.exitedVehicles;
+    stats->totalDelay = s.totalDelay;
+    return 0;
+}
@@ -0,0 +1,265 @@
+#ifndef SIMAPI_H
+#define SIMAPI_H
+
+/*
+Stable C API of the shared simulator library.
+
+The API does not expose any simulator structure: simulations are referred to by opaque handles and all
+values are passed as plain integers, so that the library can be linked by other languages without marshalling
+and updated without rebuilding its users (as long as the major version does not change).
+The selected simulation instance is thread-local, so calls on different handles may be made from different threads,
+but a handle must not be used from two threads at once. SimApiStart() is not thread-safe, as it configures the junction
+through the global simulator configuration: it must not be called concurrently with another SimApiStart().
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define SIM_API __declspec(dllexport)
+#else
+#define SIM_API __attribute__((visibility("default")))
+#endif
+
+#define SIM_API_VERSION_MAJOR 1 /**< Incremented on incompatible changes */
+#define SIM_API_VERSION_MINOR 0 /**< Incremented on backward compatible additions */
+#define SIM_API_VERSION ((SIM_API_VERSION_MAJOR << 16) | SIM_API_VERSION_MINOR) /**< API version the user is built against */
+
+#define SIM_API_NO_VEHICLE UINT64_MAX /**< Vehicle index of vehicles that could not be placed */
+
+/**
+ * @brief Lane selection policy, see enum SimSelectionPolicy
+ */
+enum SimApiSelectionPolicy
+{
+    SIM_API_RIGHT_HAND_RULE = 0,
+    SIM_API_FCFS = 1,
+    SIM_API_HLFS = 2,
+    SIM_API_DYNAMIC = 3,
+};
+
+/**
+ * @brief Light timing policy, see enum SimTimePolicy
+ */
+enum SimApiTimePolicy
+{
+    SIM_API_TIME_FIXED = 0,
+    SIM_API_TIME_PROPORTIONAL = 1,
+    SIM_API_TIME_PRIORITIZED = 2,
+};
+
+/**
+ * @brief Lane light, see enum Light
+ */
+enum SimApiLight
+{
+    SIM_API_LIGHT_DISABLED = 0,
+    SIM_API_LIGHT_RED = 1,
+    SIM_API_LIGHT_RED_YELLOW = 2,
+    SIM_API_LIGHT_YELLOW = 3,
+    SIM_API_LIGHT_GREEN = 4,
+    SIM_API_LIGHT_ARROW = 5,
+};
+
+/**
+ * @brief Lane parameters, see struct Lane
+ */
+enum SimApiLaneParameter
+{
+    SIM_API_LANE_PERMISSIVE = 0, /**< Non-zero if vehicles may yield to colliding flows, fixed when the simulation is started */
+    SIM_API_LANE_PRIORITY = 1,
+    SIM_API_LANE_MIN_GREEN_TIME = 2,
+    SIM_API_LANE_MAX_GREEN_TIME = 3,
+    SIM_API_LANE_MIN_RED_TIME = 4,
+    SIM_API_LANE_STEPS_PER_VEHICLE = 5,
+    SIM_API_LANE_SATURATION_FLOW = 6,
+    SIM_API_LANE_STARTUP_LOST_TIME = 7,
+};
+
+/**
+ * @brief Outcome statistics
+ */
+struct SimApiStats
+{
+    uint32_t step; /**< Current simulation step */
+    uint64_t waitingVehicles; /**< Number of vehicles waiting at the junction */
+    uint64_t exitedVehicles; /**< Number of vehicles that exited */
+    uint64_t totalDelay; /**< Vehicle-steps spent waiting at the junction */
+};
+
+struct SimApiHandle; /**< Simulation (opaque) */
+
+/**
+ * @brief Callback executed for each vehicle that exited the intersection
+ * @param *name Vehicle name, valid only during the call
+ * @param id Vehicle sequential index
+ * @param step Step of the exit
+ * @param *context User context
+ */
+typedef void (*SimApiExitCallback)(const char *name, uint64_t id, uint32_t step, void *context);
+
+/**
+ * @brief Get version of the library
+ * @return Version, encoded as SIM_API_VERSION
+ */
+SIM_API uint32_t SimApiGetVersion(void);
+
+/**
+ * @brief Create new simulation
+ *
+ * The junction is then described using SimApiAddRoad(), SimApiAddLane() and SimApiSetLaneParameter(),
+ * and the simulation is started using SimApiStart().
+ * @param version API version the user is built against, pass SIM_API_VERSION
+ * @return Simulation handle, NULL on failure (no memory or incompatible version)
+ */
+SIM_API struct SimApiHandle* SimApiCreate(uint32_t version);
+
+/**
+ * @brief Destroy simulation and release all its vehicles
+ * @param *handle Simulation handle, may be NULL
+ */
+SIM_API void SimApiDestroy(struct SimApiHandle *handle);
+
+/**
+ * @brief Set policies
+ * @param *handle Simulation handle, not started yet
+ * @param selectionPolicy Lane selection policy
+ * @param timePolicy Light timing policy
+ * @return 0 on success, <0 on failure
+ */
+SIM_API int SimApiSetPolicy(struct SimApiHandle *handle, enum SimApiSelectionPolicy selectionPolicy, enum SimApiTimePolicy timePolicy);
+
+/**
+ * @brief Add road to the junction
+ * @param *handle Simulation handle, not started yet
+ * @param bearing Road bearing in degrees (clockwise from north)
+ * @return Road index on success, <0 on failure
+ */
+SIM_API int SimApiAddRoad(struct SimApiHandle *handle, uint16_t bearing);
+
+/**
+ * @brief Add incoming lane to the road
+ *
+ * The lane is not permissive, has unit priority and saturation flow, minimum green and red time of 1 step
+ * and maximum green time of 10 steps.
+ * @param *handle Simulation handle, not started yet
+ * @param road Road index
+ * @param directions Bitmask of allowed target roads
+ * @return Lane index on the road on success, <0 on failure
+ */
+SIM_API int SimApiAddLane(struct SimApiHandle *handle, unsigned int road, uint8_t directions);
+
+/**
+ * @brief Set lane parameter
+ * @param *handle Simulation handle
+ * @param road Road index
+ * @param lane Lane index on the road
+ * @param parameter Parameter
+ * @param value Parameter value, from 0 to UINT32_MAX
+ * @return 0 on success, <0 on failure (including a value that is out of range or not finite)
+ * @note Parameters other than the permissive flag may be changed after the simulation is started
+ */
+SIM_API int SimApiSetLaneParameter(struct SimApiHandle *handle, unsigned int road, unsigned int lane,
+    enum SimApiLaneParameter parameter, double value);
+
+/**
+ * @brief Register callback for vehicles that exited the intersection
+ * @param *handle Simulation handle
+ * @param callback Callback, NULL to disable
+ * @param *context User context
+ * @note Exits are logged for SimApiTakeExits() regardless of the callback
+ */
+SIM_API void SimApiSetExitCallback(struct SimApiHandle *handle, SimApiExitCallback callback, void *context);
+
+/**
+ * @brief Start simulation
+ * @param *handle Simulation handle
+ * @return 0 on success, <0 on failure (invalid junction or no memory)
+ * @attention Not thread-safe, the junction is initialized through the global simulator configuration
+ */
+SIM_API int SimApiStart(struct SimApiHandle *handle);
+
+/**
+ * @brief Place vehicles on the best lanes
+ * @param *handle Started simulation handle
+ * @param count Number of vehicles
+ * @param *names Vehicle names
+ * @param *start Starting road of each vehicle
+ * @param *end Target road of each vehicle
+ * @param *ids Output sequential index of each vehicle, SIM_API_NO_VEHICLE if it could not be placed. May be NULL.
+ * @return 0 if all vehicles were placed, <0 otherwise
+ */
+SIM_API int SimApiPlaceVehicles(struct SimApiHandle *handle, size_t count, const char *const *names,
+    const uint8_t *start, const uint8_t *end, uint64_t *ids);
+
+/**
+ * @brief Remove waiting vehicle
+ * @param *handle Started simulation handle
+ * @param *name Vehicle name
+ * @return 0 on success, <0 on failure (no such vehicle)
+ */
+SIM_API int SimApiRemoveVehicle(struct SimApiHandle *handle, const char *name);
+
+/**
+ * @brief Move waiting vehicle to another lane on the same road
+ * @param *handle Started simulation handle
+ * @param *name Vehicle name
+ * @param lane Lane index on the road
+ * @return 0 on success, <0 on failure
+ */
+SIM_API int SimApiChangeLane(struct SimApiHandle *handle, const char *name, unsigned int lane);
+
+/**
+ * @brief Change destination of waiting vehicle
+ * @param *handle Started simulation handle
+ * @param *name Vehicle name
+ * @param end New target road
+ * @return 0 on success, <0 on failure
+ */
+SIM_API int SimApiRerouteVehicle(struct SimApiHandle *handle, const char *name, unsigned int end);
+
+/**
+ * @brief Perform simulation steps
+ * @param *handle Started simulation handle
+ * @param count Number of steps
+ * @param *exited Output number of vehicles that exited during these steps, may be NULL
+ * @return 0 on success, <0 on failure (exits could not be logged)
+ */
+SIM_API int SimApiStep(struct SimApiHandle *handle, uint32_t count, size_t *exited);
+
+/**
+ * @brief Take oldest logged exits
+ * @param *handle Simulation handle
+ * @param *steps Output step of each exit, may be NULL
+ * @param *ids Output sequential index of each exited vehicle, may be NULL
+ * @param max Maximum number of exits to take
+ * @return Number of exits taken, the remaining ones are kept for the next call
+ */
+SIM_API size_t SimApiTakeExits(struct SimApiHandle *handle, uint32_t *steps, uint64_t *ids, size_t max);
+
+/**
+ * @brief Get lane lights
+ * @param *handle Started simulation handle
+ * @param *lights Output light (enum SimApiLight) of each lane, in road-major order. May be NULL.
+ * @param max Maximum number of lights to store
+ * @return Number of lanes
+ */
+SIM_API size_t SimApiGetLights(struct SimApiHandle *handle, uint8_t *lights, size_t max);
+
+/**
+ * @brief Get outcome statistics
+ * @param *handle Started simulation handle
+ * @param *stats Output statistics
+ * @return 0 on success, <0 on failure
+ */
+SIM_API int SimApiGetStats(struct SimApiHandle *handle, struct SimApiStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,392 @@
+#include "sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include "bitset.h"
+#include "state.h"
+
+/*
+Snapshot layout (native byte order, no padding):
+* header,
+* one record per road (the road layout must match the configuration the snapshot is restored into), followed by the records of its lanes,
+* lane scheduling order (flat lane indices of the scheduling list, followed by the idle lanes in their rank order),
+* vehicle records in queue order, lane after lane - each lane refers to its vehicles by index into this table.
+No pointers are stored, so the snapshot can be restored into any process.
+*/
+
+#define SIM_SNAPSHOT_MAGIC 0x4D495354 /**< "TSIM" */
+#define SIM_SNAPSHOT_VERSION 5 /**< Snapshot format version */
+
+struct SimSnapshotHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t selectionPolicy;
+    uint8_t timePolicy;
+    uint8_t phaseScheduling;
+    uint8_t fixedPoint;
+    uint64_t nextVehicle;
+    uint64_t numVehicles;
+    uint32_t step;
+    uint8_t roadCount;
+    uint16_t numLanes;
+} __attribute__ ((packed));
+
+struct SimSnapshotRoad
+{
+    uint8_t position;
+    uint16_t bearing;
+    uint16_t laneCount;
+} __attribute__ ((packed));
+
+struct SimSnapshotLane
+{
+    uint8_t direction; /**< Allowed directions, bit n for enum Direction n */
+    uint8_t permissive;
+    uint8_t light;
+    uint8_t flags; /**< Bit 0 - blocked, bit 1 - unblocked */
+    float priority;
+    uint32_t minGreenTime;
+    uint32_t minRedTime;
+    uint32_t maxGreenTime;
+    uint32_t stepsPerVehicle;
+    uint32_t saturationFlow;
+    uint32_t startupLostTime;
+    float dynamicPriority;
+    int64_t fixedPriority;
+    uint32_t stepsBeforeChange;
+    uint32_t waitTime;
+    uint32_t lostTimeLeft;
+    uint64_t firstVehicle; /**< Index of the first vehicle in the vehicle table */
+    uint64_t vehicleCount;
+} __attribute__ ((packed));
+
+struct SimSnapshotVehicle
+{
+    uint64_t index;
+    uint8_t direction;
+    uint16_t nameLength;
+} __attribute__ ((packed));
+
+#define SIM_SNAPSHOT_MAX_NAME UINT16_MAX /**< Maximum vehicle name length that fits a vehicle record */
+
+static struct Vehicle* SimSnapshotDefaultAllocator(size_t nameLength, void *context)
+{
+    (void)context;
+    return malloc(sizeof(struct Vehicle) + nameLength + 1);
+}
+
+/**
+ * @brief Compare idle lanes of the selected instance by their rank, for qsort()
+ * @param *a Lane A pointer
+ * @param *b Lane B pointer
+ * @return <0 if lane A comes first, >0 if lane B comes first
+ */
+static int SimCompareIdleRank(const void *a, const void *b)
+{
+    uint64_t rankA = SimState->idleRank[(*(struct Lane* const*)a)->id];
+    uint64_t rankB = SimState->idleRank[(*(struct Lane* const*)b)->id];
+    return (rankA > rankB) - (rankA < rankB);
+}
+
+int SimSaveSnapshot(FILE *f)
+{
+    if(NULL == f)
+        return -1;
+
+    struct SimSnapshotHeader header = {
+        .magic = SIM_SNAPSHOT_MAGIC,
+        .version = SIM_SNAPSHOT_VERSION,
+        .selectionPolicy = SimState->config->selectionPolicy,
+        .timePolicy = SimState->config->timePolicy,
+        .phaseScheduling = SimState->config->phaseScheduling,
+        .fixedPoint = SimState->config->fixedPoint,
+        .nextVehicle = SimState->nextVehicle,
+        .numVehicles = SimState->numVehicles,
+        .step = SimState->step,
+        .roadCount = SimState->config->roadCount,
+        .numLanes = SimState->numLanes,
+    };
+    if(1 != fwrite(&header, sizeof(header), 1, f))
+        return -1;
+
+    uint64_t firstVehicle = 0;
+    for(size_t i = 0; i < SimState->config->roadCount; i++)
+    {
+        const struct Road *road = &SimState->config->road[i];
+        struct SimSnapshotRoad r = {.position = road->position, .bearing = road->bearing, .laneCount = road->laneCount};
+        if(1 != fwrite(&r, sizeof(r), 1, f))
+            return -1;
+
+        for(size_t k = 0; k < road->laneCount; k++)
+        {
+            const struct Lane *lane = &road->lane[k];
+            struct SimSnapshotLane l = {
+                .direction = lane->direction.mask,
+                .permissive = lane->permissive,
+                .light = lane->light,
+                .flags = (lane->blocked ? 1 : 0) | (lane->unblocked ? 2 : 0),
+                .priority = lane->priority,
+                .minGreenTime = lane->minGreenTime,
+                .minRedTime = lane->minRedTime,
+                .maxGreenTime = lane->maxGreenTime,
+                .stepsPerVehicle = lane->stepsPerVehicle,
+                .saturationFlow = lane->saturationFlow,
+                .startupLostTime = lane->startupLostTime,
+                .dynamicPriority = lane->dynamicPriority,
+                .fixedPriority = lane->fixedPriority,
+                .stepsBeforeChange = lane->stepsBeforeChange,
+                .waitTime = lane->waitTime,
+                .lostTimeLeft = lane->lostTimeLeft,
+                .firstVehicle = firstVehicle,
+                .vehicleCount = lane->vehicleCount,
+            };
+            if(1 != fwrite(&l, sizeof(l), 1, f))
+                return -1;
+            firstVehicle += lane->vehicleCount;
+        }
+    }
+
+    //scheduling list first, then the idle lanes that are not on it, so that the order is a full permutation
+    for(size_t i = 0; i < SimState->numScheduled; i++)
+    {
+        uint16_t index = SimState->lanes[i]->id;
+        if(1 != fwrite(&index, sizeof(index), 1, f))
+            return -1;
+    }
+    //idle lanes are stored in their rank order, so they are ranked the same when dropped from the list after loading
+    struct Lane **idle = SimState->readyLanes;
+    size_t numIdle = 0;
+    for(size_t i = 0; i < SimState->numLanes; i++)
+    {
+        if(!SimBitsetTest(SimState->scheduledLanes, i))
+            idle[numIdle++] = SimState->laneById[i];
+    }
+    qsort(idle, numIdle, sizeof(*idle), SimCompareIdleRank);
+    for(size_t i = 0; i < numIdle; i++)
+    {
+        uint16_t index = idle[i]->id;
+        if(1 != fwrite(&index, sizeof(index), 1, f))
+            return -1;
+    }
+
+    for(size_t i = 0; i < SimState->config->roadCount; i++)
+    {
+        for(size_t k = 0; k < SimState->config->road[i].laneCount; k++)
+        {
+            const struct Lane *lane = &SimState->config->road[i].lane[k];
+            const struct Vehicle *v = lane->vehicles;
+            for(size_t n = 0; n < lane->vehicleCount; n++, v = SimGetNextVehicle(lane, v))
+            {
+                size_t length = strlen(v->name);
+                if(length > SIM_SNAPSHOT_MAX_NAME)
+                {
+                    printf("Vehicle name is too long to be saved\r\n");
+                    return -1;
+                }
+                struct SimSnapshotVehicle r = {.index = v->index, .direction = v->direction, .nameLength = length};
+                if((1 != fwrite(&r, sizeof(r), 1, f)) || (length != fwrite(v->name, 1, length, f)))
+                    return -1;
+            }
+        }
+    }
+
+    return (0 == fflush(f)) ? 0 : -1;
+}
+
+/**
+ * @brief Get number of bytes left in file
+ * @param *f File
+ * @return Number of bytes from the current position to the end, UINT64_MAX if the file is not seekable
+ */
+static uint64_t SimSnapshotRemaining(FILE *f)
+{
+    long position = ftell(f);
+    if((position < 0) || (0 != fseek(f, 0, SEEK_END)))
+        return UINT64_MAX;
+    long end = ftell(f);
+    if((0 != fseek(f, position, SEEK_SET)) || (end < position))
+        return UINT64_MAX;
+    return end - position;
+}
+
+/**
+ * @brief Release vehicles restored by a failed load
+ * @param **lanes Lanes in flat order
+ * @param numLanes Number of lanes
+ */
+static void SimSnapshotReleaseVehicles(struct Lane **lanes, size_t numLanes)
+{
+    SimIndexClear(&SimState->vehicleIndex);
+    for(size_t i = 0; i < numLanes; i++)
+    {
+        struct Vehicle *v = lanes[i]->vehicles;
+        while(NULL != v)
+        {
+            struct Vehicle *next = v->next;
+            free(v);
+            v = next;
+        }
+        lanes[i]->vehicles = NULL;
+        lanes[i]->lastVehicle = NULL;
+        lanes[i]->vehicleCount = 0;
+    }
+}
+
+int SimLoadSnapshot(FILE *f, SimVehicleAllocator allocator, void *context)
+{
+    if(NULL == f)
+        return -1;
+    if(NULL == allocator)
+        allocator = SimSnapshotDefaultAllocator;
+
+    struct SimSnapshotHeader header;
+    if(1 != fread(&header, sizeof(header), 1, f))
+        return -1;
+    if((SIM_SNAPSHOT_MAGIC != header.magic) || (SIM_SNAPSHOT_VERSION != header.version))
+    {
+        printf("Snapshot format is not supported\r\n");
+        return -1;
+    }
+    //every vehicle takes at least a record, so a broken count is caught before anything is allocated
+    if(header.numVehicles > (SimSnapshotRemaining(f) / sizeof(struct SimSnapshotVehicle)))
+    {
+        printf("Snapshot is broken\r\n");
+        return -1;
+    }
+    //lane storage is owned by the caller, so the snapshot must fit the current configuration
+    if(SimState->config->roadCount != header.roadCount)
+    {
+        printf("Snapshot does not match junction configuration\r\n");
+        return -1;
+    }
+
+    SimState->config->selectionPolicy = header.selectionPolicy;
+    SimState->config->timePolicy = header.timePolicy;
+    SimState->config->phaseScheduling = header.phaseScheduling;
+    SimState->config->fixedPoint = header.fixedPoint;
+
+    size_t numLanes = 0;
+    uint64_t numVehicles = 0;
+    for(size_t i = 0; i < SimState->config->roadCount; i++)
+    {
+        struct Road *road = &SimState->config->road[i];
+        struct SimSnapshotRoad r;
+        if(1 != fread(&r, sizeof(r), 1, f))
+            return -1;
+        if((r.position != i) || (r.laneCount != road->laneCount))
+        {
+            printf("Snapshot does not match junction configuration\r\n");
+            return -1;
+        }
+        road->bearing = r.bearing;
+
+        for(size_t k = 0; k < road->laneCount; k++)
+        {
+            struct Lane *lane = &road->lane[k];
+            struct SimSnapshotLane l;
+            if(1 != fread(&l, sizeof(l), 1, f))
+                return -1;
+            //vehicles are stored lane after lane
+            if((l.firstVehicle != numVehicles) || (l.vehicleCount > (header.numVehicles - numVehicles)))
+            {
+                printf("Snapshot is broken\r\n");
+                return -1;
+            }
+            numVehicles += l.vehicleCount;
+            lane->direction.mask = l.direction;
+            lane->permissive = l.permissive;
+            lane->light = l.light;
+            lane->blocked = l.flags & 1;
+            lane->unblocked = (l.flags >> 1) & 1;
+            lane->priority = l.priority;
+            lane->minGreenTime = l.minGreenTime;
+            lane->minRedTime = l.minRedTime;
+            lane->maxGreenTime = l.maxGreenTime;
+            lane->stepsPerVehicle = l.stepsPerVehicle;
+            lane->saturationFlow = l.saturationFlow;
+            lane->startupLostTime = l.startupLostTime;
+            lane->dynamicPriority = l.dynamicPriority;
+            lane->fixedPriority = l.fixedPriority;
+            lane->stepsBeforeChange = l.stepsBeforeChange;
+            lane->waitTime = l.waitTime;
+            lane->lostTimeLeft = l.lostTimeLeft;
+            lane->dischargedCount = 0;
+            //announced arrivals are not stored, they are announced again from the input
+            SimClearForecast(lane);
+            lane->road = road;
+            lane->vehicles = NULL;
+            lane->lastVehicle = NULL;
+            lane->sharedCount = 0;
+            free(lane->links);
+            lane->links = NULL;
+            lane->linkCount = 0;
+            //vehicle count is restored when the vehicles are linked back
+            lane->vehicleCount = l.vehicleCount;
+            numLanes++;
+        }
+    }
+    if((numLanes != header.numLanes) || (numVehicles != header.numVehicles))
+    {
+        printf("Snapshot is broken\r\n");
+        return -1;
+    }
+
+    //directions and bearings might have changed, so the tables are rebuilt - this also restores lane indices
+    if(0 != SimBuildTables(SimState))
+        return -1;
+    struct Lane **lanes = SimState->readyLanes;
+    memcpy(lanes, SimState->lanes, numLanes * sizeof(*lanes));
+
+    //all lanes are restored to the scheduling list, lanes that are not waiting are dropped from it in the next step
+    for(size_t i = 0; i < numLanes; i++)
+    {
+        uint16_t index;
+        if((1 != fread(&index, sizeof(index), 1, f)) || (index >= numLanes))
+            return -1;
+        SimState->lanes[i] = lanes[index];
+    }
+
+    //vehicles are stored lane after lane, in queue order
+    SimIndexClear(&SimState->vehicleIndex);
+    for(size_t i = 0; i < numLanes; i++)
+    {
+        struct Vehicle **tail = &lanes[i]->vehicles;
+        for(size_t k = 0; k < lanes[i]->vehicleCount; k++)
+        {
+            struct SimSnapshotVehicle r;
+            if((1 != fread(&r, sizeof(r), 1, f)) || (r.direction >= SimState->config->roadCount))
+                goto failed;
+            struct Vehicle *v = allocator(r.nameLength, context);
+            if(NULL == v)
+            {
+                printf("Memory allocation failed\r\n");
+                goto failed;
+            }
+            v->next = NULL;
+            //the vehicle is linked first, so that it is released with the others on failure
+            *tail = v;
+            tail = &v->next;
+            if(r.nameLength != fread(v->name, 1, r.nameLength, f))
+                goto failed;
+            v->name[r.nameLength] = '\0';
+            v->index = r.index;
+            v->direction = r.direction;
+            v->lane = lanes[i];
+            v->prev = lanes[i]->lastVehicle;
+            lanes[i]->lastVehicle = v;
+            if(0 != SimIndexInsert(&SimState->vehicleIndex, v))
+                goto failed;
+        }
+    }
+
+    SimState->nextVehicle = header.nextVehicle;
+    SimState->numVehicles = header.numVehicles;
+    SimState->step = header.step;
+    SimState->exitedVehicles = 0;
+    SimState->totalDelay = 0;
+    return 0;
+
+failed:
+    SimSnapshotReleaseVehicles(lanes, numLanes);
+    return -1;
+}
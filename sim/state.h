@@ -0,0 +1,270 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sim.h"
+#include "trace.h"
+#include "timeline.h"
+#include "profile.h"
+
+#define SIM_MAX_PHASES 256 /**< Maximum number of phases of a junction scheduled by phases */
+#define SIM_LANE_SETS 7 /**< Number of lane state bitsets of an instance (active, occupied, red, movable, starting, announced, scheduled) */
+
+#define SIM_ALWAYS_INLINE inline __attribute__ ((always_inline)) /**< Inline even in unoptimized builds */
+
+/**
+ * @brief Step phase start recorded by the profile
+ */
+enum SimProfileMark
+{
+    SIM_PROFILE_STEP_START = 0, /**< Step start, also the start of red light handling */
+    SIM_PROFILE_SELECTION_START, /**< Lane selection start */
+    SIM_PROFILE_SWITCH_START, /**< Switching to green start */
+    SIM_PROFILE_VEHICLES_START, /**< Vehicle movement start */
+    SIM_PROFILE_MARKS, /**< Number of phase starts */
+};
+
+/**
+ * @brief Simulation step specialized for a combination of policies
+ */
+typedef void (*SimStepFunction)(void);
+
+/**
+ * @brief Index of waiting vehicles by name
+ */
+struct SimVehicleIndex
+{
+    struct Vehicle **slots; /**< Hash table slots, NULL if empty */
+    size_t capacity; /**< Number of slots, power of 2 */
+    size_t count; /**< Number of vehicles */
+};
+
+/**
+ * @brief Road of another instance an exit leads to
+ */
+struct SimConnection
+{
+    struct SimState *instance; /**< Neighbour instance, NULL if the exit leaves the network */
+    uint8_t road; /**< Entry road of the neighbour instance */
+};
+
+/**
+ * @brief Simulation instance state, shared between simulator modules
+ */
+struct SimState
+{
+    struct SimConfig *config; /**< Simulation configuration */
+    SimVehicleExitedCallback vehicleExitCallback; /**< Vehicle exit callback */
+    void *context; /**< Vehicle exit callback context */
+    size_t nextVehicle; /**< Next vehicle sequential index */
+    uint32_t step; /**< Current simulation step */
+    struct Lane **lanes; /**< Scheduling list: lanes that are not idle (red with no vehicles), ordered by dynamic priority */
+    size_t numScheduled; /**< Number of lanes in the scheduling list */
+    size_t numLanes; /**< Number of lanes */
+    size_t laneWords; /**< Number of words in a lane bitset */
+    uint64_t *laneConflicts; /**< For each lane: bitset of lanes that must not have green light at the same time */
+    uint64_t *activeLanes; /**< Bitset of lanes with green light or switching to green */
+    uint64_t *occupiedLanes; /**< Bitset of lanes with vehicles */
+    uint64_t *redLanes; /**< Bitset of lanes with red light (or red light with green arrow) */
+    uint64_t *movableLanes; /**< Bitset of lanes whose vehicles may move (green light, green arrow or no lights) */
+    uint64_t *startingLanes; /**< Bitset of lanes with start-up lost time left */
+    uint64_t *announcedLanes; /**< Bitset of lanes with announced arrivals */
+    uint64_t *scheduledLanes; /**< Bitset of lanes in the scheduling list */
+    uint64_t *idleRank; /**< For each lane: position among the idle lanes, lower first (lanes that became idle last come first) */
+    uint64_t nextIdleRank; /**< Rank following the lowest one given to idle lanes */
+    struct Lane **readyLanes; /**< List of lanes with a vehicle ready to move */
+    struct Lane **laneById; /**< Lanes indexed by their lane index */
+    uint64_t flowConflicts[MAX_ROADS * MAX_ROADS]; /**< For each flow (start * MAX_ROADS + end): bitset of colliding flows */
+    uint8_t turn[MAX_ROADS][MAX_ROADS]; /**< Path type (enum SimTurn) for each pair of roads */
+    size_t numVehicles; /**< Number of vehicles */
+    struct SimVehicleIndex vehicleIndex; /**< Index of waiting vehicles */
+    size_t exitedVehicles; /**< Number of vehicles that exited */
+    uint64_t totalDelay; /**< Vehicle-steps spent waiting */
+    struct SimConfig forkedConfig; /**< Configuration of a forked instance, roads and lanes are allocated in one block */
+    bool logEvents; /**< Print simulation events (initialization, vehicle exits, light changes, steps) */
+    struct SimTrace *trace; /**< Trace the light changes and vehicle exits are emitted to, NULL if not traced */
+    struct SimTimeline *timeline; /**< Timeline the light changes and queue lengths are recorded to, NULL if not recorded */
+    struct SimProfile *profile; /**< Profile the steps and queue lengths are recorded to, NULL if not profiled */
+    uint64_t *stepMarks; /**< Phase start times of the current step (enum SimProfileMark), NULL if not profiled */
+    uint64_t *phases; /**< Phases (maximal sets of lanes that may have green light at the same time) as lane bitsets */
+    size_t numPhases; /**< Number of phases, 0 if scheduling by lanes */
+    struct SimConnection downstream[MAX_ROADS]; /**< For each exit road: where the vehicles go */
+    SimStepFunction stepFunction; /**< Step function specialized for the configured policies */
+    uint32_t stepKey; /**< Policy combination the step function was bound for */
+};
+
+extern _Thread_local struct SimState *SimState; /**< Simulation instance selected by the calling thread */
+
+/**
+ * @brief Validate configuration, bind step function and allocate lane tables of an instance
+ * @param *state Simulation instance
+ * @return 0 on success, <0 on failure
+ * @note Lane indices and lane lists are assigned in road-major order. Geometry and conflict tables are not built.
+ */
+int SimAllocateTables(struct SimState *state);
+
+/**
+ * @brief Put all lanes of an instance on the scheduling list in road-major order and rebuild lane state bitsets
+ * @param *state Simulation instance with tables allocated
+ */
+void SimResetSchedule(struct SimState *state);
+
+/**
+ * @brief Reset lights, lane counters and vehicle counters of the selected instance, as done by SimInit()
+ * @note Tables must be built
+ */
+void SimResetState(void);
+
+/**
+ * @brief Validate configuration and build geometry, lane list and conflict tables of an instance
+ * @param *state Simulation instance
+ * @return 0 on success, <0 on failure
+ * @note All lanes are put on the scheduling list in road-major order, which is also the order of lane indices.
+ * Lane state bitsets are rebuilt from the lanes.
+ */
+int SimBuildTables(struct SimState *state);
+
+/**
+ * @brief Build phase table of an instance if phase scheduling is enabled, release it otherwise
+ * @param *state Simulation instance with lane conflict table built
+ * @return 0 on success, <0 on failure
+ */
+int SimBuildPhases(struct SimState *state);
+
+/**
+ * @brief Add vehicle to index
+ * @param *index Vehicle index
+ * @param *vehicle Vehicle
+ * @return 0 on success, <0 on failure
+ */
+int SimIndexInsert(struct SimVehicleIndex *index, struct Vehicle *vehicle);
+
+/**
+ * @brief Grow index, so that given number of vehicles can be inserted without allocating memory
+ * @param *index Vehicle index
+ * @param count Number of vehicles
+ * @return 0 on success, <0 on failure
+ */
+int SimIndexReserve(struct SimVehicleIndex *index, size_t count);
+
+/**
+ * @brief Remove vehicle from index
+ * @param *index Vehicle index
+ * @param *vehicle Vehicle, ignored if not indexed
+ */
+void SimIndexRemove(struct SimVehicleIndex *index, const struct Vehicle *vehicle);
+
+/**
+ * @brief Find vehicle by name
+ * @param *index Vehicle index
+ * @param *name Vehicle name
+ * @return Vehicle, NULL if not found
+ */
+struct Vehicle* SimIndexFind(const struct SimVehicleIndex *index, const char *name);
+
+/**
+ * @brief Check whether given vehicle is indexed
+ * @param *index Vehicle index
+ * @param *vehicle Vehicle
+ * @return True if indexed, false otherwise
+ */
+bool SimIndexContains(const struct SimVehicleIndex *index, const struct Vehicle *vehicle);
+
+/**
+ * @brief Remove all vehicles from index
+ * @param *index Vehicle index
+ */
+void SimIndexClear(struct SimVehicleIndex *index);
+
+/**
+ * @brief Copy index
+ * @param *dst Destination index, overwritten
+ * @param *src Source index
+ * @return 0 on success, <0 on failure
+ */
+int SimIndexCopy(struct SimVehicleIndex *dst, const struct SimVehicleIndex *src);
+
+/**
+ * @brief Emit simulation event to trace: record it or compare it to the recorded one
+ * @param *trace Trace
+ * @param *event Event
+ */
+void SimTraceEmit(struct SimTrace *trace, const struct SimTraceEvent *event);
+
+/**
+ * @brief Record light transition to timeline
+ * @param *timeline Timeline
+ * @param *lane Lane whose light changed
+ */
+void SimTimelineEmitLight(struct SimTimeline *timeline, const struct Lane *lane);
+
+/**
+ * @brief Mark lane queue as changed, the change is recorded to timeline at the end of the step
+ * @param *timeline Timeline
+ * @param *lane Lane whose vehicle count changed
+ */
+void SimTimelineMarkQueue(struct SimTimeline *timeline, const struct Lane *lane);
+
+/**
+ * @brief Record changed queue lengths to timeline
+ * @param *timeline Timeline
+ * @param step Step the changes are recorded with
+ */
+void SimTimelineEndStep(struct SimTimeline *timeline, uint32_t step);
+
+/**
+ * @brief Mark lane queue as changed, the new length is recorded to profile at the end of the step
+ * @param *profile Profile
+ * @param *lane Lane whose vehicle count changed
+ */
+void SimProfileMarkQueue(struct SimProfile *profile, const struct Lane *lane);
+
+/**
+ * @brief Record step phases and changed queue lengths to profile
+ * @param *profile Profile
+ */
+void SimProfileEndStep(struct SimProfile *profile);
+
+/**
+ * @brief Record step phase start if profiled
+ * @param *marks Phase start times, NULL if not profiled
+ * @param mark Phase
+ */
+static SIM_ALWAYS_INLINE void SimProfileMarkStep(uint64_t *marks, enum SimProfileMark mark)
+{
+    if(NULL != marks)
+        marks[mark] = SimProfileNow();
+}
+
+/**
+ * @brief Drop all arrivals announced on lane
+ * @param *lane Lane
+ */
+static inline void SimClearForecast(struct Lane *lane)
+{
+    for(size_t i = 0; i < SIM_LOOKAHEAD_HORIZON; i++)
+        lane->upcoming[i] = 0;
+    lane->upcomingCount = 0;
+    lane->upcomingDistance = 0;
+}
+
+/**
+ * @brief Get vehicle following given vehicle in line
+ * @param *lane Lane the vehicle is waiting on
+ * @param *vehicle Vehicle
+ * @return Next vehicle, NULL if this is the last one
+ */
+static inline struct Vehicle* SimGetNextVehicle(const struct Lane *lane, const struct Vehicle *vehicle)
+{
+    //shared vehicles are immutable, so the vehicles placed after them are linked by the lane
+    for(size_t i = 0; i < lane->linkCount; i++)
+    {
+        if(lane->links[i].vehicle == vehicle)
+            return lane->links[i].next;
+    }
+    return vehicle->next;
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include "timeline.h"
+#include <stdlib.h>
+#include <string.h>
+#include "state.h"
+#include "bitset.h"
+
+#define SIM_TIMELINE_BUFFER_SIZE 65536 /**< Size of the record buffer */
+#define SIM_TIMELINE_MAX_VARINT 10 /**< Maximum length of an encoded 64-bit varint */
+#define SIM_TIMELINE_MAX_RECORD (1 + 3 * SIM_TIMELINE_MAX_VARINT) /**< Maximum length of a record */
+
+struct SimTimeline
+{
+    FILE *f; /**< Timeline file */
+    struct SimState *state; /**< Instance the timeline is attached to */
+    bool failed; /**< Timeline could not be written */
+    uint8_t *buffer; /**< Record buffer */
+    size_t size; /**< Number of bytes in the buffer */
+    uint32_t lastStep; /**< Step of the last record */
+    size_t *queue; /**< Last recorded queue length of each lane */
+    uint64_t *changed; /**< Bitset of lanes whose queue changed since the last recorded step */
+};
+
+/**
+ * @brief Write buffered records to the file
+ * @param *timeline Timeline
+ */
+static void SimTimelineFlush(struct SimTimeline *timeline)
+{
+    if((0 != timeline->size) && (timeline->size != fwrite(timeline->buffer, 1, timeline->size, timeline->f)))
+        timeline->failed = true;
+    timeline->size = 0;
+}
+
+/**
+ * @brief Encode varint (7 bits per byte, least significant group first)
+ * @param *out Output buffer, at least SIM_TIMELINE_MAX_VARINT bytes
+ * @param value Value
+ * @return Number of bytes
+ */
+static size_t SimTimelineEncodeVarint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while(value >= 0x80)
+    {
+        out[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/**
+ * @brief Append record to the buffer
+ * @param *timeline Timeline
+ * @param type Record type (including the light for light transitions)
+ * @param step Step
+ * @param id Lane index
+ * @param *payload Encoded record payload
+ * @param size Payload length, up to SIM_TIMELINE_MAX_VARINT
+ */
+static void SimTimelineWrite(struct SimTimeline *timeline, uint8_t type, uint32_t step, size_t id,
+    const uint8_t *payload, size_t size)
+{
+    if((timeline->size + SIM_TIMELINE_MAX_RECORD) > SIM_TIMELINE_BUFFER_SIZE)
+        SimTimelineFlush(timeline);
+    uint8_t *record = timeline->buffer + timeline->size;
+    size_t n = 0;
+    record[n++] = type;
+    n += SimTimelineEncodeVarint(record + n, step - timeline->lastStep);
+    n += SimTimelineEncodeVarint(record + n, id);
+    if(0 != size)
+        memcpy(record + n, payload, size);
+    timeline->size += n + size;
+    timeline->lastStep = step;
+}
+
+void SimTimelineEmitLight(struct SimTimeline *timeline, const struct Lane *lane)
+{
+    SimTimelineWrite(timeline, SIM_TIMELINE_LIGHT + lane->light, timeline->state->step, lane->id, NULL, 0);
+}
+
+void SimTimelineMarkQueue(struct SimTimeline *timeline, const struct Lane *lane)
+{
+    SimBitsetSet(timeline->changed, lane->id);
+}
+
+void SimTimelineEndStep(struct SimTimeline *timeline, uint32_t step)
+{
+    struct SimState *state = timeline->state;
+    for(size_t w = 0; w < state->laneWords; w++)
+    {
+        for(uint64_t bits = timeline->changed[w]; 0 != bits; bits &= bits - 1)
+        {
+            size_t id = w * 64 + __builtin_ctzll(bits);
+            size_t length = state->laneById[id]->vehicleCount;
+            //vehicles that arrived and left within the step cancel out
+            if(length == timeline->queue[id])
+                continue;
+            int64_t delta = (int64_t)length - (int64_t)timeline->queue[id];
+            uint8_t payload[SIM_TIMELINE_MAX_VARINT];
+            size_t n = SimTimelineEncodeVarint(payload, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+            SimTimelineWrite(timeline, SIM_TIMELINE_QUEUE, step, id, payload, n);
+            timeline->queue[id] = length;
+        }
+        timeline->changed[w] = 0;
+    }
+}
+
+struct SimTimeline* SimTimelineStart(FILE *f)
+{
+    struct SimTimeline *timeline = calloc(1, sizeof(*timeline));
+    uint8_t *buffer = malloc(SIM_TIMELINE_BUFFER_SIZE);
+    size_t *queue = malloc(SimState->numLanes * sizeof(*queue) + 1);
+    uint64_t *changed = calloc(SimState->laneWords + 1, sizeof(*changed));
+    if((NULL == timeline) || (NULL == buffer) || (NULL == queue) || (NULL == changed))
+    {
+        printf("Memory allocation failed\r\n");
+        goto failed;
+    }
+    timeline->f = f;
+    timeline->buffer = buffer;
+    timeline->queue = queue;
+    timeline->changed = changed;
+    timeline->lastStep = SimState->step;
+
+    struct SimTimelineHeader header = {.magic = SIM_TIMELINE_MAGIC, .version = SIM_TIMELINE_VERSION,
+        .step = SimState->step, .laneCount = SimState->numLanes};
+    memcpy(buffer, &header, sizeof(header));
+    timeline->size = sizeof(header);
+    for(size_t i = 0; i < SimState->numLanes; i++)
+    {
+        const struct Lane *lane = SimState->laneById[i];
+        if((timeline->size + 3 + SIM_TIMELINE_MAX_VARINT) > SIM_TIMELINE_BUFFER_SIZE)
+            SimTimelineFlush(timeline);
+        uint8_t *entry = buffer + timeline->size;
+        entry[0] = lane->road->position;
+        entry[1] = lane->direction.mask;
+        entry[2] = lane->light;
+        timeline->size += 3 + SimTimelineEncodeVarint(entry + 3, lane->vehicleCount);
+        queue[i] = lane->vehicleCount;
+    }
+    SimTimelineFlush(timeline);
+    if(timeline->failed)
+    {
+        printf("Unable to write timeline\r\n");
+        goto failed;
+    }
+    timeline->state = SimState;
+    SimState->timeline = timeline;
+    return timeline;
+
+failed:
+    free(timeline);
+    free(buffer);
+    free(queue);
+    free(changed);
+    return NULL;
+}
+
+int SimTimelineStop(struct SimTimeline *timeline)
+{
+    if(NULL == timeline)
+        return -1;
+    //changes made after the last step belong to the following one
+    SimTimelineEndStep(timeline, timeline->state->step);
+    SimTimelineFlush(timeline);
+    if(0 != fflush(timeline->f))
+        timeline->failed = true;
+    if(timeline->state->timeline == timeline)
+        timeline->state->timeline = NULL;
+    int ret = timeline->failed ? -1 : 0;
+    free(timeline->buffer);
+    free(timeline->queue);
+    free(timeline->changed);
+    free(timeline);
+    return ret;
+}
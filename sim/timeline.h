@@ -0,0 +1,67 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sim.h"
+
+/*
+Timeline layout (native byte order):
+* header (struct SimTimelineHeader),
+* lane table, one entry per lane in lane index order (road-major): road index, allowed target mask,
+  light (enum Light), varint queue length,
+* records, each one starting with its type byte:
+    - light transition: SIM_TIMELINE_LIGHT + new light (enum Light), varint step delta, varint lane index,
+    - queue length change: SIM_TIMELINE_QUEUE, varint step delta, varint lane index, zigzag varint length delta.
+Step deltas are relative to the step of the previous record, starting from the header step. Light transitions
+are recorded with the step they happened in. Queue length changes are summed per lane and recorded once
+at the end of each step, including the changes made by the commands preceding the step, so the lights
+and queues after step N are the lane table updated with all records up to step N. Changes made after
+the last step are recorded with the step that would follow.
+*/
+
+#define SIM_TIMELINE_MAGIC 0x4C545354 /**< "TSTL" */
+#define SIM_TIMELINE_VERSION 1 /**< Timeline format version */
+
+/**
+ * @brief Timeline header
+ */
+struct SimTimelineHeader
+{
+    uint32_t magic; /**< SIM_TIMELINE_MAGIC */
+    uint16_t version; /**< SIM_TIMELINE_VERSION */
+    uint32_t step; /**< Step at the start of the recording */
+    uint32_t laneCount; /**< Number of lanes */
+} __attribute__ ((packed));
+
+/**
+ * @brief Timeline record type
+ */
+enum SimTimelineRecordType
+{
+    SIM_TIMELINE_LIGHT = 0x10, /**< Light transition, the new light is added to the type */
+    SIM_TIMELINE_QUEUE = 0x20, /**< Queue length change */
+};
+
+struct SimTimeline; /**< Timeline recorder (opaque) */
+
+/**
+ * @brief Start recording timeline of the selected instance
+ *
+ * The current lights and queue lengths are stored in the lane table, then the instance records its light
+ * transitions and queue length changes. Unlike the trace (see trace.h), the timeline holds no input commands
+ * and cannot be replayed, it is meant for rebuilding the signal state at any step.
+ * @param *f Output file, must stay open until the recording is stopped
+ * @return Timeline, NULL on failure
+ * @note The recording must be started after SimInit()
+ */
+struct SimTimeline* SimTimelineStart(FILE *f);
+
+/**
+ * @brief Record pending queue length changes, detach the timeline from its instance and release it
+ * @param *timeline Timeline
+ * @return 0 on success, <0 if the timeline could not be written
+ */
+int SimTimelineStop(struct SimTimeline *timeline);
+
+#endif
@@ -0,0 +1,345 @@
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include "state.h"
+
+#define SIM_TRACE_MAGIC 0x52545354 /**< "TSTR" */
+#define SIM_TRACE_VERSION 1 /**< Trace format version */
+#define SIM_TRACE_BUFFER_SIZE 65536 /**< Size of the record buffer */
+#define SIM_TRACE_MAX_VARINT 10 /**< Maximum length of an encoded 64-bit varint */
+
+struct SimTraceHeader
+{
+    uint32_t magic;
+    uint16_t version;
+} __attribute__ ((packed));
+
+struct SimTrace
+{
+    FILE *f; /**< Trace file */
+    struct SimState *state; /**< Instance the trace is attached to */
+    bool replay; /**< Replaying instead of recording */
+    bool failed; /**< Trace could not be written or read */
+    uint8_t *buffer; /**< Record buffer */
+    size_t size; /**< Number of bytes in the buffer */
+    size_t position; /**< Read position in the buffer */
+    uint32_t lastStep; /**< Step of the last event */
+    char *name; /**< Name of the last command read */
+    size_t nameCapacity; /**< Name buffer capacity */
+    bool diverged; /**< Replay diverged */
+    struct SimTraceEvent expected; /**< Recorded event at the divergence */
+    struct SimTraceEvent actual; /**< Emitted event at the divergence */
+};
+
+/**
+ * @brief Write buffered records to the file
+ * @param *trace Trace
+ */
+static void SimTraceFlush(struct SimTrace *trace)
+{
+    if((0 != trace->size) && (trace->size != fwrite(trace->buffer, 1, trace->size, trace->f)))
+        trace->failed = true;
+    trace->size = 0;
+}
+
+/**
+ * @brief Append data to the record buffer
+ * @param *trace Trace
+ * @param *data Data
+ * @param size Number of bytes
+ */
+static void SimTraceWrite(struct SimTrace *trace, const void *data, size_t size)
+{
+    if((trace->size + size) > SIM_TRACE_BUFFER_SIZE)
+        SimTraceFlush(trace);
+    if(size > SIM_TRACE_BUFFER_SIZE)
+    {
+        if(size != fwrite(data, 1, size, trace->f))
+            trace->failed = true;
+        return;
+    }
+    memcpy(trace->buffer + trace->size, data, size);
+    trace->size += size;
+}
+
+/**
+ * @brief Encode varint (7 bits per byte, least significant group first)
+ * @param *out Output buffer, at least SIM_TRACE_MAX_VARINT bytes
+ * @param value Value
+ * @return Number of bytes
+ */
+static size_t SimTraceEncodeVarint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while(value >= 0x80)
+    {
+        out[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/**
+ * @brief Make sure that given number of bytes is available in the read buffer
+ * @param *trace Trace
+ * @param count Number of bytes
+ * @return True if available, false at the end of the file
+ */
+static bool SimTraceFill(struct SimTrace *trace, size_t count)
+{
+    if((trace->size - trace->position) >= count)
+        return true;
+    trace->size -= trace->position;
+    memmove(trace->buffer, trace->buffer + trace->position, trace->size);
+    trace->position = 0;
+    trace->size += fread(trace->buffer + trace->size, 1, SIM_TRACE_BUFFER_SIZE - trace->size, trace->f);
+    return trace->size >= count;
+}
+
+/**
+ * @brief Read varint
+ * @param *trace Trace
+ * @param *value Output value
+ * @return 0 on success, <0 if the trace is broken
+ */
+static int SimTraceReadVarint(struct SimTrace *trace, uint64_t *value)
+{
+    *value = 0;
+    for(unsigned int shift = 0; shift < (7 * SIM_TRACE_MAX_VARINT); shift += 7)
+    {
+        if(!SimTraceFill(trace, 1))
+            break;
+        uint8_t byte = trace->buffer[trace->position++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if(0 == (byte & 0x80))
+            return 0;
+    }
+    trace->failed = true;
+    return -1;
+}
+
+/**
+ * @brief Read recorded event
+ * @param *trace Trace, positioned after the record type
+ * @param type Record type
+ * @param *event Output event
+ * @return 0 on success, <0 if the trace is broken
+ */
+static int SimTraceReadEvent(struct SimTrace *trace, uint8_t type, struct SimTraceEvent *event)
+{
+    uint64_t delta;
+    *event = (struct SimTraceEvent){.type = type};
+    if((0 != SimTraceReadVarint(trace, &delta)) || (0 != SimTraceReadVarint(trace, &event->id)))
+        return -1;
+    trace->lastStep += delta;
+    event->step = trace->lastStep;
+    if(SIM_TRACE_LIGHT == type)
+    {
+        if(!SimTraceFill(trace, 1))
+        {
+            trace->failed = true;
+            return -1;
+        }
+        event->light = trace->buffer[trace->position++];
+    }
+    return 0;
+}
+
+void SimTraceEmit(struct SimTrace *trace, const struct SimTraceEvent *event)
+{
+    if(!trace->replay)
+    {
+        uint8_t record[2 + 2 * SIM_TRACE_MAX_VARINT];
+        size_t n = 0;
+        record[n++] = event->type;
+        n += SimTraceEncodeVarint(record + n, event->step - trace->lastStep);
+        n += SimTraceEncodeVarint(record + n, event->id);
+        if(SIM_TRACE_LIGHT == event->type)
+            record[n++] = event->light;
+        trace->lastStep = event->step;
+        SimTraceWrite(trace, record, n);
+        return;
+    }
+
+    if(trace->diverged || trace->failed)
+        return;
+    //the event must be the next record
+    struct SimTraceEvent expected = {.type = SIM_TRACE_NONE};
+    if(SimTraceFill(trace, 1) && (trace->buffer[trace->position] >= SIM_TRACE_LIGHT))
+    {
+        uint8_t type = trace->buffer[trace->position++];
+        if(0 != SimTraceReadEvent(trace, type, &expected))
+            return;
+    }
+    if((expected.type != event->type) || (expected.step != event->step) || (expected.id != event->id)
+        || (expected.light != event->light))
+    {
+        trace->diverged = true;
+        trace->expected = expected;
+        trace->actual = *event;
+    }
+}
+
+struct SimTrace* SimTraceStartRecording(FILE *f)
+{
+    struct SimTrace *trace = calloc(1, sizeof(*trace));
+    uint8_t *buffer = malloc(SIM_TRACE_BUFFER_SIZE);
+    if((NULL == trace) || (NULL == buffer))
+    {
+        printf("Memory allocation failed\r\n");
+        free(trace);
+        free(buffer);
+        return NULL;
+    }
+    struct SimTraceHeader header = {.magic = SIM_TRACE_MAGIC, .version = SIM_TRACE_VERSION};
+    if((1 != fwrite(&header, sizeof(header), 1, f)) || (0 != SimSaveSnapshot(f)))
+    {
+        printf("Unable to write trace\r\n");
+        free(trace);
+        free(buffer);
+        return NULL;
+    }
+    trace->f = f;
+    trace->buffer = buffer;
+    trace->lastStep = SimState->step;
+    trace->state = SimState;
+    SimState->trace = trace;
+    return trace;
+}
+
+void SimTraceRecordCommand(struct SimTrace *trace, uint8_t type, uint8_t startRoad, uint8_t endRoad,
+    const char *name, uint32_t length)
+{
+    uint8_t record[3 + SIM_TRACE_MAX_VARINT] = {type, startRoad, endRoad};
+    size_t n = 3 + SimTraceEncodeVarint(record + 3, length);
+    SimTraceWrite(trace, record, n);
+    if(0 != length)
+        SimTraceWrite(trace, name, length);
+}
+
+struct SimTrace* SimTraceStartReplay(FILE *f, SimVehicleAllocator allocator, void *context)
+{
+    struct SimTrace *trace = calloc(1, sizeof(*trace));
+    uint8_t *buffer = malloc(SIM_TRACE_BUFFER_SIZE);
+    if((NULL == trace) || (NULL == buffer))
+    {
+        printf("Memory allocation failed\r\n");
+        free(trace);
+        free(buffer);
+        return NULL;
+    }
+    struct SimTraceHeader header;
+    if((1 != fread(&header, sizeof(header), 1, f)) || (SIM_TRACE_MAGIC != header.magic)
+        || (SIM_TRACE_VERSION != header.version) || (0 != SimLoadSnapshot(f, allocator, context)))
+    {
+        printf("Trace is broken or incompatible\r\n");
+        free(trace);
+        free(buffer);
+        return NULL;
+    }
+    trace->f = f;
+    trace->buffer = buffer;
+    trace->replay = true;
+    trace->lastStep = SimState->step;
+    trace->state = SimState;
+    SimState->trace = trace;
+    return trace;
+}
+
+int SimTraceReadCommand(struct SimTrace *trace, struct SimTraceCommand *cmd)
+{
+    if(trace->diverged || trace->failed)
+        return -1;
+    if(!SimTraceFill(trace, 1))
+        return 0;
+
+    uint8_t type = trace->buffer[trace->position++];
+    if(type >= SIM_TRACE_LIGHT)
+    {
+        //recorded event was not emitted
+        struct SimTraceEvent expected;
+        if(0 != SimTraceReadEvent(trace, type, &expected))
+            return -1;
+        trace->diverged = true;
+        trace->expected = expected;
+        trace->actual = (struct SimTraceEvent){.type = SIM_TRACE_NONE};
+        return -1;
+    }
+
+    if(!SimTraceFill(trace, 2))
+    {
+        trace->failed = true;
+        return -1;
+    }
+    cmd->type = type;
+    cmd->startRoad = trace->buffer[trace->position++];
+    cmd->endRoad = trace->buffer[trace->position++];
+    uint64_t length;
+    if((0 != SimTraceReadVarint(trace, &length)) || (length > UINT32_MAX))
+    {
+        trace->failed = true;
+        return -1;
+    }
+    if(length >= trace->nameCapacity)
+    {
+        char *name = realloc(trace->name, length + 1);
+        if(NULL == name)
+        {
+            printf("Memory allocation failed\r\n");
+            trace->failed = true;
+            return -1;
+        }
+        trace->name = name;
+        trace->nameCapacity = length + 1;
+    }
+    //the name may be longer than the buffer
+    for(size_t copied = 0; copied < length;)
+    {
+        if(!SimTraceFill(trace, 1))
+        {
+            trace->failed = true;
+            return -1;
+        }
+        size_t chunk = trace->size - trace->position;
+        if(chunk > (length - copied))
+            chunk = length - copied;
+        memcpy(trace->name + copied, trace->buffer + trace->position, chunk);
+        trace->position += chunk;
+        copied += chunk;
+    }
+    trace->name[length] = '\0';
+    cmd->length = length;
+    cmd->name = trace->name;
+    return 1;
+}
+
+bool SimTraceGetDivergence(const struct SimTrace *trace, struct SimTraceEvent *expected, struct SimTraceEvent *actual)
+{
+    if(!trace->diverged)
+        return false;
+    if(NULL != expected)
+        *expected = trace->expected;
+    if(NULL != actual)
+        *actual = trace->actual;
+    return true;
+}
+
+int SimTraceStop(struct SimTrace *trace)
+{
+    if(NULL == trace)
+        return -1;
+    if(!trace->replay)
+    {
+        SimTraceFlush(trace);
+        if(0 != fflush(trace->f))
+            trace->failed = true;
+    }
+    if(trace->state->trace == trace)
+        trace->state->trace = NULL;
+    int ret = trace->failed ? -1 : 0;
+    free(trace->buffer);
+    free(trace->name);
+    free(trace);
+    return ret;
+}
@@ -0,0 +1,116 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "sim.h"
+
+/*
+Trace layout (native byte order):
+* header (struct SimTraceHeader),
+* snapshot of the simulation at the start of the recording (see SimSaveSnapshot()),
+* records, each one starting with its type byte:
+    - input command (type below SIM_TRACE_LIGHT): start road, end road, varint name length, name,
+    - light transition: varint step delta, varint lane index (road-major), light,
+    - vehicle exit: varint step delta, varint vehicle sequential index.
+Step deltas are relative to the step of the previous event. Records are buffered and written in blocks,
+so that the trace can stay enabled in production.
+*/
+
+/**
+ * @brief Trace record type
+ */
+enum SimTraceRecordType
+{
+    SIM_TRACE_NONE = 0, /**< No record (end of trace or a command where an event was expected) */
+    SIM_TRACE_LIGHT = 0x40, /**< Light transition */
+    SIM_TRACE_EXIT = 0x41, /**< Vehicle exit */
+};
+
+/**
+ * @brief Event emitted by the simulation
+ */
+struct SimTraceEvent
+{
+    uint8_t type; /**< Record type (enum SimTraceRecordType) */
+    uint32_t step; /**< Step the event happened in */
+    uint64_t id; /**< Lane index for light transitions, vehicle sequential index for exits */
+    uint8_t light; /**< New light (enum Light) for light transitions */
+};
+
+/**
+ * @brief Recorded input command
+ */
+struct SimTraceCommand
+{
+    uint8_t type; /**< Command type, below SIM_TRACE_LIGHT */
+    uint8_t startRoad; /**< Start road */
+    uint8_t endRoad; /**< End road */
+    uint32_t length; /**< Name length */
+    const char *name; /**< Name (null-terminated), valid until the next command is read */
+};
+
+struct SimTrace; /**< Trace recorder or replayer (opaque) */
+
+/**
+ * @brief Start recording trace of the selected instance
+ *
+ * The current state of the instance is stored in the trace, then the instance emits its light transitions
+ * and vehicle exits to the trace. Input commands must be recorded by the user with SimTraceRecordCommand().
+ * @param *f Output file, must stay open until the recording is stopped
+ * @return Trace, NULL on failure
+ */
+struct SimTrace* SimTraceStartRecording(FILE *f);
+
+/**
+ * @brief Record input command
+ * @param *trace Trace
+ * @param type Command type, below SIM_TRACE_LIGHT
+ * @param startRoad Start road
+ * @param endRoad End road
+ * @param *name Name, can be NULL if the length is 0
+ * @param length Name length
+ */
+void SimTraceRecordCommand(struct SimTrace *trace, uint8_t type, uint8_t startRoad, uint8_t endRoad,
+    const char *name, uint32_t length);
+
+/**
+ * @brief Start replaying trace into the selected instance
+ *
+ * The simulation is restored from the trace (call this function *instead of* SimInit()) and then its light
+ * transitions and vehicle exits are compared to the recorded ones. The user executes the recorded commands
+ * read with SimTraceReadCommand().
+ * @param *f Input file, must stay open until the replay is stopped
+ * @param allocator Vehicle allocator, NULL to use malloc()
+ * @param *context Allocator context
+ * @return Trace, NULL on failure
+ */
+struct SimTrace* SimTraceStartReplay(FILE *f, SimVehicleAllocator allocator, void *context);
+
+/**
+ * @brief Read next recorded command
+ * @param *trace Trace
+ * @param *cmd Output command
+ * @return 1 if a command was read, 0 at the end of the trace, <0 on divergence or broken trace
+ */
+int SimTraceReadCommand(struct SimTrace *trace, struct SimTraceCommand *cmd);
+
+/**
+ * @brief Get first divergence found during replay
+ * @param *trace Trace
+ * @param *expected Output recorded event, type SIM_TRACE_NONE if the simulation emitted an event that was not recorded
+ * @param *actual Output emitted event, type SIM_TRACE_NONE if the simulation did not emit a recorded event
+ * @return True if the replay diverged, false otherwise
+ */
+bool SimTraceGetDivergence(const struct SimTrace *trace, struct SimTraceEvent *expected, struct SimTraceEvent *actual);
+
+/**
+ * @brief Stop recording or replaying, detach the trace from its instance and release it
+ * @param *trace Trace
+ * @return 0 on success, <0 if the trace could not be written or read
+ */
+int SimTraceStop(struct SimTrace *trace);
+
+#endif
@@ -3,7 +3,11 @@
 
 #include <stdint.h>
 
-#define MAX_LANES 3 /**< Maximum incoming lanes per road */
+#define MAX_ROADS 8 /**< Maximum number of roads in a junction */
+#define SIM_LOOKAHEAD_HORIZON 16 /**< Number of future steps whose arrivals are known to the look-ahead policy */
+#define SIM_FIXED_SHIFT 16 /**< Number of fractional bits of fixed-point lane scores */
+#define SIM_FIXED_ONE ((int64_t)1 << SIM_FIXED_SHIFT) /**< Fixed-point representation of 1 */
+#define SIM_CACHE_LINE 64 /**< Cache line size lanes are aligned to */
 
 #define MAX_VEHICLE_NAME_LENGTH 32 /**< Maximum vehicle name length, might be 0 if vehicle structures are allocated dynamically */
 
@@ -22,6 +26,8 @@ enum Light
 
 /**
  * @brief Geographical direction
+ * @note Roads are identified by their index in the junction. The compass directions name the roads
+ * of a typical four-leg junction, other junctions may use any index below MAX_ROADS.
  */
 enum Direction
 {
@@ -35,21 +41,57 @@ enum Direction
 struct Road;
 struct Vehicle;
 
+/**
+ * @brief Link between a vehicle shared with forked simulation instances and the next vehicle in line
+ * @note Shared vehicles are never modified, so the link is kept by the lane instead
+ */
+struct VehicleLink
+{
+    const struct Vehicle *vehicle; /**< Shared vehicle */
+    struct Vehicle *next; /**< Next vehicle in line */
+};
+
 /**
  * @brief Lane on a road
+ *
+ * The lane is aligned to cache lines. The state read or written by every step the lane takes part in comes first
+ * and fills the first line, followed by the configuration, which is not modified after SimInit(), and the state
+ * used only when vehicles are placed or removed, or by the look-ahead policy. Lanes of instances stepped
+ * by different threads never share a line.
+ * @note Dynamically allocated lane arrays must be aligned to SIM_CACHE_LINE, e.g. using aligned_alloc()
  */
 struct Lane
 {
+    /* Lane state, used by every step */
+    enum Light light; /**< Current light state */
+    uint32_t waitTime; /**< Steps elapsed waiting for the green light */
+    size_t vehicleCount; /**< Number of vehicles */
+    struct Vehicle *vehicles; /**< Line of vehicles */
+    size_t id; /**< Lane index in the junction */
+    int64_t fixedPriority; /**< Dynamic lane priority in fixed-point mode, in 1/SIM_FIXED_ONE units */
+    float dynamicPriority; /**< Dynamic lane priority */
+    uint32_t stepsBeforeChange; /**< Steps left to change the light */
+    uint32_t lostTimeLeft; /**< Steps left before vehicles start to leave after switching to green */
+    uint32_t dischargedCount; /**< Number of vehicles that left the lane in the current step */
+    bool blocked; /**< Lane is blocked in given step, because there was a vehicle on another lane
+        that had precedence over this lane */
+    bool unblocked; /**< Lane has been unblocked and it's light will change to green */
+    float priority; /**< Lane priority (configuration, kept with the state as it weights the dynamic priority) */
+
     /* Lane configuration */
-    struct
+    struct Road *road __attribute__ ((aligned (SIM_CACHE_LINE))); /**< Parent road */
+    union
     {
-        uint8_t north : 1;
-        uint8_t south : 1;
-        uint8_t west : 1;
-        uint8_t east : 1;
+        struct
+        {
+            uint8_t north : 1;
+            uint8_t south : 1;
+            uint8_t west : 1;
+            uint8_t east : 1;
+        };
+        uint8_t mask; /**< Bit n set if road n is an allowed target */
     } direction; /**< Allowed target directions */
     bool permissive; /**< Lane is not protected - a colliding flow may occur */
-    float priority; /**< Lane priority */
     uint32_t minGreenTime; /**< Minimum green light time */
     uint32_t minRedTime; /**< Minimum red light time */
     union
@@ -58,18 +100,17 @@ struct Lane
         uint32_t greenTime; /**< Fixed green time */
     };
     uint32_t stepsPerVehicle; /**< Time steps per vehicle for proportional timing */
+    uint32_t saturationFlow; /**< Maximum number of vehicles leaving the lane in one step, 0 is treated as 1 */
+    uint32_t startupLostTime; /**< Steps after switching to green before the first vehicle leaves */
 
-    /* Lane state */
-    enum Light light; /**< Current light state */
-    struct Road *road; /**< Parent road */
-    struct Vehicle *vehicles; /**< Line of vehicles */
-    size_t vehicleCount; /**< Number of vehicles */
-    float dynamicPriority; /**< Dynamic lane priority */
-    uint32_t stepsBeforeChange; /**< Steps left to change the light */
-    uint32_t waitTime; /**< Steps elapsed waiting for the green light */
-    bool blocked; /**< Lane is blocked in given step, because there was a vehicle on another lane
-        that had precedence over this lane */
-    bool unblocked; /**< Lane has been unblocked and it's light will change to green */
+    /* Lane state, used when the line changes */
+    struct Vehicle *lastVehicle; /**< Last vehicle in line */
+    size_t sharedCount; /**< Number of vehicles at the front of the line shared with forked instances */
+    struct VehicleLink *links; /**< Links following shared vehicles */
+    size_t linkCount; /**< Number of links */
+    uint16_t upcoming[SIM_LOOKAHEAD_HORIZON]; /**< Announced arrivals, indexed by step modulo the horizon */
+    uint32_t upcomingCount; /**< Number of announced arrivals */
+    uint32_t upcomingDistance; /**< Sum of steps left until each announced arrival */
 };
 
 /**
@@ -78,9 +119,15 @@ struct Lane
 struct Road
 {
     /* Road configuration */
-    enum Direction position; /**< Geographical road position */
-    struct Lane lane[MAX_LANES]; /**< Incoming lanes */
+    enum Direction position; /**< Road position, equal to the road index */
+    uint16_t bearing; /**< Road bearing in degrees (clockwise from north), defines the order of roads around the junction */
+    struct Lane *lane; /**< Incoming lanes */
     size_t laneCount; /**< Number of incoming lanes */
+
+    /* Road state */
+    uint8_t order; /**< Clockwise order of the road around the junction */
+    uint8_t right; /**< Index of the road at the right hand side, which is also the right turn target */
+    size_t vehicleCount; /**< Number of vehicles waiting on all lanes of the road */
 };
 
 /**
@@ -92,6 +139,7 @@ struct Vehicle
     enum Direction direction; /**< Vehicle target direction */
     struct Lane *lane; /**< Current lane */
     struct Vehicle *next; /**< Next vehicle in line */
+    struct Vehicle *prev; /**< Previous vehicle in line, not used if the vehicle is shared with forked instances */
     char name[MAX_VEHICLE_NAME_LENGTH]; /**< Vehicle name */
 };
 
@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "simapi.h"
+
+static struct SimApiHandle* CreateJunction(void)
+{
+    static const uint16_t bearing[4] = {0, 180, 270, 90};
+    struct SimApiHandle *handle = SimApiCreate(SIM_API_VERSION);
+    if(NULL == handle)
+        return NULL;
+    for(unsigned int i = 0; i < 4; i++)
+    {
+        int road = SimApiAddRoad(handle, bearing[i]);
+        int lane = SimApiAddLane(handle, road, 0xF & ~(1 << i));
+        SimApiSetLaneParameter(handle, road, lane, SIM_API_LANE_MAX_GREEN_TIME, 4);
+        SimApiSetLaneParameter(handle, road, lane, SIM_API_LANE_STEPS_PER_VEHICLE, 1);
+    }
+    if(0 != SimApiStart(handle))
+    {
+        SimApiDestroy(handle);
+        return NULL;
+    }
+    return handle;
+}
+
+static void PlaceVehicles(struct SimApiHandle *handle, size_t count)
+{
+    std::vector<std::string> names;
+    std::vector<const char*> pointers;
+    std::vector<uint8_t> start, end;
+    for(size_t i = 0; i < count; i++)
+    {
+        names.push_back("v" + std::to_string(i));
+        start.push_back(i % 4);
+        end.push_back((i + 1 + i / 4) % 4);
+        if(start.back() == end.back())
+            end.back() = (end.back() + 1) % 4;
+    }
+    for(auto &name : names)
+        pointers.push_back(name.c_str());
+    std::vector<uint64_t> ids(count);
+    ASSERT_EQ(0, SimApiPlaceVehicles(handle, count, pointers.data(), start.data(), end.data(), ids.data()));
+    for(size_t i = 0; i < count; i++)
+        EXPECT_EQ(i + 1, ids[i]);
+}
+
+static void RecordName(const char *name, uint64_t id, uint32_t step, void *context)
+{
+    (void)id;
+    (void)step;
+    static_cast<std::vector<std::string>*>(context)->push_back(name);
+}
+
+TEST(SimApi, RejectsIncompatibleVersions)
+{
+    EXPECT_EQ(SIM_API_VERSION, SimApiGetVersion());
+    EXPECT_EQ(nullptr, SimApiCreate(SIM_API_VERSION + (1 << 16)));
+    EXPECT_EQ(nullptr, SimApiCreate(SIM_API_VERSION + 1));
+    struct SimApiHandle *handle = SimApiCreate(SIM_API_VERSION_MAJOR << 16);
+    EXPECT_NE(nullptr, handle);
+    SimApiDestroy(handle);
+}
+
+TEST(SimApi, ValidatesJunctionAndState)
+{
+    struct SimApiHandle *handle = SimApiCreate(SIM_API_VERSION);
+    ASSERT_NE(nullptr, handle);
+    EXPECT_GT(0, SimApiAddLane(handle, 0, 0x2));
+    EXPECT_EQ(0, SimApiAddRoad(handle, 0));
+    EXPECT_EQ(1, SimApiAddRoad(handle, 180));
+    EXPECT_EQ(0, SimApiAddLane(handle, 0, 0x2));
+    EXPECT_EQ(0, SimApiAddLane(handle, 1, 0x1));
+    EXPECT_EQ(1, SimApiAddLane(handle, 1, 0x1));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 1, SIM_API_LANE_PRIORITY, 2));
+    uint64_t id;
+    const char *name = "a";
+    uint8_t start = 0, end = 1;
+    EXPECT_GT(0, SimApiPlaceVehicles(handle, 1, &name, &start, &end, &id));
+    EXPECT_GT(0, SimApiStep(handle, 1, NULL));
+
+    ASSERT_EQ(0, SimApiStart(handle));
+    EXPECT_GT(0, SimApiStart(handle));
+    EXPECT_GT(0, SimApiAddRoad(handle, 90));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_PERMISSIVE, 1));
+    EXPECT_EQ(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_PRIORITY, 2));
+    //values that can't be converted to an unsigned 32-bit integer are rejected
+    EXPECT_EQ(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_MAX_GREEN_TIME, UINT32_MAX));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_MAX_GREEN_TIME, UINT32_MAX + 1.));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_MIN_GREEN_TIME, -1.));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_MIN_GREEN_TIME, NAN));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_STEPS_PER_VEHICLE, INFINITY));
+    EXPECT_GT(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_PRIORITY, -INFINITY));
+    EXPECT_EQ(0, SimApiSetLaneParameter(handle, 0, 0, SIM_API_LANE_MAX_GREEN_TIME, 10));
+    EXPECT_EQ(3u, SimApiGetLights(handle, NULL, 0));
+
+    //there is no lane from the north road to the west road
+    const char *names[2] = {"a", "b"};
+    uint8_t starts[2] = {0, 0}, ends[2] = {1, 2};
+    uint64_t ids[2];
+    EXPECT_GT(0, SimApiPlaceVehicles(handle, 2, names, starts, ends, ids));
+    EXPECT_EQ(1u, ids[0]);
+    EXPECT_EQ(SIM_API_NO_VEHICLE, ids[1]);
+    EXPECT_GT(0, SimApiRemoveVehicle(handle, "b"));
+    EXPECT_GT(0, SimApiChangeLane(handle, "a", 1));
+    EXPECT_GT(0, SimApiRerouteVehicle(handle, "a", 2));
+    SimApiDestroy(handle);
+}
+
+TEST(SimApi, BulkStepsMatchSingleSteps)
+{
+    struct SimApiHandle *single = CreateJunction();
+    struct SimApiHandle *bulk = CreateJunction();
+    ASSERT_NE(nullptr, single);
+    ASSERT_NE(nullptr, bulk);
+    std::vector<std::string> names;
+    SimApiSetExitCallback(bulk, RecordName, &names);
+    PlaceVehicles(single, 500);
+    PlaceVehicles(bulk, 500);
+    ASSERT_EQ(0, SimApiRemoveVehicle(bulk, "v7"));
+    ASSERT_EQ(0, SimApiRemoveVehicle(single, "v7"));
+
+    std::vector<uint32_t> singleSteps, bulkSteps;
+    std::vector<uint64_t> singleIds, bulkIds;
+    struct SimApiStats stats;
+    do
+    {
+        size_t exited;
+        ASSERT_EQ(0, SimApiStep(single, 1, &exited));
+        singleSteps.resize(singleSteps.size() + exited);
+        singleIds.resize(singleIds.size() + exited);
+        EXPECT_EQ(exited, SimApiTakeExits(single, singleSteps.data() + singleSteps.size() - exited,
+            singleIds.data() + singleIds.size() - exited, exited));
+        ASSERT_EQ(0, SimApiGetStats(single, &stats));
+    }
+    while(0 != stats.waitingVehicles);
+    EXPECT_EQ(499u, stats.exitedVehicles);
+
+    size_t exited;
+    ASSERT_EQ(0, SimApiStep(bulk, stats.step, &exited));
+    EXPECT_EQ(499u, exited);
+    //take exits in parts
+    bulkSteps.resize(exited);
+    bulkIds.resize(exited);
+    EXPECT_EQ(100u, SimApiTakeExits(bulk, bulkSteps.data(), bulkIds.data(), 100));
+    EXPECT_EQ(exited - 100, SimApiTakeExits(bulk, bulkSteps.data() + 100, bulkIds.data() + 100, exited));
+    EXPECT_EQ(0u, SimApiTakeExits(bulk, NULL, NULL, exited));
+
+    EXPECT_EQ(singleSteps, bulkSteps);
+    EXPECT_EQ(singleIds, bulkIds);
+    ASSERT_EQ(exited, names.size());
+    for(size_t i = 0; i < exited; i++)
+        EXPECT_EQ("v" + std::to_string(bulkIds[i] - 1), names[i]);
+
+    SimApiDestroy(single);
+    SimApiDestroy(bulk);
+}
@@ -61,61 +61,81 @@ TEST(SimHelpers, RightTurn)
     EXPECT_FALSE(SimIsRightTurn(NORTH, NORTH));
 }
 
+static void SetupCompass(struct Road *road, struct Lane *lane)
+{
+    static const uint16_t bearing[4] = {[NORTH] = 0, [SOUTH] = 180, [WEST] = 270, [EAST] = 90};
+    for(int i = 0; i < 4; i++)
+    {
+        road[i] = {};
+        road[i].position = (enum Direction)i;
+        road[i].bearing = bearing[i];
+        road[i].laneCount = 1;
+        road[i].lane = &lane[i];
+        lane[i] = {};
+        lane[i].road = &road[i];
+    }
+    SimSetupRoadGeometry(road, 4);
+}
+
 TEST(SimHelpers, RightTurnFromLane)
 {
-    struct Road road;
-    road.position = NORTH;
-    road.laneCount = 1;
-    road.lane[0].road = &road;
-    road.lane[0].direction.west = 1;    
-    EXPECT_TRUE(SimCanTurnRightFromLane(&road.lane[0]));
-    road.lane[0].direction.west = 0;
-    road.lane[0].direction.north = 1;
-    road.lane[0].direction.east = 1;
-    EXPECT_FALSE(SimCanTurnRightFromLane(&road.lane[0]));
-    road.position = SOUTH;
-    road.lane[0].direction.east = 1;
-    EXPECT_TRUE(SimCanTurnRightFromLane(&road.lane[0]));
-    road.lane[0].direction.east = 0;
-    EXPECT_FALSE(SimCanTurnRightFromLane(&road.lane[0]));
+    struct Road road[4];
+    struct Lane lane[4];
+    SetupCompass(road, lane);
+    road[NORTH].lane[0].direction.west = 1;
+    EXPECT_TRUE(SimCanTurnRightFromLane(&road[NORTH].lane[0]));
+    road[NORTH].lane[0].direction.west = 0;
+    road[NORTH].lane[0].direction.north = 1;
+    road[NORTH].lane[0].direction.east = 1;
+    EXPECT_FALSE(SimCanTurnRightFromLane(&road[NORTH].lane[0]));
+    road[SOUTH].lane[0].direction.east = 1;
+    EXPECT_TRUE(SimCanTurnRightFromLane(&road[SOUTH].lane[0]));
+    road[SOUTH].lane[0].direction.east = 0;
+    road[SOUTH].lane[0].direction.west = 1;
+    EXPECT_FALSE(SimCanTurnRightFromLane(&road[SOUTH].lane[0]));
 }
 
 TEST(SimHelper, RightHand)
 {
-    struct Road road[2];
-    struct Vehicle v[2];
-    road[0].laneCount = 1;
-    road[0].lane[0].road = &road[0];
-    road[0].lane[0].vehicleCount = 1;
-    road[0].lane[0].vehicles = &v[0];
-    v[0].lane = &road[0].lane[0];
-
-    road[1].laneCount = 1;
-    road[1].lane[0].road = &road[1];
-    road[1].lane[0].vehicleCount = 1;
-    road[1].lane[0].vehicles = &v[1];
-    v[1].lane = &road[1].lane[0];
+    struct Road road[4];
+    struct Lane lane[4];
+    SetupCompass(road, lane);
 
-    road[0].position = NORTH;
-    road[1].position = EAST;
-    EXPECT_TRUE(SimIsAtRightHand(&v[0], &v[1]));
-    road[0].position = SOUTH;
-    road[1].position = WEST;
-    EXPECT_TRUE(SimIsAtRightHand(&v[0], &v[1]));
-    road[0].position = WEST;
-    road[1].position = NORTH;
-    EXPECT_TRUE(SimIsAtRightHand(&v[0], &v[1]));
-    road[0].position = EAST;
-    road[1].position = SOUTH;
-    EXPECT_TRUE(SimIsAtRightHand(&v[0], &v[1]));
+    EXPECT_TRUE(SimIsRoadAtRightHand(&road[NORTH], &road[EAST]));
+    EXPECT_TRUE(SimIsRoadAtRightHand(&road[SOUTH], &road[WEST]));
+    EXPECT_TRUE(SimIsRoadAtRightHand(&road[WEST], &road[NORTH]));
+    EXPECT_TRUE(SimIsRoadAtRightHand(&road[EAST], &road[SOUTH]));
 
-    road[0].position = NORTH;
-    road[1].position = NORTH;
-    EXPECT_FALSE(SimIsAtRightHand(&v[0], &v[1]));
+    EXPECT_FALSE(SimIsRoadAtRightHand(&road[NORTH], &road[NORTH]));
+    EXPECT_FALSE(SimIsRoadAtRightHand(&road[NORTH], &road[SOUTH]));
+    EXPECT_FALSE(SimIsRoadAtRightHand(&road[NORTH], &road[WEST]));
+}
 
-    road[1].position = SOUTH;
-    EXPECT_FALSE(SimIsAtRightHand(&v[0], &v[1]));
+TEST(SimHelper, TurnsOfIrregularJunctions)
+{
+    //T junction: west, south and east roads
+    EXPECT_EQ(SIM_TURN_RIGHT, SimGetTurn(0, 2, 3));
+    EXPECT_EQ(SIM_TURN_LEFT, SimGetTurn(0, 1, 3));
+    EXPECT_EQ(SIM_TURN_U, SimGetTurn(1, 1, 3));
+    //five roads: two ways are straight, the outer ones are turns
+    EXPECT_EQ(SIM_TURN_LEFT, SimGetTurn(0, 1, 5));
+    EXPECT_EQ(SIM_TURN_STRAIGHT, SimGetTurn(0, 2, 5));
+    EXPECT_EQ(SIM_TURN_STRAIGHT, SimGetTurn(0, 3, 5));
+    EXPECT_EQ(SIM_TURN_RIGHT, SimGetTurn(0, 4, 5));
+    //two slight turns from neighbouring roads cross each other
+    EXPECT_TRUE(SimArePathsColliding(0, 2, 1, 3, 5));
+    EXPECT_FALSE(SimArePathsColliding(0, 2, 2, 0, 5));
 
-    road[1].position = WEST;
-    EXPECT_FALSE(SimIsAtRightHand(&v[0], &v[1]));
-}
\ No newline at end of file
+    //roads are ordered clockwise by bearing, regardless of their indices
+    struct Road road[3] = {};
+    road[0].bearing = 270;
+    road[1].bearing = 90;
+    road[2].bearing = 180;
+    SimSetupRoadGeometry(road, 3);
+    EXPECT_EQ(2, road[0].order);
+    EXPECT_EQ(0, road[1].order);
+    EXPECT_EQ(1, road[2].order);
+    EXPECT_EQ(2, road[0].right);
+    EXPECT_EQ(0, road[1].right);
+    EXPECT_EQ(1, road[2].right);
+}
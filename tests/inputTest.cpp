@@ -0,0 +1,435 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+extern "C" {
+#include "sim.h"
+#include "json.h"
+#include "command.h"
+#include "jsonscan.h"
+#include "config.h"
+#include "batch.h"
+#include "output.h"
+}
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief Configure a junction of 4 roads with one lane each
+ */
+static void SetupJunction(void)
+{
+    static struct Road roads[4];
+    static struct Lane lanes[4][1];
+    static const uint16_t bearing[4] = {[NORTH] = 0, [SOUTH] = 180, [WEST] = 270, [EAST] = 90};
+    SimConfig.selectionPolicy = SIM_DYNAMIC;
+    SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    for(int i = 0; i < 4; i++)
+    {
+        roads[i] = {};
+        roads[i].position = (enum Direction)i;
+        roads[i].bearing = bearing[i];
+        roads[i].lane = lanes[i];
+        roads[i].laneCount = 1;
+        lanes[i][0] = {};
+        lanes[i][0].road = &roads[i];
+        lanes[i][0].direction.mask = 0xF & ~(1u << i);
+        lanes[i][0].minGreenTime = 1;
+        lanes[i][0].maxGreenTime = 10;
+        lanes[i][0].minRedTime = 1;
+        lanes[i][0].priority = 1.f;
+    }
+}
+
+/**
+ * @brief Files of the running test, removed at the end of the scope
+ *
+ * The tests are run as separate processes (possibly in parallel), so every file is named after the test
+ * and the process.
+ */
+class TestFiles
+{
+public:
+    ~TestFiles()
+    {
+        for(const std::string &path : paths)
+            std::remove(path.c_str());
+    }
+
+    /**
+     * @brief Get path of a file in the temporary directory
+     * @param *name File name suffix
+     * @return Path, unique to the running test and process
+     */
+    std::string Path(const char *name)
+    {
+        const ::testing::TestInfo *test = ::testing::UnitTest::GetInstance()->current_test_info();
+        paths.push_back(::testing::TempDir() + test->test_suite_name() + "." + test->name() + "."
+            + std::to_string(getpid()) + "." + name);
+        return paths.back();
+    }
+
+private:
+    std::vector<std::string> paths;
+};
+
+/**
+ * @brief Write input file and run the simulation on it
+ * @param &data Input file contents
+ * @param &output Output JSON
+ * @return JsonRunSimFromExternalData() result
+ */
+static int RunInput(const std::vector<uint8_t> &data, std::string &output)
+{
+    TestFiles files;
+    std::string inPath = files.Path("in.dat"), outPath = files.Path("out.json");
+    FILE *f = fopen(inPath.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    SetupJunction();
+    int ret = JsonRunSimFromExternalData(inPath.c_str(), outPath.c_str(), NULL);
+    std::ifstream out(outPath, std::ios::binary);
+    std::stringstream content;
+    content << out.rdbuf();
+    output = content.str();
+    return ret;
+}
+
+/**
+ * @brief Append v1 command
+ */
+static void AddV1(std::vector<uint8_t> &data, uint8_t type, uint8_t startRoad, uint8_t endRoad, const std::string &name)
+{
+    struct InCommand cmd = {type, startRoad, endRoad, (uint32_t)name.size()};
+    data.insert(data.end(), (const uint8_t*)&cmd, (const uint8_t*)(&cmd + 1));
+    data.insert(data.end(), name.begin(), name.end());
+}
+
+/**
+ * @brief Get v1 input: two vehicles on the same road, 3 steps, one more vehicle and 3 steps
+ */
+static std::vector<uint8_t> GetV1Input(void)
+{
+    std::vector<uint8_t> data;
+    AddV1(data, COMMAND_ADD_VEHICLE, NORTH, SOUTH, "v1");
+    AddV1(data, COMMAND_ADD_VEHICLE, NORTH, SOUTH, "v2");
+    for(int i = 0; i < 3; i++)
+        AddV1(data, COMMAND_STEP, 0, 0, "");
+    AddV1(data, COMMAND_ADD_VEHICLE, EAST, WEST, "v3");
+    for(int i = 0; i < 3; i++)
+        AddV1(data, COMMAND_STEP, 0, 0, "");
+    return data;
+}
+
+/**
+ * @brief Get v2 commands equivalent to GetV1Input()
+ */
+static std::vector<uint8_t> GetV2Commands(void)
+{
+    return {COMMAND_ADD_VEHICLE, NORTH, SOUTH, 2, 'v', '1',
+        COMMAND_ADD_VEHICLE, NORTH, SOUTH, 2, 'v', '2',
+        COMMAND_STEP, 3,
+        COMMAND_ADD_VEHICLE, EAST, WEST, 2, 'v', '3',
+        COMMAND_STEP, 3};
+}
+
+/**
+ * @brief Get v2 file with given blocks
+ */
+static std::vector<uint8_t> GetV2Input(const std::vector<std::vector<uint8_t>> &blocks)
+{
+    std::vector<uint8_t> data = {'T', 'I', 'N', '2'};
+    for(const std::vector<uint8_t> &block : blocks)
+        data.insert(data.end(), block.begin(), block.end());
+    return data;
+}
+
+TEST(JsonInput, StoredBlocksMatchV1)
+{
+    std::string expected, output;
+    ASSERT_EQ(0, RunInput(GetV1Input(), expected));
+    std::vector<uint8_t> commands = GetV2Commands();
+    std::vector<uint8_t> first = {IN_BLOCK_STORED, 14, 14}, second = {IN_BLOCK_STORED, 8, 8};
+    first.insert(first.end(), commands.begin(), commands.begin() + 14);
+    second.insert(second.end(), commands.begin() + 14, commands.end());
+    ASSERT_EQ(0, RunInput(GetV2Input({first, second}), output));
+    EXPECT_EQ(expected, output);
+    //both vehicles of the north road leave before the east one
+    EXPECT_LT(output.find("\"v2\""), output.find("\"v3\""));
+}
+
+TEST(JsonInput, LzBlockMatchesV1)
+{
+    std::string expected, output;
+    ASSERT_EQ(0, RunInput(GetV1Input(), expected));
+    //the second add command repeats the first 5 bytes of the first one
+    std::vector<uint8_t> block = {IN_BLOCK_LZ, 22, 21,
+        6, COMMAND_ADD_VEHICLE, NORTH, SOUTH, 2, 'v', '1',
+        5 - IN_MIN_MATCH, 6,
+        11, '2', COMMAND_STEP, 3, COMMAND_ADD_VEHICLE, EAST, WEST, 2, 'v', '3', COMMAND_STEP, 3};
+    ASSERT_EQ(0, RunInput(GetV2Input({block}), output));
+    EXPECT_EQ(expected, output);
+}
+
+TEST(JsonInput, BrokenBlocksAreRejected)
+{
+    std::string output;
+    //match reaching before the start of the block
+    std::vector<uint8_t> block = {IN_BLOCK_LZ, 12, 6, 1, COMMAND_STEP, 7 - IN_MIN_MATCH, 2, 3, 1};
+    EXPECT_NE(0, RunInput(GetV2Input({block}), output));
+    //command cut by the end of the block
+    block = {IN_BLOCK_STORED, 4, 4, COMMAND_ADD_VEHICLE, NORTH, SOUTH, 2};
+    EXPECT_NE(0, RunInput(GetV2Input({block}), output));
+    //zero steps
+    block = {IN_BLOCK_STORED, 2, 2, COMMAND_STEP, 0};
+    EXPECT_NE(0, RunInput(GetV2Input({block}), output));
+}
+
+/**
+ * @brief Write text file
+ */
+static void WriteText(const std::string &path, const std::string &text)
+{
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+}
+
+/**
+ * @brief Read whole file
+ */
+static std::string ReadFile(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+/**
+ * @brief Get JSON commands equivalent to GetV1Input(), with whitespace and escapes in odd places
+ */
+static std::string GetJsonInput(void)
+{
+    return "{\"commands\": [\n"
+        "  {\"type\": \"addVehicle\", \"vehicleId\": \"v1\", \"startRoad\": \"north\", \"endRoad\": \"south\"},\n"
+        "  { \"endRoad\" : \"south\" , \"vehicleId\":\"\\u0076\\u0032\",\"startRoad\":\"north\",\"type\":\"addVehicle\" },\n"
+        "  {\"type\": \"step\"}, {\"type\": \"step\", \"comment\": \"ignored \\\" [{\"}, {\"type\": \"step\"},\n"
+        "  {\"type\": \"addVehicle\", \"vehicleId\": \"v3\", \"startRoad\": \"east\", \"endRoad\": \"west\"},\n"
+        "  {\"type\": \"step\"}, {\"type\": \"step\"}, {\"type\": \"step\"}\n"
+        "]}\n";
+}
+
+TEST(JsonScan, ConvertedInputMatchesV1)
+{
+    std::string expected, output;
+    ASSERT_EQ(0, RunInput(GetV1Input(), expected));
+    TestFiles files;
+    std::string jsonPath = files.Path("json"), inPath = files.Path("dat"), outPath = files.Path("out.json");
+    WriteText(jsonPath, GetJsonInput());
+    ASSERT_EQ(0, JsonScanConvert(jsonPath.c_str(), inPath.c_str(), NULL));
+    SetupJunction();
+    ASSERT_EQ(0, JsonRunSimFromExternalData(inPath.c_str(), outPath.c_str(), NULL));
+    EXPECT_EQ(expected, ReadFile(outPath));
+}
+
+TEST(JsonScan, OutputDoesNotDependOnChunks)
+{
+    //long enough for many chunks and a few compressed blocks
+    std::string json = "{\"commands\": [";
+    for(int i = 0; i < 20000; i++)
+    {
+        json += "{\"type\": \"addVehicle\", \"vehicleId\": \"veh\\\\icle\\n" + std::to_string(i)
+            + "\", \"startRoad\": \"north\", \"endRoad\": \"east\"}, {\"type\": \"step\"}, ";
+        if(0 == (i % 7))
+            json += "{\"type\": \"changeLane\", \"vehicleId\": \"\\u017c\\ud83d\\ude97\", \"lane\": " + std::to_string(i % 3) + "}, ";
+    }
+    json += "{\"type\": \"removeVehicle\", \"vehicleId\": \"veh\\\\icle\\n0\"}]}";
+    TestFiles files;
+    std::string jsonPath = files.Path("json"), inPath = files.Path("dat");
+    WriteText(jsonPath, json);
+    struct JsonScanOptions options = {1, 0, JSON_SCAN_SCALAR};
+    ASSERT_EQ(0, JsonScanConvert(jsonPath.c_str(), inPath.c_str(), &options));
+    std::string expected = ReadFile(inPath);
+    const struct JsonScanOptions variants[] = {
+        {3, 64, JSON_SCAN_SCALAR},
+        {4, 1000, JSON_SCAN_AUTO},
+        {2, 4096, JSON_SCAN_SSE2},
+        {5, 192, JSON_SCAN_AVX2},
+    };
+    for(const struct JsonScanOptions &variant : variants)
+    {
+        if(!JsonScanIsSupported(variant.level))
+            continue;
+        ASSERT_EQ(0, JsonScanConvert(jsonPath.c_str(), inPath.c_str(), &variant));
+        EXPECT_EQ(expected, ReadFile(inPath)) << variant.threads << " threads, chunk " << variant.chunkSize;
+    }
+}
+
+TEST(JsonScan, BrokenJsonIsRejected)
+{
+    const char *inputs[] = {
+        "{\"commands\": [{\"type\": \"step\"}, {\"type\": \"step}]}",
+        "{\"commands\": [{\"type\": \"jump\"}]}",
+        "{\"commands\": [{\"type\": \"step\", \"extra\": {\"a\": 1}}]}",
+        "{\"commands\": [{\"type\": \"removeVehicle\"}]}",
+        "{\"commands\": [{\"type\": \"step\"}]}, []",
+        "{\"commands\": [{\"type\": \"step\"}",
+    };
+    TestFiles files;
+    std::string jsonPath = files.Path("json"), inPath = files.Path("dat");
+    for(const char *input : inputs)
+    {
+        WriteText(jsonPath, input);
+        struct JsonScanOptions options = {2, 64, JSON_SCAN_AUTO};
+        EXPECT_NE(0, JsonScanConvert(jsonPath.c_str(), inPath.c_str(), &options)) << input;
+    }
+}
+
+TEST(ConfigJunction, CompiledJunctionMatchesBuiltIn)
+{
+    std::string expected;
+    ASSERT_EQ(0, RunInput(GetV1Input(), expected));
+    TestFiles files;
+    std::string inPath = files.Path("dat"), configPath = files.Path("json"), imagePath = files.Path("bin"),
+        outPath = files.Path("out.json");
+    std::vector<uint8_t> data = GetV1Input();
+    FILE *f = fopen(inPath.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+
+    WriteText(configPath, "{\"selectionPolicy\": \"dynamic\", \"timePolicy\": \"prioritized\", \"roads\": [\n"
+        "  {\"bearing\": 0, \"lanes\": [{\"directions\": [\"south\", \"west\", \"east\"]}]},\n"
+        "  {\"bearing\": 180, \"lanes\": [{\"directions\": [0, 2, 3], \"minGreenTime\": 1, \"maxGreenTime\": 10}]},\n"
+        "  {\"bearing\": 270, \"lanes\": [{\"directions\": [\"north\", \"south\", \"east\"], \"priority\": 1.0}]},\n"
+        "  {\"bearing\": 90, \"lanes\": [{\"directions\": [\"north\", \"south\", \"west\"], \"permissive\": false}]}\n"
+        "]}\n");
+    ASSERT_EQ(0, ConfigCompile(configPath.c_str(), imagePath.c_str()));
+    struct SimState *junction = ConfigLoad(imagePath.c_str());
+    ASSERT_NE(nullptr, junction);
+    SimSelect(junction);
+    struct JsonRunOptions options = {};
+    options.initialized = true;
+    EXPECT_EQ(0, JsonRunSimFromExternalData(inPath.c_str(), outPath.c_str(), &options));
+    SimRelease(junction);
+    EXPECT_EQ(expected, ReadFile(outPath));
+}
+
+TEST(ConfigJunction, BrokenConfigIsRejected)
+{
+    const char *inputs[] = {
+        "{\"roads\": [{\"bearing\": 0, \"lanes\": [{\"directions\": [\"up\"]}]}]}",
+        "{\"roads\": [{\"bearing\": 0, \"lanes\": [{\"directions\": [8]}]}]}",
+        "{\"roads\": [{\"bearing\": 0, \"lanes\": [{\"directions\": [1], \"speed\": 3}]}]}",
+        "{\"roads\": [{\"bearing\": 0, \"lanes\": [{\"directions\": [1], \"minGreenTime\": -1}]}]}",
+        "{\"roads\": [{\"lanes\": []}]}",
+        "{\"selectionPolicy\": \"random\", \"roads\": []}",
+        "{\"roads\": [{\"bearing\": 0, \"lanes\": []}]",
+        "{\"roads\": []} {}",
+        "{\"fixedPoint\": 1, \"roads\": []}",
+    };
+    for(const char *input : inputs)
+    {
+        struct SimConfig config;
+        EXPECT_NE(0, ConfigParse(input, &config)) << input;
+    }
+
+    struct SimConfig config;
+    ASSERT_EQ(0, ConfigParse(" {\"phaseScheduling\": true, \"roads\": [{\"bearing\": 90, \"lanes\": [{\"directions\": []}, "
+        "{\"directions\": [\"west\", 1], \"saturationFlow\": 3}]}, {\"bearing\": 270}]}\n", &config));
+    EXPECT_TRUE(config.phaseScheduling);
+    EXPECT_EQ(2u, config.roadCount);
+    EXPECT_EQ(2u, config.road[0].laneCount);
+    EXPECT_EQ(0x6u, config.road[0].lane[1].direction.mask);
+    EXPECT_EQ(3u, config.road[0].lane[1].saturationFlow);
+    EXPECT_EQ(10u, config.road[0].lane[1].maxGreenTime);
+    EXPECT_EQ(&config.road[0], config.road[0].lane[1].road);
+    EXPECT_EQ(0u, config.road[1].laneCount);
+    ConfigRelease(&config);
+}
+
+TEST(Batch, ScenariosMatchSingleRuns)
+{
+    std::string expected;
+    ASSERT_EQ(0, RunInput(GetV1Input(), expected));
+    TestFiles files;
+    std::string inPath = files.Path("dat"), jsonPath = files.Path("json"), manifestPath = files.Path("txt");
+    std::vector<std::string> outPaths;
+    for(int i = 0; i < 24; i++)
+        outPaths.push_back(files.Path((std::to_string(i) + ".out.json").c_str()));
+    std::vector<uint8_t> data = GetV1Input();
+    FILE *f = fopen(inPath.c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+    WriteText(jsonPath, GetJsonInput());
+
+    //more scenarios than threads, each input used by several of them at once
+    std::string manifest = "# scenario list\n\n";
+    for(int i = 0; i < 24; i++)
+        manifest += ((i % 2) ? jsonPath : ("  " + inPath)) + "\t" + outPaths[i] + "\n";
+    WriteText(manifestPath, manifest);
+    SetupJunction();
+    struct BatchOptions options = {5, NULL};
+    ASSERT_EQ(0, BatchRun(manifestPath.c_str(), &options));
+    for(int i = 0; i < 24; i++)
+        EXPECT_EQ(expected, ReadFile(outPaths[i])) << i;
+    SimSetEventLogging(true);
+
+    //a failed scenario does not stop the others
+    WriteText(manifestPath, files.Path("missing.json") + " " + files.Path("missing.out.json") + "\n"
+        + inPath + " " + outPaths[0] + "\n");
+    std::remove(outPaths[0].c_str());
+    EXPECT_NE(0, BatchRun(manifestPath.c_str(), &options));
+    EXPECT_EQ(expected, ReadFile(outPaths[0]));
+    SimSetEventLogging(true);
+
+    WriteText(manifestPath, inPath + "\n");
+    EXPECT_NE(0, BatchRun(manifestPath.c_str(), &options));
+    SimSetEventLogging(true);
+}
+
+TEST(Output, MatchesSequentialWrites)
+{
+    TestFiles files;
+    std::string path = files.Path("txt");
+    for(bool noRing : {false, true})
+    {
+        //buffers much smaller than the data, so that most writes span several buffers
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(4, pwrite(fd, "head", 4, 0));
+        struct OutputOptions options = {7, noRing};
+        struct Output *out = OutputOpen(fd, 4, &options);
+        ASSERT_NE(nullptr, out);
+        std::string expected = "head";
+        for(int i = 0; i < 500; i++)
+        {
+            std::string element = "\"element" + std::to_string(i) + "\",";
+            EXPECT_EQ(0, OutputWriteString(out, element.c_str()));
+            expected += element;
+            //rewind over data in the active buffer, in the buffer being written or already in the file
+            if(0 == (i % 3))
+            {
+                size_t count = 1 + (i % 11);
+                OutputRewind(out, count);
+                expected.resize(expected.size() - count);
+            }
+            EXPECT_EQ(expected.size(), OutputTell(out));
+            if(0 == (i % 100))
+            {
+                EXPECT_EQ(0, OutputFlush(out));
+            }
+        }
+        if(noRing)
+        {
+            EXPECT_FALSE(OutputUsesRing(out));
+        }
+        EXPECT_EQ(0, OutputClose(out));
+        EXPECT_EQ(0, ftruncate(fd, expected.size()));
+        close(fd);
+        EXPECT_EQ(expected, ReadFile(path)) << noRing;
+    }
+}
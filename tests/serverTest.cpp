@@ -0,0 +1,361 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+extern "C" {
+#include "sim.h"
+#include "command.h"
+#include "server.h"
+}
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Configure a junction of 4 roads with one lane each
+ */
+static void SetupJunction(void)
+{
+    static struct Road roads[4];
+    static struct Lane lanes[4][1];
+    static const uint16_t bearing[4] = {[NORTH] = 0, [SOUTH] = 180, [WEST] = 270, [EAST] = 90};
+    SimConfig.selectionPolicy = SIM_DYNAMIC;
+    SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    for(int i = 0; i < 4; i++)
+    {
+        roads[i] = {};
+        roads[i].position = (enum Direction)i;
+        roads[i].bearing = bearing[i];
+        roads[i].lane = lanes[i];
+        roads[i].laneCount = 1;
+        lanes[i][0] = {};
+        lanes[i][0].road = &roads[i];
+        lanes[i][0].direction.mask = 0xF & ~(1u << i);
+        lanes[i][0].minGreenTime = 1;
+        lanes[i][0].maxGreenTime = 10;
+        lanes[i][0].minRedTime = 1;
+        lanes[i][0].priority = 1.f;
+    }
+}
+
+/**
+ * @brief Server running in a child process for the duration of the scope
+ *
+ * The server runs until it receives SIGTERM, so it is run in a forked process and stopped at the end of the test.
+ */
+class TestServer
+{
+public:
+    TestServer()
+    {
+        path = ::testing::TempDir() + "serverTest." + std::to_string(getpid()) + ".sock";
+        //the child must not write out the buffered output of the test
+        fflush(stdout);
+        pid = fork();
+        if(0 == pid)
+        {
+            SetupJunction();
+            SimSetEventLogging(false);
+            _exit((0 == ServerRun(path.c_str())) ? 0 : 1);
+        }
+    }
+
+    ~TestServer()
+    {
+        for(int fd : fds)
+            close(fd);
+        if(pid <= 0)
+            return;
+        kill(pid, SIGTERM);
+        int status;
+        EXPECT_EQ(pid, waitpid(pid, &status, 0));
+        EXPECT_TRUE(WIFEXITED(status) && (0 == WEXITSTATUS(status)));
+    }
+
+    /**
+     * @brief Connect to the server, waiting until it listens
+     * @return Socket, <0 on failure
+     */
+    int Connect(void)
+    {
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+        for(int i = 0; i < 1000; i++)
+        {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(0 == connect(fd, (struct sockaddr*)&address, sizeof(address)))
+            {
+                //a stalled server fails the test instead of hanging it
+                struct timeval timeout = {.tv_sec = 10, .tv_usec = 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                fds.push_back(fd);
+                return fd;
+            }
+            close(fd);
+            usleep(10000);
+        }
+        return -1;
+    }
+
+private:
+    pid_t pid;
+    std::string path;
+    std::vector<int> fds;
+};
+
+/**
+ * @brief Append request
+ */
+static void AddRequest(std::vector<uint8_t> &data, uint8_t type, uint8_t startRoad, uint8_t endRoad, const std::string &name)
+{
+    struct InCommand cmd = {.type = type, .startRoad = startRoad, .endRoad = endRoad, .length = (uint32_t)name.size()};
+    data.insert(data.end(), (uint8_t*)&cmd, (uint8_t*)&cmd + sizeof(cmd));
+    data.insert(data.end(), name.begin(), name.end());
+}
+
+static bool SendAll(int fd, const std::vector<uint8_t> &data)
+{
+    return (ssize_t)data.size() == send(fd, data.data(), data.size(), 0);
+}
+
+static bool ReceiveAll(int fd, void *data, size_t size)
+{
+    //an empty read would wait for data
+    return (0 == size) || ((ssize_t)size == recv(fd, data, size, MSG_WAITALL));
+}
+
+/**
+ * @brief Receive one response
+ * @param fd Socket
+ * @param &payload Response payload
+ * @return Response header, type 0 if the connection was closed
+ */
+static struct ServerResponse ReceiveResponse(int fd, std::vector<uint8_t> &payload)
+{
+    struct ServerResponse response = {};
+    if(!ReceiveAll(fd, &response, sizeof(response)))
+        return {};
+    payload.resize(response.length);
+    if(!ReceiveAll(fd, payload.data(), payload.size()))
+        return {};
+    return response;
+}
+
+/**
+ * @brief Send one request and receive its response
+ */
+static struct ServerResponse Request(int fd, uint8_t type, uint8_t startRoad, uint8_t endRoad, const std::string &name,
+    std::vector<uint8_t> &payload)
+{
+    std::vector<uint8_t> data;
+    AddRequest(data, type, startRoad, endRoad, name);
+    if(!SendAll(fd, data))
+        return {};
+    return ReceiveResponse(fd, payload);
+}
+
+/**
+ * @brief Step until a vehicle exits
+ * @return Exited vehicle names, empty if none exited in 100 steps
+ */
+static std::vector<std::string> StepToExit(int fd)
+{
+    std::vector<std::string> names;
+    std::vector<uint8_t> payload;
+    for(int i = 0; (i < 100) && names.empty(); i++)
+    {
+        struct ServerResponse response = Request(fd, COMMAND_STEP, 0, 0, "", payload);
+        if((COMMAND_STEP != response.type) || (SERVER_OK != response.status))
+            break;
+        for(size_t k = 0; (k + sizeof(uint16_t)) <= payload.size();)
+        {
+            uint16_t length;
+            memcpy(&length, &payload[k], sizeof(length));
+            names.emplace_back((char*)&payload[k + sizeof(length)], length);
+            k += sizeof(length) + length;
+        }
+    }
+    return names;
+}
+
+TEST(Server, RequestsSplitAcrossReads)
+{
+    TestServer server;
+    int fd = server.Connect();
+    ASSERT_LE(0, fd);
+
+    //the request is sent byte by byte, the header itself is split too
+    std::vector<uint8_t> data;
+    AddRequest(data, COMMAND_ADD_VEHICLE, NORTH, SOUTH, "vehicle");
+    for(uint8_t byte : data)
+    {
+        ASSERT_EQ(1, send(fd, &byte, 1, 0));
+        usleep(1000);
+    }
+    std::vector<uint8_t> payload;
+    struct ServerResponse response = ReceiveResponse(fd, payload);
+    EXPECT_EQ(COMMAND_ADD_VEHICLE, response.type);
+    EXPECT_EQ(SERVER_OK, response.status);
+    EXPECT_EQ(0u, response.length);
+    EXPECT_EQ(std::vector<std::string>{"vehicle"}, StepToExit(fd));
+}
+
+TEST(Server, PipelinedRequestsAreAnsweredInOrder)
+{
+    TestServer server;
+    int fd = server.Connect();
+    ASSERT_LE(0, fd);
+
+    std::vector<uint8_t> data;
+    AddRequest(data, COMMAND_ADD_VEHICLE, NORTH, SOUTH, "v1");
+    AddRequest(data, COMMAND_ADD_VEHICLE, NORTH, NORTH, "v2");
+    AddRequest(data, COMMAND_REMOVE_VEHICLE, 0, 0, "v3");
+    AddRequest(data, COMMAND_QUERY_LIGHTS, 0, 0, "");
+    AddRequest(data, COMMAND_STEP, 0, 0, "");
+    ASSERT_TRUE(SendAll(fd, data));
+
+    std::vector<uint8_t> payload;
+    const uint8_t types[] = {COMMAND_ADD_VEHICLE, COMMAND_ADD_VEHICLE, COMMAND_REMOVE_VEHICLE, COMMAND_QUERY_LIGHTS, COMMAND_STEP};
+    const uint8_t statuses[] = {SERVER_OK, SERVER_FAILED, SERVER_FAILED, SERVER_OK, SERVER_OK};
+    for(size_t i = 0; i < sizeof(types); i++)
+    {
+        struct ServerResponse response = ReceiveResponse(fd, payload);
+        EXPECT_EQ(types[i], response.type);
+        EXPECT_EQ(statuses[i], response.status);
+        if(COMMAND_QUERY_LIGHTS == response.type)
+        {
+            EXPECT_EQ(4u, response.count);
+            EXPECT_EQ(4u, response.length);
+        }
+    }
+}
+
+TEST(Server, SlowReaderDoesNotStallOthers)
+{
+    TestServer server;
+    int slow = server.Connect();
+    int other = server.Connect();
+    ASSERT_LE(0, slow);
+    ASSERT_LE(0, other);
+
+    //light queries are sent without reading the responses, until the server stops reading too
+    std::vector<uint8_t> query;
+    AddRequest(query, COMMAND_QUERY_LIGHTS, 0, 0, "");
+    std::vector<uint8_t> data;
+    for(int i = 0; i < 4096; i++)
+        data.insert(data.end(), query.begin(), query.end());
+    fcntl(slow, F_SETFL, fcntl(slow, F_GETFL) | O_NONBLOCK);
+    size_t sent = 0;
+    struct pollfd pfd = {.fd = slow, .events = POLLOUT, .revents = 0};
+    while((sent < (64u << 20)) && (poll(&pfd, 1, 200) > 0))
+    {
+        ssize_t size = send(slow, data.data(), data.size(), 0);
+        ASSERT_TRUE((size > 0) || (EAGAIN == errno));
+        sent += (size > 0) ? size : 0;
+    }
+    ASSERT_LT(sent, 64u << 20);
+
+    //the server has pending output for the slow client, but it still serves the other one
+    std::vector<uint8_t> payload;
+    EXPECT_EQ(SERVER_OK, Request(other, COMMAND_ADD_VEHICLE, WEST, EAST, "other", payload).status);
+
+    //the slow client completes its last request and reads everything, which was sent in parts
+    size_t requests = (sent + query.size() - 1) / query.size();
+    size_t rest = requests * query.size() - sent;
+    size_t received = 0;
+    std::vector<uint8_t> in;
+    while(received < requests)
+    {
+        pfd.events = POLLIN | ((0 != rest) ? POLLOUT : 0);
+        ASSERT_LT(0, poll(&pfd, 1, 5000));
+        if((0 != rest) && (pfd.revents & POLLOUT))
+        {
+            ssize_t size = send(slow, query.data() + query.size() - rest, rest, 0);
+            rest -= (size > 0) ? size : 0;
+        }
+        if(pfd.revents & POLLIN)
+        {
+            uint8_t buffer[65536];
+            ssize_t size = recv(slow, buffer, sizeof(buffer), 0);
+            ASSERT_LT(0, size);
+            in.insert(in.end(), buffer, buffer + size);
+            size_t position = 0;
+            while((in.size() - position) >= (sizeof(struct ServerResponse) + 4))
+            {
+                struct ServerResponse response;
+                memcpy(&response, &in[position], sizeof(response));
+                ASSERT_EQ(COMMAND_QUERY_LIGHTS, response.type);
+                ASSERT_EQ(SERVER_OK, response.status);
+                ASSERT_EQ(4u, response.length);
+                position += sizeof(response) + response.length;
+                ++received;
+            }
+            in.erase(in.begin(), in.begin() + position);
+        }
+    }
+    EXPECT_TRUE(in.empty());
+    EXPECT_EQ(std::vector<std::string>{"other"}, StepToExit(other));
+}
+
+TEST(Server, BadRequestClosesConnection)
+{
+    TestServer server;
+    int fd = server.Connect();
+    ASSERT_LE(0, fd);
+
+    //requests following a bad one are not handled
+    std::vector<uint8_t> data;
+    AddRequest(data, COMMAND_ADD_VEHICLE, NORTH, SOUTH, "v1");
+    AddRequest(data, 99, 0, 0, "");
+    AddRequest(data, COMMAND_STEP, 0, 0, "");
+    ASSERT_TRUE(SendAll(fd, data));
+    std::vector<uint8_t> payload;
+    EXPECT_EQ(SERVER_OK, ReceiveResponse(fd, payload).status);
+    struct ServerResponse response = ReceiveResponse(fd, payload);
+    EXPECT_EQ(99, response.type);
+    EXPECT_EQ(SERVER_BAD_REQUEST, response.status);
+    uint8_t byte;
+    EXPECT_EQ(0, recv(fd, &byte, 1, 0));
+
+    //too long names are rejected before the name is received
+    fd = server.Connect();
+    ASSERT_LE(0, fd);
+    struct InCommand cmd = {.type = COMMAND_ADD_VEHICLE, .startRoad = NORTH, .endRoad = SOUTH, .length = SERVER_MAX_NAME_LENGTH + 1};
+    ASSERT_EQ((ssize_t)sizeof(cmd), send(fd, &cmd, sizeof(cmd), 0));
+    response = ReceiveResponse(fd, payload);
+    EXPECT_EQ(COMMAND_ADD_VEHICLE, response.type);
+    EXPECT_EQ(SERVER_BAD_REQUEST, response.status);
+    EXPECT_EQ(0u, response.length);
+    EXPECT_EQ(0, recv(fd, &byte, 1, 0));
+}
+
+TEST(Server, ConnectionsRunIndependentSimulations)
+{
+    TestServer server;
+    int first = server.Connect();
+    int second = server.Connect();
+    ASSERT_LE(0, first);
+    ASSERT_LE(0, second);
+
+    std::vector<uint8_t> payload;
+    EXPECT_EQ(SERVER_OK, Request(first, COMMAND_ADD_VEHICLE, NORTH, SOUTH, "v1", payload).status);
+    EXPECT_EQ(SERVER_FAILED, Request(second, COMMAND_REMOVE_VEHICLE, 0, 0, "v1", payload).status);
+    EXPECT_EQ(SERVER_OK, Request(second, COMMAND_ADD_VEHICLE, WEST, EAST, "v2", payload).status);
+    EXPECT_EQ(std::vector<std::string>{"v1"}, StepToExit(first));
+
+    //a reset restarts only the simulation of its connection
+    EXPECT_EQ(SERVER_OK, Request(first, COMMAND_ADD_VEHICLE, SOUTH, NORTH, "v3", payload).status);
+    EXPECT_EQ(SERVER_OK, Request(second, COMMAND_RESET, 0, 0, "", payload).status);
+    EXPECT_EQ(SERVER_FAILED, Request(second, COMMAND_REMOVE_VEHICLE, 0, 0, "v2", payload).status);
+    EXPECT_EQ(std::vector<std::string>{"v3"}, StepToExit(first));
+    EXPECT_TRUE(StepToExit(second).empty());
+}
@@ -0,0 +1,1061 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+extern "C" {
+#include "sim.h"
+#include "trace.h"
+#include "timeline.h"
+#include "profile.h"
+}
+
+static void SetupJunction(void)
+{
+    SimConfig.selectionPolicy = SIM_DYNAMIC;
+    SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
+    SimConfig.phaseScheduling = false;
+    SimConfig.fixedPoint = false;
+    static struct Road roads[4];
+    static struct Lane lanes[4][1];
+    static const uint16_t bearing[4] = {[NORTH] = 0, [SOUTH] = 180, [WEST] = 270, [EAST] = 90};
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    for(int i = 0; i < 4; i++)
+    {
+        SimConfig.road[i].position = (enum Direction)i;
+        SimConfig.road[i].bearing = bearing[i];
+        SimConfig.road[i].lane = lanes[i];
+        SimConfig.road[i].laneCount = 1;
+        SimConfig.road[i].lane[0] = {};
+        SimConfig.road[i].lane[0].road = &SimConfig.road[i];
+        SimConfig.road[i].lane[0].direction.north = (NORTH != i);
+        SimConfig.road[i].lane[0].direction.south = (SOUTH != i);
+        SimConfig.road[i].lane[0].direction.west = (WEST != i);
+        SimConfig.road[i].lane[0].direction.east = (EAST != i);
+        SimConfig.road[i].lane[0].minGreenTime = 1;
+        SimConfig.road[i].lane[0].maxGreenTime = 4;
+        SimConfig.road[i].lane[0].minRedTime = 1;
+        SimConfig.road[i].lane[0].stepsPerVehicle = 1;
+        SimConfig.road[i].lane[0].priority = 1.f;
+    }
+}
+
+static void RecordExit(struct Vehicle *vehicle, void *context)
+{
+    static_cast<std::vector<std::string>*>(context)->push_back(vehicle->name);
+}
+
+static std::vector<std::string> RunToEnd(void)
+{
+    std::vector<std::string> exited;
+    SimRegisterVehicleExitedCallback(RecordExit, &exited);
+    while(SimDoStep())
+        ;
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+    return exited;
+}
+
+static struct Vehicle* TrackedAllocator(size_t nameLength, void *context)
+{
+    void *v = malloc(sizeof(struct Vehicle) + nameLength + 1);
+    static_cast<std::vector<void*>*>(context)->push_back(v);
+    return static_cast<struct Vehicle*>(v);
+}
+
+TEST(SimSnapshot, RestoreContinuesIdentically)
+{
+    static struct Vehicle v[24];
+    SetupJunction();
+    SimInit();
+    for(size_t i = 0; i < 24; i++)
+    {
+        snprintf(v[i].name, sizeof(v[i].name), "v%zu", i);
+        enum Direction start = (enum Direction)(i % 4), end = (enum Direction)((i / 4 + i + 1) % 4);
+        if(start == end)
+            end = (enum Direction)((end + 1) % 4);
+        v[i].direction = end;
+        ASSERT_EQ(0, SimPlaceVehicle(&v[i], SimSelectLane(start, end)));
+        if(i % 3)
+            SimDoStep();
+    }
+
+    FILE *f = tmpfile();
+    ASSERT_NE(nullptr, f);
+    ASSERT_EQ(0, SimSaveSnapshot(f));
+    std::vector<std::string> expected = RunToEnd();
+    ASSERT_FALSE(expected.empty());
+
+    //start from a scrambled configuration to make sure everything is restored
+    SetupJunction();
+    SimConfig.selectionPolicy = SIM_FCFS;
+    SimConfig.road[0].lane[0].maxGreenTime = 100;
+    SimInit();
+    rewind(f);
+    std::vector<void*> restored;
+    ASSERT_EQ(0, SimLoadSnapshot(f, TrackedAllocator, &restored));
+    fclose(f);
+    EXPECT_EQ(SIM_DYNAMIC, SimConfig.selectionPolicy);
+    EXPECT_EQ(4u, SimConfig.road[0].lane[0].maxGreenTime);
+    EXPECT_EQ(expected, RunToEnd());
+    for(void *v : restored)
+        free(v);
+}
+
+static std::vector<std::string> StartTiedLanes(struct Vehicle *v)
+{
+    snprintf(v[0].name, sizeof(v[0].name), "n");
+    v[0].direction = SOUTH;
+    EXPECT_EQ(0, SimPlaceVehicle(&v[0], SimSelectLane(NORTH, SOUTH)));
+    snprintf(v[1].name, sizeof(v[1].name), "e");
+    v[1].direction = WEST;
+    EXPECT_EQ(0, SimPlaceVehicle(&v[1], SimSelectLane(EAST, WEST)));
+    return RunToEnd();
+}
+
+TEST(SimSnapshot, RestoresSchedulingOrder)
+{
+    static struct Vehicle v[3], copies[2];
+    SetupJunction();
+    SimConfig.selectionPolicy = SIM_HLFS;
+    SimInit();
+    //serve the east lane alone, so it becomes idle after the others
+    snprintf(v[2].name, sizeof(v[2].name), "first");
+    v[2].direction = WEST;
+    ASSERT_EQ(0, SimPlaceVehicle(&v[2], SimSelectLane(EAST, WEST)));
+    RunToEnd();
+    for(int i = 0; i < 8; i++)
+        SimDoStep();
+
+    FILE *f = tmpfile();
+    ASSERT_NE(nullptr, f);
+    ASSERT_EQ(0, SimSaveSnapshot(f));
+    //equal priority, the lane that became idle last starts first
+    std::vector<std::string> expected = {"e", "n"};
+    EXPECT_EQ(expected, StartTiedLanes(v));
+
+    rewind(f);
+    ASSERT_EQ(0, SimLoadSnapshot(f, NULL, NULL));
+    fclose(f);
+    EXPECT_EQ(expected, StartTiedLanes(copies));
+}
+
+TEST(SimSnapshot, RejectsForeignData)
+{
+    FILE *f = tmpfile();
+    ASSERT_NE(nullptr, f);
+    fputs("definitely not a snapshot, but long enough to fill the header", f);
+    rewind(f);
+    EXPECT_GT(0, SimLoadSnapshot(f, NULL, NULL));
+    fclose(f);
+}
+
+static void FreeRestored(struct Vehicle *vehicle, void *context)
+{
+    (void)context;
+    free(vehicle);
+}
+
+/**
+ * @brief Load snapshot from memory
+ */
+static int LoadSnapshotData(const std::vector<uint8_t> &data)
+{
+    FILE *f = tmpfile();
+    fwrite(data.data(), 1, data.size(), f);
+    rewind(f);
+    int ret = SimLoadSnapshot(f, NULL, NULL);
+    fclose(f);
+    return ret;
+}
+
+TEST(SimSnapshot, RejectsBrokenVehicleTable)
+{
+    static struct Vehicle v[8];
+    SetupJunction();
+    SimInit();
+    for(size_t i = 0; i < 8; i++)
+    {
+        snprintf(v[i].name, sizeof(v[i].name), "vehicle%zu", i);
+        v[i].direction = (enum Direction)((i + 1) % 4);
+        ASSERT_EQ(0, SimPlaceVehicle(&v[i], SimSelectLane((enum Direction)(i % 4), v[i].direction)));
+    }
+    FILE *f = tmpfile();
+    ASSERT_EQ(0, SimSaveSnapshot(f));
+    std::vector<uint8_t> data(ftell(f));
+    rewind(f);
+    ASSERT_EQ(data.size(), fread(data.data(), 1, data.size(), f));
+    fclose(f);
+
+    //vehicles restored before the end of the file are released (checked by the leak sanitizer)
+    std::vector<uint8_t> truncated(data.begin(), data.end() - 3);
+    SimInit();
+    EXPECT_GT(0, LoadSnapshotData(truncated));
+    //vehicle count far beyond the file size (the count follows the magic, version, policies and next vehicle index)
+    std::vector<uint8_t> counted = data;
+    counted[18 + 7] = 0x10;
+    SimInit();
+    EXPECT_GT(0, LoadSnapshotData(counted));
+    SimInit();
+    EXPECT_EQ(0, LoadSnapshotData(data));
+    EXPECT_NE(nullptr, SimFindVehicle("vehicle7"));
+    SimRegisterVehicleExitedCallback(FreeRestored, NULL);
+    while(SimDoStep())
+        ;
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+}
+
+static void PlaceVehicles(struct Vehicle *v, size_t count, size_t seed)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        snprintf(v[i].name, sizeof(v[i].name), "v%zu_%zu", seed, i);
+        enum Direction start = (enum Direction)((i + seed) % 4), end = (enum Direction)((i / 3 + seed) % 4);
+        if(start == end)
+            end = (enum Direction)((end + 1) % 4);
+        v[i].direction = end;
+        ASSERT_EQ(0, SimPlaceVehicle(&v[i], SimSelectLane(start, end)));
+        if(i % 2)
+            SimDoStep();
+    }
+}
+
+static void ChangeBranchParameters(struct SimConfig *config)
+{
+    config->selectionPolicy = SIM_FCFS;
+    config->road[NORTH].lane[0].maxGreenTime = 1;
+    config->road[SOUTH].lane[0].priority = 3.f;
+}
+
+TEST(SimFork, BranchesEvolveIndependently)
+{
+    static struct Vehicle shared[3][16], mainOnly[3][4], branchOnly[3][4];
+
+    //reference runs without forking
+    SetupJunction();
+    SimInit();
+    PlaceVehicles(shared[0], 16, 0);
+    PlaceVehicles(mainOnly[0], 4, 1);
+    std::vector<std::string> expectedMain = RunToEnd();
+
+    SetupJunction();
+    SimInit();
+    PlaceVehicles(shared[1], 16, 0);
+    ChangeBranchParameters(&SimConfig);
+    PlaceVehicles(branchOnly[1], 4, 2);
+    std::vector<std::string> expectedBranch = RunToEnd();
+    struct SimStats expectedStats;
+    SimGetStats(&expectedStats);
+    ASSERT_NE(expectedMain, expectedBranch);
+
+    //fork and place more vehicles on both instances
+    SetupJunction();
+    SimInit();
+    PlaceVehicles(shared[2], 16, 0);
+    struct SimState *branch = SimFork();
+    ASSERT_NE(nullptr, branch);
+    PlaceVehicles(mainOnly[2], 4, 1);
+    SimSelect(branch);
+    ChangeBranchParameters(SimGetConfig());
+    EXPECT_NE(&SimConfig, SimGetConfig());
+    PlaceVehicles(branchOnly[2], 4, 2);
+    EXPECT_EQ(expectedBranch, RunToEnd());
+    struct SimStats stats;
+    SimGetStats(&stats);
+    EXPECT_EQ(expectedStats.exitedVehicles, stats.exitedVehicles);
+    EXPECT_EQ(expectedStats.totalDelay, stats.totalDelay);
+
+    SimSelect(NULL);
+    EXPECT_EQ(SIM_DYNAMIC, SimConfig.selectionPolicy);
+    SimRelease(branch);
+    EXPECT_EQ(expectedMain, RunToEnd());
+}
+
+TEST(SimGeometry, ManyLanesOnThreeRoads)
+{
+    //T junction with more lanes than fit a single bitset word
+    static struct Road roads[3];
+    static struct Lane lanes[3][30];
+    static const uint16_t bearing[3] = {270, 90, 180};
+    SimConfig.road = roads;
+    SimConfig.roadCount = 3;
+    SimConfig.selectionPolicy = SIM_DYNAMIC;
+    SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
+    for(int i = 0; i < 3; i++)
+    {
+        roads[i].position = (enum Direction)i;
+        roads[i].bearing = bearing[i];
+        roads[i].laneCount = 30;
+        roads[i].lane = lanes[i];
+        for(int k = 0; k < 30; k++)
+        {
+            lanes[i][k] = {};
+            lanes[i][k].road = &roads[i];
+            lanes[i][k].direction.mask = 1u << ((i + 1 + k % 2) % 3);
+            lanes[i][k].minGreenTime = 1;
+            lanes[i][k].maxGreenTime = 4;
+            lanes[i][k].minRedTime = 1;
+            lanes[i][k].stepsPerVehicle = 1;
+            lanes[i][k].priority = 1.f;
+        }
+    }
+    ASSERT_EQ(0, SimInit());
+    EXPECT_EQ(nullptr, SimSelectLane(NORTH, EAST));
+
+    static struct Vehicle v[60];
+    for(size_t i = 0; i < 60; i++)
+    {
+        snprintf(v[i].name, sizeof(v[i].name), "v%zu", i);
+        enum Direction start = (enum Direction)(i % 3), end = (enum Direction)((i % 3 + 1 + (i / 3) % 2) % 3);
+        v[i].direction = end;
+        ASSERT_EQ(0, SimPlaceVehicle(&v[i], SimSelectLane(start, end)));
+    }
+    EXPECT_EQ(60u, RunToEnd().size());
+}
+
+static std::vector<size_t> ExitsPerStep(size_t steps)
+{
+    std::vector<size_t> exits;
+    struct SimStats stats;
+    SimGetStats(&stats);
+    size_t previous = stats.exitedVehicles;
+    for(size_t i = 0; i < steps; i++)
+    {
+        SimDoStep();
+        SimGetStats(&stats);
+        exits.push_back(stats.exitedVehicles - previous);
+        previous = stats.exitedVehicles;
+    }
+    return exits;
+}
+
+TEST(SimSaturationFlow, DischargesSeveralVehiclesPerStep)
+{
+    static struct Vehicle v[2][7];
+    for(int run = 0; run < 2; run++)
+    {
+        SetupJunction();
+        SimConfig.timePolicy = SIM_TIME_FIXED;
+        SimConfig.road[NORTH].lane[0].greenTime = 10;
+        SimConfig.road[NORTH].lane[0].saturationFlow = 3;
+        SimConfig.road[NORTH].lane[0].startupLostTime = 2 * run;
+        ASSERT_EQ(0, SimInit());
+        for(size_t i = 0; i < 7; i++)
+        {
+            snprintf(v[run][i].name, sizeof(v[run][i].name), "v%zu", i);
+            v[run][i].direction = SOUTH;
+            ASSERT_EQ(0, SimPlaceVehicle(&v[run][i], SimSelectLane(NORTH, SOUTH)));
+        }
+        //red + yellow, then green (with lost time) and full discharge
+        std::vector<size_t> expected = {0, 3, 3, 1, 0};
+        if(0 != run)
+            expected = {0, 0, 0, 3, 3, 1};
+        EXPECT_EQ(expected, ExitsPerStep(expected.size()));
+    }
+}
+
+TEST(SimSaturationFlow, GivesWayBetweenPasses)
+{
+    //lights are disabled, vehicles from the north turning left give way to the vehicles from the south
+    static struct Vehicle north[4], south[2];
+    SetupJunction();
+    SimConfig.selectionPolicy = SIM_RIGHT_HAND_RULE;
+    SimConfig.road[NORTH].lane[0].saturationFlow = 4;
+    ASSERT_EQ(0, SimInit());
+    for(size_t i = 0; i < 4; i++)
+    {
+        snprintf(north[i].name, sizeof(north[i].name), "n%zu", i);
+        north[i].direction = EAST;
+        ASSERT_EQ(0, SimPlaceVehicle(&north[i], SimSelectLane(NORTH, EAST)));
+    }
+    for(size_t i = 0; i < 2; i++)
+    {
+        snprintf(south[i].name, sizeof(south[i].name), "s%zu", i);
+        south[i].direction = NORTH;
+        ASSERT_EQ(0, SimPlaceVehicle(&south[i], SimSelectLane(SOUTH, NORTH)));
+    }
+    std::vector<std::string> expected = {"s0", "s1", "n0", "n1", "n2", "n3"};
+    EXPECT_EQ(expected, RunToEnd());
+}
+
+static void PlaceNamed(struct Vehicle *v, const char *name, enum Direction start, enum Direction end)
+{
+    snprintf(v->name, sizeof(v->name), "%s", name);
+    v->direction = end;
+    ASSERT_EQ(0, SimPlaceVehicle(v, SimSelectLane(start, end)));
+}
+
+TEST(SimVehicleIndex, RemoveChangeLaneAndReroute)
+{
+    static struct Vehicle v[5];
+    static struct Lane north[2];
+    SetupJunction();
+    north[0] = SimConfig.road[NORTH].lane[0];
+    north[1] = north[0];
+    north[1].direction.mask = 1u << SOUTH;
+    SimConfig.road[NORTH].lane = north;
+    SimConfig.road[NORTH].laneCount = 2;
+    ASSERT_EQ(0, SimInit());
+
+    const char *names[] = {"a", "b", "c", "d", "e"};
+    for(size_t i = 0; i < 5; i++)
+        PlaceNamed(&v[i], names[i], NORTH, WEST);
+    EXPECT_EQ(&v[2], SimFindVehicle("c"));
+    EXPECT_EQ(nullptr, SimFindVehicle("x"));
+
+    ASSERT_EQ(0, SimRemoveVehicle(&v[1]));
+    EXPECT_EQ(nullptr, SimFindVehicle("b"));
+    EXPECT_GT(0, SimRemoveVehicle(&v[1]));
+    ASSERT_EQ(0, SimRemoveVehicle(&v[4]));
+
+    //lane 1 doesn't allow turning west
+    EXPECT_GT(0, SimChangeLane(&v[2], &north[1]));
+    ASSERT_EQ(0, SimRerouteVehicle(&v[2], SOUTH));
+    EXPECT_EQ(&north[0], v[2].lane);
+    ASSERT_EQ(0, SimChangeLane(&v[2], &north[1]));
+    EXPECT_EQ(&north[1], v[2].lane);
+    EXPECT_EQ(1u, north[1].vehicleCount);
+    EXPECT_EQ(2u, north[0].vehicleCount);
+    EXPECT_EQ(&v[3], north[0].lastVehicle);
+    EXPECT_GT(0, SimRerouteVehicle(&v[2], NORTH));
+    //roads beyond the junction are rejected, even where the shifted direction bit would wrap to an allowed one
+    EXPECT_GT(0, SimRerouteVehicle(&v[3], (enum Direction)(32 + WEST)));
+    EXPECT_GT(0, SimRerouteVehicle(&v[3], (enum Direction)4));
+    EXPECT_EQ(WEST, v[3].direction);
+    EXPECT_EQ(&north[0], v[3].lane);
+
+    struct SimStats stats;
+    SimGetStats(&stats);
+    EXPECT_EQ(3u, stats.waitingVehicles);
+    std::vector<std::string> exited = RunToEnd();
+    std::sort(exited.begin(), exited.end());
+    std::vector<std::string> expected = {"a", "c", "d"};
+    EXPECT_EQ(expected, exited);
+}
+
+TEST(SimVehicleIndex, RemoveSharedVehiclesFromFork)
+{
+    static struct Vehicle v[5];
+    SetupJunction();
+    ASSERT_EQ(0, SimInit());
+    const char *names[] = {"a", "b", "c", "d", "e"};
+    for(size_t i = 0; i < 4; i++)
+        PlaceNamed(&v[i], names[i], NORTH, SOUTH);
+
+    struct SimState *branch = SimFork();
+    ASSERT_NE(nullptr, branch);
+    SimSelect(branch);
+    ASSERT_EQ(0, SimRemoveVehicle(SimFindVehicle("b")));
+    ASSERT_EQ(0, SimRemoveVehicle(SimFindVehicle("d")));
+    EXPECT_GT(0, SimRerouteVehicle(SimFindVehicle("c"), WEST));
+    PlaceNamed(&v[4], names[4], NORTH, SOUTH);
+    ASSERT_EQ(0, SimRemoveVehicle(SimFindVehicle("c")));
+    std::vector<std::string> expectedBranch = {"a", "e"};
+    EXPECT_EQ(expectedBranch, RunToEnd());
+
+    SimSelect(NULL);
+    SimRelease(branch);
+    EXPECT_EQ(&v[1], SimFindVehicle("b"));
+    std::vector<std::string> expectedMain = {"a", "b", "c", "d"};
+    EXPECT_EQ(expectedMain, RunToEnd());
+}
+
+TEST(SimVehicleIndex, ManyVehicles)
+{
+    static struct Vehicle v[1000];
+    SetupJunction();
+    ASSERT_EQ(0, SimInit());
+    for(size_t i = 0; i < 1000; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "v%zu", i);
+        PlaceNamed(&v[i], name, (enum Direction)(i % 4), (enum Direction)((i + 1) % 4));
+    }
+    for(size_t i = 0; i < 1000; i += 3)
+        ASSERT_EQ(0, SimRemoveVehicle(&v[i]));
+    for(size_t i = 0; i < 1000; i++)
+        EXPECT_EQ((i % 3) ? &v[i] : nullptr, SimFindVehicle(v[i].name));
+    EXPECT_EQ(666u, RunToEnd().size());
+    EXPECT_EQ(nullptr, SimFindVehicle("v1"));
+}
+
+static void FreeExited(struct Vehicle *vehicle, void *context)
+{
+    (void)context;
+    free(vehicle);
+}
+
+/**
+ * @brief Record a run with arrivals on every road to a trace
+ */
+static FILE* RecordTrace(void)
+{
+    SetupJunction();
+    SimInit();
+    SimRegisterVehicleExitedCallback(FreeExited, NULL);
+    FILE *f = tmpfile();
+    struct SimTrace *trace = SimTraceStartRecording(f);
+    EXPECT_NE(nullptr, trace);
+    for(size_t i = 0; i < 40; i++)
+    {
+        char name[16];
+        int length = snprintf(name, sizeof(name), "v%zu", i);
+        enum Direction start = (enum Direction)(i % 4), end = (enum Direction)((i / 4 + i + 1) % 4);
+        if(start == end)
+            end = (enum Direction)((end + 1) % 4);
+        SimTraceRecordCommand(trace, 1, start, end, name, length);
+        struct Vehicle *v = static_cast<struct Vehicle*>(malloc(sizeof(*v)));
+        strcpy(v->name, name);
+        v->direction = end;
+        SimPlaceVehicle(v, SimSelectLane(start, end));
+        if(i % 3)
+        {
+            SimTraceRecordCommand(trace, 2, 0, 0, NULL, 0);
+            SimDoStep();
+        }
+    }
+    do
+        SimTraceRecordCommand(trace, 2, 0, 0, NULL, 0);
+    while(SimDoStep());
+    EXPECT_EQ(0, SimTraceStop(trace));
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+    rewind(f);
+    return f;
+}
+
+/**
+ * @brief Replay trace
+ * @param *f Trace file
+ * @param skip Index of the command that is not executed, SIZE_MAX to execute all
+ * @param *expected Output recorded event at the divergence
+ * @param *actual Output emitted event at the divergence
+ * @return True if the replay diverged
+ */
+static bool ReplayTrace(FILE *f, size_t skip, struct SimTraceEvent *expected, struct SimTraceEvent *actual)
+{
+    //start from a different state to make sure it is restored from the trace
+    SetupJunction();
+    SimConfig.selectionPolicy = SIM_FCFS;
+    SimInit();
+    SimRegisterVehicleExitedCallback(FreeExited, NULL);
+    struct SimTrace *trace = SimTraceStartReplay(f, NULL, NULL);
+    EXPECT_NE(nullptr, trace);
+    struct SimTraceCommand cmd;
+    int ret;
+    for(size_t i = 0; 1 == (ret = SimTraceReadCommand(trace, &cmd)); i++)
+    {
+        if(i == skip)
+            continue;
+        if(2 == cmd.type)
+            SimDoStep();
+        else
+        {
+            struct Vehicle *v = static_cast<struct Vehicle*>(malloc(sizeof(*v)));
+            strcpy(v->name, cmd.name);
+            v->direction = (enum Direction)cmd.endRoad;
+            SimPlaceVehicle(v, SimSelectLane((enum Direction)cmd.startRoad, (enum Direction)cmd.endRoad));
+        }
+    }
+    bool diverged = SimTraceGetDivergence(trace, expected, actual);
+    EXPECT_EQ(diverged ? -1 : 0, ret);
+    EXPECT_EQ(0, SimTraceStop(trace));
+    struct SimConfig *config = SimGetConfig();
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        while(0 != config->road[i].lane[0].vehicleCount)
+        {
+            struct Vehicle *v = config->road[i].lane[0].vehicles;
+            SimRemoveVehicle(v);
+            free(v);
+        }
+    }
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+    return diverged;
+}
+
+TEST(SimTrace, ReplayMatchesRecording)
+{
+    FILE *f = RecordTrace();
+    struct SimTraceEvent expected, actual;
+    EXPECT_FALSE(ReplayTrace(f, SIZE_MAX, &expected, &actual));
+    EXPECT_EQ(SIM_DYNAMIC, SimConfig.selectionPolicy);
+    fclose(f);
+}
+
+TEST(SimTrace, StopsAtFirstDivergence)
+{
+    FILE *f = RecordTrace();
+    //drop the arrival of v4
+    struct SimTraceEvent expected, actual;
+    EXPECT_TRUE(ReplayTrace(f, 6, &expected, &actual));
+    EXPECT_TRUE((expected.type != actual.type) || (expected.id != actual.id) || (expected.light != actual.light));
+    //v4 arrives after two steps, nothing can diverge earlier
+    EXPECT_GE(std::max(expected.step, actual.step), 2u);
+    fclose(f);
+}
+
+/**
+ * @brief Lights and queue lengths of all lanes
+ */
+struct LaneStates
+{
+    std::vector<uint8_t> light;
+    std::vector<uint64_t> queue;
+    bool operator==(const LaneStates &other) const
+    {
+        return (light == other.light) && (queue == other.queue);
+    }
+};
+
+static LaneStates GetLaneStates(void)
+{
+    LaneStates states;
+    struct SimConfig *config = SimGetConfig();
+    for(size_t i = 0; i < config->roadCount; i++)
+    {
+        states.light.push_back(config->road[i].lane[0].light);
+        states.queue.push_back(config->road[i].lane[0].vehicleCount);
+    }
+    return states;
+}
+
+static uint64_t ReadVarint(const std::vector<uint8_t> &data, size_t &position)
+{
+    uint64_t value = 0;
+    for(unsigned int shift = 0; position < data.size(); shift += 7)
+    {
+        uint8_t byte = data[position++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if(0 == (byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+/**
+ * @brief Rebuild lane states after each step from a timeline
+ * @param *f Timeline file
+ * @param steps Number of steps
+ * @return States after each step, preceded by the initial state
+ */
+static std::vector<LaneStates> ReadTimeline(FILE *f, size_t steps)
+{
+    std::vector<uint8_t> data;
+    rewind(f);
+    for(int c; EOF != (c = fgetc(f));)
+        data.push_back(c);
+    struct SimTimelineHeader header;
+    EXPECT_GE(data.size(), sizeof(header));
+    memcpy(&header, data.data(), sizeof(header));
+    EXPECT_EQ((uint32_t)SIM_TIMELINE_MAGIC, header.magic);
+    EXPECT_EQ(4u, header.laneCount);
+    size_t position = sizeof(header);
+    LaneStates states;
+    for(uint32_t i = 0; i < header.laneCount; i++)
+    {
+        EXPECT_EQ(i, data[position]); //one lane per road
+        states.light.push_back(data[position + 2]);
+        position += 3;
+        states.queue.push_back(ReadVarint(data, position));
+    }
+    std::vector<LaneStates> timeline = {states};
+    uint32_t step = header.step;
+    while(position < data.size())
+    {
+        uint8_t type = data[position++];
+        step += ReadVarint(data, position);
+        //all records of the previous steps were read
+        while(timeline.size() < (step + 1))
+            timeline.push_back(states);
+        uint64_t lane = ReadVarint(data, position);
+        if(SIM_TIMELINE_QUEUE == type)
+        {
+            uint64_t delta = ReadVarint(data, position);
+            states.queue[lane] += (delta & 1) ? ~(delta >> 1) : (delta >> 1);
+        }
+        else
+        {
+            EXPECT_EQ(SIM_TIMELINE_LIGHT, type & 0xF0);
+            states.light[lane] = type - SIM_TIMELINE_LIGHT;
+        }
+    }
+    while(timeline.size() < (steps + 1))
+        timeline.push_back(states);
+    return timeline;
+}
+
+TEST(SimTimeline, RebuildsStateAfterEachStep)
+{
+    SetupJunction();
+    SimInit();
+    SimRegisterVehicleExitedCallback(FreeExited, NULL);
+    FILE *f = tmpfile();
+    struct SimTimeline *timeline = SimTimelineStart(f);
+    ASSERT_NE(nullptr, timeline);
+    std::vector<LaneStates> expected = {GetLaneStates()};
+    for(size_t i = 0; i < 40; i++)
+    {
+        struct Vehicle *v = static_cast<struct Vehicle*>(malloc(sizeof(*v)));
+        snprintf(v->name, sizeof(v->name), "v%zu", i);
+        enum Direction start = (enum Direction)(i % 4), end = (enum Direction)((i / 4 + i + 1) % 4);
+        if(start == end)
+            end = (enum Direction)((end + 1) % 4);
+        v->direction = end;
+        SimPlaceVehicle(v, SimSelectLane(start, end));
+        if(i % 3)
+        {
+            SimDoStep();
+            expected.push_back(GetLaneStates());
+        }
+    }
+    bool more;
+    do
+    {
+        more = SimDoStep();
+        expected.push_back(GetLaneStates());
+    }
+    while(more);
+    EXPECT_EQ(0, SimTimelineStop(timeline));
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+
+    std::vector<LaneStates> rebuilt = ReadTimeline(f, expected.size() - 1);
+    ASSERT_EQ(expected.size(), rebuilt.size());
+    for(size_t i = 0; i < expected.size(); i++)
+        EXPECT_TRUE(expected[i] == rebuilt[i]) << "step " << i;
+    fclose(f);
+}
+
+static size_t CountOccurrences(const std::string &text, const std::string &pattern)
+{
+    size_t count = 0;
+    for(size_t i = text.find(pattern); std::string::npos != i; i = text.find(pattern, i + 1))
+        count++;
+    return count;
+}
+
+TEST(SimProfile, RecordsStepsPhasesAndQueues)
+{
+    SetupJunction();
+    SimInit();
+    SimRegisterVehicleExitedCallback(FreeExited, NULL);
+    FILE *f = tmpfile();
+    struct SimProfile *profile = SimProfileStart(f);
+    ASSERT_NE(nullptr, profile);
+    for(size_t i = 0; i < 12; i++)
+    {
+        struct Vehicle *v = static_cast<struct Vehicle*>(malloc(sizeof(*v)));
+        snprintf(v->name, sizeof(v->name), "v%zu", i);
+        v->direction = (enum Direction)((i + 1) % 4);
+        SimPlaceVehicle(v, SimSelectLane((enum Direction)(i % 4), v->direction));
+    }
+    SimProfileSpan(profile, SIM_PROFILE_COMMANDS);
+    size_t steps = 1;
+    while(SimDoStep())
+    {
+        SimProfileSpan(profile, SIM_PROFILE_OUTPUT);
+        steps++;
+    }
+    SimProfileSpan(profile, SIM_PROFILE_FINISH);
+    EXPECT_EQ(0, SimProfileStop(profile));
+    SimRegisterVehicleExitedCallback(NULL, NULL);
+
+    std::string text;
+    rewind(f);
+    char buffer[4096];
+    for(size_t n; 0 != (n = fread(buffer, 1, sizeof(buffer), f)); )
+        text.append(buffer, n);
+    fclose(f);
+    EXPECT_EQ(0u, text.find("{\"traceEvents\":["));
+    EXPECT_EQ(steps, CountOccurrences(text, "\"name\":\"Step\""));
+    EXPECT_EQ(steps, CountOccurrences(text, "\"name\":\"SimHandleSelection\""));
+    EXPECT_EQ(steps, CountOccurrences(text, "\"name\":\"SimHandleVehicles\""));
+    EXPECT_EQ(1u, CountOccurrences(text, "\"name\":\"Commands\""));
+    EXPECT_EQ(steps - 1, CountOccurrences(text, "\"name\":\"Output\""));
+    EXPECT_EQ(1u, CountOccurrences(text, "\"name\":\"Finish\""));
+    EXPECT_NE(std::string::npos, text.find("\"args\":{\"step\":0}"));
+    //the counters start at zero, rise with the placed vehicles and drop back to zero when the junction is empty
+    for(int road = 0; road < 4; road++)
+    {
+        std::string counter = "\"name\":\"Road " + std::to_string(road) + " lane 0\"";
+        EXPECT_LE(3u, CountOccurrences(text, counter)) << counter;
+    }
+    EXPECT_EQ(8u, CountOccurrences(text, "\"args\":{\"queue\":0}"));
+    EXPECT_NE(std::string::npos, text.find("\"otherData\":{\"droppedEvents\":0}}"));
+}
+
+TEST(SimLookahead, AnnouncedArrivalsPromoteLane)
+{
+    static struct Vehicle v[2][2];
+    for(int policy : {SIM_DYNAMIC, SIM_LOOKAHEAD})
+    {
+        SetupJunction();
+        SimConfig.selectionPolicy = (enum SimSelectionPolicy)policy;
+        ASSERT_EQ(0, SimInit());
+        struct Vehicle *north = v[SIM_LOOKAHEAD == policy], *west = north + 1;
+        PlaceNamed(north, "n", NORTH, SOUTH);
+        PlaceNamed(west, "w", WEST, EAST);
+        if(SIM_LOOKAHEAD == policy)
+        {
+            for(uint32_t step = 1; step < 4; step++)
+                ASSERT_EQ(0, SimAnnounceVehicle(WEST, EAST, step));
+        }
+        else
+            EXPECT_GT(0, SimAnnounceVehicle(WEST, EAST, 1));
+        SimDoStep();
+        //equal lanes are served in road order, unless more vehicles are coming
+        bool westFirst = (SIM_LOOKAHEAD == policy);
+        EXPECT_EQ(westFirst ? LIGHT_ARROW : LIGHT_RED_YELLOW, SimConfig.road[NORTH].lane[0].light);
+        EXPECT_EQ(westFirst ? LIGHT_RED_YELLOW : LIGHT_ARROW, SimConfig.road[WEST].lane[0].light);
+        RunToEnd();
+    }
+}
+
+TEST(SimLookahead, ArrivalsExpireWithinHorizon)
+{
+    SetupJunction();
+    SimConfig.selectionPolicy = SIM_LOOKAHEAD;
+    ASSERT_EQ(0, SimInit());
+    struct Lane *lane = &SimConfig.road[SOUTH].lane[0];
+    EXPECT_GT(0, SimAnnounceVehicle(SOUTH, NORTH, 0));
+    EXPECT_GT(0, SimAnnounceVehicle(SOUTH, NORTH, SIM_LOOKAHEAD_HORIZON));
+    ASSERT_EQ(0, SimAnnounceVehicle(SOUTH, NORTH, 2));
+    ASSERT_EQ(0, SimAnnounceVehicle(SOUTH, NORTH, SIM_LOOKAHEAD_HORIZON - 1));
+    EXPECT_EQ(2u, lane->upcomingCount);
+    EXPECT_EQ(1u + SIM_LOOKAHEAD_HORIZON, lane->upcomingDistance);
+    SimDoStep();
+    EXPECT_EQ(2u, lane->upcomingCount);
+    EXPECT_EQ(SIM_LOOKAHEAD_HORIZON - 1u, lane->upcomingDistance);
+    SimDoStep();
+    EXPECT_EQ(1u, lane->upcomingCount);
+    EXPECT_EQ(SIM_LOOKAHEAD_HORIZON - 3u, lane->upcomingDistance);
+    for(uint32_t i = 2; i < SIM_LOOKAHEAD_HORIZON; i++)
+        SimDoStep();
+    EXPECT_EQ(0u, lane->upcomingCount);
+    EXPECT_EQ(0u, lane->upcomingDistance);
+}
+
+TEST(SimPhases, StartsBestCompatibleSet)
+{
+    //straight lanes only: north-south and west-east flows are compatible among themselves
+    static const enum Direction opposite[4] = {[NORTH] = SOUTH, [SOUTH] = NORTH, [WEST] = EAST, [EAST] = WEST};
+    static const size_t queued[4] = {[NORTH] = 5, [SOUTH] = 0, [WEST] = 4, [EAST] = 3};
+    static struct Vehicle v[2][12];
+    for(int phases = 0; phases < 2; phases++)
+    {
+        SetupJunction();
+        SimConfig.selectionPolicy = SIM_HLFS;
+        SimConfig.phaseScheduling = phases;
+        for(int i = 0; i < 4; i++)
+            SimConfig.road[i].lane[0].direction.mask = 1u << opposite[i];
+        ASSERT_EQ(0, SimInit());
+        size_t n = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            for(size_t k = 0; k < queued[i]; k++, n++)
+            {
+                char name[16];
+                snprintf(name, sizeof(name), "v%zu", n);
+                PlaceNamed(&v[phases][n], name, (enum Direction)i, opposite[i]);
+            }
+        }
+        SimDoStep();
+        //lanes alone: the longest line is served first and blocks both other lanes
+        //phases: west and east together have more vehicles than north
+        EXPECT_EQ(phases ? LIGHT_RED : LIGHT_RED_YELLOW, SimConfig.road[NORTH].lane[0].light);
+        EXPECT_EQ(phases ? LIGHT_RED_YELLOW : LIGHT_RED, SimConfig.road[WEST].lane[0].light);
+        EXPECT_EQ(phases ? LIGHT_RED_YELLOW : LIGHT_RED, SimConfig.road[EAST].lane[0].light);
+        EXPECT_EQ(12u, RunToEnd().size());
+    }
+}
+
+TEST(SimMaxPressure, HoldsLaneWithCongestedExit)
+{
+    static struct Vehicle a[2][7], b[20];
+    for(int connected = 0; connected < 2; connected++)
+    {
+        SetupJunction();
+        SimConfig.selectionPolicy = SIM_MAX_PRESSURE;
+        SimConfig.road[NORTH].lane[0].direction.mask = 1u << SOUTH;
+        SimConfig.road[WEST].lane[0].direction.mask = 1u << EAST;
+        ASSERT_EQ(0, SimInit());
+
+        //the next junction east has a long queue on its west entry
+        struct SimState *next = SimFork();
+        ASSERT_NE(nullptr, next);
+        SimSelect(next);
+        for(size_t i = 0; i < 20; i++)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "b%zu", i);
+            PlaceNamed(&b[i], name, WEST, EAST);
+        }
+        SimSelect(NULL);
+        if(connected)
+        {
+            ASSERT_EQ(0, SimConnectRoad(EAST, next, WEST));
+        }
+
+        for(size_t i = 0; i < 7; i++)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "a%zu", i);
+            if(i < 3)
+                PlaceNamed(&a[connected][i], name, NORTH, SOUTH);
+            else
+                PlaceNamed(&a[connected][i], name, WEST, EAST);
+        }
+        SimDoStep();
+        //isolated: the longer west line wins, connected: its pressure is negative
+        EXPECT_EQ(connected ? LIGHT_RED_YELLOW : LIGHT_RED, SimConfig.road[NORTH].lane[0].light);
+        EXPECT_EQ(connected ? LIGHT_RED : LIGHT_RED_YELLOW, SimConfig.road[WEST].lane[0].light);
+        EXPECT_EQ(7u, RunToEnd().size());
+        ASSERT_EQ(0, SimConnectRoad(EAST, NULL, WEST));
+        SimRelease(next);
+    }
+    EXPECT_GT(0, SimConnectRoad((enum Direction)4, NULL, WEST));
+}
+
+TEST(SimLaneAssignment, BalancesSharedApproach)
+{
+    //two lanes from north serving all directions, the second one with twice the priority
+    static struct Road roads[4];
+    static struct Lane lanes[4][2];
+    static struct Vehicle v[30];
+    SetupJunction();
+    for(int i = 0; i < 4; i++)
+    {
+        roads[i] = SimConfig.road[i];
+        roads[i].lane = lanes[i];
+        lanes[i][0] = SimConfig.road[i].lane[0];
+        lanes[i][0].road = &roads[i];
+        lanes[i][1] = lanes[i][0];
+    }
+    SimConfig.road = roads;
+    roads[NORTH].laneCount = 2;
+    lanes[NORTH][1].priority = 2.f;
+    ASSERT_EQ(0, SimInit());
+
+    for(size_t i = 0; i < 30; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "v%zu", i);
+        PlaceNamed(&v[i], name, NORTH, (enum Direction)(1 + i % 3));
+    }
+    EXPECT_EQ(10u, lanes[NORTH][0].vehicleCount);
+    EXPECT_EQ(20u, lanes[NORTH][1].vehicleCount);
+    EXPECT_EQ(30u, RunToEnd().size());
+}
+
+TEST(SimFixedPoint, ServesFirstComerAtHugeIndices)
+{
+    //start numbering vehicles far above 2^24, where the float reciprocals of consecutive indices are equal
+    SetupJunction();
+    SimConfig.selectionPolicy = SIM_FCFS;
+    SimConfig.fixedPoint = true;
+    ASSERT_EQ(0, SimInit());
+    FILE *f = tmpfile();
+    ASSERT_NE(nullptr, f);
+    ASSERT_EQ(0, SimSaveSnapshot(f));
+    //next vehicle index field of the snapshot header
+    uint64_t next = (1ULL << 40) + 1;
+    fseek(f, 10, SEEK_SET);
+    fwrite(&next, sizeof(next), 1, f);
+    rewind(f);
+    ASSERT_EQ(0, SimLoadSnapshot(f, NULL, NULL));
+    fclose(f);
+
+    //west-east and north-south are crossing, the west lane is behind the north lane in the initial order
+    static struct Vehicle v[2];
+    PlaceNamed(&v[0], "first", WEST, EAST);
+    PlaceNamed(&v[1], "second", NORTH, SOUTH);
+    EXPECT_EQ(next, v[0].index);
+    EXPECT_EQ(std::vector<std::string>({"first", "second"}), RunToEnd());
+}
+
+TEST(SimFixedPoint, MatchesFloatOnExactValues)
+{
+    //integer priorities and queues are represented exactly in both modes
+    static struct Vehicle v[2][16];
+    std::vector<std::string> exited[2];
+    for(int fixedPoint = 0; fixedPoint < 2; fixedPoint++)
+    {
+        SetupJunction();
+        SimConfig.fixedPoint = fixedPoint;
+        SimConfig.road[SOUTH].lane[0].priority = 2.f;
+        ASSERT_EQ(0, SimInit());
+        PlaceVehicles(v[fixedPoint], 16, 0);
+        exited[fixedPoint] = RunToEnd();
+    }
+    EXPECT_FALSE(exited[1].empty());
+    EXPECT_EQ(exited[0], exited[1]);
+}
+
+TEST(SimStep, RejectsInvalidPolicy)
+{
+    SetupJunction();
+    SimConfig.timePolicy = (enum SimTimePolicy)7;
+    EXPECT_GT(0, SimInit());
+    SetupJunction();
+    SimConfig.selectionPolicy = (enum SimSelectionPolicy)9;
+    EXPECT_GT(0, SimInit());
+}
+
+static std::vector<uint8_t> CompileJunction(void)
+{
+    FILE *f = tmpfile();
+    EXPECT_NE(nullptr, f);
+    EXPECT_EQ(0, SimCompileJunction(&SimConfig, f));
+    std::vector<uint8_t> image(ftell(f));
+    rewind(f);
+    EXPECT_EQ(image.size(), fread(image.data(), 1, image.size(), f));
+    fclose(f);
+    return image;
+}
+
+TEST(SimJunction, LoadedInstanceMatchesInit)
+{
+    static struct Vehicle v[2][2][16];
+    for(int phases = 0; phases < 2; phases++)
+    {
+        SetupJunction();
+        SimConfig.phaseScheduling = phases;
+        SimConfig.road[SOUTH].lane[0].priority = 2.f;
+        ASSERT_EQ(0, SimInit());
+        PlaceVehicles(v[phases][0], 16, 0);
+        std::vector<std::string> expected = RunToEnd();
+        struct SimStats expectedStats;
+        SimGetStats(&expectedStats);
+
+        std::vector<uint8_t> image = CompileJunction();
+        struct SimState *junction = SimLoadJunction(image.data(), image.size());
+        ASSERT_NE(nullptr, junction);
+        //the image is copied
+        std::fill(image.begin(), image.end(), 0);
+        SimSelect(junction);
+        EXPECT_EQ(2.f, SimGetConfig()->road[SOUTH].lane[0].priority);
+        PlaceVehicles(v[phases][1], 16, 0);
+        EXPECT_EQ(expected, RunToEnd());
+        struct SimStats stats;
+        SimGetStats(&stats);
+        EXPECT_EQ(expectedStats.step, stats.step);
+        EXPECT_EQ(expectedStats.totalDelay, stats.totalDelay);
+        SimRelease(junction);
+    }
+}
+
+TEST(SimJunction, RejectsCorruptedImage)
+{
+    SetupJunction();
+    std::vector<uint8_t> image = CompileJunction();
+    struct SimState *junction = SimLoadJunction(image.data(), image.size());
+    ASSERT_NE(nullptr, junction);
+    SimRelease(junction);
+
+    EXPECT_EQ(nullptr, SimLoadJunction(image.data(), image.size() - 1));
+    EXPECT_EQ(nullptr, SimLoadJunction(image.data(), 8));
+    for(size_t i : {size_t(0), size_t(13), image.size() / 2, image.size() - 1})
+    {
+        std::vector<uint8_t> corrupted = image;
+        corrupted[i] ^= 0x40;
+        EXPECT_EQ(nullptr, SimLoadJunction(corrupted.data(), corrupted.size())) << "byte " << i;
+    }
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+extern "C" {
+#include "sim.h"
+#include "controller.h"
+}
+
+#ifndef SOAK_BUDGET_US
+#define SOAK_BUDGET_US 1000
+#endif
+#ifndef SOAK_STEPS
+#define SOAK_STEPS 100000
+#endif
+
+//allocations made by the simulator and the controller are counted through linker wrappers
+static bool SoakCounting = false;
+static size_t SoakAllocations = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    SoakAllocations += SoakCounting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    SoakAllocations += SoakCounting;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    SoakAllocations += SoakCounting;
+    return __real_realloc(ptr, size);
+}
+}
+
+/**
+ * @brief Configure a junction of 4 roads with a left, straight and right lane each
+ */
+static void SetupJunction(enum SimSelectionPolicy selectionPolicy)
+{
+    static struct Road roads[4];
+    static struct Lane lanes[4][3];
+    static const uint16_t bearing[4] = {[NORTH] = 0, [SOUTH] = 180, [WEST] = 270, [EAST] = 90};
+    SimConfig.selectionPolicy = selectionPolicy;
+    SimConfig.timePolicy = SIM_TIME_PRIORITIZED;
+    SimConfig.road = roads;
+    SimConfig.roadCount = 4;
+    for(int i = 0; i < 4; i++)
+    {
+        roads[i] = {};
+        roads[i].position = (enum Direction)i;
+        roads[i].bearing = bearing[i];
+        roads[i].lane = lanes[i];
+        roads[i].laneCount = 3;
+        for(int k = 0; k < 3; k++)
+        {
+            lanes[i][k] = {};
+            lanes[i][k].road = &roads[i];
+            lanes[i][k].minGreenTime = 2;
+            lanes[i][k].maxGreenTime = 12;
+            lanes[i][k].minRedTime = 1;
+            lanes[i][k].stepsPerVehicle = 1;
+            lanes[i][k].saturationFlow = 2;
+            lanes[i][k].startupLostTime = 1;
+            lanes[i][k].priority = 1.f + 0.5f * k;
+        }
+    }
+    //each lane serves one of the three other roads
+    for(int i = 0; i < 4; i++)
+    {
+        for(int k = 0, end = 0; end < 4; end++)
+        {
+            if(end != i)
+                lanes[i][k++].direction.mask = 1u << end;
+        }
+    }
+}
+
+/**
+ * @brief Run the controller under synthetic load and verify the latency budget
+ * @param selectionPolicy Lane selection policy
+ */
+static void Soak(enum SimSelectionPolicy selectionPolicy)
+{
+    SetupJunction(selectionPolicy);
+    SimSetEventLogging(false);
+    ASSERT_EQ(0, SimInit());
+    struct Controller controller;
+    ASSERT_EQ(0, ControllerInit(&controller, 4096, SOAK_BUDGET_US * 1000ULL));
+    //the test does not run with real-time priority, so measure the CPU time of the step to exclude preemption
+    controller.clock = CLOCK_THREAD_CPUTIME_ID;
+
+    //bursty arrivals: up to 4 vehicles per step, with occasional removals
+    uint32_t seed = 12345;
+    uint64_t placed = 0;
+    SoakCounting = true;
+    for(uint32_t step = 0; step < SOAK_STEPS; step++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t arrivals = (seed >> 16) % ((0 == (step / 1000) % 4) ? 5 : 3);
+        for(uint32_t i = 0; i < arrivals; i++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            unsigned int start = (seed >> 16) % 4;
+            unsigned int end = (start + 1 + (seed >> 20) % 3) % 4;
+            char name[16];
+            int length = snprintf(name, sizeof(name), "v%llu", (unsigned long long)placed++);
+            ControllerDetect(&controller, name, length, (enum Direction)start, (enum Direction)end);
+        }
+        if(0 == (seed >> 24) % 16)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "v%llu", (unsigned long long)(placed - 1 - (seed >> 8) % 64));
+            ControllerRemove(&controller, name);
+        }
+        ControllerStep(&controller);
+    }
+    SoakCounting = false;
+
+    ControllerPrintReport(&controller, stdout);
+    EXPECT_EQ(0u, SoakAllocations);
+    EXPECT_EQ((uint64_t)SOAK_STEPS, controller.histogram.count);
+    EXPECT_EQ(0u, controller.overruns);
+    EXPECT_LE(controller.histogram.max, SOAK_BUDGET_US * 1000ULL);
+    struct SimStats stats;
+    SimGetStats(&stats);
+    EXPECT_GT(stats.exitedVehicles, (size_t)SOAK_STEPS);
+    ControllerDeinit(&controller);
+    SimSetEventLogging(true);
+}
+
+TEST(SimSoak, DynamicPolicyStaysWithinBudget)
+{
+    Soak(SIM_DYNAMIC);
+}
+
+TEST(SimSoak, HlfsPolicyStaysWithinBudget)
+{
+    Soak(SIM_HLFS);
+}
+
+TEST(SimSoak, FcfsPolicyStaysWithinBudget)
+{
+    Soak(SIM_FCFS);
+}
+
+TEST(Controller, UnknownRoadsAreDropped)
+{
+    SetupJunction(SIM_DYNAMIC);
+    SimSetEventLogging(false);
+    ASSERT_EQ(0, SimInit());
+    struct Controller controller;
+    ASSERT_EQ(0, ControllerInit(&controller, 16, 0));
+    EXPECT_GT(0, ControllerDetect(&controller, "a", 1, (enum Direction)7, SOUTH));
+    EXPECT_GT(0, ControllerDetect(&controller, "b", 1, NORTH, (enum Direction)200));
+    //no lane from a road back to itself
+    EXPECT_GT(0, ControllerDetect(&controller, "c", 1, NORTH, NORTH));
+    EXPECT_EQ(3u, controller.dropped);
+    EXPECT_EQ(0, ControllerDetect(&controller, "d", 1, NORTH, SOUTH));
+    struct SimStats stats;
+    SimGetStats(&stats);
+    EXPECT_EQ(1u, stats.waitingVehicles);
+    ControllerDeinit(&controller);
+    SimSetEventLogging(true);
+}
+
+TEST(SimSoak, HistogramPercentiles)
+{
+    struct ControllerHistogram histogram = {};
+    histogram.bucket[3] = 90;
+    histogram.bucket[10] = 9;
+    histogram.bucket[20] = 1;
+    histogram.count = 100;
+    histogram.max = 1500000;
+    EXPECT_EQ(15u, ControllerGetPercentile(&histogram, 50.));
+    EXPECT_EQ(2047u, ControllerGetPercentile(&histogram, 99.));
+    EXPECT_EQ(1500000u, ControllerGetPercentile(&histogram, 100.));
+    histogram = {};
+    EXPECT_EQ(0u, ControllerGetPercentile(&histogram, 50.));
+}
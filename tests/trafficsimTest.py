@@ -0,0 +1,120 @@
+# Tests of the trafficsim extension module, run by CTest with the module directory on PYTHONPATH
+
+import unittest
+import trafficsim
+
+NORTH, SOUTH, WEST, EAST = range(4)
+
+
+def junction():
+    # one lane per road, going to all other roads
+    return [{"bearing": bearing, "lanes": [{"directions": [d for d in range(4) if d != road]}]}
+            for road, bearing in enumerate([0, 180, 270, 90])]
+
+
+class SimulationTest(unittest.TestCase):
+    def test_vehicles_exit(self):
+        sim = trafficsim.Simulation(junction(), record_names=True)
+        self.assertEqual(1, sim.add_vehicle("v1", NORTH, SOUTH))
+        self.assertEqual(2, sim.add_vehicle("v2", WEST, EAST))
+        self.assertEqual(3, sim.add_vehicle("v3", EAST, NORTH))
+        self.assertEqual(3, sim.stats()["waiting"])
+
+        self.assertEqual(3, sim.step(100))
+        steps, ids, names = sim.take_exits()
+        self.assertEqual(3, len(memoryview(steps)))
+        self.assertEqual([1, 2, 3], sorted(memoryview(ids)))
+        self.assertEqual({"v1", "v2", "v3"}, set(names))
+        self.assertTrue(all(step < 100 for step in memoryview(steps)))
+        stats = sim.stats()
+        self.assertEqual((100, 0, 3), (stats["step"], stats["waiting"], stats["exited"]))
+
+        # the log starts over after it is taken
+        steps, ids, names = sim.take_exits()
+        self.assertEqual((0, 0, []), (len(memoryview(steps)), len(memoryview(ids)), names))
+
+    def test_names_not_recorded(self):
+        sim = trafficsim.Simulation(junction())
+        sim.add_vehicle("v1", NORTH, SOUTH)
+        sim.step(100)
+        self.assertIsNone(sim.take_exits()[2])
+
+    def test_remove_and_reroute(self):
+        sim = trafficsim.Simulation(junction(), record_names=True)
+        sim.add_vehicle("v1", NORTH, SOUTH)
+        sim.add_vehicle("v2", NORTH, WEST)
+        sim.remove_vehicle("v1")
+        sim.reroute_vehicle("v2", EAST)
+        sim.change_lane("v2", 0)
+        self.assertEqual(1, sim.stats()["waiting"])
+        sim.step(100)
+        self.assertEqual(["v2"], sim.take_exits()[2])
+
+    def test_lights(self):
+        sim = trafficsim.Simulation(junction())
+        lights = memoryview(sim.lights())
+        self.assertEqual(4, len(lights))
+        self.assertTrue(lights.readonly)
+        sim.add_vehicle("v1", NORTH, SOUTH)
+        sim.step()
+        # the lane with the only waiting vehicle gets a green light
+        self.assertNotEqual(bytes(lights), bytes(memoryview(sim.lights())))
+
+    def test_instances_are_independent(self):
+        # each object is forked from its own junction, so vehicles and steps are not shared
+        first = trafficsim.Simulation(junction())
+        second = trafficsim.Simulation(junction())
+        first.add_vehicle("v1", NORTH, SOUTH)
+        first.step(10)
+        self.assertEqual(0, second.stats()["waiting"])
+        self.assertEqual(0, second.stats()["step"])
+        self.assertEqual(1, second.add_vehicle("v1", SOUTH, NORTH))
+        with self.assertRaises(KeyError):
+            second.remove_vehicle("v2")
+        del first
+        self.assertEqual(1, second.step(100))
+
+    def test_reinit_starts_over(self):
+        sim = trafficsim.Simulation(junction(), record_names=True)
+        sim.add_vehicle("v1", NORTH, SOUTH)
+        sim.step(3)
+        sim.__init__(junction())
+        stats = sim.stats()
+        self.assertEqual((0, 0, 0), (stats["step"], stats["waiting"], stats["exited"]))
+        self.assertIsNone(sim.take_exits()[2])
+
+    def test_unknown_vehicle(self):
+        sim = trafficsim.Simulation(junction())
+        sim.add_vehicle("v1", NORTH, SOUTH)
+        with self.assertRaises(KeyError):
+            sim.remove_vehicle("v2")
+        with self.assertRaises(KeyError):
+            sim.reroute_vehicle("v2", EAST)
+        with self.assertRaises(KeyError):
+            sim.change_lane("v2", 0)
+
+    def test_bad_road(self):
+        sim = trafficsim.Simulation(junction())
+        for start, end in [(-1, SOUTH), (NORTH, -1), (4, SOUTH), (NORTH, 4), (NORTH, NORTH)]:
+            with self.assertRaises(ValueError):
+                sim.add_vehicle("v1", start, end)
+        sim.add_vehicle("v1", NORTH, SOUTH)
+        for end in [-1, 4, 32 + WEST, NORTH]:
+            with self.assertRaises(ValueError):
+                sim.reroute_vehicle("v1", end)
+        with self.assertRaises(ValueError):
+            sim.change_lane("v1", 1)
+        self.assertEqual(1, sim.stats()["waiting"])
+
+    def test_bad_junction(self):
+        for roads in [[], [{"bearing": 0, "lanes": []}] * 33, [1], [{"bearing": 0}],
+                      [{"bearing": 0, "lanes": [{"directions": [5]}]}, {"bearing": 180, "lanes": [{"directions": [0]}]}]]:
+            with self.assertRaises((ValueError, TypeError)):
+                trafficsim.Simulation(roads)
+        sim = trafficsim.Simulation.__new__(trafficsim.Simulation)
+        with self.assertRaises(RuntimeError):
+            sim.step()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,9 +1,17 @@
 import sys
 import json
+import socket
 import struct
 import subprocess
 
+sys.path.insert(0, "build/python")
+try:
+    import trafficsim
+except ImportError:
+    trafficsim = None
+
 DATA_FILE = "cinput.dat"
+BATCH_SIZE = 256
 
 def encodeDirection(dir):
     if dir == "north":
@@ -17,19 +25,125 @@ def encodeDirection(dir):
     else:
         raise Exception("Unknown direction " + dir)
 
-with open(DATA_FILE, "wb") as cinput:
-    with open(sys.argv[1]) as f:
-        cmds = json.load(f)["commands"]
-        for cmd in cmds:
+def encodeCommand(cmd):
+    if cmd["type"] == "addVehicle":
+        nameLen = len(cmd["vehicleId"])
+        return struct.pack("=BBBI{}s".format(nameLen), 1, encodeDirection(cmd["startRoad"]),
+            encodeDirection(cmd["endRoad"]), nameLen, bytes(cmd["vehicleId"], encoding="utf8"))
+    elif cmd["type"] == "step":
+        return struct.pack("=BxxI", 2, 0)
+    elif cmd["type"] in ("removeVehicle", "changeLane", "rerouteVehicle"):
+        nameLen = len(cmd["vehicleId"])
+        if cmd["type"] == "removeVehicle":
+            type, arg = 3, 0
+        elif cmd["type"] == "changeLane":
+            type, arg = 4, cmd["lane"]
+        else:
+            type, arg = 5, encodeDirection(cmd["endRoad"])
+        return struct.pack("=BBBI{}s".format(nameLen), type, 0, arg, nameLen, bytes(cmd["vehicleId"], encoding="utf8"))
+    else:
+        raise Exception("Unknown command " + cmd["type"]) 
+
+def receive(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise Exception("Server closed the connection")
+        data += chunk
+    return data
+
+def runOnServer(path, cmds, outPath):
+    # commands are sent in batches, the server answers each command with a header and payload
+    statuses = []
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(path)
+        sock.sendall(struct.pack("=BxxI", 7, 0))
+        receive(sock, 10)
+        for i in range(0, len(cmds), BATCH_SIZE):
+            batch = cmds[i:i + BATCH_SIZE]
+            sock.sendall(b"".join(encodeCommand(cmd) for cmd in batch))
+            for cmd in batch:
+                type, status, count, length = struct.unpack("=BBII", receive(sock, 10))
+                payload = receive(sock, length)
+                if status == 2:
+                    raise Exception("Server rejected command " + cmd["type"])
+                if type == 2:
+                    names, offset = [], 0
+                    for n in range(count):
+                        nameLen, = struct.unpack_from("=H", payload, offset)
+                        names.append(payload[offset + 2:offset + 2 + nameLen].decode("utf8"))
+                        offset += 2 + nameLen
+                    statuses.append({"leftVehicles": names})
+    with open(outPath, "w") as out:
+        json.dump({"stepStatuses": statuses}, out, indent=1)
+
+def defaultJunction():
+    # same junction as the one set up by the executable, one lane per road
+    bearings = {"north": 0, "south": 180, "west": 270, "east": 90}
+    roads = []
+    for start in ("north", "south", "west", "east"):
+        lane = {"directions": [encodeDirection(end) for end in bearings if end != start],
+            "minGreenTime": 1, "maxGreenTime": 10, "minRedTime": 1, "priority": 1.0}
+        roads.append({"bearing": bearings[start], "lanes": [lane]})
+    return roads
+
+def runInProcess(cmds, outPath):
+    sim = trafficsim.Simulation(defaultJunction(), record_names=True)
+    statuses = []
+    pending = 0
+    def flushSteps():
+        # consecutive steps are run at once, exits are split by their step numbers
+        nonlocal pending
+        if pending == 0:
+            return
+        sim.step(pending)
+        steps, ids, names = sim.take_exits()
+        statuses.extend({"leftVehicles": []} for i in range(pending))
+        for step, name in zip(memoryview(steps), names):
+            statuses[step]["leftVehicles"].append(name)
+        pending = 0
+
+    for cmd in cmds:
+        if cmd["type"] == "step":
+            pending += 1
+            continue
+        flushSteps()
+        try:
             if cmd["type"] == "addVehicle":
-                nameLen = len(cmd["vehicleId"])
-                data = struct.pack("=BBBI{}s".format(nameLen), 1, encodeDirection(cmd["startRoad"]),
-                    encodeDirection(cmd["endRoad"]), nameLen, bytes(cmd["vehicleId"], encoding="utf8"))
-            elif cmd["type"] == "step":
-                data = struct.pack("=BxxI", 2, 0)
+                sim.add_vehicle(cmd["vehicleId"], encodeDirection(cmd["startRoad"]), encodeDirection(cmd["endRoad"]))
+            elif cmd["type"] == "removeVehicle":
+                sim.remove_vehicle(cmd["vehicleId"])
+            elif cmd["type"] == "changeLane":
+                sim.change_lane(cmd["vehicleId"], cmd["lane"])
+            elif cmd["type"] == "rerouteVehicle":
+                sim.reroute_vehicle(cmd["vehicleId"], encodeDirection(cmd["endRoad"]))
             else:
-                raise Exception("Unknown command " + cmd["type"]) 
+                raise Exception("Unknown command " + cmd["type"])
+        except (KeyError, ValueError) as e:
+            print("Command {} ignored: {}".format(cmd["type"], e))
+    flushSteps()
+    with open(outPath, "w") as out:
+        json.dump({"stepStatuses": statuses}, out, indent=1)
 
-            cinput.write(data)
+def loadCommands(path):
+    with open(path) as f:
+        return json.load(f)["commands"]
+
+if len(sys.argv) > 4 and sys.argv[3] == "--socket":
+    runOnServer(sys.argv[4], loadCommands(sys.argv[1]), sys.argv[2])
+elif trafficsim is not None:
+    runInProcess(loadCommands(sys.argv[1]), sys.argv[2])
+else:
+    if "--v1" in sys.argv[3:]:
+        # legacy fixed-size command records
+        with open(DATA_FILE, "wb") as cinput:
+            for cmd in loadCommands(sys.argv[1]):
+                cinput.write(encodeCommand(cmd))
+    else:
+        # the simulator parses the JSON natively and writes the compact input file
+        conversion = subprocess.run(["build/traffic.exe", "-j", sys.argv[1], DATA_FILE], capture_output = True, text = True)
+        if conversion.returncode != 0:
+            raise Exception("Conversion failed: " + conversion.stdout)
 
-print(subprocess.run(["build/traffic.exe", DATA_FILE, sys.argv[2]], capture_output = True, text = True).stdout)
\ No newline at end of file
+    print(subprocess.run(["build/traffic.exe", DATA_FILE, sys.argv[2]], capture_output = True, text = True).stdout)